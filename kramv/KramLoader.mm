@@ -9,6 +9,7 @@
 #include <mutex>
 
 #include "KramLib.h"
+#include "TaskSystem.h"
 
 using namespace kram;
 using namespace STL_NAMESPACE;
@@ -51,6 +52,9 @@ struct KramBlit {
     vector<KramBlit> _blits;
     NSMutableArray<id<MTLTexture>> *_blitTextures;
     NSMutableArray<id<MTLTexture>> *_mipgenTextures;
+
+    // made on the first decode, and then reused for every texture
+    unique_ptr<task_system> _decodeSystem;
 }
 
 - (instancetype)init
@@ -93,11 +97,15 @@ bool isDecodeImageNeeded(MyMTLPixelFormat pixelFormat, MyMTLTextureType type)
     return needsDecode;
 }
 
-bool decodeImage(const KTXImage &image, KTXImage &imageDecoded)
+bool decodeImage(const KTXImage &image, KTXImage &imageDecoded, task_system &system)
 {
     KramDecoderParams decoderParams;
     KramDecoder decoder;
 
+    // decode large mips across all the cores, so the viewer doesn't stall
+    decoderParams.numJobs = system.num_threads();
+    decoderParams.system = &system;
+
     // macOS Intel only had BC support, and already have macOS arm64 build
 #if SIMD_SSE
     if (isETCFormat(image.pixelFormat)) {
@@ -263,8 +271,13 @@ inline MyMTLPixelFormat remapInternalRGBFormat(MyMTLPixelFormat format)
     }
 
     if (isDecodeImageNeeded(image.pixelFormat, image.textureType)) {
+        // one pool for the loader, so each texture doesn't start threads
+        if (!_decodeSystem) {
+            _decodeSystem = make_unique<task_system>((int32_t)std::thread::hardware_concurrency());
+        }
+
         KTXImage imageDecoded;
-        if (!decodeImage(image, imageDecoded)) {
+        if (!decodeImage(image, imageDecoded, *_decodeSystem)) {
             return nil;
         }
 
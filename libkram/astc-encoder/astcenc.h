@@ -555,6 +555,14 @@ struct astcenc_image
 
 	/** @brief The array of 2D slices, of length @c dim_z. */
 	void** data;
+
+	/**
+	 * @brief Optional byte per block, compression skips nonzero blocks.
+	 *
+	 * Those blocks are already in the output buffer, and are left untouched.
+	 * This is unused for decompression.
+	 */
+	const uint8_t* skip_blocks;
 };
 
 /**
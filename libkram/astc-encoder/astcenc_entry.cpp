@@ -871,6 +871,12 @@ static void compress_image(
 
 		for (unsigned int i = base; i < base + count; i++)
 		{
+			// Skip blocks that the caller already encoded
+			if (image.skip_blocks && image.skip_blocks[i])
+			{
+				continue;
+			}
+
 			// Decode i into x, y, z block indices
 			int z = i / plane_blocks;
 			unsigned int rem = i - (z * plane_blocks);
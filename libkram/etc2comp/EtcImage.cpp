@@ -109,7 +109,7 @@ namespace Etc
 	{
 	}
 
-    Image::EncodingStatus Image::EncodeSinglepass(float a_fEffort, uint8_t* outputTexture)
+    Image::EncodingStatus Image::EncodeSinglepass(float a_fEffort, uint8_t* outputTexture, const uint8_t* skipBlocks)
     {
         m_encodingStatus = EncodingStatus::SUCCESS;
         m_fEffort = a_fEffort;
@@ -150,6 +150,13 @@ namespace Etc
                     
                     for (int x = 0; x < (int)m_uiBlockColumns; x++)
                     {
+                        // leave blocks that are already encoded
+                        if (skipBlocks && *skipBlocks++)
+                        {
+                            outputBlock += blockSize;
+                            continue;
+                        }
+                        
                         int srcX = x * 4;
 
                         // now pull all pixels for the block, this clamps to edge
@@ -211,6 +218,13 @@ namespace Etc
                     
                     for (int x = 0; x < (int)m_uiBlockColumns; x++)
                     {
+                        // leave blocks that are already encoded
+                        if (skipBlocks && *skipBlocks++)
+                        {
+                            outputBlock += blockSize;
+                            continue;
+                        }
+                        
                         int srcX = x * 4;
 
                         // this block copies out a 4x4 tile from the source image
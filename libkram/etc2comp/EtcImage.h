@@ -78,7 +78,8 @@ namespace Etc
 		EncodingStatus Encode(float blockPercent, float a_fEffort, uint8_t* outputTexture);
 
         // Single-pass encoding. One block at a time to not was so much memory and time as Encode does.
-        EncodingStatus EncodeSinglepass(float a_fEffort, uint8_t* outputTexture);
+        // Blocks with a nonzero skipBlocks byte are already encoded, and left as is.
+        EncodingStatus EncodeSinglepass(float a_fEffort, uint8_t* outputTexture, const uint8_t* skipBlocks = nullptr);
         
         // Translate to rgba8unorm texture (even r/rg11)
         EncodingStatus Decode(const uint8_t* etcBlocks, uint8_t* outputTexture);
@@ -16,6 +16,8 @@
 // for zstd decompress
 #include "zstd.h"
 
+#include "TaskSystem.h"
+
 #ifndef USE_LIBCOMPRESSION
 #define USE_LIBCOMPRESSION 0 // KRAM_APPLE
 #endif
@@ -1221,11 +1223,12 @@ inline bool isKTX1File(const uint8_t* data, size_t dataSize)
     return true;
 }
 
-bool KTXImage::open(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly)
+bool KTXImage::open(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly,
+                    task_system* unpackSystem)
 {
     // Note: never trust the extension, always load based on the identifier
     if (isKTX2File(imageData, imageDataLength)) {
-        return openKTX2(imageData, imageDataLength, isInfoOnly);
+        return openKTX2(imageData, imageDataLength, isInfoOnly, unpackSystem);
     }
 
     // check for ktx1
@@ -1370,6 +1373,15 @@ void KTXImage::addSourceHashProps(uint32_t sourceHash)
     }
 }
 
+uint32_t KTXImage::sourceHashProp() const
+{
+    string propValue = getProp(kPropSourceHash);
+    if (propValue.empty())
+        return 0;
+
+    return (uint32_t)strtoul(propValue.c_str(), nullptr, 16);
+}
+
 void KTXImage::addAddressProps(const char* addressContent)
 {
     addProp(kPropAddress, addressContent);
@@ -1664,7 +1676,8 @@ const char* textureTypeName(MyMTLTextureType textureType)
 // can use ktx2ktx2 and ktx2sc to supercompress, and kramv can use this to open and view data as a KTX1 file.
 // ignoring Basis and supercompression data, etc.
 
-bool KTXImage::openKTX2(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly)
+bool KTXImage::openKTX2(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly,
+                        task_system* unpackSystem)
 {
     if ((size_t)imageDataLength < sizeof(KTX2Header)) {
         return false;
@@ -1825,22 +1838,42 @@ bool KTXImage::openKTX2(const uint8_t* imageData, size_t imageDataLength, bool i
 
         supercompressionType = (KTX2Supercompression)header2.supercompressionScheme;
 
-        // need to decompress mips here
-        for (uint32_t i = 0; i < header.numberOfMipmapLevels; ++i) {
+        // need this for unpackLevel to have enough data
+        int32_t numLevels = (int32_t)header.numberOfMipmapLevels;
+        for (int32_t i = 0; i < numLevels; ++i) {
+            mipLevels[i].lengthCompressed = levels[i].lengthCompressed;
+        }
+
+        // need to decompress mips here, each level writes to its own part of fileData
+        std::atomic<bool> success(true);
+
+        auto unpackLevelAt = [&](int32_t i) {
             // compresssed level
-            const auto& level2 = levels[i];
-            const uint8_t* srcData = imageData + level2.offset;
+            const uint8_t* srcData = imageData + levels[i].offset;
 
             // uncompressed level
-            auto& level1 = mipLevels[i];
-            level1.lengthCompressed = level2.lengthCompressed; // need this for copyLevel to have enough data
-            uint8_t* dstData = (uint8_t*)fileData + level1.offset; // can const_cast, since class owns data
+            uint8_t* dstData = (uint8_t*)fileData + mipLevels[i].offset; // can const_cast, since class owns data
 
             if (!unpackLevel(i, srcData, dstData)) {
-                return false;
+                success = false;
             }
+        };
 
-            // have decompressed here, so set to 0
+        if (unpackSystem && numLevels > 1) {
+            unpackSystem->run_and_wait(numLevels, unpackLevelAt);
+        }
+        else {
+            for (int32_t i = 0; i < numLevels && success; ++i) {
+                unpackLevelAt(i);
+            }
+        }
+
+        if (!success) {
+            return false;
+        }
+
+        // have decompressed here, so set to 0
+        for (auto& level1 : mipLevels) {
             level1.lengthCompressed = 0;
         }
 
@@ -1851,6 +1884,22 @@ bool KTXImage::openKTX2(const uint8_t* imageData, size_t imageDataLength, bool i
     return true;
 }
 
+// Reuse one zstd context per thread across all levels and files,
+// instead of ZSTD_decompress allocating a new one on every call.
+static ZSTD_DCtx* threadZstdDecompressContext()
+{
+    struct ZSTDDScope {
+        ~ZSTDDScope() { ZSTD_freeDCtx(ctx); }
+        ZSTD_DCtx* ctx = nullptr;
+    };
+    thread_local ZSTDDScope scope;
+
+    if (!scope.ctx) {
+        scope.ctx = ZSTD_createDCtx();
+    }
+    return scope.ctx;
+}
+
 bool KTXImage::unpackLevel(uint32_t mipNumber, const uint8_t* srcData, uint8_t* dstData) const
 {
     // uncompressed level
@@ -1870,9 +1919,16 @@ bool KTXImage::unpackLevel(uint32_t mipNumber, const uint8_t* srcData, uint8_t*
 
         switch (supercompressionType) {
             case KTX2SupercompressionZstd: {
+                ZSTD_DCtx* dctx = threadZstdDecompressContext();
+                if (!dctx) {
+                    KLOGE("kram", "decode mip zstd context failed");
+                    return false;
+                }
+
                 // decompress from zstd directly into ktx1 ordered chunk
                 // Note: decode fails with FSE_decompress.
-                size_t dstDataSizeZstd = ZSTD_decompress(
+                size_t dstDataSizeZstd = ZSTD_decompressDCtx(
+                    dctx,
                     dstData, dstDataSize,
                     srcData, srcDataSize);
 
@@ -1899,7 +1955,8 @@ bool KTXImage::unpackLevel(uint32_t mipNumber, const uint8_t* srcData, uint8_t*
                     scratchBuffer,
                     COMPRESSION_ZLIB);
 #else
-                mz_ulong dstDataSizeMiniz = 0;
+                // this is in/out, so must pass the size of dstData
+                mz_ulong dstDataSizeMiniz = dstDataSize;
                 if (mz_uncompress(dstData, &dstDataSizeMiniz,
                                   srcData, srcDataSize) != MZ_OK) {
                     KLOGE("kram", "decode mip zlib failed");
@@ -1924,6 +1981,132 @@ bool KTXImage::unpackLevel(uint32_t mipNumber, const uint8_t* srcData, uint8_t*
     return true;
 }
 
+bool KTXImage::unpackLevelChunks(uint32_t mipNumber, uint32_t chunkStart, uint32_t chunkCount, uint8_t* dstData) const
+{
+    if (!fileData || mipNumber >= mipLevels.size()) {
+        return false;
+    }
+    if (chunkCount == 0 || chunkStart + chunkCount > totalChunks()) {
+        return false;
+    }
+
+    const auto& level = mipLevels[mipNumber];
+    const uint8_t* srcData = fileData + level.offset;
+
+    // chunks are packed one after another in each level
+    size_t skipDataSize = chunkStart * level.length;
+    size_t dstDataSize = chunkCount * level.length;
+
+    if (level.lengthCompressed == 0) {
+        memcpy(dstData, srcData + skipDataSize, dstDataSize);
+        return true;
+    }
+
+    size_t srcDataSize = level.lengthCompressed;
+
+    // Stream decode the level, dropping the chunks before chunkStart into
+    // scratch, and stop once the requested chunks are filled in.  So only
+    // the requested chunks are ever resident.
+    uint8_t scratchData[16 * 1024];
+
+    switch (supercompressionType) {
+        case KTX2SupercompressionZstd: {
+            ZSTD_DCtx* dctx = threadZstdDecompressContext();
+            if (!dctx) {
+                KLOGE("kram", "decode mip zstd context failed");
+                return false;
+            }
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+            ZSTD_inBuffer input = {srcData, srcDataSize, 0};
+
+            size_t dataSize = 0;
+            while (dataSize < skipDataSize + dstDataSize) {
+                ZSTD_outBuffer output;
+                if (dataSize < skipDataSize) {
+                    output = {scratchData, std::min(sizeof(scratchData), skipDataSize - dataSize), 0};
+                }
+                else {
+                    output = {dstData + (dataSize - skipDataSize), skipDataSize + dstDataSize - dataSize, 0};
+                }
+
+                size_t result = ZSTD_decompressStream(dctx, &output, &input);
+                if (ZSTD_isError(result)) {
+                    KLOGE("kram", "decode mip zstd failed");
+                    return false;
+                }
+
+                dataSize += output.pos;
+
+                // frame ended, or no more input, before the chunks were filled in
+                if ((result == 0 || input.pos == input.size) && output.pos == 0) {
+                    KLOGE("kram", "decode mip zstd size not expected");
+                    return false;
+                }
+            }
+            break;
+        }
+
+        case KTX2SupercompressionZlib: {
+            mz_stream stream = {};
+            if (mz_inflateInit(&stream) != MZ_OK) {
+                KLOGE("kram", "decode mip zlib failed");
+                return false;
+            }
+
+            stream.next_in = srcData;
+            stream.avail_in = (unsigned int)srcDataSize;
+
+            bool success = true;
+            size_t dataSize = 0;
+            while (dataSize < skipDataSize + dstDataSize) {
+                uint8_t* outData;
+                size_t outDataSize;
+                if (dataSize < skipDataSize) {
+                    outData = scratchData;
+                    outDataSize = std::min(sizeof(scratchData), skipDataSize - dataSize);
+                }
+                else {
+                    outData = dstData + (dataSize - skipDataSize);
+                    outDataSize = skipDataSize + dstDataSize - dataSize;
+                }
+
+                stream.next_out = outData;
+                stream.avail_out = (unsigned int)outDataSize;
+
+                int status = mz_inflate(&stream, MZ_SYNC_FLUSH);
+
+                size_t outDataWritten = outDataSize - stream.avail_out;
+                dataSize += outDataWritten;
+
+                if (status != MZ_OK && status != MZ_STREAM_END) {
+                    success = false;
+                    break;
+                }
+                if (status == MZ_STREAM_END && dataSize < skipDataSize + dstDataSize) {
+                    success = false;
+                    break;
+                }
+            }
+
+            mz_inflateEnd(&stream);
+
+            if (!success) {
+                KLOGE("kram", "decode mip zlib failed");
+                return false;
+            }
+            break;
+        }
+
+        // already checked at top of function
+        default: {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 vector<uint8_t>& KTXImage::imageData()
 {
     return _imageData;
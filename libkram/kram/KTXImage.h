@@ -13,6 +13,8 @@ namespace kram {
 
 using namespace STL_NAMESPACE;
 
+class task_system;
+
 // TODO: abstract MyMTLPixelFormat and move to readable/neutral type
 enum MyMTLPixelFormat {
     // Note: bc6/7 aren't supported by squish
@@ -270,7 +272,10 @@ struct KTX2Compressor {
 class KTXImage {
 public:
     // this calls init calls
-    bool open(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly = false);
+    // unpackSystem is optional, and decompresses supercompressed ktx2 levels in parallel.
+    // This can be the system running this call, since its waits help with the levels.
+    bool open(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly = false,
+              task_system* unpackSystem = nullptr);
 
     void initProps(const uint8_t* propsData, size_t propDataSize);
 
@@ -288,6 +293,7 @@ public:
     void addFormatProps();
     void addSwizzleProps(const char* swizzleTextPre, const char* swizzleTexPost);
     void addSourceHashProps(uint32_t sourceHash);
+    uint32_t sourceHashProp() const; // 0 if not present
     void addChannelProps(const char* channelContent);
     void addAddressProps(const char* addressContent);
     void addFilterProps(const char* filterContent);
@@ -316,6 +322,12 @@ public:
     // can use on ktx1/2 files, does a decompress if needed
     bool unpackLevel(uint32_t mipNumber, const uint8_t* srcData, uint8_t* dstData) const;
 
+    // For lazy loading, open with isInfoOnly so levels stay compressed in fileData.
+    // levelLength and levelLengthCompressed report sizes before anything is unpacked.
+    // This then streams out only chunkCount chunks of one mip into dstData, which
+    // must hold chunkCount * mipLength(mipNumber) bytes.
+    bool unpackLevelChunks(uint32_t mipNumber, uint32_t chunkStart, uint32_t chunkCount, uint8_t* dstData) const;
+
     // helpers to work with the mipLevels array, mipLength and levelLength are important to get right
     // mip data depends on format
 
@@ -340,7 +352,8 @@ public:
     uint32_t faceCount() const { return std::max(1u, header.numberOfFaces); }
 
 private:
-    bool openKTX2(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly);
+    bool openKTX2(const uint8_t* imageData, size_t imageDataLength, bool isInfoOnly,
+                  task_system* unpackSystem);
 
     // ktx2 mips are uncompressed to convert back to ktx1, but without the image offset
     vector<uint8_t> _imageData;
@@ -16,7 +16,9 @@
 //#include <vector>
 
 #include "KTXImage.h"
+#include "KramBenchmark.h"
 #include "KramDDSHelper.h"
+#include "KramEncodeCache.h"
 #include "KramFileHelper.h"
 #include "KramImage.h" // has config defines, move them out
 #include "KramMmapHelper.h"
@@ -56,6 +58,15 @@ void* operator new[](size_t size, size_t alignment, size_t alignmentOffset, cons
 #define strtok_r strtok_s
 #endif
 
+// for kram serve -socket
+#if !KRAM_WIN
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 namespace kram {
 
 using namespace STL_NAMESPACE;
@@ -138,7 +149,8 @@ inline const char* toFilenameShort(const char* filename)
     return filenameShort;
 }
 
-bool KTXImageData::open(const char* filename, KTXImage& image, bool isInfoOnly_)
+bool KTXImageData::open(const char* filename, KTXImage& image, bool isInfoOnly_,
+                        task_system* unpackSystem)
 {
     isInfoOnly = isInfoOnly_;
 
@@ -197,7 +209,7 @@ bool KTXImageData::open(const char* filename, KTXImage& image, bool isInfoOnly_)
     }
     else {
         // read the KTXImage in from the data, it will alias mmap or fileData
-        isLoaded = image.open(data, dataSize, isInfoOnly);
+        isLoaded = image.open(data, dataSize, isInfoOnly, unpackSystem);
     }
 
     // this means KTXImage is using it's own storage
@@ -307,7 +319,8 @@ bool KTXImageData::openPNG(const uint8_t* data, size_t dataSize, KTXImage& image
     return true;
 }
 
-bool KTXImageData::open(const uint8_t* data, size_t dataSize, KTXImage& image, bool isInfoOnly_)
+bool KTXImageData::open(const uint8_t* data, size_t dataSize, KTXImage& image, bool isInfoOnly_,
+                        task_system* unpackSystem)
 {
     isInfoOnly = isInfoOnly_;
     close();
@@ -325,7 +338,7 @@ bool KTXImageData::open(const uint8_t* data, size_t dataSize, KTXImage& image, b
 
     // image will likely alias incoming data, so KTXImageData is unused
 
-    if (!image.open(data, dataSize, isInfoOnly)) {
+    if (!image.open(data, dataSize, isInfoOnly, unpackSystem)) {
         return false;
     }
     return true;
@@ -335,9 +348,10 @@ bool KTXImageData::open(const uint8_t* data, size_t dataSize, KTXImage& image, b
 bool SetupSourceKTX(KTXImageData& srcImageData,
                     const string& srcFilename,
                     KTXImage& sourceImage,
-                    bool isInfoOnly)
+                    bool isInfoOnly,
+                    task_system* unpackSystem = nullptr)
 {
-    if (!srcImageData.open(srcFilename.c_str(), sourceImage, isInfoOnly)) {
+    if (!srcImageData.open(srcFilename.c_str(), sourceImage, isInfoOnly, unpackSystem)) {
         KLOGE("Kram", "File input \"%s\" could not be opened for read.\n",
               srcFilename.c_str());
         return false;
@@ -835,6 +849,32 @@ bool LoadPng(const uint8_t* data, size_t dataSize, bool isPremulRgb, bool isGray
     return sourceImage.loadImageFromPixels(pixels, width, height, hasColor, hasAlpha);
 }
 
+// The tmp file goes next to dst, so that CommitTmpFile can rename it into place.
+bool SetupTmpFile(FileHelper& tmpFileHelper, const string& dstFilename, const char* suffix)
+{
+    return tmpFileHelper.openTemporaryFileFor(dstFilename.c_str(), ".kramimage-", suffix);
+}
+
+// Renaming avoids reading and rewriting the whole output, and dst is
+// replaced in one step.  This only copies if tmp and dst are on different volumes.
+bool CommitTmpFile(FileHelper& tmpFileHelper, const string& dstFilename, bool isSynced, bool isVerbose)
+{
+    size_t bytesSaved = 0;
+    if (!tmpFileHelper.moveTemporaryFileTo(dstFilename.c_str(), isSynced, bytesSaved)) {
+        return false;
+    }
+
+    if (isVerbose) {
+        if (bytesSaved > 0) {
+            KLOGI("Kram", "renamed output to %s, saved copying %zu bytes", dstFilename.c_str(), bytesSaved);
+        }
+        else {
+            KLOGI("Kram", "copied output to %s", dstFilename.c_str());
+        }
+    }
+    return true;
+}
+
 // Use this to fix the src png, will only have a single block with srgb or not.
 // Can then run ImageOptim on it, with block preservation set.
 // Need this since Photoshop refuses to save the srgb flag, and stuff a giant
@@ -897,28 +937,26 @@ bool SavePNG(Image& image, const char* filename)
         return false;
     }
 
+    // this is overwriting the source file, so write a tmp file and then
+    // rename it over the original.  A failure leaves the original png intact.
     FileHelper fileHelper;
-    if (!fileHelper.open(filename, "w+b")) {
+    if (!SetupTmpFile(fileHelper, filename, ".png")) {
         return false;
     }
 
-    // this is overrwriting the source file currently
-    // TODO: could use tmp file, and then replace existing
-    // this could destroy original png on failure otherwise
     if (!fileHelper.write((const uint8_t*)outputData.data(), outputData.size())) {
         return false;
     }
 
+    if (!CommitTmpFile(fileHelper, filename, false, false)) {
+        return false;
+    }
+
     KLOGI("Kram", "saved %s %s sRGB block", filename, isSrgb ? "with" : "without");
 
     return true;
 }
 
-bool SetupTmpFile(FileHelper& tmpFileHelper, const char* suffix)
-{
-    return tmpFileHelper.openTemporaryFile("kramimage-", suffix, "w+b");
-}
-
 bool SetupSourceImage(const string& srcFilename, Image& sourceImage,
                       bool isPremulSrgb = false, bool isGray = false)
 {
@@ -1003,11 +1041,12 @@ constexpr size_t countof(T const (&)[N]) noexcept
 
 #define isStringEqual(lhs, rhs) (strcmp(lhs, rhs) == 0)
 
-static int32_t kramAppEncode(vector<const char*>& args);
-static int32_t kramAppDecode(vector<const char*>& args);
+// system is an optional pool that -jobs work runs on, instead of starting threads
+static int32_t kramAppEncode(vector<const char*>& args, task_system* system = nullptr);
+static int32_t kramAppDecode(vector<const char*>& args, task_system* system = nullptr);
 static int32_t kramAppInfo(vector<const char*>& args);
 
-static int32_t kramAppCommand(vector<const char*>& args);
+static int32_t kramAppCommand(vector<const char*>& args, task_system* system = nullptr);
 
 static const char* formatFormat(MyMTLPixelFormat format)
 {
@@ -1628,6 +1667,8 @@ void kramDecodeUsage(bool showVersion = true)
           "Usage: kram decode\n"
           "\t [-swizzle rgba01]\n"
           "\t [-e/ncoder (squish | ate | etcenc | bcenc | astcenc | explicit | ..)]\n"
+          "\t [-j/obs 4]\n"
+          "\t [-fsync]\tflush output to disk before renaming it into place\n"
           "\t [-v/erbose]\n"
           // TODO: does this support .ktx2, .dds?
           "\t -i/nput <.ktx | .ktx2 | .dds>\n"
@@ -1667,7 +1708,44 @@ void kramScriptUsage(bool showVersion = true)
           "\t -i/nput kramscript.txt\n"
           "\t [-v/erbose]\n"
           "\t [-j/obs numJobs]\n"
+          "\t [-memlimit 8192]\tMB of estimated memory that running commands can reserve\n"
           "\t [-c/ontinue]\tcontinue on errors\n"
+          "\t [-incremental]\tskip encodes whose output hash of src and args matches\n"
+          "\t [-cache dir] [-cachesize 4096]\tcopy encodes from a shared dir of prior outputs\n"
+          "\n",
+          showVersion ? usageName : "");
+}
+
+void kramBenchUsage(bool showVersion = true)
+{
+    KLOGI("Kram",
+          "%s\n"
+          "Usage: kram bench\n"
+          "\t [-tasks]\tcompare task_system and Scheduler on 1, 4, 16, 64 threads\n"
+          "\t [-mips]\tcompare SIMD and scalar mip box filters in GB/s\n"
+          "\t [-srgb]\tcheck and time the linear to srgb8 table against powf\n"
+          "\t [-decode]\ttime block decode per format in Mpix/s, serial vs. -j threads\n"
+          "\t [-ktx2]\ttime supercompressed ktx2 open in MB/s, serial vs. -j threads\n"
+          "\t [-j/obs numJobs]\n"
+          "\n",
+          showVersion ? usageName : "");
+}
+
+void kramServeUsage(bool showVersion = true)
+{
+    KLOGI("Kram",
+          "%s\n"
+          "Usage: kram serve\n"
+          "\t [-socket path]\tread commands from clients of a local socket instead of stdin\n"
+          "\t [-j/obs numJobs]\n"
+          "\t [-memlimit 8192]\tMB of estimated memory that running commands can reserve\n"
+          "\t [-v/erbose]\n"
+          "\n"
+          "\tReads encode, decode, info and fixup commands one per line, and runs them on one pool.\n"
+          "\tinfo needs -output, since the status lines are the only output to the client.\n"
+          "\tWrites \"index ok|failed seconds\" per command, index counts from 1 per stream.\n"
+          "\tWith stdin, status goes to stdout and logs go to stderr.\n"
+          "\t\"quit\" ends a stream, and \"shutdown\" stops the server.\n"
           "\n",
           showVersion ? usageName : "");
 }
@@ -1709,9 +1787,9 @@ void kramEncodeUsage(bool showVersion = true)
           "\n"
           "\t [-type 2d|3d|..]\n"
           "\t [-e/ncoder (squish | ate | etcenc | bcenc | astcenc | explicit | ..)]\n"
-          "\t [-resize (16x32 | pow2)]\n"
+          "\t [-resize (16x32 | pow2)] [-resizefilter point]\n"
           "\n"
-          "\t [-mipnone] [-mipflood]\n"
+          "\t [-mipnone] [-mipflood] [-mipfilter box]\n"
           "\t [-mipmin size] [-mipmax size] [-mipskip count]\n"
           "\n"
           "\t [-chunks 4x4]\n"
@@ -1722,6 +1800,11 @@ void kramEncodeUsage(bool showVersion = true)
           "\t [-premul] [-prezero] [-premulrgb]\n"
           "\t [-gray]\n"
           "\t [-optopaque]\n"
+          "\t [-refine 10]\n"
+          "\t [-jobs 4]\n"
+          "\t [-incremental]\n"
+          "\t [-cache dir] [-cachesize 4096]\n"
+          "\t [-fsync]\n"
           "\t [-v]\n"
           "\n"
           "\t [-testall]\n"
@@ -1774,6 +1857,12 @@ void kramEncodeUsage(bool showVersion = true)
           "\t-mipflood"
           "\tDilate color by upscaling smaller mips to higher\n"
 
+          "\t-mipfilter box|linear|mitchell|lanczos3|kaiser"
+          "\tMip downsample filter, box is fastest, others are sharper\n"
+
+          "\t-resizefilter point|box|linear|mitchell|lanczos3|kaiser"
+          "\tFilter used by -resize, defaults to point\n"
+
           "\t-mipmin size"
           "\tOnly output mips >= size px\n"
 
@@ -1835,6 +1924,8 @@ void kramEncodeUsage(bool showVersion = true)
 
           "\t-optopaque"
           "\tChange format from bc7/3 to bc1, or etc2rgba to rgba if opaque\n"
+          "\t-refine 10"
+          "\tbcenc bc1/3/7 encode at the fastest level, then the worst 10%% of blocks at the highest level, overrides -quality\n"
           "\n"
 
           "\t-chunks 4x4"
@@ -1852,6 +1943,20 @@ void kramEncodeUsage(bool showVersion = true)
           "\t-avg [rgba]"
           "\tPost-swizzle, average channels per block (f.e. normals) lrgb astc/bc3/etc2rgba\n"
 
+          "\t-jobs 4"
+          "\tEncode chunks, mips, rows of blocks and ktx2 levels across this many threads, output matches single-threaded\n"
+
+          "\t-incremental"
+          "\tSkip encode if the ktx/ktx2 output has the same hash of src and args\n"
+
+          "\t-cache dir"
+          "\tCopy output from a dir of prior encodes keyed by src, args and version\n"
+          "\t-cachesize 4096"
+          "\tMB the cache dir can hold before removing least recently used outputs\n"
+
+          "\t-fsync"
+          "\tFlush output to disk before renaming it into place\n"
+
           "\t-v"
           "\tVerbose encoding output\n"
           "\n",
@@ -1870,13 +1975,15 @@ void kramUsage()
     KLOGI("Kram",
           usageName
           "\n"
-          "SYNTAX\nkram [encode | decode | info | script | fixup | ...]\n");
+          "SYNTAX\nkram [encode | decode | info | script | fixup | bench | serve | ...]\n");
 
     kramEncodeUsage(false);
     kramInfoUsage(false);
     kramDecodeUsage(false);
     kramScriptUsage(false);
     kramFixupUsage(false);
+    kramBenchUsage(false);
+    kramServeUsage(false);
 }
 
 static int32_t kramAppInfo(vector<const char*>& args)
@@ -2407,7 +2514,7 @@ string kramInfoKTXToString(const string& srcFilename, const KTXImage& srcImage,
     return info;
 }
 
-static int32_t kramAppDecode(vector<const char*>& args)
+static int32_t kramAppDecode(vector<const char*>& args, task_system* sharedSystem)
 {
     // this is help
     int32_t argc = (int32_t)args.size();
@@ -2425,6 +2532,8 @@ static int32_t kramAppDecode(vector<const char*>& args)
 
     bool error = false;
     bool isVerbose = false;
+    bool isSynced = false;
+    int32_t numJobs = 1;
     string swizzleText;
     TexEncoder textureDecoder = kTexEncoderUnknown;
 
@@ -2437,7 +2546,10 @@ static int32_t kramAppDecode(vector<const char*>& args)
             break;
         }
 
-        if (isStringEqual(word, "-output") ||
+        if (isStringEqual(word, "-fsync")) {
+            isSynced = true;
+        }
+        else if (isStringEqual(word, "-output") ||
             isStringEqual(word, "-o")) {
             ++i;
             if (i >= argc) {
@@ -2489,6 +2601,22 @@ static int32_t kramAppDecode(vector<const char*>& args)
 
             textureDecoder = parseEncoder(args[i]);
         }
+        else if (isStringEqual(word, "-jobs") ||
+                 isStringEqual(word, "-j")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "jobs arg invalid");
+                error = true;
+                break;
+            }
+
+            numJobs = StringToInt32(args[i]);
+            if (numJobs < 1) {
+                KLOGE("Kram", "jobs arg invalid");
+                error = true;
+                break;
+            }
+        }
 
         // probably should be per-command and global verbose
         else if (isStringEqual(word, "-v") ||
@@ -2545,17 +2673,33 @@ static int32_t kramAppDecode(vector<const char*>& args)
     KTXImageData srcImageData;
     FileHelper tmpFileHelper;
 
-    bool success = SetupSourceKTX(srcImageData, srcFilename, srcImage, false);
+    // only spin up threads if asked to, these decompress ktx2 levels
+    unique_ptr<task_system> localSystem;
+    task_system* system = nullptr;
+    if (numJobs > 1) {
+        if (!sharedSystem) {
+            localSystem = make_unique<task_system>(numJobs);
+        }
+        system = sharedSystem ? sharedSystem : localSystem.get();
+    }
+
+    Timer timerOpen;
+    bool success = SetupSourceKTX(srcImageData, srcFilename, srcImage, false, system);
     if (!success)
         return -1;
 
+    if (isVerbose) {
+        KLOGI("Kram", "Opened %s in %0.3fms\n",
+              srcFilename.c_str(), timerOpen.timeElapsedMillis());
+    }
+
     // TODO: for hdr decode, may need to walk blocks or ask caller to pass -hdr flag
     if (!validateFormatAndDecoder(srcImage.textureType, srcImage.pixelFormat, textureDecoder)) {
         KLOGE("Kram", "format decode only supports ktx output");
         return -1;
     }
 
-    success = SetupTmpFile(tmpFileHelper, dstExt);
+    success = SetupTmpFile(tmpFileHelper, dstFilename, dstExt);
     if (!success)
         return -1;
 
@@ -2571,13 +2715,17 @@ static int32_t kramAppDecode(vector<const char*>& args)
     params.decoder = textureDecoder;
     params.swizzleText = swizzleText;
 
+    // large mips decode in bands on the same threads
+    params.numJobs = numJobs;
+    params.system = system;
+
     KramDecoder decoder; // just to call decode
     success = decoder.decode(srcImage, tmpFileHelper.pointer(), params);
 
     // rename to dest filepath, note this only occurs if above succeeded
     // so any existing files are left alone on failure.
     if (success)
-        success = tmpFileHelper.copyTemporaryFileTo(dstFilename.c_str());
+        success = CommitTmpFile(tmpFileHelper, dstFilename, isSynced, isVerbose);
 
     return success ? 0 : -1;
 }
@@ -2666,7 +2814,96 @@ int32_t kramAppFixup(vector<const char*>& args)
     return error ? -1 : 0;
 }
 
-static int32_t kramAppEncode(vector<const char*>& args)
+// Hash the src bytes, the encode args that affect the output, and the kram version.
+// Paths, verbose, cache and thread counts are skipped, since output doesn't depend on them.
+// The crc is only compared against one output.  A cache dir holds far more entries,
+// and a collision would serve the wrong texture, so the cacheKey is a 128-bit
+// xxhash from two seeds, and the src size.
+static bool hashEncodeSource(const string& srcFilename, const vector<const char*>& args, uint32_t& sourceHash, string& cacheKey)
+{
+    MmapHelper mmapHelper;
+    vector<uint8_t> fileData;
+
+    const uint8_t* data;
+    size_t dataSize;
+    if (mmapHelper.open(srcFilename.c_str())) {
+        data = mmapHelper.data();
+        dataSize = mmapHelper.dataLength();
+    }
+    else {
+        FileHelper fileHelper;
+        if (!fileHelper.open(srcFilename.c_str(), "rb")) {
+            return false;
+        }
+
+        size_t size = fileHelper.size();
+        if (size == (size_t)-1) {
+            return false;
+        }
+
+        fileData.resize(size);
+        if (!fileHelper.read(fileData.data(), size)) {
+            return false;
+        }
+
+        data = fileData.data();
+        dataSize = fileData.size();
+    }
+
+    mz_ulong crc = mz_crc32(MZ_CRC32_INIT, data, dataSize);
+    uint64_t keyHash0 = xxhash64(data, dataSize, 0);
+    uint64_t keyHash1 = xxhash64(data, dataSize, 0x9E3779B97F4A7C15ULL);
+
+    string normalizedArgs = KRAM_VERSION;
+    int32_t argc = (int32_t)args.size();
+    for (int32_t i = 0; i < argc; ++i) {
+        const char* word = args[i];
+
+        if (isStringEqual(word, "-input") || isStringEqual(word, "-i") ||
+            isStringEqual(word, "-output") || isStringEqual(word, "-o") ||
+            isStringEqual(word, "-jobs") || isStringEqual(word, "-j") ||
+            isStringEqual(word, "-cache") || isStringEqual(word, "-cachesize")) {
+            ++i;
+            continue;
+        }
+        if (isStringEqual(word, "-verbose") || isStringEqual(word, "-v") ||
+            isStringEqual(word, "-incremental") || isStringEqual(word, "-fsync")) {
+            continue;
+        }
+
+        normalizedArgs += ' ';
+        normalizedArgs += word;
+    }
+
+    crc = mz_crc32(crc, (const uint8_t*)normalizedArgs.c_str(), normalizedArgs.size());
+    keyHash0 = xxhash64((const uint8_t*)normalizedArgs.c_str(), normalizedArgs.size(), keyHash0);
+    keyHash1 = xxhash64((const uint8_t*)normalizedArgs.c_str(), normalizedArgs.size(), keyHash1);
+
+    // 0 means no hash in the props
+    sourceHash = crc ? (uint32_t)crc : 1;
+
+    sprintf(cacheKey, "%016" PRIx64 "%016" PRIx64 "%08" PRIx64, keyHash0, keyHash1, (uint64_t)dataSize);
+    return true;
+}
+
+// Returns true if dst exists and was encoded from the same src and args.
+// Only ktx and ktx2 carry props, so dds is always re-encoded.
+static bool isEncodeOutputCurrent(const string& dstFilename, uint32_t sourceHash)
+{
+    if (!(isKTXFilename(dstFilename) || isKTX2Filename(dstFilename))) {
+        return false;
+    }
+
+    KTXImage dstImage;
+    KTXImageData dstImageData;
+    if (!dstImageData.open(dstFilename.c_str(), dstImage, true)) {
+        return false;
+    }
+
+    return dstImage.sourceHashProp() == sourceHash;
+}
+
+static int32_t kramAppEncode(vector<const char*>& args, task_system* system)
 {
     // this is help
     int32_t argc = (int32_t)args.size();
@@ -2679,11 +2916,17 @@ static int32_t kramAppEncode(vector<const char*>& args)
     string srcFilename;
     string dstFilename;
     string resizeString;
+    ImageResizeFilter resizeFilter = kImageResizeFilterPoint;
 
     ImageInfoArgs infoArgs;
 
     bool isPremulRgb = false;
     bool isGray = false;
+    bool isIncremental = false;
+    bool isSynced = false;
+
+    string cacheDir;
+    uint64_t cacheSize = 4096ull * 1024 * 1024;
 
     bool error = false;
     for (int32_t i = 0; i < argc; ++i) {
@@ -2696,7 +2939,39 @@ static int32_t kramAppEncode(vector<const char*>& args)
             break;
         }
 
-        if (isStringEqual(word, "-sdf")) {
+        if (isStringEqual(word, "-incremental")) {
+            isIncremental = true;
+        }
+        else if (isStringEqual(word, "-fsync")) {
+            isSynced = true;
+        }
+        else if (isStringEqual(word, "-cache")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no cache dir defined");
+                error = true;
+                break;
+            }
+
+            cacheDir = args[i];
+        }
+        else if (isStringEqual(word, "-cachesize")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no cache size defined");
+                error = true;
+                break;
+            }
+
+            int32_t cacheSizeMB = StringToInt32(args[i]);
+            if (cacheSizeMB <= 0) {
+                KLOGE("Kram", "cache size must be > 0 MB");
+                error = true;
+                break;
+            }
+            cacheSize = (uint64_t)cacheSizeMB * 1024 * 1024;
+        }
+        else if (isStringEqual(word, "-sdf")) {
             infoArgs.doSDF = true;
         }
         else if (isStringEqual(word, "-sdfThreshold")) {
@@ -2774,6 +3049,14 @@ static int32_t kramAppEncode(vector<const char*>& args)
         else if (isStringEqual(word, "-mipflood")) {
             infoArgs.doMipflood = true;
         }
+        else if (isStringEqual(word, "-mipfilter")) {
+            ++i;
+            if (i >= argc || !parseImageResizeFilter(args[i], infoArgs.mipFilter)) {
+                KLOGE("Kram", "mipfilter arg invalid");
+                error = true;
+                break;
+            }
+        }
 
         else if (isStringEqual(word, "-heightScale")) {
             ++i;
@@ -2885,6 +3168,16 @@ static int32_t kramAppEncode(vector<const char*>& args)
 
             infoArgs.quality = StringToInt32(args[i]);
         }
+        else if (isStringEqual(word, "-refine")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "refine arg invalid");
+                error = true;
+                break;
+            }
+
+            infoArgs.refinePercent = StringToInt32(args[i]);
+        }
 
         else if (isStringEqual(word, "-output") ||
                  isStringEqual(word, "-o")) {
@@ -2955,6 +3248,14 @@ static int32_t kramAppEncode(vector<const char*>& args)
 
             resizeString = args[i];
         }
+        else if (isStringEqual(word, "-resizefilter")) {
+            ++i;
+            if (i >= argc || !parseImageResizeFilter(args[i], resizeFilter)) {
+                KLOGE("Kram", "resizefilter arg invalid");
+                error = true;
+                break;
+            }
+        }
 
         // This means to post-multiply alpha after loading, not that incoming data in already premul
         // png has the limitation that it's unmul, but tiff/exr can store premul.  With 8-bit images
@@ -2975,6 +3276,22 @@ static int32_t kramAppEncode(vector<const char*>& args)
                  isStringEqual(word, "-verbose")) {
             infoArgs.isVerbose = true;
         }
+        else if (isStringEqual(word, "-jobs") ||
+                 isStringEqual(word, "-j")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "jobs arg invalid");
+                error = true;
+                break;
+            }
+
+            infoArgs.numJobs = StringToInt32(args[i]);
+            if (infoArgs.numJobs < 1) {
+                KLOGE("Kram", "jobs arg invalid");
+                error = true;
+                break;
+            }
+        }
         else if (isStringEqual(word, "-f") ||
                  isStringEqual(word, "-format")) {
             ++i;
@@ -3087,7 +3404,48 @@ static int32_t kramAppEncode(vector<const char*>& args)
 
     infoArgs.isKTX2 = isDstKTX2;
 
+    EncodeCache encodeCache;
+    string cacheKey;
+
+    if (!cacheDir.empty()) {
+        if (!encodeCache.open(cacheDir.c_str(), cacheSize)) {
+            return -1;
+        }
+    }
+
+    if (isIncremental || encodeCache.isOpen()) {
+        if (!hashEncodeSource(srcFilename, args, infoArgs.sourceHash, cacheKey)) {
+            KLOGE("Kram", "encode couldn't read %s to hash it", srcFilename.c_str());
+            return -1;
+        }
+    }
+
+    // skip the encode if the output was built from the same src and args
+    if (isIncremental) {
+        if (isEncodeOutputCurrent(dstFilename, infoArgs.sourceHash)) {
+            if (infoArgs.isVerbose) {
+                KLOGI("Kram", "%s is up to date", dstFilename.c_str());
+            }
+            return 0;
+        }
+    }
+
+    // or copy the output of the same encode from the cache
+    if (encodeCache.isOpen()) {
+        if (encodeCache.fetch(cacheKey, dstExt, dstFilename.c_str())) {
+            if (infoArgs.isVerbose) {
+                KLOGI("Kram", "%s from cache entry %s", dstFilename.c_str(), cacheKey.c_str());
+            }
+            return 0;
+        }
+    }
+
     // Any new settings just go into this struct which is passed into encoder
+    // -jobs runs on the shared pool of kram serve
+    if (infoArgs.numJobs > 1) {
+        infoArgs.system = system;
+    }
+
     ImageInfo info;
     info.initWithArgs(infoArgs);
 
@@ -3127,7 +3485,7 @@ static int32_t kramAppEncode(vector<const char*>& args)
     }
 
     if (success) {
-        success = SetupTmpFile(tmpFileHelper, dstExt);
+        success = SetupTmpFile(tmpFileHelper, dstFilename, dstExt);
 
         if (!success) {
             KLOGE("Kram", "encode couldn't generate tmp file for output");
@@ -3139,6 +3497,10 @@ static int32_t kramAppEncode(vector<const char*>& args)
 
         success = false;
 
+        // -incremental needs the hash on these outputs too, or they're always rewritten.
+        // dds has no props, so it's always rewritten anyways.
+        srcImageKTX.addSourceHashProps(infoArgs.sourceHash);
+
         // Don't allow DDS -> DDS?  This is really the only case for this
         if (isDstDDS && !isDDS) {
             DDSHelper ddsHelper;
@@ -3150,7 +3512,8 @@ static int32_t kramAppEncode(vector<const char*>& args)
         }
         else if (isDstKTX2) {
             KramEncoder encoder;
-            success = encoder.saveKTX2(srcImageKTX, infoArgs.compressor, tmpFileHelper.pointer());
+            success = encoder.saveKTX2(srcImageKTX, infoArgs.compressor, tmpFileHelper.pointer(), infoArgs.numJobs,
+                                       infoArgs.numJobs > 1 ? system : nullptr);
         }
 
         if (!success) {
@@ -3160,7 +3523,7 @@ static int32_t kramAppEncode(vector<const char*>& args)
         // rename to dest filepath, note this only occurs if above succeeded
         // so any existing files are left alone on failure.
         if (success) {
-            success = tmpFileHelper.copyTemporaryFileTo(dstFilename.c_str());
+            success = CommitTmpFile(tmpFileHelper, dstFilename, isSynced, infoArgs.isVerbose);
 
             if (!success) {
                 KLOGE("Kram", "rename of temp file failed");
@@ -3171,11 +3534,21 @@ static int32_t kramAppEncode(vector<const char*>& args)
     // so now can complete validation knowing hdr vs. ldr input
     // this checks the dst format
     else if (success) {
-        bool isHDR = !srcImage.pixelsFloat().empty();
+        bool isHDR = srcImage.isHDR();
 
         if (isHDR) {
             MyMTLPixelFormat format = info.pixelFormat;
 
+            // Only 32f output needs float mips, everything else is built
+            // from half.  Astcenc reads half directly, and explicit formats
+            // convert per pixel as they're written.
+            if (isFloatFormat(format) && !isHalfFormat(format)) {
+                srcImage.convertPixelsToFloat();
+            }
+            else {
+                srcImage.convertPixelsToHalf();
+            }
+
             // astcecnc and bcenc are only hdr encoder with explicit input from 16f/32f mips.
             if (!isFloatFormat(format)) {
                 KLOGE("Kram", "only explicit and encoded float formats for hdr");
@@ -3207,7 +3580,7 @@ static int32_t kramAppEncode(vector<const char*>& args)
         info.initWithSourceImage(srcImage);
 
         if (success && ((wResize && hResize) || resizePow2)) {
-            success = srcImage.resizeImage(wResize, hResize, resizePow2, kImageResizeFilterPoint);
+            success = srcImage.resizeImage(wResize, hResize, resizePow2, resizeFilter);
 
             if (!success) {
                 KLOGE("Kram", "resize failed");
@@ -3252,7 +3625,7 @@ static int32_t kramAppEncode(vector<const char*>& args)
         // rename to dest filepath, note this only occurs if above succeeded
         // so any existing files are left alone on failure.
         if (success) {
-            success = tmpFileHelper.copyTemporaryFileTo(dstFilename.c_str());
+            success = CommitTmpFile(tmpFileHelper, dstFilename, isSynced, infoArgs.isVerbose);
 
             if (!success) {
                 KLOGE("Kram", "rename of temp file failed");
@@ -3260,46 +3633,386 @@ static int32_t kramAppEncode(vector<const char*>& args)
         }
     }
 
+    // a failed insert only costs a later encode, so it's not an error
+    if (success && encodeCache.isOpen()) {
+        encodeCache.insert(cacheKey, dstExt, dstFilename.c_str());
+    }
+
     // done
     return success ? 0 : -1;
 }
 
-int32_t kramAppScript(vector<const char*>& args)
+// A line of a script, and what's known about its cost.
+struct ScriptCommand {
+    string commandAndArgs;
+    double cost = 0.0;           // relative, estimated from the src dimensions
+    uint64_t memoryEstimate = 0; // peak working set in bytes
+    double timeElapsed = 0.0;    // measured when the command runs
+};
+
+// Dimensions and format read from the header of a src image.
+struct ScriptSourceInfo {
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t numChunks = 0;
+    MyMTLPixelFormat pixelFormat = MyMTLPixelFormatInvalid;
+};
+
+// Read only the header of an image to get its size.  PNG has IHDR
+// as the first chunk, and ktx/ktx2/dds are opened as info only.
+static bool peekImageHeader(const char* filename, ScriptSourceInfo& sourceInfo)
 {
-    // this is help
-    int32_t argc = (int32_t)args.size();
-    if (argc == 0) {
-        kramScriptUsage();
-        return 0;
-    }
+    if (isPNGFilename(filename)) {
+        FileHelper fileHelper;
+        if (!fileHelper.open(filename, "rb")) {
+            return false;
+        }
 
-    string srcFilename;
+        // signature, IHDR length and type, then big-endian width and height
+        uint8_t header[24];
+        if (!fileHelper.read(header, sizeof(header))) {
+            return false;
+        }
+        if (!isPNGFile(header, sizeof(header))) {
+            return false;
+        }
 
-    bool isVerbose = false;
-    bool error = false;
-    // this won't stop immediately, but when error occurs, no more tasks will exectue
-    bool isHaltedOnError = true;
+        sourceInfo.width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+        sourceInfo.height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+        sourceInfo.numChunks = 1;
+        sourceInfo.pixelFormat = MyMTLPixelFormatRGBA8Unorm;
+        return true;
+    }
 
-    int32_t numJobs = 1;
+    if (!(isKTXFilename(filename) || isKTX2Filename(filename) || isDDSFilename(filename))) {
+        return false;
+    }
 
-    for (int32_t i = 0; i < argc; ++i) {
-        // check for options
-        const char* word = args[i];
-        if (word[0] != '-') {
-            KLOGE("Kram", "unexpected argument \"%s\"\n",
-                  word);
-            error = true;
-            break;
-        }
+    KTXImage image;
+    KTXImageData imageData;
+    if (!imageData.open(filename, image, true)) {
+        return false;
+    }
 
-        if (isStringEqual(word, "-input") ||
-            isStringEqual(word, "-i")) {
-            ++i;
-            if (i >= argc) {
-                KLOGE("Kram", "no input file defined");
-                error = true;
-                break;
-            }
+    sourceInfo.width = image.width;
+    sourceInfo.height = image.height;
+    sourceInfo.numChunks = image.totalChunks();
+    sourceInfo.pixelFormat = image.pixelFormat;
+    return true;
+}
+
+// Bytes per pixel of a format, block formats are all treated as 1 byte per pixel.
+static uint64_t bytesPerPixelOfFormat(MyMTLPixelFormat format)
+{
+    if (format == MyMTLPixelFormatInvalid || isBlockFormat(format)) {
+        return 1;
+    }
+    return blockSizeOfFormat(format);
+}
+
+// Rough peak working set of a command.  Encode holds the src image, the
+// chunks being mipped (copy, half/float and mip scratch), and the output mips.
+static uint64_t estimateScriptCommandMemory(const char* commandName, const ScriptSourceInfo& sourceInfo,
+                                            const ImageInfoArgs& infoArgs, bool isKTX2, bool isMipNone)
+{
+    // allocator overhead, encoder contexts, and the image structs
+    const uint64_t kBaseMemory = 16 * 1024 * 1024;
+
+    uint64_t chunkPixels = (uint64_t)sourceInfo.width * (uint64_t)sourceInfo.height;
+    uint64_t pixels = chunkPixels * (uint64_t)sourceInfo.numChunks;
+
+    bool isSrcHDR = isFloatFormat(sourceInfo.pixelFormat) || isHalfFormat(sourceInfo.pixelFormat);
+
+    if (isStringEqual(commandName, "encode")) {
+        bool isHDR = isSrcHDR || infoArgs.isHDR ||
+                     isFloatFormat(infoArgs.pixelFormat) || isHalfFormat(infoArgs.pixelFormat);
+
+        // Image stores Color, or half4 for hdr unless writing 32f
+        bool isDstFloat = isFloatFormat(infoArgs.pixelFormat) && !isHalfFormat(infoArgs.pixelFormat);
+        uint64_t hdrBytesPerPixel = isDstFloat ? sizeof(float4) : sizeof(half4);
+        uint64_t srcBytes = pixels * (isSrcHDR ? hdrBytesPerPixel : sizeof(Color));
+
+        // per chunk copy, and the next mip.  Ldr also has the half copy for srgb/premul.
+        uint64_t chunkBytesPerPixel = isHDR ? (hdrBytesPerPixel + hdrBytesPerPixel) : (sizeof(Color) + sizeof(half4) + sizeof(Color));
+        uint64_t numChunksInFlight = (uint64_t)std::min(sourceInfo.numChunks, std::max(infoArgs.numJobs, 1));
+        uint64_t workBytes = chunkPixels * chunkBytesPerPixel * numChunksInFlight;
+
+        // mips add a third, and ktx2 holds compressed copies of the levels
+        uint64_t dstBytes = pixels * bytesPerPixelOfFormat(infoArgs.pixelFormat);
+        if (!isMipNone) {
+            dstBytes = (dstBytes * 4) / 3;
+        }
+        if (isKTX2) {
+            dstBytes *= 2;
+        }
+
+        return kBaseMemory + srcBytes + workBytes + dstBytes;
+    }
+    else if (isStringEqual(commandName, "decode")) {
+        // src file is mapped, and the output is rgba8 or float4 mips
+        uint64_t srcBytes = pixels * bytesPerPixelOfFormat(sourceInfo.pixelFormat);
+        uint64_t dstBytes = pixels * (isSrcHDR ? sizeof(float4) : sizeof(Color));
+        return kBaseMemory + ((srcBytes + dstBytes) * 4) / 3;
+    }
+
+    // info loads png into memory
+    return kBaseMemory + pixels * sizeof(Color);
+}
+
+// Cost is the pixel count of the -input, since encode and decode times mostly scale with that.
+// Cost and memory are left at 0 when the input can't be found.
+static void estimateScriptCommand(ScriptCommand& command)
+{
+    string commandAndArgs = command.commandAndArgs;
+
+    vector<const char*> args;
+    char* rest = (char*)commandAndArgs.c_str();
+    char* token;
+    while ((token = strtok_r(rest, " ", &rest))) {
+        args.push_back(token);
+    }
+
+    if (args.empty()) {
+        return;
+    }
+
+    // only pull out the args that affect memory use
+    const char* input = nullptr;
+    const char* output = "";
+    ImageInfoArgs infoArgs;
+    bool isKTX2 = false;
+    bool isMipNone = false;
+
+    int32_t argc = (int32_t)args.size();
+    for (int32_t i = 1; i < argc; ++i) {
+        const char* word = args[i];
+        const char* value = (i + 1 < argc) ? args[i + 1] : nullptr;
+
+        if (isStringEqual(word, "-input") || isStringEqual(word, "-i")) {
+            input = value;
+        }
+        else if (isStringEqual(word, "-output") || isStringEqual(word, "-o")) {
+            output = value ? value : "";
+        }
+        else if (isStringEqual(word, "-format") || isStringEqual(word, "-f")) {
+            infoArgs.formatString = value ? value : "";
+        }
+        else if (isStringEqual(word, "-jobs") || isStringEqual(word, "-j")) {
+            infoArgs.numJobs = value ? StringToInt32(value) : 1;
+        }
+        else if (isStringEqual(word, "-hdr")) {
+            infoArgs.isHDR = true;
+        }
+        else if (isStringEqual(word, "-mipnone")) {
+            isMipNone = true;
+        }
+        else if (isStringEqual(word, "-zstd") || isStringEqual(word, "-zlib")) {
+            isKTX2 = true;
+        }
+    }
+
+    if (!input) {
+        return;
+    }
+
+    ScriptSourceInfo sourceInfo;
+    if (!peekImageHeader(input, sourceInfo)) {
+        return;
+    }
+
+    isKTX2 = isKTX2 || isKTX2Filename(output);
+    if (!infoArgs.formatString.empty()) {
+        validateFormatAndEncoder(infoArgs);
+    }
+
+    command.cost = (double)sourceInfo.width * (double)sourceInfo.height * (double)sourceInfo.numChunks;
+    command.memoryEstimate = estimateScriptCommandMemory(args[0], sourceInfo, infoArgs, isKTX2, isMipNone);
+}
+
+// Commands reserve their estimated working set before they run, and block until it fits.
+// Reservations are granted in the order requested, so a large command isn't starved by
+// smaller ones slipping in ahead of it.  A command larger than the limit runs alone.
+class ScriptMemoryBudget {
+public:
+    ScriptMemoryBudget(uint64_t limit) : _limit(limit) {}
+
+    // returns the amount reserved, pass that to release
+    uint64_t reserve(uint64_t size)
+    {
+        size = std::min(size, _limit);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        uint64_t ticket = _nextTicket++;
+        _condition.wait(lock, [&]() {
+            return ticket == _servingTicket && _reserved + size <= _limit;
+        });
+
+        _reserved += size;
+        _peak = std::max(_peak, _reserved);
+        _servingTicket++;
+
+        // let the next ticket check if it fits too
+        _condition.notify_all();
+        return size;
+    }
+
+    void release(uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _reserved -= size;
+        _condition.notify_all();
+    }
+
+    uint64_t reserved()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _reserved;
+    }
+
+    uint64_t peak()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _peak;
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    uint64_t _limit;
+    uint64_t _reserved = 0;
+    uint64_t _peak = 0;
+    uint64_t _nextTicket = 0;
+    uint64_t _servingTicket = 0;
+};
+
+// Longest job first.  Ties and unknown costs keep script order, and
+// unknown costs are given the average so they don't all run last.
+static void orderScriptCommands(vector<ScriptCommand>& commands, vector<int32_t>& commandOrder)
+{
+    double totalCost = 0.0;
+    uint64_t totalMemory = 0;
+    int32_t numCosts = 0;
+    for (auto& command : commands) {
+        estimateScriptCommand(command);
+        if (command.cost > 0.0) {
+            totalCost += command.cost;
+            totalMemory += command.memoryEstimate;
+            numCosts++;
+        }
+    }
+
+    double averageCost = numCosts ? (totalCost / numCosts) : 1.0;
+    uint64_t averageMemory = numCosts ? (totalMemory / numCosts) : 0;
+    for (auto& command : commands) {
+        if (command.cost == 0.0) {
+            command.cost = averageCost;
+            command.memoryEstimate = averageMemory;
+        }
+    }
+
+    commandOrder.resize(commands.size());
+    for (int32_t i = 0; i < (int32_t)commands.size(); ++i) {
+        commandOrder[i] = i;
+    }
+
+    std::stable_sort(commandOrder.begin(), commandOrder.end(), [&](int32_t lhs, int32_t rhs) {
+        return commands[lhs].cost > commands[rhs].cost;
+    });
+}
+
+// Simulate workers that each take the next command when they go idle.
+static double simulateMakespan(const vector<double>& durations, const vector<int32_t>& order, int32_t numWorkers)
+{
+    vector<double> workerTimes(std::max(numWorkers, 1), 0.0);
+    for (int32_t index : order) {
+        auto it = std::min_element(workerTimes.begin(), workerTimes.end());
+        *it += durations[index];
+    }
+    return *std::max_element(workerTimes.begin(), workerTimes.end());
+}
+
+// Costs are converted to seconds with the total measured time, so the
+// prediction tests the relative costs and the ordering, not the absolute scale.
+static void logScriptMakespan(const vector<ScriptCommand>& commands, const vector<int32_t>& commandOrder,
+                              int32_t numWorkers, double actualMakespan)
+{
+    double totalCost = 0.0;
+    double totalTime = 0.0;
+    for (const auto& command : commands) {
+        totalCost += command.cost;
+        totalTime += command.timeElapsed;
+    }
+
+    if (commands.empty() || totalCost <= 0.0) {
+        return;
+    }
+
+    double secondsPerCost = totalTime / totalCost;
+    vector<double> predicted(commands.size());
+    vector<double> measured(commands.size());
+    for (int32_t i = 0; i < (int32_t)commands.size(); ++i) {
+        predicted[i] = commands[i].cost * secondsPerCost;
+        measured[i] = commands[i].timeElapsed;
+    }
+
+    vector<int32_t> scriptOrder(commands.size());
+    for (int32_t i = 0; i < (int32_t)commands.size(); ++i) {
+        scriptOrder[i] = i;
+    }
+
+    KLOGI("Kram", "script makespan predicted %0.3fs (script order %0.3fs), actual %0.3fs, actual times in script order %0.3fs",
+          simulateMakespan(predicted, commandOrder, numWorkers),
+          simulateMakespan(predicted, scriptOrder, numWorkers),
+          actualMakespan,
+          simulateMakespan(measured, scriptOrder, numWorkers));
+}
+
+int32_t kramAppScript(vector<const char*>& args)
+{
+    // this is help
+    int32_t argc = (int32_t)args.size();
+    if (argc == 0) {
+        kramScriptUsage();
+        return 0;
+    }
+
+    string srcFilename;
+
+    bool isVerbose = false;
+    bool error = false;
+    // this won't stop immediately, but when error occurs, no more tasks will exectue
+    bool isHaltedOnError = true;
+
+    // encode commands skip outputs that are up to date
+    bool isIncremental = false;
+
+    // encode commands copy outputs from this dir, size is passed through as MB
+    string cacheDir;
+    string cacheSize;
+
+    int32_t numJobs = 1;
+
+    // no limit by default, but reservations are still tracked for the summary
+    uint64_t memoryLimit = UINT64_MAX;
+
+    for (int32_t i = 0; i < argc; ++i) {
+        // check for options
+        const char* word = args[i];
+        if (word[0] != '-') {
+            KLOGE("Kram", "unexpected argument \"%s\"\n",
+                  word);
+            error = true;
+            break;
+        }
+
+        if (isStringEqual(word, "-input") ||
+            isStringEqual(word, "-i")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no input file defined");
+                error = true;
+                break;
+            }
 
             srcFilename = args[i];
         }
@@ -3314,6 +4027,30 @@ int32_t kramAppScript(vector<const char*>& args)
             }
 
             numJobs = StringToInt32(args[i]);
+            if (numJobs < 1) {
+                KLOGE("Kram", "job count must be > 0");
+
+                error = true;
+                break;
+            }
+        }
+        else if (isStringEqual(word, "-memlimit")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no memory limit defined");
+
+                error = true;
+                break;
+            }
+
+            int32_t memoryLimitMB = StringToInt32(args[i]);
+            if (memoryLimitMB <= 0) {
+                KLOGE("Kram", "memory limit must be > 0 MB");
+
+                error = true;
+                break;
+            }
+            memoryLimit = (uint64_t)memoryLimitMB * 1024 * 1024;
         }
         else if (isStringEqual(word, "-v") ||
                  isStringEqual(word, "-verbose")) {
@@ -3323,6 +4060,31 @@ int32_t kramAppScript(vector<const char*>& args)
                  isStringEqual(word, "-continue")) {
             isHaltedOnError = false;
         }
+        else if (isStringEqual(word, "-incremental")) {
+            isIncremental = true;
+        }
+        else if (isStringEqual(word, "-cache")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no cache dir defined");
+
+                error = true;
+                break;
+            }
+
+            cacheDir = args[i];
+        }
+        else if (isStringEqual(word, "-cachesize")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no cache size defined");
+
+                error = true;
+                break;
+            }
+
+            cacheSize = args[i];
+        }
         else {
             KLOGE("Kram", "unexpected argument \"%s\"\n",
                   word);
@@ -3350,61 +4112,95 @@ int32_t kramAppScript(vector<const char*>& args)
     FILE* fp = fileHelper.pointer();
     char str[4096];
 
-    string commandAndArgs;
-
     Timer scriptTimer;
 
+    // serially read commands out of the script
+    vector<ScriptCommand> commands;
+    while (fp) {
+        fgets(str, sizeof(str), fp);
+        if (feof(fp)) {
+            break;
+        }
+
+        ScriptCommand command;
+        command.commandAndArgs = str;
+        if (!command.commandAndArgs.empty() && command.commandAndArgs.back() == '\n') {
+            command.commandAndArgs.pop_back();
+        }
+        if (command.commandAndArgs.empty()) {
+            continue;
+        }
+
+        commands.push_back(command);
+    }
+
+    // Peek at the src images to estimate cost, and then start the longest
+    // commands first.  Otherwise a few large textures at the end of the script
+    // leave a long tail running on one thread.
+    vector<int32_t> commandOrder;
+    orderScriptCommands(commands, commandOrder);
+
     // as a global this auto allocates 16 threads, and don't want that unless actually
     // using scripting.  And even then want control over the number of threads.
     std::atomic<int32_t> errorCounter(0); // doesn't initialize to 0 otherwise
     std::atomic<int32_t> skippedCounter(0);
-    int32_t commandCounter = 0;
+    int32_t commandCounter = (int32_t)commands.size();
+    int32_t numWorkers = 1;
+
+    ScriptMemoryBudget memoryBudget(memoryLimit);
+
+    Timer runTimer;
 
     {
+        // the main thread submits the commands, and helps run them
+        task_system::setup_scheduler_thread();
+
         task_system system(numJobs);
+        task_group commandGroup(system);
+
+        // main thread also runs commands while it waits on the group
+        numWorkers = system.num_threads() + 1;
 
         // TODO: should really limit threads if less than command count.
         if (isVerbose) {
             KLOGI("Kram", "script system started with %d threads", system.num_threads());
+            system.log_threads();
         }
 
-        while (fp) {
-            // serially read commands out of the script
-            fgets(str, sizeof(str), fp);
-            if (feof(fp)) {
-                break;
-            }
+        for (int32_t commandIndex : commandOrder) {
+            // async execute the command across the provided threads
+            // this works for symmetric an asymmetric cores.  Work
+            // stealing will happen on low perf cores that can't keep up.
+            // Commands from this thread are started in the order submitted.
+            ScriptCommand& scriptCommand = commands[commandIndex];
 
-            commandAndArgs = str;
-            if (commandAndArgs.empty()) {
+            // stop any new work when not "continue on error"
+            if (isHaltedOnError && int32_t(errorCounter) > 0) {
+                skippedCounter++;
                 continue;
             }
 
-            commandCounter++;
+            // Wait here until the estimated working set fits.  Blocking in a task
+            // would tie up a worker that could be running the commands holding it.
+            uint64_t reservedMemory = memoryBudget.reserve(scriptCommand.memoryEstimate);
 
-            if (commandAndArgs.back() == '\n') {
-                commandAndArgs.pop_back();
-            }
+            commandGroup.run([&, commandIndex, reservedMemory]() {
+                ScriptCommand& scriptCommand = commands[commandIndex];
 
-            // async execute the command across the provided threads
-            // this works for symmetric an asymmetric cores.  Work
-            // stealing will happen on low perf cores that can't keep up.
-            // Could peek at src images to determine dimensions and mem
-            // usage estimates.  But then would need hard/easy queues.
-
-            system.async_([&, commandAndArgs]() mutable {
-                // stop any new work when not "continue on error"
+                // an error may have occurred since this was submitted
                 if (isHaltedOnError && int32_t(errorCounter) > 0) {
+                    memoryBudget.release(reservedMemory);
                     skippedCounter++;
                     return 0; // not really success, just skipping command
                 }
 
                 Timer commandTimer;
                 if (isVerbose) {
-                    KLOGI("Kram", "running %s", commandAndArgs.c_str());
+                    KLOGI("Kram", "running %s (reserved %0.1fMB)", scriptCommand.commandAndArgs.c_str(),
+                          reservedMemory / (1024.0 * 1024.0));
                 }
 
-                string commandAndArgsCopy = commandAndArgs;
+                string commandAndArgs = scriptCommand.commandAndArgs;
 
                 // tokenize the strings
                 vector<const char*> args;
@@ -3419,19 +4215,36 @@ int32_t kramAppScript(vector<const char*>& args)
                 }
                 const char* command = args[0];
 
+                if (isIncremental && isStringEqual(command, "encode")) {
+                    args.push_back("-incremental");
+                }
+
+                // encodes share one cache dir, it's safe across threads and processes
+                if (!cacheDir.empty() && isStringEqual(command, "encode")) {
+                    args.push_back("-cache");
+                    args.push_back(cacheDir.c_str());
+
+                    if (!cacheSize.empty()) {
+                        args.push_back("-cachesize");
+                        args.push_back(cacheSize.c_str());
+                    }
+                }
+
                 int32_t errorCode = kramAppCommand(args);
 
+                scriptCommand.timeElapsed = commandTimer.timeElapsed();
+                memoryBudget.release(reservedMemory);
+
                 if (isVerbose) {
-                    auto timeElapsed = commandTimer.timeElapsed();
-                    if (timeElapsed > 1.0) {
+                    if (scriptCommand.timeElapsed > 1.0) {
                         // TODO: extract output filename
                         // TODO: task sys passes threadIndex into this, so can report which thread completed work
-                        KLOGI("Kram", "perf: %s %s took %0.3fs", command, "file", timeElapsed);
+                        KLOGI("Kram", "perf: %s %s took %0.3fs", command, "file", scriptCommand.timeElapsed);
                     }
                 }
 
                 if (errorCode != 0) {
-                    KLOGE("Kram", "cmd: failed %s", commandAndArgsCopy.c_str());
+                    KLOGE("Kram", "cmd: failed %s", scriptCommand.commandAndArgs.c_str());
                     errorCounter++;
 
                     return errorCode;
@@ -3440,12 +4253,19 @@ int32_t kramAppScript(vector<const char*>& args)
                 return 0;
             });
         }
+
+        // Block until all commands complete, so the error count is accurate.
+        // The main thread helps run commands while it waits.
+        commandGroup.wait();
     }
 
-    // There are joins done at close of scope above before task system shuts down.
-    // This makes sure that return value is accurate if there are errors.  Most task
-    // systems don't have this, and shutting down the entire task system isn't ideal.
-    // There's a future system that we could block on instead.
+    if (isVerbose) {
+        logScriptMakespan(commands, commandOrder, numWorkers, runTimer.timeElapsed());
+
+        KLOGI("Kram", "script memory reserved %0.1fMB, peak %0.1fMB",
+              memoryBudget.reserved() / (1024.0 * 1024.0),
+              memoryBudget.peak() / (1024.0 * 1024.0));
+    }
 
     if (errorCounter > 0) {
         KLOGE("Kram", "script %d/%d commands failed", int32_t(errorCounter), commandCounter);
@@ -3459,6 +4279,488 @@ int32_t kramAppScript(vector<const char*>& args)
     return 0;
 }
 
+// Writes status lines for the commands of one serve stream.  Commands finish
+// on any thread, so each line is written whole under the lock.
+class ServeStream {
+public:
+    // fd < 0 writes to stdout, and logs must go to stderr
+    ServeStream(int32_t fd) : _fd(fd) {}
+
+    void writeStatus(const string& status)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_fd < 0) {
+            fputs(status.c_str(), stdout);
+            fflush(stdout);
+            return;
+        }
+
+#if !KRAM_WIN
+        // a client that went away just stops getting status
+        const char* data = status.c_str();
+        size_t bytesRemaining = status.size();
+        while (bytesRemaining > 0) {
+            ssize_t bytesWritten = write(_fd, data, bytesRemaining);
+            if (bytesWritten <= 0) {
+                break;
+            }
+            data += bytesWritten;
+            bytesRemaining -= bytesWritten;
+        }
+#endif
+    }
+
+private:
+    std::mutex _mutex;
+    int32_t _fd;
+};
+
+// Shared by all streams of a kram serve.
+struct ServeState {
+    ServeState(int32_t numJobs, uint64_t memoryLimit) : system(numJobs), jobSystem(numJobs), memoryBudget(memoryLimit) {}
+
+    // Commands run on system, and their -jobs work runs on jobSystem.  A wait
+    // helps run other tasks of its pool, so with one pool a waiting command
+    // could run a whole other command on its stack, and that one another.
+    task_system system;
+    task_system jobSystem;
+    ScriptMemoryBudget memoryBudget;
+    bool isVerbose = false;
+
+    std::atomic<bool> isShutdown{false};
+    std::atomic<int32_t> numCommands{0};
+    std::atomic<int32_t> numFailed{0};
+};
+
+// Only commands that run on one image.  Nested script or serve would start another pool.
+// info writes its report to stdout without -output, and that would mix into the status
+// lines of stdin mode, or go to the server's stdout and not the client in socket mode.
+static bool isServeCommand(const vector<const char*>& args)
+{
+    if (args.empty()) {
+        return false;
+    }
+
+    const char* command = args[0];
+    if (isStringEqual(command, "info")) {
+        for (const char* arg : args) {
+            if (isStringEqual(arg, "-output") || isStringEqual(arg, "-o")) {
+                return true;
+            }
+        }
+
+        KLOGE("Kram", "serve needs info -output file");
+        return false;
+    }
+
+    return isStringEqual(command, "encode") ||
+           isStringEqual(command, "decode") ||
+           isStringEqual(command, "fixup");
+}
+
+// Reads commands until eof, quit or shutdown, and runs them on the shared pool.
+// Returns once all commands read from this stream have finished, so the
+// stream can be closed.
+static void serveCommandStream(FILE* input, ServeStream& output, ServeState& state)
+{
+    task_group commandGroup(state.system);
+
+    char str[4096];
+    int32_t commandCounter = 0;
+
+    while (!state.isShutdown && fgets(str, sizeof(str), input)) {
+        string commandAndArgs = str;
+        while (!commandAndArgs.empty() &&
+               (commandAndArgs.back() == '\n' || commandAndArgs.back() == '\r')) {
+            commandAndArgs.pop_back();
+        }
+
+        if (commandAndArgs.empty() || commandAndArgs[0] == '#') {
+            continue;
+        }
+        if (commandAndArgs == "quit") {
+            break;
+        }
+        if (commandAndArgs == "shutdown") {
+            state.isShutdown = true;
+            break;
+        }
+
+        // status lines refer to commands by their 1-based order in the stream
+        int32_t commandIndex = ++commandCounter;
+        state.numCommands++;
+
+        ScriptCommand scriptCommand;
+        scriptCommand.commandAndArgs = commandAndArgs;
+        estimateScriptCommand(scriptCommand);
+
+        // Wait on the reader until the estimated working set fits, not in a task
+        // where it would block a worker.  This also stops reading until it fits.
+        uint64_t reservedMemory = state.memoryBudget.reserve(scriptCommand.memoryEstimate);
+
+        commandGroup.run([&state, &output, commandIndex, scriptCommand, reservedMemory]() {
+            Timer commandTimer;
+            if (state.isVerbose) {
+                KLOGI("Kram", "serving %d: %s", commandIndex, scriptCommand.commandAndArgs.c_str());
+            }
+
+            // tokenize the strings, strtok_r modifies the copy
+            string commandAndArgs = scriptCommand.commandAndArgs;
+            vector<const char*> args;
+            char* rest = (char*)commandAndArgs.c_str();
+            char* token;
+            while ((token = strtok_r(rest, " ", &rest))) {
+                args.push_back(token);
+            }
+
+            int32_t errorCode = -1;
+            if (isServeCommand(args)) {
+                // -jobs runs on the warm job pool instead of starting its own
+                errorCode = kramAppCommand(args, &state.jobSystem);
+            }
+            else {
+                KLOGE("Kram", "serve can't run %s", scriptCommand.commandAndArgs.c_str());
+            }
+
+            double timeElapsed = commandTimer.timeElapsed();
+            state.memoryBudget.release(reservedMemory);
+
+            if (errorCode != 0) {
+                state.numFailed++;
+            }
+
+            string status;
+            sprintf(status, "%d %s %0.3f\n", commandIndex, errorCode == 0 ? "ok" : "failed", timeElapsed);
+            output.writeStatus(status);
+        });
+    }
+
+    // the reader helps run commands while it waits
+    commandGroup.wait();
+}
+
+#if !KRAM_WIN
+
+// A client of serve -socket.  Its reader thread runs until the client
+// closes its end, or the server shuts down.
+struct ServeConnection {
+    std::thread thread;
+    std::mutex mutex;
+    int32_t fd = -1;
+    bool isOpen = true;
+    std::atomic<bool> isDone{false};
+};
+
+static bool serveSocket(const string& socketPath, ServeState& state)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        KLOGE("Kram", "serve socket path %s is too long", socketPath.c_str());
+        return false;
+    }
+    strlcpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path));
+
+    int32_t listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        KLOGE("Kram", "serve couldn't create socket");
+        return false;
+    }
+
+    // remove the socket left by a prior server
+    unlink(socketPath.c_str());
+
+    if (bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listenFd, 64) != 0) {
+        KLOGE("Kram", "serve couldn't listen on %s", socketPath.c_str());
+        close(listenFd);
+        return false;
+    }
+
+    // writes to a client that disconnected shouldn't end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    if (state.isVerbose) {
+        KLOGI("Kram", "serve listening on %s", socketPath.c_str());
+    }
+
+    vector<unique_ptr<ServeConnection>> connections;
+
+    while (!state.isShutdown) {
+        // join the threads of clients that are done
+        for (auto it = connections.begin(); it != connections.end();) {
+            if ((*it)->isDone) {
+                (*it)->thread.join();
+                it = connections.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        // poll with a timeout, so a shutdown from a client is seen
+        pollfd pollFd = {listenFd, POLLIN, 0};
+        if (poll(&pollFd, 1, 100) <= 0) {
+            continue;
+        }
+
+        int32_t fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        auto connection = make_unique<ServeConnection>();
+        ServeConnection* conn = connection.get();
+        conn->fd = fd;
+
+        conn->thread = std::thread([&state, conn]() {
+            FILE* input = fdopen(conn->fd, "r");
+            if (input) {
+                ServeStream output(conn->fd);
+                serveCommandStream(input, output, state);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(conn->mutex);
+                if (input) {
+                    fclose(input);
+                }
+                else {
+                    close(conn->fd);
+                }
+                conn->isOpen = false;
+            }
+            conn->isDone = true;
+        });
+
+        connections.push_back(std::move(connection));
+    }
+
+    // unblock readers of the other clients, their running commands still finish
+    for (auto& connection : connections) {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->isOpen) {
+            shutdown(connection->fd, SHUT_RD);
+        }
+    }
+    for (auto& connection : connections) {
+        connection->thread.join();
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return true;
+}
+
+#endif
+
+static int32_t kramAppServe(vector<const char*>& args)
+{
+    string socketPath;
+
+    bool isVerbose = false;
+    bool error = false;
+
+    int32_t numJobs = 1;
+
+    // no limit by default, but reservations are still tracked for the summary
+    uint64_t memoryLimit = UINT64_MAX;
+
+    int32_t argc = (int32_t)args.size();
+    for (int32_t i = 0; i < argc; ++i) {
+        const char* word = args[i];
+        if (word[0] != '-') {
+            KLOGE("Kram", "unexpected argument \"%s\"\n",
+                  word);
+            error = true;
+            break;
+        }
+
+        if (isStringEqual(word, "-socket")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no socket path defined");
+
+                error = true;
+                break;
+            }
+
+            socketPath = args[i];
+        }
+        else if (isStringEqual(word, "-jobs") ||
+                 isStringEqual(word, "-j")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no job count defined");
+
+                error = true;
+                break;
+            }
+
+            numJobs = StringToInt32(args[i]);
+            if (numJobs < 1) {
+                KLOGE("Kram", "job count must be > 0");
+
+                error = true;
+                break;
+            }
+        }
+        else if (isStringEqual(word, "-memlimit")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "no memory limit defined");
+
+                error = true;
+                break;
+            }
+
+            int32_t memoryLimitMB = StringToInt32(args[i]);
+            if (memoryLimitMB <= 0) {
+                KLOGE("Kram", "memory limit must be > 0 MB");
+
+                error = true;
+                break;
+            }
+            memoryLimit = (uint64_t)memoryLimitMB * 1024 * 1024;
+        }
+        else if (isStringEqual(word, "-v") ||
+                 isStringEqual(word, "-verbose")) {
+            isVerbose = true;
+        }
+        else {
+            KLOGE("Kram", "unexpected argument \"%s\"\n",
+                  word);
+            error = true;
+            break;
+        }
+    }
+
+    if (error) {
+        kramServeUsage();
+        return -1;
+    }
+
+    // stdout carries the status lines, so keep logs out of that stream
+    if (socketPath.empty()) {
+        setLogToStderr(true);
+    }
+
+    Timer serveTimer;
+
+    // The pool, astcenc contexts and format tables stay warm across all
+    // commands, instead of being rebuilt by a process per command.
+    task_system::setup_scheduler_thread();
+
+    ServeState state(numJobs, memoryLimit);
+    state.isVerbose = isVerbose;
+
+    if (isVerbose) {
+        KLOGI("Kram", "serve started with %d threads", state.system.num_threads());
+        state.system.log_threads();
+    }
+
+    if (!socketPath.empty()) {
+#if KRAM_WIN
+        KLOGE("Kram", "serve -socket isn't supported on Windows");
+        return -1;
+#else
+        if (!serveSocket(socketPath, state)) {
+            return -1;
+        }
+#endif
+    }
+    else {
+        ServeStream output(-1);
+        serveCommandStream(stdin, output, state);
+    }
+
+    if (isVerbose) {
+        KLOGI("Kram", "serve completed %d commands, %d failed, in %0.3fs, peak memory reserved %0.1fMB",
+              int32_t(state.numCommands), int32_t(state.numFailed), serveTimer.timeElapsed(),
+              state.memoryBudget.peak() / (1024.0 * 1024.0));
+    }
+
+    return 0;
+}
+
+static int32_t kramAppBench(vector<const char*>& args)
+{
+    // this is help
+    int32_t argc = (int32_t)args.size();
+    if (argc == 0) {
+        kramBenchUsage();
+        return 0;
+    }
+
+    bool doTasks = false;
+    bool doMips = false;
+    bool doSRGB = false;
+    bool doDecode = false;
+    bool doKTX2 = false;
+    int32_t numJobs = (int32_t)std::thread::hardware_concurrency();
+    bool error = false;
+
+    for (int32_t i = 0; i < argc; ++i) {
+        const char* word = args[i];
+
+        if (isStringEqual(word, "-tasks")) {
+            doTasks = true;
+        }
+        else if (isStringEqual(word, "-mips")) {
+            doMips = true;
+        }
+        else if (isStringEqual(word, "-srgb")) {
+            doSRGB = true;
+        }
+        else if (isStringEqual(word, "-decode")) {
+            doDecode = true;
+        }
+        else if (isStringEqual(word, "-ktx2")) {
+            doKTX2 = true;
+        }
+        else if (isStringEqual(word, "-jobs") ||
+                 isStringEqual(word, "-j")) {
+            ++i;
+            if (i >= argc) {
+                KLOGE("Kram", "jobs arg invalid");
+                error = true;
+                break;
+            }
+
+            numJobs = StringToInt32(args[i]);
+        }
+        else {
+            KLOGE("Kram", "unexpected argument \"%s\"\n",
+                  word);
+            error = true;
+            break;
+        }
+    }
+
+    if (error) {
+        kramBenchUsage();
+        return -1;
+    }
+
+    if (doTasks) {
+        benchmarkTaskSystems({1, 4, 16, 64});
+    }
+    if (doMips) {
+        benchmarkMipper();
+    }
+    if (doSRGB) {
+        benchmarkSRGB();
+    }
+    if (doDecode) {
+        benchmarkDecoder(std::max(numJobs, 1));
+    }
+    if (doKTX2) {
+        benchmarkKTX2Open(std::max(numJobs, 1));
+    }
+
+    return 0;
+}
+
 enum CommandType {
     kCommandTypeUnknown,
 
@@ -3467,6 +4769,8 @@ enum CommandType {
     kCommandTypeInfo,
     kCommandTypeScript,
     kCommandTypeFixup,
+    kCommandTypeBench,
+    kCommandTypeServe,
     // TODO: more commands, but scripting doesn't deal with failure or dependency
     //    kCommandTypeMerge, // combine channels from multiple png/ktx into one ktx
     //    kCommandTypeAtlas, // combine images into a single texture + atlas table (atlas to 2d or 2darray)
@@ -3492,6 +4796,12 @@ CommandType parseCommandType(const char* command)
     else if (isStringEqual(command, "fixup")) {
         commandType = kCommandTypeFixup;
     }
+    else if (isStringEqual(command, "bench")) {
+        commandType = kCommandTypeBench;
+    }
+    else if (isStringEqual(command, "serve")) {
+        commandType = kCommandTypeServe;
+    }
     return commandType;
 }
 
@@ -3560,7 +4870,7 @@ void PSTest()
     }
 }
 
-int32_t kramAppCommand(vector<const char*>& args)
+int32_t kramAppCommand(vector<const char*>& args, task_system* system)
 {
     PSTest();
 
@@ -3579,10 +4889,10 @@ int32_t kramAppCommand(vector<const char*>& args)
     switch (commandType) {
         case kCommandTypeEncode:
             args.erase(args.begin());
-            return kramAppEncode(args);
+            return kramAppEncode(args, system);
         case kCommandTypeDecode:
             args.erase(args.begin());
-            return kramAppDecode(args);
+            return kramAppDecode(args, system);
         case kCommandTypeInfo:
             args.erase(args.begin());
             return kramAppInfo(args);
@@ -3592,6 +4902,12 @@ int32_t kramAppCommand(vector<const char*>& args)
         case kCommandTypeFixup:
             args.erase(args.begin());
             return kramAppFixup(args);
+        case kCommandTypeBench:
+            args.erase(args.begin());
+            return kramAppBench(args);
+        case kCommandTypeServe:
+            args.erase(args.begin());
+            return kramAppServe(args);
         default:
             break;
     }
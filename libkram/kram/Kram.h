@@ -12,16 +12,24 @@ using namespace STL_NAMESPACE;
 
 class Image;
 class KTXImage;
+class task_system;
 
 // This helper needs to stay alive since KTXImage may alias the data.
 // KTXImage also has an internal vector already, but fileData may point to the mmap or vector here.
 class KTXImageData {
 public:
     // class keeps the data alive in mmapHelper or fileData
-    bool open(const char* filename, KTXImage& image, bool isInfoOnly_ = false);
+    // unpackSystem is optional, and decompresses ktx2 levels in parallel
+    bool open(const char* filename, KTXImage& image, bool isInfoOnly_ = false,
+              task_system* unpackSystem = nullptr);
 
     // class aliases data, so caller must keep alive.  Useful with bundle.
-    bool open(const uint8_t* data, size_t dataSize, KTXImage& image, bool isInfoOnly_ = false);
+    bool open(const uint8_t* data, size_t dataSize, KTXImage& image, bool isInfoOnly_ = false,
+              task_system* unpackSystem = nullptr);
+
+    // Maps the file and leaves ktx2 levels compressed, then KTXImage::unpackLevelChunks
+    // can stream in mips on demand.  This class must stay alive while those are read.
+    bool openLazy(const char* filename, KTXImage& image) { return open(filename, image, true); }
 
     // This releases all memory associated with this class
     void close();
@@ -0,0 +1,724 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramBenchmark.h"
+
+#include <cfloat>
+#include <cmath>
+
+#include "KTXImage.h"
+#include "KramBlockDecoder.h"
+#include "KramFileHelper.h"
+#include "KramImage.h"
+#include "KramImageInfo.h"
+#include "KramMipper.h"
+#include "KramThreadPool.h"
+#include "KramTimer.h"
+#include "TaskSystem.h"
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+//-----------------------------
+
+struct LatencyStats {
+    double average = 0.0;
+    double p50 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// times are in seconds, stats are in microseconds
+static LatencyStats computeLatencyStats(vector<double>& times)
+{
+    LatencyStats stats;
+    if (times.empty())
+        return stats;
+
+    std::sort(times.begin(), times.end());
+
+    double sum = 0.0;
+    for (double time : times) {
+        sum += time;
+    }
+
+    size_t count = times.size();
+    stats.average = 1e6 * sum / count;
+    stats.p50 = 1e6 * times[count / 2];
+    stats.p99 = 1e6 * times[std::min(count - 1, (count * 99) / 100)];
+    stats.max = 1e6 * times[count - 1];
+    return stats;
+}
+
+// A little work, so the jobs aren't only measuring the queues.
+static uint32_t benchmarkJobWork(uint32_t seed)
+{
+    for (int32_t i = 0; i < 64; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+    }
+    return seed;
+}
+
+struct TaskBenchmarkResults {
+    int32_t numThreads = 0;
+    double jobsPerSecond = 0.0;
+    LatencyStats loadLatency;
+    LatencyStats wakeLatency;
+};
+
+// Engine wraps a pool, with submit(f) and numThreads().  Completion is tracked
+// with an atomic, so neither engine's wait is measured.
+template <typename Engine>
+static void benchmarkEngine(Engine& engine, TaskBenchmarkResults& results)
+{
+    const int32_t kNumJobs = 100000;
+    const int32_t kNumWakes = 100;
+
+    results.numThreads = engine.numThreads();
+
+    // throughput, and latency of each job from submit to start
+    vector<double> latencies(kNumJobs);
+    std::atomic<int32_t> numDone(0);
+    std::atomic<uint32_t> checksum(0);
+
+    Timer throughputTimer;
+    for (int32_t i = 0; i < kNumJobs; ++i) {
+        double submitTime = currentTimestamp();
+        engine.submit([&, i, submitTime]() {
+            latencies[i] = currentTimestamp() - submitTime;
+            checksum += benchmarkJobWork(i);
+            numDone++;
+        });
+    }
+
+    while (numDone < kNumJobs) {
+        std::this_thread::yield();
+    }
+    double throughputTime = throughputTimer.timeElapsed();
+
+    results.jobsPerSecond = kNumJobs / throughputTime;
+    results.loadLatency = computeLatencyStats(latencies);
+
+    // wakeup latency, let threads go idle and park before each job
+    vector<double> wakeLatencies(kNumWakes);
+    for (int32_t i = 0; i < kNumWakes; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        std::atomic<bool> isDone(false);
+        double submitTime = currentTimestamp();
+        engine.submit([&, i, submitTime]() {
+            wakeLatencies[i] = currentTimestamp() - submitTime;
+            isDone = true;
+        });
+
+        while (!isDone) {
+            std::this_thread::yield();
+        }
+    }
+
+    results.wakeLatency = computeLatencyStats(wakeLatencies);
+}
+
+struct TaskSystemEngine {
+    task_system system;
+
+    TaskSystemEngine(int32_t numThreads) : system(numThreads) {}
+
+    int32_t numThreads() const { return system.num_threads(); }
+
+    template <typename F>
+    void submit(F&& f) { system.async_(std::forward<F>(f)); }
+};
+
+struct SchedulerEngine {
+    Scheduler scheduler;
+
+    SchedulerEngine(int32_t numThreads) : scheduler(numThreads) {}
+
+    int32_t numThreads() const { return (int32_t)scheduler.numWorkers(); }
+
+    template <typename F>
+    void submit(F&& f) { scheduler.scheduleJob(JobPriority::Default, std::forward<F>(f)); }
+};
+
+static void logTaskBenchmark(const char* name, const TaskBenchmarkResults& results)
+{
+    KLOGI("Bench", "%-12s threads:%2d %10.0f jobs/s, load latency avg:%.1f p50:%.1f p99:%.1f max:%.1f us, wake latency avg:%.1f p99:%.1f max:%.1f us",
+          name, results.numThreads, results.jobsPerSecond,
+          results.loadLatency.average, results.loadLatency.p50, results.loadLatency.p99, results.loadLatency.max,
+          results.wakeLatency.average, results.wakeLatency.p99, results.wakeLatency.max);
+}
+
+void benchmarkTaskSystems(const vector<int32_t>& threadCounts)
+{
+    // Note that task_system caps threads at the physical core count.
+    for (int32_t numThreads : threadCounts) {
+        TaskBenchmarkResults results;
+        {
+            TaskSystemEngine engine(numThreads);
+            benchmarkEngine(engine, results);
+        }
+        logTaskBenchmark("task_system", results);
+
+        {
+            SchedulerEngine engine(numThreads);
+            benchmarkEngine(engine, results);
+            engine.scheduler.stats().log();
+        }
+        logTaskBenchmark("Scheduler", results);
+    }
+}
+
+//-----------------------------
+
+struct MipBenchmarkImage {
+    vector<Color> pixels;
+    vector<half4> pixelsHalf;
+    vector<float4> pixelsFloat;
+    ImageData image;
+};
+
+static void initMipBenchmarkImage(MipBenchmarkImage& mip, int32_t width, int32_t height,
+                                  bool hasHalf, bool hasFloat, bool isSRGB, bool isHDR)
+{
+    int32_t numPixels = width * height;
+    mip.pixels.resize(numPixels);
+    if (hasHalf)
+        mip.pixelsHalf.resize(numPixels);
+    if (hasFloat)
+        mip.pixelsFloat.resize(numPixels);
+
+    mip.image.width = width;
+    mip.image.height = height;
+    mip.image.depth = 1;
+    mip.image.pixels = mip.pixels.data();
+    mip.image.pixelsHalf = hasHalf ? mip.pixelsHalf.data() : nullptr;
+    mip.image.pixelsFloat = hasFloat ? mip.pixelsFloat.data() : nullptr;
+    mip.image.isSRGB = isSRGB;
+    mip.image.isHDR = isHDR;
+}
+
+static bool isMipBenchmarkEqual(const MipBenchmarkImage& lhs, const MipBenchmarkImage& rhs, int32_t numPixels)
+{
+    return memcmp(lhs.pixels.data(), rhs.pixels.data(), numPixels * sizeof(Color)) == 0 &&
+           (lhs.pixelsHalf.empty() || memcmp(lhs.pixelsHalf.data(), rhs.pixelsHalf.data(), numPixels * sizeof(half4)) == 0) &&
+           (lhs.pixelsFloat.empty() || memcmp(lhs.pixelsFloat.data(), rhs.pixelsFloat.data(), numPixels * sizeof(float4)) == 0);
+}
+
+// Time one level of the mip chain from a 4k image, for each path that
+// mipmapLevel takes, and then the whole chain.  GB/s is of top-level src
+// pixels read, and best of a few runs.
+void benchmarkMipper()
+{
+    const int32_t kWidth = 4096;
+    const int32_t kHeight = 4096;
+    const int32_t kNumRuns = 5;
+
+    struct MipPath {
+        const char* name;
+        bool hasHalf;
+        bool hasFloat;
+        bool isSRGB;
+        bool isHDR;
+        size_t srcPixelSize;
+    };
+
+    const MipPath paths[] = {
+        {"8-bit", false, false, false, false, sizeof(Color)},
+        {"half", true, false, false, false, sizeof(half4)},
+        {"half srgb", true, false, true, false, sizeof(half4)},
+        {"float", false, true, false, true, sizeof(float4)},
+    };
+
+    Mipper mipper;
+
+    for (const MipPath& path : paths) {
+        MipBenchmarkImage src;
+        initMipBenchmarkImage(src, kWidth, kHeight, path.hasHalf, path.hasFloat, path.isSRGB, path.isHDR);
+
+        // a noisy premul-like image, so nothing is constant
+        uint32_t seed = 1;
+        for (int32_t i = 0; i < kWidth * kHeight; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            Color c = {(uint8_t)(seed >> 24), (uint8_t)(seed >> 16), (uint8_t)(seed >> 8), 255};
+            src.pixels[i] = c;
+
+            float4 cFloat = float4m(c.r, c.g, c.b, c.a) * (1.0f / 255.0f);
+            if (path.hasHalf)
+                src.pixelsHalf[i] = half4m(cFloat);
+            if (path.hasFloat)
+                src.pixelsFloat[i] = cFloat;
+        }
+
+        MipBenchmarkImage dst, dstScalar;
+        initMipBenchmarkImage(dst, kWidth / 2, kHeight / 2, path.hasHalf, path.hasFloat, path.isSRGB, path.isHDR);
+        initMipBenchmarkImage(dstScalar, kWidth / 2, kHeight / 2, path.hasHalf, path.hasFloat, path.isSRGB, path.isHDR);
+
+        double bestTime = 1e10;
+        double bestTimeScalar = 1e10;
+        for (int32_t run = 0; run < kNumRuns; ++run) {
+            Timer timer;
+            mipper.mipmap(src.image, dst.image);
+            bestTime = std::min(bestTime, timer.timeElapsed());
+
+            Timer timerScalar;
+            mipper.mipmapScalar(src.image, dstScalar.image);
+            bestTimeScalar = std::min(bestTimeScalar, timerScalar.timeElapsed());
+        }
+
+        double srcGB = (double)kWidth * kHeight * path.srcPixelSize / 1e9;
+        bool isEqual = isMipBenchmarkEqual(dst, dstScalar, (kWidth / 2) * (kHeight / 2));
+
+        KLOGI("Bench", "mip %-10s %6.2f GB/s, scalar %6.2f GB/s, %4.2fx %s",
+              path.name, srcGB / bestTime, srcGB / bestTimeScalar, bestTimeScalar / bestTime,
+              isEqual ? "bit-exact" : "MISMATCH");
+
+        // whole chain built from tiles, vs. reading each level back to build the next
+        int32_t numLevels = 0;
+        vector<MipBenchmarkImage> levels, levelsSerial;
+        vector<ImageData> levelImages;
+        for (int32_t w = kWidth / 2, h = kHeight / 2; w >= 1 && h >= 1; w /= 2, h /= 2) {
+            numLevels++;
+        }
+        levels.resize(numLevels);
+        levelsSerial.resize(numLevels);
+        levelImages.resize(numLevels);
+        for (int32_t i = 0; i < numLevels; ++i) {
+            int32_t w = kWidth >> (i + 1);
+            int32_t h = kHeight >> (i + 1);
+            initMipBenchmarkImage(levels[i], w, h, path.hasHalf, path.hasFloat, path.isSRGB, path.isHDR);
+            initMipBenchmarkImage(levelsSerial[i], w, h, path.hasHalf, path.hasFloat, path.isSRGB, path.isHDR);
+            levelImages[i] = levels[i].image;
+        }
+
+        double bestTimeChain = 1e10;
+        double bestTimeSerial = 1e10;
+        for (int32_t run = 0; run < kNumRuns; ++run) {
+            Timer timer;
+            mipper.mipmapLevels(src.image, levelImages.data(), numLevels);
+            bestTimeChain = std::min(bestTimeChain, timer.timeElapsed());
+
+            Timer timerSerial;
+            const ImageData* levelSrc = &src.image;
+            for (int32_t i = 0; i < numLevels; ++i) {
+                mipper.mipmap(*levelSrc, levelsSerial[i].image);
+                levelSrc = &levelsSerial[i].image;
+            }
+            bestTimeSerial = std::min(bestTimeSerial, timerSerial.timeElapsed());
+        }
+
+        bool isChainEqual = true;
+        for (int32_t i = 0; i < numLevels; ++i) {
+            isChainEqual &= isMipBenchmarkEqual(levels[i], levelsSerial[i], levelImages[i].width * levelImages[i].height);
+        }
+
+        KLOGI("Bench", "mip %-10s chain %6.2f GB/s, per level %6.2f GB/s, %4.2fx %s",
+              path.name, srcGB / bestTimeChain, srcGB / bestTimeSerial, bestTimeSerial / bestTimeChain,
+              isChainEqual ? "bit-exact" : "MISMATCH");
+
+        // cost of the sharper filters relative to box, on the common srgb path
+        if (!path.isSRGB)
+            continue;
+
+        const ImageResizeFilter filters[] = {
+            kImageResizeFilterLinear,
+            kImageResizeFilterMitchell,
+            kImageResizeFilterLanczos3,
+            kImageResizeFilterKaiser,
+        };
+
+        Mipper filterMipper;
+        for (ImageResizeFilter filter : filters) {
+            filterMipper.setFilter(filter);
+
+            double bestTimeFilter = 1e10;
+            for (int32_t run = 0; run < kNumRuns; ++run) {
+                Timer timer;
+                filterMipper.mipmap(src.image, dstScalar.image);
+                bestTimeFilter = std::min(bestTimeFilter, timer.timeElapsed());
+            }
+
+            KLOGI("Bench", "mip %-10s %-8s %6.2f GB/s, %4.2fx box",
+                  path.name, imageResizeFilterName(filter),
+                  srcGB / bestTimeFilter, bestTimeFilter / bestTime);
+        }
+    }
+}
+
+//-----------------------------
+
+// Compare all 4 channels of the table encode against powf.
+static void checkSRGBColor(float4 c, uint32_t& numMismatches)
+{
+    Color table = linearToSRGBColor(c);
+    Color reference = ColorFromUnormFloat4(linearToSRGB(c));
+    if (memcmp(&table, &reference, sizeof(Color)) == 0) {
+        return;
+    }
+
+    if (numMismatches < 8) {
+        KLOGW("Bench", "srgb8 mismatch %.9g,%.9g table %d,%d powf %d,%d",
+              c.x, c.w, table.r, table.a, reference.r, reference.a);
+    }
+    numMismatches++;
+}
+
+// Check the srgb8 table against powf for every float in [0,1], and for
+// out of range values from hdr and premul sources, and time both.
+void benchmarkSRGB()
+{
+    uint32_t oneBits;
+    float one = 1.0f;
+    memcpy(&oneBits, &one, sizeof(oneBits));
+
+    Timer timerValidate;
+    uint32_t numMismatches = 0;
+    uint32_t numChecked = 0;
+    for (uint32_t bits = 0; bits <= oneBits; ++bits) {
+        float lin;
+        memcpy(&lin, &bits, sizeof(lin));
+
+        // alpha gets the same value, and is scaled without the curve
+        checkSRGBColor(float4m(lin, lin, lin, lin), numMismatches);
+        numChecked++;
+    }
+
+    // negative and above 1 values, including the infinities
+    const float kOutOfRange[] = {
+        -0.0f, -1e-30f, -0.001f, -0.5f, -1.0f, -255.0f, -FLT_MAX, -INFINITY,
+        1.0000001f, 1.001f, 1.5f, 2.0f, 255.0f, 256.0f, 1e10f, FLT_MAX, INFINITY};
+    for (float lin : kOutOfRange) {
+        checkSRGBColor(float4m(lin, lin, lin, lin), numMismatches);
+
+        // in range rgb with out of range alpha, and the reverse
+        checkSRGBColor(float4m(0.5f, 0.25f, 0.75f, lin), numMismatches);
+        checkSRGBColor(float4m(lin, 0.25f, lin, 0.5f), numMismatches);
+        numChecked += 3;
+    }
+
+    KLOGI("Bench", "srgb8 checked %u colors in %0.1fs, %s",
+          numChecked, timerValidate.timeElapsed(),
+          numMismatches ? "MISMATCH" : "bit-exact");
+
+    const int32_t kNumPixels = 4096 * 1024;
+    const int32_t kNumRuns = 5;
+
+    vector<float4> pixels(kNumPixels);
+    vector<Color> colors(kNumPixels);
+    for (int32_t i = 0; i < kNumPixels; ++i) {
+        float lin = (float)i / kNumPixels;
+        pixels[i] = float4m(lin, lin * 0.5f, lin * 0.25f, 1.0f);
+    }
+
+    double bestTime = 1e10;
+    double bestTimeReference = 1e10;
+    for (int32_t run = 0; run < kNumRuns; ++run) {
+        Timer timer;
+        for (int32_t i = 0; i < kNumPixels; ++i) {
+            colors[i] = linearToSRGBColor(pixels[i]);
+        }
+        bestTime = std::min(bestTime, timer.timeElapsed());
+
+        Timer timerReference;
+        for (int32_t i = 0; i < kNumPixels; ++i) {
+            colors[i] = ColorFromUnormFloat4(linearToSRGB(pixels[i]));
+        }
+        bestTimeReference = std::min(bestTimeReference, timerReference.timeElapsed());
+    }
+
+    double mpix = kNumPixels / 1e6;
+    KLOGI("Bench", "srgb8 table %6.1f Mpix/s, powf %6.1f Mpix/s, %4.2fx",
+          mpix / bestTime, mpix / bestTimeReference, bestTimeReference / bestTime);
+}
+
+//-----------------------------
+
+// Encode a noisy tile, and repeat its blocks out to a large mip, since
+// encoding the whole mip at each format would dominate the benchmark.
+static bool initDecodeBenchmarkBlocks(MyMTLPixelFormat format, int32_t width, int32_t height,
+                                      vector<uint8_t>& blocks)
+{
+    const int32_t kTileSize = 256;
+
+    vector<Color> pixels(kTileSize * kTileSize);
+    uint32_t seed = 1;
+    for (int32_t y = 0; y < kTileSize; ++y) {
+        for (int32_t x = 0; x < kTileSize; ++x) {
+            // a gradient with some noise, so blocks pick a mix of modes
+            seed = seed * 1664525u + 1013904223u;
+            uint8_t noise = (uint8_t)(seed >> 28);
+            Color c = {(uint8_t)(x + noise), (uint8_t)(y + noise), (uint8_t)((x ^ y) + noise), (uint8_t)(255 - noise)};
+            pixels[y * kTileSize + x] = c;
+        }
+    }
+
+    Image image;
+    image.loadImageFromPixels(pixels, kTileSize, kTileSize, true, true);
+
+    ImageInfoArgs infoArgs;
+    infoArgs.pixelFormat = format;
+    infoArgs.quality = 0;
+    infoArgs.doMipmaps = false;
+    if (!validateFormatAndEncoder(infoArgs)) {
+        return false;
+    }
+
+    ImageInfo info;
+    info.initWithArgs(infoArgs);
+    info.initWithSourceImage(image);
+
+    KramEncoder encoder;
+    KTXImage tileImage;
+    if (!encoder.encode(info, image, tileImage)) {
+        return false;
+    }
+
+    const uint8_t* tileBlocks = tileImage.imageData().data() + tileImage.mipLevels[0].offset;
+
+    Int2 blockDims = blockDimsOfFormat(format);
+    int32_t blockSize = blockSizeOfFormat(format);
+    int32_t tileBlocksX = (kTileSize + blockDims.x - 1) / blockDims.x;
+    int32_t tileBlocksY = (kTileSize + blockDims.y - 1) / blockDims.y;
+    int32_t blocksX = (width + blockDims.x - 1) / blockDims.x;
+    int32_t blocksY = (height + blockDims.y - 1) / blockDims.y;
+
+    blocks.resize(blocksX * blocksY * blockSize);
+    for (int32_t by = 0; by < blocksY; ++by) {
+        for (int32_t bx = 0; bx < blocksX; ++bx) {
+            int32_t tileBlock = (by % tileBlocksY) * tileBlocksX + (bx % tileBlocksX);
+            memcpy(&blocks[(by * blocksX + bx) * blockSize], tileBlocks + tileBlock * blockSize, blockSize);
+        }
+    }
+
+    return true;
+}
+
+// Time decodeBlocks of a 4k mip for each format, on one thread and in bands
+// across numJobs threads.  Mpix/s is best of a few runs.
+void benchmarkDecoder(int32_t numJobs)
+{
+    const int32_t kWidth = 4096;
+    const int32_t kHeight = 4096;
+    const int32_t kNumRuns = 5;
+
+    // snorm and srgb take different paths through the decoders
+    const MyMTLPixelFormat formats[] = {
+        MyMTLPixelFormatBC1_RGBA,
+        MyMTLPixelFormatBC1_RGBA_sRGB,
+        MyMTLPixelFormatBC3_RGBA,
+        MyMTLPixelFormatBC3_RGBA_sRGB,
+        MyMTLPixelFormatBC4_RUnorm,
+        MyMTLPixelFormatBC4_RSnorm,
+        MyMTLPixelFormatBC5_RGUnorm,
+        MyMTLPixelFormatBC5_RGSnorm,
+        MyMTLPixelFormatBC7_RGBAUnorm,
+        MyMTLPixelFormatBC7_RGBAUnorm_sRGB,
+        MyMTLPixelFormatEAC_R11Unorm,
+        MyMTLPixelFormatEAC_R11Snorm,
+        MyMTLPixelFormatEAC_RG11Unorm,
+        MyMTLPixelFormatEAC_RG11Snorm,
+        MyMTLPixelFormatETC2_RGB8,
+        MyMTLPixelFormatETC2_RGB8_sRGB,
+        MyMTLPixelFormatEAC_RGBA8,
+        MyMTLPixelFormatEAC_RGBA8_sRGB,
+        MyMTLPixelFormatASTC_4x4_LDR,
+        MyMTLPixelFormatASTC_4x4_sRGB,
+        MyMTLPixelFormatASTC_8x8_LDR,
+        MyMTLPixelFormatASTC_8x8_sRGB,
+    };
+
+    task_system system(numJobs);
+
+    vector<uint8_t> blocks;
+    vector<uint8_t> blocksLibrary;
+    vector<uint8_t> pixels(kWidth * kHeight * sizeof(Color));
+    vector<uint8_t> pixelsParallel(pixels.size());
+
+    for (MyMTLPixelFormat format : formats) {
+        if (!initDecodeBenchmarkBlocks(format, kWidth, kHeight, blocks)) {
+            KLOGI("Bench", "decode %-12s no encoder", formatTypeName(format));
+            continue;
+        }
+
+        KramDecoderParams params;
+        KramDecoderParams paramsParallel;
+        paramsParallel.system = &system;
+
+        KramDecoder decoder;
+
+        double bestTime = 1e10;
+        double bestTimeParallel = 1e10;
+        bool success = true;
+        for (int32_t run = 0; run < kNumRuns && success; ++run) {
+            Timer timer;
+            success &= decoder.decodeBlocks(kWidth, kHeight, blocks.data(), (uint32_t)blocks.size(), format, pixels, params);
+            bestTime = std::min(bestTime, timer.timeElapsed());
+
+            Timer timerParallel;
+            success &= decoder.decodeBlocks(kWidth, kHeight, blocks.data(), (uint32_t)blocks.size(), format, pixelsParallel, paramsParallel);
+            bestTimeParallel = std::min(bestTimeParallel, timerParallel.timeElapsed());
+        }
+
+        if (!success) {
+            KLOGI("Bench", "decode %-12s no decoder", formatTypeName(format));
+            continue;
+        }
+
+        double mpix = (double)kWidth * kHeight / 1e6;
+        bool isEqual = pixels == pixelsParallel;
+
+        KLOGI("Bench", "decode %-12s %7.1f Mpix/s, %d jobs %7.1f Mpix/s, %4.2fx %s",
+              formatTypeName(format), mpix / bestTime, numJobs, mpix / bestTimeParallel,
+              bestTime / bestTimeParallel, isEqual ? "bit-exact" : "MISMATCH");
+
+        if (!isBlockRowDecoderFormat(format)) {
+            continue;
+        }
+
+        // compare the block row decoder to the per block library decoder
+        // that it replaces, serially, and check the output matches
+        KramDecoderParams paramsLibrary;
+        paramsLibrary.useBlockRowDecoder = false;
+
+        double bestTimeLibrary = 1e10;
+        for (int32_t run = 0; run < kNumRuns && success; ++run) {
+            // the library path remaps snorm bc4/5 endpoints in place, so each run gets a fresh copy
+            blocksLibrary = blocks;
+
+            Timer timer;
+            success &= decoder.decodeBlocks(kWidth, kHeight, blocksLibrary.data(), (uint32_t)blocksLibrary.size(), format, pixelsParallel, paramsLibrary);
+            bestTimeLibrary = std::min(bestTimeLibrary, timer.timeElapsed());
+        }
+
+        if (!success) {
+            continue;
+        }
+
+        isEqual = pixels == pixelsParallel;
+
+        KLOGI("Bench", "decode %-12s %7.1f Mpix/s library, %4.2fx block rows %s",
+              formatTypeName(format), mpix / bestTimeLibrary,
+              bestTimeLibrary / bestTime, isEqual ? "bit-exact" : "MISMATCH");
+    }
+}
+
+//-----------------------------
+
+// Write the image as a supercompressed KTX2 to a tmp file, and read it back.
+static bool saveKTX2BenchmarkData(const KTXImage& image, const KTX2Compressor& compressor,
+                                  vector<uint8_t>& fileData)
+{
+    FileHelper fileHelper;
+    if (!fileHelper.openTemporaryFile("kram-bench-", ".ktx2", "w+b")) {
+        return false;
+    }
+
+    KramEncoder encoder;
+    if (!encoder.saveKTX2(image, compressor, fileHelper.pointer())) {
+        return false;
+    }
+
+    size_t fileSize = fileHelper.size();
+    if (fileSize == (size_t)-1) {
+        return false;
+    }
+
+    fileData.resize(fileSize);
+    rewind(fileHelper.pointer());
+    return fileHelper.read(fileData.data(), fileSize);
+}
+
+// Time open of a mipped 4k rgba8 KTX2 for each compressor.  Each level is a
+// job, so the top mip bounds the speedup.  Times are best of a few runs.
+void benchmarkKTX2Open(int32_t numJobs)
+{
+    const int32_t kWidth = 4096;
+    const int32_t kHeight = 4096;
+    const int32_t kNumRuns = 5;
+
+    // a gradient with some noise, so the levels compress like a texture would
+    vector<Color> pixels(kWidth * kHeight);
+    uint32_t seed = 1;
+    for (int32_t y = 0; y < kHeight; ++y) {
+        for (int32_t x = 0; x < kWidth; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            uint8_t noise = (uint8_t)(seed >> 28);
+            Color c = {(uint8_t)(x + noise), (uint8_t)(y + noise), (uint8_t)((x ^ y) + noise), 255};
+            pixels[y * kWidth + x] = c;
+        }
+    }
+
+    Image image;
+    image.loadImageFromPixels(pixels, kWidth, kHeight, true, false);
+
+    ImageInfoArgs infoArgs;
+    infoArgs.pixelFormat = MyMTLPixelFormatRGBA8Unorm;
+    infoArgs.doMipmaps = true;
+    if (!validateFormatAndEncoder(infoArgs)) {
+        return;
+    }
+
+    ImageInfo info;
+    info.initWithArgs(infoArgs);
+    info.initWithSourceImage(image);
+
+    KramEncoder encoder;
+    KTXImage srcImage;
+    if (!encoder.encode(info, image, srcImage)) {
+        KLOGW("Bench", "ktx2 encode failed");
+        return;
+    }
+
+    const KTX2Supercompression compressorTypes[] = {
+        KTX2SupercompressionZstd,
+        KTX2SupercompressionZlib,
+    };
+
+    task_system system(numJobs);
+
+    vector<uint8_t> fileData;
+    for (KTX2Supercompression compressorType : compressorTypes) {
+        KTX2Compressor compressor;
+        compressor.compressorType = compressorType;
+
+        if (!saveKTX2BenchmarkData(srcImage, compressor, fileData)) {
+            KLOGW("Bench", "ktx2 %s save failed", supercompressionName(compressorType));
+            continue;
+        }
+
+        double bestTime = 1e10;
+        double bestTimeParallel = 1e10;
+        bool success = true;
+        bool isEqual = true;
+        size_t unpackedSize = 0;
+        for (int32_t run = 0; run < kNumRuns && success; ++run) {
+            KTXImage image, imageParallel;
+
+            Timer timer;
+            success &= image.open(fileData.data(), fileData.size());
+            bestTime = std::min(bestTime, timer.timeElapsed());
+
+            Timer timerParallel;
+            success &= imageParallel.open(fileData.data(), fileData.size(), false, &system);
+            bestTimeParallel = std::min(bestTimeParallel, timerParallel.timeElapsed());
+
+            unpackedSize = image.imageData().size();
+            isEqual &= success && unpackedSize == imageParallel.imageData().size() &&
+                       memcmp(image.imageData().data(), imageParallel.imageData().data(), unpackedSize) == 0;
+        }
+
+        if (!success) {
+            KLOGW("Bench", "ktx2 %s open failed", supercompressionName(compressorType));
+            continue;
+        }
+
+        double unpackedMB = unpackedSize / 1e6;
+        KLOGI("Bench", "ktx2 open %-4s %5.1f MB from %5.1f MB, %7.1f MB/s, %d jobs %7.1f MB/s, %4.2fx %s",
+              supercompressionName(compressorType), unpackedMB, fileData.size() / 1e6,
+              unpackedMB / bestTime, numJobs, unpackedMB / bestTimeParallel,
+              bestTime / bestTimeParallel, isEqual ? "bit-exact" : "MISMATCH");
+    }
+}
+
+} // namespace kram
@@ -0,0 +1,34 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+//#include "KramConfig.h"
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+// Micro-benchmarks run by "kram bench".  Results are logged.
+
+// Compare task_system and the Scheduler for throughput of tiny jobs,
+// latency of jobs under that load, and wakeup latency of an idle pool.
+void benchmarkTaskSystems(const vector<int32_t>& threadCounts);
+
+// Compare the SIMD and scalar 2x2 box filter for the 8-bit, half and float
+// mip paths, and check that the outputs match.
+void benchmarkMipper();
+
+// Check the linear to srgb8 table against powf on every float in [0,1] and
+// on out of range values, in all 4 channels, and compare their speed.
+void benchmarkSRGB();
+
+// Time block decode per format in Mpix/s, serially and in bands across numJobs,
+// and the block row decoders against the library decoders they replace.
+void benchmarkDecoder(int32_t numJobs);
+
+// Time open of a supercompressed KTX2 per compressor, unpacking the levels
+// serially and across numJobs threads.
+void benchmarkKTX2Open(int32_t numJobs);
+
+} // namespace kram
@@ -0,0 +1,168 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramBlockCache.h"
+
+#include <cassert>
+
+#include "KramMipper.h" // for Color
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+// 64-bit hash of the footprint, 8 bytes at a time.  Footprints are a multiple
+// of 4 bytes, since odd astc blocks like 5x5 have an odd number of pixels.
+// The full footprint is still compared on a match.
+static uint64_t hashFootprint(const uint8_t* data, int32_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    int32_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    if (i < size) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(uint32_t));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Map node with its allocation header, and a bucket.  Roughly, since
+// this depends on the stl, but close enough to bound the memory.
+static const size_t kMapEntryOverhead = 4 * sizeof(void*) + sizeof(uint64_t) + sizeof(uint32_t);
+
+BlockCache::BlockCache(MyMTLPixelFormat format, int32_t quality, size_t maxBytes, size_t maxBlocks)
+    : _format(format),
+      _quality(quality),
+      _nextMipId(0),
+      _numLookups(0),
+      _numHits(0),
+      _numDuplicates(0),
+      _numBytes(0)
+{
+    Int2 blockDims = blockDimsOfFormat(format);
+    _footprintSize = blockDims.x * blockDims.y * (int32_t)sizeof(Color);
+    _blockSize = blockSizeOfFormat(format);
+    _entrySize = _footprintSize + _blockSize + sizeof(Entry) + kMapEntryOverhead;
+
+    // Blocks aren't spread evenly by the hash, so leave shards some slack
+    size_t maxShardEntries = maxBytes / kNumShards / _entrySize;
+    size_t maxShardBlocks = 2 * ((maxBlocks + kNumShards - 1) / kNumShards);
+    _maxShardEntries = (uint32_t)std::min(maxShardEntries, maxShardBlocks);
+
+    // Reserve up front, so the vectors don't grow past the bound with
+    // slack from doubling, and the map doesn't rehash.
+    for (Shard& shard : _shards) {
+        shard.entries.reserve(_maxShardEntries);
+        shard.data.reserve(_maxShardEntries * (size_t)(_footprintSize + _blockSize));
+        shard.map.reserve(_maxShardEntries);
+    }
+}
+
+uint32_t BlockCache::beginMip()
+{
+    return _nextMipId++;
+}
+
+BlockCache::Result BlockCache::lookup(uint32_t mipId, int32_t blockIndex, const Color* footprint,
+                                      uint8_t* dstBlock, uint32_t& entryIndex, int32_t& srcBlockIndex)
+{
+    const uint8_t* footprintData = (const uint8_t*)footprint;
+    uint64_t hash = hashFootprint(footprintData, _footprintSize);
+
+    uint32_t shardIndex = hash % kNumShards;
+    Shard& shard = _shards[shardIndex];
+
+    _numLookups++;
+
+    lock_guard<mutex> lock(shard.lock);
+
+    auto it = shard.map.find(hash);
+    if (it != shard.map.end()) {
+        const Entry& entry = shard.entries[it->second];
+        const uint8_t* entryData = shard.data.data() + entry.dataOffset;
+
+        // a hash collision is treated as a miss
+        if (memcmp(entryData, footprintData, _footprintSize) != 0) {
+            return kMiss;
+        }
+
+        if (entry.isComplete) {
+            memcpy(dstBlock, entryData + _footprintSize, _blockSize);
+            _numHits++;
+            return kHit;
+        }
+
+        if (entry.mipId == mipId) {
+            srcBlockIndex = entry.blockIndex;
+            _numDuplicates++;
+            return kDuplicate;
+        }
+
+        // another mip is still encoding it
+        return kMiss;
+    }
+
+    if (shard.entries.size() >= _maxShardEntries) {
+        return kMiss;
+    }
+
+    Entry entry;
+    entry.dataOffset = (uint32_t)shard.data.size();
+    entry.mipId = mipId;
+    entry.blockIndex = blockIndex;
+    entry.isComplete = false;
+
+    shard.data.insert(shard.data.end(), footprintData, footprintData + _footprintSize);
+    shard.data.resize(shard.data.size() + _blockSize);
+
+    uint32_t shardEntry = (uint32_t)shard.entries.size();
+    shard.entries.push_back(entry);
+    shard.map[hash] = shardEntry;
+
+    _numBytes += _entrySize;
+
+    entryIndex = shardEntry * kNumShards + shardIndex;
+    return kClaimed;
+}
+
+void BlockCache::complete(uint32_t entryIndex, const uint8_t* encodedBlock)
+{
+    Shard& shard = _shards[entryIndex % kNumShards];
+
+    lock_guard<mutex> lock(shard.lock);
+
+    Entry& entry = shard.entries[entryIndex / kNumShards];
+    assert(!entry.isComplete);
+
+    memcpy(shard.data.data() + entry.dataOffset + _footprintSize, encodedBlock, _blockSize);
+    entry.isComplete = true;
+}
+
+void BlockCache::logStats() const
+{
+    int32_t numLookups = _numLookups.load();
+    int32_t numHits = _numHits.load();
+    int32_t numDuplicates = _numDuplicates.load();
+
+    if (numLookups == 0) {
+        return;
+    }
+
+    float hitRate = (100.0f * (numHits + numDuplicates)) / numLookups;
+
+    KLOGI("Image", "Block cache reused %d of %d blocks (%0.1f%%), %d hits and %d duplicates, %d KB\n",
+          numHits + numDuplicates, numLookups, hitRate,
+          numHits, numDuplicates, (int32_t)(_numBytes.load() / 1024));
+}
+
+} // namespace kram
@@ -0,0 +1,95 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+//#include "KramConfig.h"
+#include "KTXImage.h" // for MyMTLPixelFormat
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+struct Color;
+
+// Remembers the encoded bits of each unique block footprint of source pixels,
+// so tiled and atlas content that repeats blocks across chunks and mips only
+// encodes them once.  One cache is made per encode, since the format and the
+// encoder settings must match for the bits to be reused.  This is thread-safe,
+// and the entries are split into shards that each have their own lock.
+//
+// Within a mip, the first block with a new footprint claims the entry, and
+// later copies become duplicates of that block.  Those are copied after the
+// mip is encoded, and then the claims are completed with the encoded bits.
+// Other mips that see an entry claimed but not yet completed just encode it.
+class BlockCache {
+public:
+    enum Result {
+        kMiss,      // not cached, and can't be claimed
+        kClaimed,   // caller encodes the block, then calls complete
+        kDuplicate, // claimed earlier in this mip, copy from srcBlockIndex after encode
+        kHit,       // encoded bits were copied to dstBlock
+    };
+
+    // maxBytes bounds the footprints and encoded bits that are stored, along with
+    // the entry and map overhead.  Once that's reached, lookups still hit but no
+    // new entries are claimed.  maxBlocks is the most blocks that will be looked
+    // up, so small images don't reserve storage for the whole bound.
+    BlockCache(MyMTLPixelFormat format, int32_t quality, size_t maxBytes, size_t maxBlocks);
+
+    // Each mip gets its own id, so duplicates are only copied within it.
+    uint32_t beginMip();
+
+    // footprint is the block dimensions of the format in pixels.  entryIndex
+    // is set for kClaimed, and srcBlockIndex is set for kDuplicate.
+    Result lookup(uint32_t mipId, int32_t blockIndex, const Color* footprint,
+                  uint8_t* dstBlock, uint32_t& entryIndex, int32_t& srcBlockIndex);
+
+    // Stores the encoded bits for an entry that lookup claimed.
+    void complete(uint32_t entryIndex, const uint8_t* encodedBlock);
+
+    // Logs the hit rate and memory use, if any blocks were looked up.
+    void logStats() const;
+
+    MyMTLPixelFormat format() const { return _format; }
+    int32_t quality() const { return _quality; }
+
+private:
+    static const uint32_t kNumShards = 16;
+
+    // entry index is shard in the low bits, and the entry in that shard above it
+    struct Entry {
+        uint32_t dataOffset;    // footprint, then the encoded bits
+        uint32_t mipId;         // mip that claimed it
+        int32_t blockIndex;     // block that claimed it
+        bool isComplete;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        unordered_map<uint64_t, uint32_t> map; // footprint hash to entry
+        vector<Entry> entries;
+        vector<uint8_t> data;
+    };
+
+    MyMTLPixelFormat _format;
+    int32_t _quality;
+    int32_t _footprintSize;
+    int32_t _blockSize;
+    size_t _entrySize;       // footprint, encoded bits and overhead
+    uint32_t _maxShardEntries;
+
+    Shard _shards[kNumShards];
+
+    std::atomic<uint32_t> _nextMipId;
+    std::atomic<int32_t> _numLookups;
+    std::atomic<int32_t> _numHits;
+    std::atomic<int32_t> _numDuplicates;
+    std::atomic<size_t> _numBytes;
+};
+
+} // namespace kram
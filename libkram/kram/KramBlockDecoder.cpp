@@ -0,0 +1,999 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramBlockDecoder.h"
+
+#include <math.h>
+
+#include "KramMipper.h" // for Color
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+//-----------------------------
+// 16 byte register ops.  lookup16 is pshufb/tbl, and an index with the high bit
+// set returns 0.  The decoders only use indices 0-15 and 0x80.  The 32-bit lane
+// ops build palettes for 4 blocks at once, and the 16-bit lane ops are for etc.
+
+#if SIMD_SSE
+
+typedef __m128i vec16;
+
+inline vec16 load16(const void* src) { return _mm_loadu_si128((const __m128i*)src); }
+inline void store16(void* dst, vec16 v) { _mm_storeu_si128((__m128i*)dst, v); }
+inline vec16 lookup16(vec16 table, vec16 indices) { return _mm_shuffle_epi8(table, indices); }
+inline vec16 or16(vec16 a, vec16 b) { return _mm_or_si128(a, b); }
+inline vec16 and16(vec16 a, vec16 b) { return _mm_and_si128(a, b); }
+
+// mask is all 0 or 1 bits per lane
+inline vec16 select16(vec16 mask, vec16 a, vec16 b) { return _mm_blendv_epi8(b, a, mask); }
+
+inline vec16 set32(uint32_t a, uint32_t b, uint32_t c, uint32_t d) { return _mm_setr_epi32(a, b, c, d); }
+inline vec16 splat32(uint32_t a) { return _mm_set1_epi32(a); }
+inline vec16 add32(vec16 a, vec16 b) { return _mm_add_epi32(a, b); }
+inline vec16 mul32(vec16 a, vec16 b) { return _mm_mullo_epi32(a, b); }
+inline vec16 cmpgt32(vec16 a, vec16 b) { return _mm_cmpgt_epi32(a, b); }
+template <int N>
+inline vec16 shl32(vec16 a) { return _mm_slli_epi32(a, N); }
+template <int N>
+inline vec16 shr32(vec16 a) { return _mm_srli_epi32(a, N); }
+
+inline void transpose32(vec16& a, vec16& b, vec16& c, vec16& d)
+{
+    vec16 ab01 = _mm_unpacklo_epi32(a, b);
+    vec16 cd01 = _mm_unpacklo_epi32(c, d);
+    vec16 ab23 = _mm_unpackhi_epi32(a, b);
+    vec16 cd23 = _mm_unpackhi_epi32(c, d);
+
+    a = _mm_unpacklo_epi64(ab01, cd01);
+    b = _mm_unpackhi_epi64(ab01, cd01);
+    c = _mm_unpacklo_epi64(ab23, cd23);
+    d = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+inline vec16 set16(int16_t a, int16_t b, int16_t c, int16_t d, int16_t e, int16_t f, int16_t g, int16_t h)
+{
+    return _mm_setr_epi16(a, b, c, d, e, f, g, h);
+}
+inline vec16 widenLo8to16(vec16 a) { return _mm_cvtepu8_epi16(a); }
+inline vec16 widenHi8to16(vec16 a) { return _mm_cvtepu8_epi16(_mm_srli_si128(a, 8)); }
+inline vec16 add16(vec16 a, vec16 b) { return _mm_add_epi16(a, b); }
+inline vec16 mul16(vec16 a, vec16 b) { return _mm_mullo_epi16(a, b); }
+template <int N>
+inline vec16 sra16(vec16 a) { return _mm_srai_epi16(a, N); }
+
+// signed 16-bit to unsigned 8-bit with saturation
+inline vec16 packus16(vec16 a, vec16 b) { return _mm_packus_epi16(a, b); }
+
+#elif SIMD_NEON
+
+typedef uint8x16_t vec16;
+
+inline int32x4_t as32(vec16 a) { return vreinterpretq_s32_u8(a); }
+inline int16x8_t as16(vec16 a) { return vreinterpretq_s16_u8(a); }
+inline vec16 from32(int32x4_t a) { return vreinterpretq_u8_s32(a); }
+inline vec16 from16(int16x8_t a) { return vreinterpretq_u8_s16(a); }
+
+inline vec16 load16(const void* src) { return vld1q_u8((const uint8_t*)src); }
+inline void store16(void* dst, vec16 v) { vst1q_u8((uint8_t*)dst, v); }
+inline vec16 lookup16(vec16 table, vec16 indices) { return vqtbl1q_u8(table, indices); }
+inline vec16 or16(vec16 a, vec16 b) { return vorrq_u8(a, b); }
+inline vec16 and16(vec16 a, vec16 b) { return vandq_u8(a, b); }
+
+// mask is all 0 or 1 bits per lane
+inline vec16 select16(vec16 mask, vec16 a, vec16 b) { return vbslq_u8(mask, a, b); }
+
+inline vec16 set32(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    const uint32_t values[4] = {a, b, c, d};
+    return vreinterpretq_u8_u32(vld1q_u32(values));
+}
+inline vec16 splat32(uint32_t a) { return vreinterpretq_u8_u32(vdupq_n_u32(a)); }
+inline vec16 add32(vec16 a, vec16 b) { return from32(vaddq_s32(as32(a), as32(b))); }
+inline vec16 mul32(vec16 a, vec16 b) { return from32(vmulq_s32(as32(a), as32(b))); }
+inline vec16 cmpgt32(vec16 a, vec16 b) { return vreinterpretq_u8_u32(vcgtq_s32(as32(a), as32(b))); }
+template <int N>
+inline vec16 shl32(vec16 a) { return vreinterpretq_u8_u32(vshlq_n_u32(vreinterpretq_u32_u8(a), N)); }
+template <int N>
+inline vec16 shr32(vec16 a) { return vreinterpretq_u8_u32(vshrq_n_u32(vreinterpretq_u32_u8(a), N)); }
+
+inline void transpose32(vec16& a, vec16& b, vec16& c, vec16& d)
+{
+    int32x4x2_t ab = vtrnq_s32(as32(a), as32(b)); // a0 b0 a2 b2, a1 b1 a3 b3
+    int32x4x2_t cd = vtrnq_s32(as32(c), as32(d));
+
+    a = from32(vcombine_s32(vget_low_s32(ab.val[0]), vget_low_s32(cd.val[0])));
+    b = from32(vcombine_s32(vget_low_s32(ab.val[1]), vget_low_s32(cd.val[1])));
+    c = from32(vcombine_s32(vget_high_s32(ab.val[0]), vget_high_s32(cd.val[0])));
+    d = from32(vcombine_s32(vget_high_s32(ab.val[1]), vget_high_s32(cd.val[1])));
+}
+
+inline vec16 set16(int16_t a, int16_t b, int16_t c, int16_t d, int16_t e, int16_t f, int16_t g, int16_t h)
+{
+    const int16_t values[8] = {a, b, c, d, e, f, g, h};
+    return from16(vld1q_s16(values));
+}
+inline vec16 widenLo8to16(vec16 a) { return vreinterpretq_u8_u16(vmovl_u8(vget_low_u8(a))); }
+inline vec16 widenHi8to16(vec16 a) { return vreinterpretq_u8_u16(vmovl_u8(vget_high_u8(a))); }
+inline vec16 add16(vec16 a, vec16 b) { return from16(vaddq_s16(as16(a), as16(b))); }
+inline vec16 mul16(vec16 a, vec16 b) { return from16(vmulq_s16(as16(a), as16(b))); }
+template <int N>
+inline vec16 sra16(vec16 a) { return from16(vshrq_n_s16(as16(a), N)); }
+
+// signed 16-bit to unsigned 8-bit with saturation
+inline vec16 packus16(vec16 a, vec16 b) { return vcombine_u8(vqmovun_s16(as16(a)), vqmovun_s16(as16(b))); }
+
+#else
+
+// scalar emulation of the ops above, so the decoders have one code path
+struct vec16 {
+    union {
+        uint8_t u8[16];
+        int16_t s16[8];
+        uint32_t u32[4];
+    };
+};
+
+inline vec16 load16(const void* src)
+{
+    vec16 v;
+    memcpy(v.u8, src, 16);
+    return v;
+}
+inline void store16(void* dst, vec16 v) { memcpy(dst, v.u8, 16); }
+inline vec16 lookup16(vec16 table, vec16 indices)
+{
+    vec16 v;
+    for (int32_t i = 0; i < 16; ++i)
+        v.u8[i] = (indices.u8[i] & 0x80) ? 0 : table.u8[indices.u8[i] & 15];
+    return v;
+}
+inline vec16 or16(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] |= b.u32[i];
+    return a;
+}
+inline vec16 and16(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] &= b.u32[i];
+    return a;
+}
+inline vec16 select16(vec16 mask, vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] = (a.u32[i] & mask.u32[i]) | (b.u32[i] & ~mask.u32[i]);
+    return a;
+}
+
+inline vec16 set32(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    vec16 v;
+    v.u32[0] = a;
+    v.u32[1] = b;
+    v.u32[2] = c;
+    v.u32[3] = d;
+    return v;
+}
+inline vec16 splat32(uint32_t a) { return set32(a, a, a, a); }
+inline vec16 add32(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] += b.u32[i];
+    return a;
+}
+inline vec16 mul32(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] *= b.u32[i];
+    return a;
+}
+inline vec16 cmpgt32(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] = ((int32_t)a.u32[i] > (int32_t)b.u32[i]) ? 0xFFFFFFFF : 0;
+    return a;
+}
+template <int N>
+inline vec16 shl32(vec16 a)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] <<= N;
+    return a;
+}
+template <int N>
+inline vec16 shr32(vec16 a)
+{
+    for (int32_t i = 0; i < 4; ++i)
+        a.u32[i] >>= N;
+    return a;
+}
+
+inline void transpose32(vec16& a, vec16& b, vec16& c, vec16& d)
+{
+    vec16 rows[4] = {a, b, c, d};
+    a = set32(rows[0].u32[0], rows[1].u32[0], rows[2].u32[0], rows[3].u32[0]);
+    b = set32(rows[0].u32[1], rows[1].u32[1], rows[2].u32[1], rows[3].u32[1]);
+    c = set32(rows[0].u32[2], rows[1].u32[2], rows[2].u32[2], rows[3].u32[2]);
+    d = set32(rows[0].u32[3], rows[1].u32[3], rows[2].u32[3], rows[3].u32[3]);
+}
+
+inline vec16 set16(int16_t a, int16_t b, int16_t c, int16_t d, int16_t e, int16_t f, int16_t g, int16_t h)
+{
+    vec16 v;
+    const int16_t values[8] = {a, b, c, d, e, f, g, h};
+    memcpy(v.s16, values, 16);
+    return v;
+}
+inline vec16 widenLo8to16(vec16 a)
+{
+    vec16 v;
+    for (int32_t i = 0; i < 8; ++i)
+        v.s16[i] = a.u8[i];
+    return v;
+}
+inline vec16 widenHi8to16(vec16 a)
+{
+    vec16 v;
+    for (int32_t i = 0; i < 8; ++i)
+        v.s16[i] = a.u8[8 + i];
+    return v;
+}
+inline vec16 add16(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 8; ++i)
+        a.s16[i] = (int16_t)(a.s16[i] + b.s16[i]);
+    return a;
+}
+inline vec16 mul16(vec16 a, vec16 b)
+{
+    for (int32_t i = 0; i < 8; ++i)
+        a.s16[i] = (int16_t)(a.s16[i] * b.s16[i]);
+    return a;
+}
+template <int N>
+inline vec16 sra16(vec16 a)
+{
+    for (int32_t i = 0; i < 8; ++i)
+        a.s16[i] = (int16_t)(a.s16[i] >> N);
+    return a;
+}
+inline vec16 packus16(vec16 a, vec16 b)
+{
+    vec16 v;
+    for (int32_t i = 0; i < 8; ++i) {
+        v.u8[i] = (uint8_t)std::min(std::max((int32_t)a.s16[i], 0), 255);
+        v.u8[8 + i] = (uint8_t)std::min(std::max((int32_t)b.s16[i], 0), 255);
+    }
+    return v;
+}
+
+#endif
+
+//-----------------------------
+
+class BlockDecoderTables {
+public:
+    BlockDecoderTables()
+    {
+        // A row of 4 2-bit selectors is one byte in bc1 (and etc after reordering).
+        // Each pixel copies the 4 bytes of its palette color.
+        for (uint32_t row = 0; row < 256; ++row) {
+            for (uint32_t x = 0; x < 4; ++x) {
+                uint32_t selector = (row >> (2 * x)) & 3;
+                for (uint32_t i = 0; i < 4; ++i) {
+                    colorMasks[row][x * 4 + i] = (uint8_t)(selector * 4 + i);
+                }
+            }
+        }
+
+        // etc2comp stores r11 as v / 2047.0f, and then rounds that * 255.0f
+        for (int32_t v = 0; v < 2048; ++v) {
+            eac11To8[v] = (uint8_t)(int32_t)roundf((v / 2047.0f) * 255.0f);
+        }
+    }
+
+    alignas(16) uint8_t colorMasks[256][16];
+    uint8_t eac11To8[2048];
+};
+
+static const BlockDecoderTables gBlockDecoderTables;
+
+// bc4/eac alpha modifiers, and etc1 and T/H modifiers in etc2comp order
+static const int32_t kEACModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static const int32_t kETC1Modifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+static const int32_t kETC2Distances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+// Stores 4 pixels, fewer on the right edge of the image.
+inline void storeRow(Color* dst, vec16 row, int32_t numColumns)
+{
+    if (numColumns == 4) {
+        store16(dst, row);
+    }
+    else {
+        Color pixels[4];
+        store16(pixels, row);
+        memcpy(dst, pixels, numColumns * sizeof(Color));
+    }
+}
+
+// One lookup index per pixel from 4 3-bit selectors packed in 12 bits, shifted
+// into the channel byte that the pixel writes.  fill sets the other bytes.
+// The multiply shifts each lane left by a different amount, so that >> 9
+// moves selector x to the bottom of lane x.
+template <int Shift>
+inline vec16 selectorMask3(uint32_t row12, uint32_t fill)
+{
+    vec16 selectors = and16(shr32<9>(mul32(splat32(row12), set32(1 << 9, 1 << 6, 1 << 3, 1))), splat32(7));
+    return or16(shl32<Shift>(selectors), splat32(fill));
+}
+
+// Calls decodeGroup with 4 blocks at a time across a row of blocks.  The last
+// group is padded with zero blocks, and pixels past w are never stored.
+template <typename F>
+static void forEachBlockGroup(const uint8_t* srcBlocks, int32_t blockSize, int32_t numBlocksX, const F& decodeGroup)
+{
+    uint8_t paddedBlocks[4 * 16];
+
+    for (int32_t bx = 0; bx < numBlocksX; bx += 4) {
+        const uint8_t* blocks = srcBlocks + bx * blockSize;
+        int32_t numBlocks = std::min(4, numBlocksX - bx);
+
+        if (numBlocks < 4) {
+            memset(paddedBlocks, 0, sizeof(paddedBlocks));
+            memcpy(paddedBlocks, blocks, numBlocks * blockSize);
+            blocks = paddedBlocks;
+        }
+
+        decodeGroup(blocks, bx, numBlocks);
+    }
+}
+
+//-----------------------------
+// BC1-5, matches rgbcx with the default cBC1Ideal mode
+
+inline vec16 expand5(vec16 c) { return or16(shl32<3>(c), shr32<2>(c)); }
+inline vec16 expand6(vec16 c) { return or16(shl32<2>(c), shr32<4>(c)); }
+
+// exact x / 3, x / 5 and x / 7 as (x * m) >> 16 for the interpolation sums up to 7 * 255
+inline vec16 div3(vec16 x) { return shr32<16>(mul32(x, splat32(21846))); }
+inline vec16 div5(vec16 x) { return shr32<16>(mul32(x, splat32(13108))); }
+inline vec16 div7(vec16 x) { return shr32<16>(mul32(x, splat32(9363))); }
+
+inline vec16 mulConst(vec16 x, uint32_t c) { return mul32(x, splat32(c)); }
+
+inline vec16 packColors(vec16 r, vec16 g, vec16 b, vec16 a)
+{
+    return or16(or16(r, shl32<8>(g)), or16(shl32<16>(b), shl32<24>(a)));
+}
+
+// 4 color palettes for the bc1 blocks at blockSize apart.  Each block has a
+// lane until the final transpose.
+static void bc1Palettes(const uint8_t* blocks, int32_t blockSize, vec16 palettes[4])
+{
+    uint32_t endpoints[4];
+    for (int32_t i = 0; i < 4; ++i) {
+        memcpy(&endpoints[i], blocks + i * blockSize, sizeof(uint32_t));
+    }
+
+    vec16 e = set32(endpoints[0], endpoints[1], endpoints[2], endpoints[3]);
+    vec16 l = and16(e, splat32(0xFFFF));
+    vec16 h = shr32<16>(e);
+
+    vec16 mask5 = splat32(31);
+    vec16 mask6 = splat32(63);
+
+    vec16 r0 = expand5(shr32<11>(l));
+    vec16 g0 = expand6(and16(shr32<5>(l), mask6));
+    vec16 b0 = expand5(and16(l, mask5));
+
+    vec16 r1 = expand5(shr32<11>(h));
+    vec16 g1 = expand6(and16(shr32<5>(h), mask6));
+    vec16 b1 = expand5(and16(h, mask5));
+
+    // l > h is 4 colors, else 3 colors and transparent black
+    vec16 isFourColor = cmpgt32(l, h);
+
+    vec16 r2 = select16(isFourColor, div3(add32(add32(r0, r0), r1)), shr32<1>(add32(r0, r1)));
+    vec16 g2 = select16(isFourColor, div3(add32(add32(g0, g0), g1)), shr32<1>(add32(g0, g1)));
+    vec16 b2 = select16(isFourColor, div3(add32(add32(b0, b0), b1)), shr32<1>(add32(b0, b1)));
+
+    vec16 r3 = div3(add32(add32(r1, r1), r0));
+    vec16 g3 = div3(add32(add32(g1, g1), g0));
+    vec16 b3 = div3(add32(add32(b1, b1), b0));
+
+    vec16 a = splat32(255);
+
+    vec16 c0 = packColors(r0, g0, b0, a);
+    vec16 c1 = packColors(r1, g1, b1, a);
+    vec16 c2 = packColors(r2, g2, b2, a);
+    vec16 c3 = and16(isFourColor, packColors(r3, g3, b3, a));
+
+    transpose32(c0, c1, c2, c3);
+
+    palettes[0] = c0;
+    palettes[1] = c1;
+    palettes[2] = c2;
+    palettes[3] = c3;
+}
+
+// 8 value palettes for the bc4 blocks at blockSize apart, as 2 packed 32-bit lanes.
+static void bc4Palettes(const uint8_t* blocks, int32_t blockSize, vec16& palettesLo, vec16& palettesHi)
+{
+    vec16 l = set32(blocks[0], blocks[blockSize], blocks[2 * blockSize], blocks[3 * blockSize]);
+    vec16 h = set32(blocks[1], blocks[blockSize + 1], blocks[2 * blockSize + 1], blocks[3 * blockSize + 1]);
+
+    // l > h interpolates 6 values, else 4 values and 0, 255
+    vec16 isEightValue = cmpgt32(l, h);
+
+    vec16 v2 = select16(isEightValue, div7(add32(mulConst(l, 6), h)), div5(add32(mulConst(l, 4), h)));
+    vec16 v3 = select16(isEightValue, div7(add32(mulConst(l, 5), mulConst(h, 2))), div5(add32(mulConst(l, 3), mulConst(h, 2))));
+    vec16 v4 = select16(isEightValue, div7(add32(mulConst(l, 4), mulConst(h, 3))), div5(add32(mulConst(l, 2), mulConst(h, 3))));
+    vec16 v5 = select16(isEightValue, div7(add32(mulConst(l, 3), mulConst(h, 4))), div5(add32(l, mulConst(h, 4))));
+    vec16 v6 = and16(isEightValue, div7(add32(mulConst(l, 2), mulConst(h, 5))));
+    vec16 v7 = select16(isEightValue, div7(add32(l, mulConst(h, 6))), splat32(255));
+
+    palettesLo = packColors(l, h, v2, v3);
+    palettesHi = packColors(v4, v5, v6, v7);
+}
+
+// Snorm bc4/bc5 endpoints are offset by 128, this copies the group with
+// unorm endpoints so the source isn't modified.
+static const uint8_t* remapSignedBlocks(const uint8_t* blocks, int32_t blockSize, uint8_t* remappedBlocks)
+{
+    memcpy(remappedBlocks, blocks, 4 * blockSize);
+    for (int32_t i = 0; i < 4 * blockSize; i += 8) {
+        remappedBlocks[i] ^= 0x80;
+        remappedBlocks[i + 1] ^= 0x80;
+    }
+    return remappedBlocks;
+}
+
+// 48 bits of 3-bit selectors after the 2 endpoints, a row is 12 bits
+inline uint64_t bc4SelectorBits(const uint8_t* block)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, block + 2, 6);
+    return bits;
+}
+
+static void decodeBC1BlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+
+    forEachBlockGroup(srcBlocks, 8, numBlocksX, [&](const uint8_t* blocks, int32_t bx, int32_t numBlocks) {
+        vec16 palettes[4];
+        bc1Palettes(blocks, 8, palettes);
+
+        for (int32_t i = 0; i < numBlocks; ++i) {
+            const uint8_t* block = blocks + i * 8;
+            int32_t x = (bx + i) * 4;
+            int32_t numColumns = std::min(4, w - x);
+
+            for (int32_t y = 0; y < numRows; ++y) {
+                vec16 row = lookup16(palettes[i], load16(gBlockDecoderTables.colorMasks[block[4 + y]]));
+                storeRow(dstRow + y * w + x, row, numColumns);
+            }
+        }
+    });
+}
+
+static void decodeBC3BlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+
+    vec16 rgbMask = splat32(0x00FFFFFF);
+
+    forEachBlockGroup(srcBlocks, 16, numBlocksX, [&](const uint8_t* blocks, int32_t bx, int32_t numBlocks) {
+        vec16 palettes[4];
+        bc1Palettes(blocks + 8, 16, palettes);
+
+        vec16 alphaLo, alphaHi, unused0 = splat32(0), unused1 = splat32(0);
+        bc4Palettes(blocks, 16, alphaLo, alphaHi);
+        transpose32(alphaLo, alphaHi, unused0, unused1);
+        vec16 alphaPalettes[4] = {alphaLo, alphaHi, unused0, unused1};
+
+        for (int32_t i = 0; i < numBlocks; ++i) {
+            const uint8_t* block = blocks + i * 16;
+            int32_t x = (bx + i) * 4;
+            int32_t numColumns = std::min(4, w - x);
+
+            uint64_t alphaBits = bc4SelectorBits(block);
+
+            for (int32_t y = 0; y < numRows; ++y) {
+                vec16 row = lookup16(palettes[i], load16(gBlockDecoderTables.colorMasks[block[8 + 4 + y]]));
+                vec16 alpha = lookup16(alphaPalettes[i], selectorMask3<24>((uint32_t)(alphaBits >> (12 * y)), 0x00808080));
+                storeRow(dstRow + y * w + x, or16(and16(row, rgbMask), alpha), numColumns);
+            }
+        }
+    });
+}
+
+static void decodeBC4BlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow, bool isSigned)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+
+    // gb = 0, a = 255
+    vec16 alpha = splat32(0xFF000000);
+
+    forEachBlockGroup(srcBlocks, 8, numBlocksX, [&](const uint8_t* blocks, int32_t bx, int32_t numBlocks) {
+        uint8_t remappedBlocks[4 * 8];
+        if (isSigned) {
+            blocks = remapSignedBlocks(blocks, 8, remappedBlocks);
+        }
+
+        vec16 lo, hi, unused0 = splat32(0), unused1 = splat32(0);
+        bc4Palettes(blocks, 8, lo, hi);
+        transpose32(lo, hi, unused0, unused1);
+        vec16 palettes[4] = {lo, hi, unused0, unused1};
+
+        for (int32_t i = 0; i < numBlocks; ++i) {
+            const uint8_t* block = blocks + i * 8;
+            int32_t x = (bx + i) * 4;
+            int32_t numColumns = std::min(4, w - x);
+
+            uint64_t bits = bc4SelectorBits(block);
+
+            for (int32_t y = 0; y < numRows; ++y) {
+                vec16 row = lookup16(palettes[i], selectorMask3<0>((uint32_t)(bits >> (12 * y)), 0x80808000));
+                storeRow(dstRow + y * w + x, or16(row, alpha), numColumns);
+            }
+        }
+    });
+}
+
+static void decodeBC5BlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow, bool isSigned)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+
+    // b = 0, a = 255
+    vec16 alpha = splat32(0xFF000000);
+
+    forEachBlockGroup(srcBlocks, 16, numBlocksX, [&](const uint8_t* blocks, int32_t bx, int32_t numBlocks) {
+        uint8_t remappedBlocks[4 * 16];
+        if (isSigned) {
+            blocks = remapSignedBlocks(blocks, 16, remappedBlocks);
+        }
+
+        // transposes to the r palette in bytes 0-7, and g in 8-15 of each block
+        vec16 redLo, redHi, greenLo, greenHi;
+        bc4Palettes(blocks, 16, redLo, redHi);
+        bc4Palettes(blocks + 8, 16, greenLo, greenHi);
+        transpose32(redLo, redHi, greenLo, greenHi);
+        vec16 palettes[4] = {redLo, redHi, greenLo, greenHi};
+
+        for (int32_t i = 0; i < numBlocks; ++i) {
+            const uint8_t* block = blocks + i * 16;
+            int32_t x = (bx + i) * 4;
+            int32_t numColumns = std::min(4, w - x);
+
+            uint64_t redBits = bc4SelectorBits(block);
+            uint64_t greenBits = bc4SelectorBits(block + 8);
+
+            for (int32_t y = 0; y < numRows; ++y) {
+                vec16 mask = or16(selectorMask3<0>((uint32_t)(redBits >> (12 * y)), 0x80800000),
+                                  selectorMask3<8>((uint32_t)(greenBits >> (12 * y)), 0x00000800));
+                vec16 row = lookup16(palettes[i], mask);
+                storeRow(dstRow + y * w + x, or16(row, alpha), numColumns);
+            }
+        }
+    });
+}
+
+//-----------------------------
+// ETC2 and EAC, matches etc2comp.  The modes are parsed per block, and then
+// rows are palette lookups like bc.  Selectors are stored by column.
+
+// EAC 8 value palette as 2 packed 32-bit values.  r11 values are clamped to
+// 11 bits and then rounded to 8 bits, alpha is clamped to 8 bits.
+static void eacPalette(const uint8_t* block, bool isR11, bool isSigned, uint32_t& paletteLo, uint32_t& paletteHi)
+{
+    int32_t base = block[0];
+    int32_t multiplier = block[1] >> 4;
+    const int32_t* modifiers = kEACModifiers[block[1] & 15];
+
+    if (isSigned) {
+        base ^= 0x80;
+    }
+
+    uint8_t values[8];
+    if (isR11) {
+        int32_t base11 = base * 8 + 4;
+        int32_t multiplier11 = (multiplier == 0) ? 1 : (multiplier * 8);
+
+        for (int32_t i = 0; i < 8; ++i) {
+            int32_t value = std::min(std::max(base11 + modifiers[i] * multiplier11, 0), 2047);
+            values[i] = gBlockDecoderTables.eac11To8[value];
+        }
+    }
+    else {
+        for (int32_t i = 0; i < 8; ++i) {
+            values[i] = (uint8_t)std::min(std::max(base + modifiers[i] * multiplier, 0), 255);
+        }
+    }
+
+    memcpy(&paletteLo, values, 4);
+    memcpy(&paletteHi, values + 4, 4);
+}
+
+inline uint64_t eacSelectorBits(const uint8_t* block)
+{
+    uint64_t bits = 0;
+    for (int32_t i = 2; i < 8; ++i) {
+        bits = (bits << 8) | block[i];
+    }
+    return bits;
+}
+
+// 4 3-bit selectors of row y in the 12 bit order of selectorMask3
+inline uint32_t eacRowSelectors(uint64_t bits, int32_t y)
+{
+    uint32_t row12 = 0;
+    for (int32_t x = 0; x < 4; ++x) {
+        int32_t pixel = x * 4 + y;
+        row12 |= (uint32_t)((bits >> (45 - 3 * pixel)) & 7) << (3 * x);
+    }
+    return row12;
+}
+
+inline uint32_t expand4(uint32_t c) { return (c << 4) | c; }
+inline uint32_t expandBits5(uint32_t c) { return (c << 3) | (c >> 2); }
+inline uint32_t expandBits6(uint32_t c) { return (c << 2) | (c >> 4); }
+inline uint32_t expandBits7(uint32_t c) { return (c << 1) | (c >> 6); }
+
+inline uint32_t packColor(uint32_t r, uint32_t g, uint32_t b)
+{
+    return r | (g << 8) | (b << 16) | 0xFF000000;
+}
+
+// 4 palette colors from base colors and modifiers added to rgb, clamped to 8 bits
+inline vec16 etcPalette(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3,
+                        int32_t m0, int32_t m1, int32_t m2, int32_t m3)
+{
+    vec16 colors = set32(c0, c1, c2, c3);
+
+    vec16 lo = add16(widenLo8to16(colors), set16(m0, m0, m0, 0, m1, m1, m1, 0));
+    vec16 hi = add16(widenHi8to16(colors), set16(m2, m2, m2, 0, m3, m3, m3, 0));
+    return packus16(lo, hi);
+}
+
+// Spread the 4 bits of one selector plane for row y to the even bits of a
+// bc1 style selector byte.  Pixel (x, y) is bit x * 4 + y.
+inline uint32_t etcRowSelectorBits(uint32_t bits16, int32_t y)
+{
+    // gathers bits 0, 4, 8, 12 to bits 9-12, the products don't overlap
+    uint32_t nibble = ((((bits16 >> y) & 0x1111) * 0x249) >> 9) & 15;
+    return (nibble & 1) | ((nibble & 2) << 1) | ((nibble & 4) << 2) | ((nibble & 8) << 3);
+}
+
+// Decodes the rgb of an ETC2 block into 4 rows with a = 255.
+static void decodeETC2ColorRows(const uint8_t* block, vec16 rows[4])
+{
+    uint32_t b0 = block[0];
+    uint32_t b1 = block[1];
+    uint32_t b2 = block[2];
+    uint32_t b3 = block[3];
+
+    bool isDifferential = (b3 & 2) != 0;
+    bool isFlipped = (b3 & 1) != 0;
+
+    // 0 = etc1, 1 = T or H
+    int32_t mode = 0;
+
+    uint32_t c0 = 0, c1 = 0;
+    vec16 palette0, palette1;
+
+    if (isDifferential) {
+        // 3-bit signed deltas, and out of range sums select the etc2 modes
+        int32_t r = b0 >> 3, dr = (int32_t)((b0 & 7) ^ 4) - 4;
+        int32_t g = b1 >> 3, dg = (int32_t)((b1 & 7) ^ 4) - 4;
+        int32_t b = b2 >> 3, db = (int32_t)((b2 & 7) ^ 4) - 4;
+
+        if (r + dr < 0 || r + dr > 31) {
+            // T mode
+            uint32_t r1 = expand4(((b0 >> 1) & 0xC) | (b0 & 3));
+            uint32_t g1 = expand4(b1 >> 4);
+            uint32_t bl1 = expand4(b1 & 15);
+            uint32_t r2 = expand4(b2 >> 4);
+            uint32_t g2 = expand4(b2 & 15);
+            uint32_t bl2 = expand4(b3 >> 4);
+
+            int32_t d = kETC2Distances[((b3 >> 1) & 6) | (b3 & 1)];
+
+            uint32_t color1 = packColor(r1, g1, bl1);
+            uint32_t color2 = packColor(r2, g2, bl2);
+            palette0 = etcPalette(color1, color2, color2, color2, 0, d, 0, -d);
+            mode = 1;
+        }
+        else if (g + dg < 0 || g + dg > 31) {
+            // H mode
+            uint32_t r1 = (b0 >> 3) & 15;
+            uint32_t g1 = ((b0 & 7) << 1) | ((b1 >> 4) & 1);
+            uint32_t bl1 = (b1 & 8) | ((b1 & 3) << 1) | (b2 >> 7);
+            uint32_t r2 = (b2 >> 3) & 15;
+            uint32_t g2 = ((b2 & 7) << 1) | (b3 >> 7);
+            uint32_t bl2 = (b3 >> 3) & 15;
+
+            // the low bit of the distance is from the color order
+            uint32_t rgb1 = (r1 << 8) | (g1 << 4) | bl1;
+            uint32_t rgb2 = (r2 << 8) | (g2 << 4) | bl2;
+            int32_t d = kETC2Distances[(b3 & 4) | ((b3 & 1) << 1) | (rgb1 >= rgb2 ? 1 : 0)];
+
+            uint32_t color1 = packColor(expand4(r1), expand4(g1), expand4(bl1));
+            uint32_t color2 = packColor(expand4(r2), expand4(g2), expand4(bl2));
+            palette0 = etcPalette(color1, color1, color2, color2, d, -d, d, -d);
+            mode = 1;
+        }
+        else if (b + db < 0 || b + db > 31) {
+            // planar mode, 3 colors are interpolated to each pixel
+            uint32_t b4 = block[4];
+            uint32_t b5 = block[5];
+            uint32_t b6 = block[6];
+            uint32_t b7 = block[7];
+
+            int32_t ro = expandBits6((b0 >> 1) & 63);
+            int32_t go = expandBits7(((b0 & 1) << 6) | ((b1 >> 1) & 63));
+            int32_t bo = expandBits6(((b1 & 1) << 5) | (b2 & 0x18) | ((b2 & 3) << 1) | (b3 >> 7));
+
+            int32_t rh = expandBits6(((b3 >> 1) & 0x3E) | (b3 & 1));
+            int32_t gh = expandBits7(b4 >> 1);
+            int32_t bh = expandBits6(((b4 & 1) << 5) | (b5 >> 3));
+
+            int32_t rv = expandBits6(((b5 & 7) << 3) | (b6 >> 5));
+            int32_t gv = expandBits7(((b6 & 31) << 2) | (b7 >> 6));
+            int32_t bv = expandBits6(b7 & 63);
+
+            // (x * (h - o) + y * (v - o) + 4 * o + 2) >> 2, 2 pixels per register.
+            // Alpha has o = h = v = 255, so it's 255.
+            vec16 dh = set16(rh - ro, gh - go, bh - bo, 0, rh - ro, gh - go, bh - bo, 0);
+            vec16 dv = set16(rv - ro, gv - go, bv - bo, 0, rv - ro, gv - go, bv - bo, 0);
+            vec16 origin = set16(4 * ro + 2, 4 * go + 2, 4 * bo + 2, 4 * 255 + 2,
+                                 4 * ro + 2, 4 * go + 2, 4 * bo + 2, 4 * 255 + 2);
+
+            vec16 x01 = mul16(dh, set16(0, 0, 0, 0, 1, 1, 1, 1));
+            vec16 x23 = mul16(dh, set16(2, 2, 2, 2, 3, 3, 3, 3));
+
+            for (int32_t y = 0; y < 4; ++y) {
+                vec16 rowOrigin = add16(origin, mul16(dv, set16(y, y, y, y, y, y, y, y)));
+                rows[y] = packus16(sra16<2>(add16(rowOrigin, x01)), sra16<2>(add16(rowOrigin, x23)));
+            }
+            return;
+        }
+        else {
+            c0 = packColor(expandBits5(r), expandBits5(g), expandBits5(b));
+            c1 = packColor(expandBits5(r + dr), expandBits5(g + dg), expandBits5(b + db));
+        }
+    }
+    else {
+        c0 = packColor(expand4(b0 >> 4), expand4(b1 >> 4), expand4(b2 >> 4));
+        c1 = packColor(expand4(b0 & 15), expand4(b1 & 15), expand4(b2 & 15));
+    }
+
+    if (mode == 0) {
+        const int32_t* m0 = kETC1Modifiers[b3 >> 5];
+        const int32_t* m1 = kETC1Modifiers[(b3 >> 2) & 7];
+
+        palette0 = etcPalette(c0, c0, c0, c0, m0[0], m0[1], -m0[0], -m0[1]);
+        palette1 = etcPalette(c1, c1, c1, c1, m1[0], m1[1], -m1[0], -m1[1]);
+    }
+
+    uint32_t msb = ((uint32_t)block[4] << 8) | block[5];
+    uint32_t lsb = ((uint32_t)block[6] << 8) | block[7];
+
+    // Each pixel selects from the palette of its subblock.  Unflipped subblocks
+    // are 2 columns, and flipped are 2 rows.  Hide the other pixels of each lookup.
+    vec16 none = splat32(0);
+    vec16 all = splat32(0x80808080);
+    vec16 left = set32(0, 0, 0x80808080, 0x80808080);
+    vec16 right = set32(0x80808080, 0x80808080, 0, 0);
+
+    for (int32_t y = 0; y < 4; ++y) {
+        uint32_t selectors = etcRowSelectorBits(lsb, y) | (etcRowSelectorBits(msb, y) << 1);
+        vec16 mask = load16(gBlockDecoderTables.colorMasks[selectors]);
+
+        if (mode == 1) {
+            rows[y] = lookup16(palette0, mask);
+        }
+        else {
+            vec16 hide0, hide1;
+            if (isFlipped) {
+                hide0 = (y < 2) ? none : all;
+                hide1 = (y < 2) ? all : none;
+            }
+            else {
+                hide0 = left;
+                hide1 = right;
+            }
+
+            rows[y] = or16(lookup16(palette0, or16(mask, hide0)), lookup16(palette1, or16(mask, hide1)));
+        }
+    }
+}
+
+static void decodeETC2BlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow, bool hasAlpha)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+    int32_t blockSize = hasAlpha ? 16 : 8;
+
+    vec16 rgbMask = splat32(0x00FFFFFF);
+
+    for (int32_t bx = 0; bx < numBlocksX; ++bx) {
+        const uint8_t* block = srcBlocks + bx * blockSize;
+        int32_t x = bx * 4;
+        int32_t numColumns = std::min(4, w - x);
+
+        vec16 rows[4];
+        decodeETC2ColorRows(hasAlpha ? block + 8 : block, rows);
+
+        if (hasAlpha) {
+            uint32_t lo, hi;
+            eacPalette(block, false, false, lo, hi);
+            vec16 palette = set32(lo, hi, 0, 0);
+
+            uint64_t bits = eacSelectorBits(block);
+
+            for (int32_t y = 0; y < numRows; ++y) {
+                vec16 alpha = lookup16(palette, selectorMask3<24>(eacRowSelectors(bits, y), 0x00808080));
+                rows[y] = or16(and16(rows[y], rgbMask), alpha);
+            }
+        }
+
+        for (int32_t y = 0; y < numRows; ++y) {
+            storeRow(dstRow + y * w + x, rows[y], numColumns);
+        }
+    }
+}
+
+static void decodeEACBlockRow(const uint8_t* srcBlocks, int32_t w, int32_t numRows, Color* dstRow, bool isRG, bool isSigned)
+{
+    int32_t numBlocksX = (w + 3) / 4;
+    int32_t blockSize = isRG ? 16 : 8;
+
+    // r11 is r001, rg11 is rg01
+    vec16 alpha = splat32(0xFF000000);
+
+    for (int32_t bx = 0; bx < numBlocksX; ++bx) {
+        const uint8_t* block = srcBlocks + bx * blockSize;
+        int32_t x = bx * 4;
+        int32_t numColumns = std::min(4, w - x);
+
+        uint32_t redLo, redHi, greenLo = 0, greenHi = 0;
+        eacPalette(block, true, isSigned, redLo, redHi);
+
+        uint64_t redBits = eacSelectorBits(block);
+        uint64_t greenBits = 0;
+        if (isRG) {
+            eacPalette(block + 8, true, isSigned, greenLo, greenHi);
+            greenBits = eacSelectorBits(block + 8);
+        }
+
+        vec16 palette = set32(redLo, redHi, greenLo, greenHi);
+
+        for (int32_t y = 0; y < numRows; ++y) {
+            vec16 mask;
+            if (isRG) {
+                mask = or16(selectorMask3<0>(eacRowSelectors(redBits, y), 0x80800000),
+                            selectorMask3<8>(eacRowSelectors(greenBits, y), 0x00000800));
+            }
+            else {
+                mask = selectorMask3<0>(eacRowSelectors(redBits, y), 0x80808000);
+            }
+
+            storeRow(dstRow + y * w + x, or16(lookup16(palette, mask), alpha), numColumns);
+        }
+    }
+}
+
+//-----------------------------
+
+bool isBlockRowDecoderFormat(MyMTLPixelFormat format)
+{
+    switch (format) {
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+        case MyMTLPixelFormatBC3_RGBA:
+        case MyMTLPixelFormatBC3_RGBA_sRGB:
+        case MyMTLPixelFormatBC4_RUnorm:
+        case MyMTLPixelFormatBC4_RSnorm:
+        case MyMTLPixelFormatBC5_RGUnorm:
+        case MyMTLPixelFormatBC5_RGSnorm:
+
+        case MyMTLPixelFormatETC2_RGB8:
+        case MyMTLPixelFormatETC2_RGB8_sRGB:
+        case MyMTLPixelFormatEAC_RGBA8:
+        case MyMTLPixelFormatEAC_RGBA8_sRGB:
+        case MyMTLPixelFormatEAC_R11Unorm:
+        case MyMTLPixelFormatEAC_R11Snorm:
+        case MyMTLPixelFormatEAC_RG11Unorm:
+        case MyMTLPixelFormatEAC_RG11Snorm:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool decodeBlockRows(MyMTLPixelFormat format, const uint8_t* srcBlocks,
+                     int32_t w, int32_t h, int32_t blockRowStart, int32_t blockRowEnd,
+                     Color* dstPixels)
+{
+    if (!isBlockRowDecoderFormat(format)) {
+        return false;
+    }
+
+    const int32_t blockDim = 4;
+    int32_t numBlocksX = (w + blockDim - 1) / blockDim;
+    int32_t blockSize = blockSizeOfFormat(format);
+
+    for (int32_t by = blockRowStart; by < blockRowEnd; ++by) {
+        const uint8_t* blocks = srcBlocks + by * numBlocksX * blockSize;
+        int32_t y = by * blockDim;
+        int32_t numRows = std::min(blockDim, h - y);
+        Color* dstRow = dstPixels + y * w;
+
+        switch (format) {
+            case MyMTLPixelFormatBC1_RGBA:
+            case MyMTLPixelFormatBC1_RGBA_sRGB:
+                decodeBC1BlockRow(blocks, w, numRows, dstRow);
+                break;
+            case MyMTLPixelFormatBC3_RGBA:
+            case MyMTLPixelFormatBC3_RGBA_sRGB:
+                decodeBC3BlockRow(blocks, w, numRows, dstRow);
+                break;
+            case MyMTLPixelFormatBC4_RUnorm:
+            case MyMTLPixelFormatBC4_RSnorm:
+                decodeBC4BlockRow(blocks, w, numRows, dstRow, format == MyMTLPixelFormatBC4_RSnorm);
+                break;
+            case MyMTLPixelFormatBC5_RGUnorm:
+            case MyMTLPixelFormatBC5_RGSnorm:
+                decodeBC5BlockRow(blocks, w, numRows, dstRow, format == MyMTLPixelFormatBC5_RGSnorm);
+                break;
+
+            case MyMTLPixelFormatETC2_RGB8:
+            case MyMTLPixelFormatETC2_RGB8_sRGB:
+                decodeETC2BlockRow(blocks, w, numRows, dstRow, false);
+                break;
+            case MyMTLPixelFormatEAC_RGBA8:
+            case MyMTLPixelFormatEAC_RGBA8_sRGB:
+                decodeETC2BlockRow(blocks, w, numRows, dstRow, true);
+                break;
+            case MyMTLPixelFormatEAC_R11Unorm:
+            case MyMTLPixelFormatEAC_R11Snorm:
+                decodeEACBlockRow(blocks, w, numRows, dstRow, false, format == MyMTLPixelFormatEAC_R11Snorm);
+                break;
+            case MyMTLPixelFormatEAC_RG11Unorm:
+            case MyMTLPixelFormatEAC_RG11Snorm:
+                decodeEACBlockRow(blocks, w, numRows, dstRow, true, format == MyMTLPixelFormatEAC_RG11Snorm);
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace kram
@@ -0,0 +1,31 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+#include <cstdint>
+
+//#include "KramConfig.h"
+#include "KTXImage.h" // for MyMTLPixelFormat
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+struct Color;
+
+// Whether decodeBlockRows handles the format.  These are the palette formats
+// with 4x4 blocks: BC1/3/4/5 and ETC2 rgb/rgba and EAC r11/rg11.
+bool isBlockRowDecoderFormat(MyMTLPixelFormat format);
+
+// Decodes block rows [blockRowStart, blockRowEnd) of a w x h image straight into
+// dstPixels, which is the whole w x h image.  Palettes are built with simd for
+// several blocks at once, and each row of 4 pixels is one table lookup and store.
+// Output is bit-exact with the rgbcx and etc2comp decoders, including the 0001
+// fill of the channels a format doesn't have.  Returns false if the format isn't
+// supported.  Snorm endpoints are remapped on the fly, srcBlocks isn't modified.
+bool decodeBlockRows(MyMTLPixelFormat format, const uint8_t* srcBlocks,
+                     int32_t w, int32_t h, int32_t blockRowStart, int32_t blockRowEnd,
+                     Color* dstPixels);
+
+} // namespace kram
@@ -0,0 +1,358 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramEncodeCache.h"
+
+#include <stdio.h>
+
+#include <filesystem>
+#include <mutex>
+
+#if KRAM_WIN
+#include <process.h> // for _getpid()
+#define getpid() _getpid()
+#else
+#include <unistd.h> // for getpid()
+#endif
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+namespace fs = std::filesystem;
+
+// tmp files older than this are left from a crashed process
+static const auto kStaleTmpAge = std::chrono::hours(1);
+
+// eviction lock older than this is left from a crashed process
+static const auto kStaleLockAge = std::chrono::minutes(1);
+
+// Other processes add to the dir too, so the size estimate is
+// resynced with a scan after this many inserts.
+static const uint32_t kRescanInterval = 64;
+
+// Inserts in this process keep a running size of each cache dir, so a script
+// of encodes doesn't scan the dir on every insert, only once it's over maxSize.
+struct CacheDirUsage {
+    uint64_t size = 0;
+    uint32_t numInserts = 0;
+    bool isScanned = false;
+};
+
+static std::mutex gCacheDirUsageLock;
+static unordered_map<string, CacheDirUsage> gCacheDirUsage;
+
+static const uint64_t kXXPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kXXPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kXXPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kXXPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kXXPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int32_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value; // little endian
+}
+
+static inline uint32_t read32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxhashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * kXXPrime2;
+    acc = rotl64(acc, 31);
+    return acc * kXXPrime1;
+}
+
+static inline uint64_t xxhashMergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= xxhashRound(0, value);
+    return acc * kXXPrime1 + kXXPrime4;
+}
+
+// zstd only bundles this privately, so it's repeated here
+uint64_t xxhash64(const uint8_t* data, size_t dataSize, uint64_t seed)
+{
+    const uint8_t* end = data + dataSize;
+    uint64_t hash;
+
+    if (dataSize >= 32) {
+        uint64_t v1 = seed + kXXPrime1 + kXXPrime2;
+        uint64_t v2 = seed + kXXPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kXXPrime1;
+
+        const uint8_t* limit = end - 32;
+        do {
+            v1 = xxhashRound(v1, read64(data));
+            v2 = xxhashRound(v2, read64(data + 8));
+            v3 = xxhashRound(v3, read64(data + 16));
+            v4 = xxhashRound(v4, read64(data + 24));
+            data += 32;
+        } while (data <= limit);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxhashMergeRound(hash, v1);
+        hash = xxhashMergeRound(hash, v2);
+        hash = xxhashMergeRound(hash, v3);
+        hash = xxhashMergeRound(hash, v4);
+    }
+    else {
+        hash = seed + kXXPrime5;
+    }
+
+    hash += (uint64_t)dataSize;
+
+    for (; data + 8 <= end; data += 8) {
+        hash ^= xxhashRound(0, read64(data));
+        hash = rotl64(hash, 27) * kXXPrime1 + kXXPrime4;
+    }
+    if (data + 4 <= end) {
+        hash ^= (uint64_t)read32(data) * kXXPrime1;
+        hash = rotl64(hash, 23) * kXXPrime2 + kXXPrime3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        hash ^= (*data) * kXXPrime5;
+        hash = rotl64(hash, 11) * kXXPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kXXPrime2;
+    hash ^= hash >> 29;
+    hash *= kXXPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static bool endsWith(const string& str, const char* suffix)
+{
+    size_t suffixLength = strlen(suffix);
+    return str.size() >= suffixLength &&
+           strcmp(str.c_str() + str.size() - suffixLength, suffix) == 0;
+}
+
+// Unique across processes and threads, so tmp files never collide.
+static string uniqueTmpSuffix()
+{
+    static std::atomic<uint32_t> counter(0);
+
+    string suffix;
+    sprintf(suffix, ".%d.%u.tmp", (int32_t)getpid(), counter++);
+    return suffix;
+}
+
+bool EncodeCache::open(const char* cacheDir, uint64_t maxSize)
+{
+    _cacheDir.clear();
+
+    std::error_code ec;
+    fs::create_directories(cacheDir, ec);
+    if (!fs::is_directory(cacheDir, ec)) {
+        KLOGE("EncodeCache", "couldn't create cache dir %s", cacheDir);
+        return false;
+    }
+
+    _cacheDir = cacheDir;
+    _maxSize = maxSize;
+    return true;
+}
+
+string EncodeCache::entryFilename(const string& key, const char* ext) const
+{
+    string filename = _cacheDir;
+    filename += '/';
+    filename += key;
+    filename += ext;
+    return filename;
+}
+
+bool EncodeCache::fetch(const string& key, const char* ext, const char* dstFilename)
+{
+    if (!isOpen())
+        return false;
+
+    string entry = entryFilename(key, ext);
+
+    std::error_code ec;
+    if (!fs::is_regular_file(entry, ec))
+        return false;
+
+    // touch for lru, no output shares the entry file so this only changes the entry
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+
+    fs::path parentPath = fs::path(dstFilename).parent_path();
+    if (!parentPath.empty()) {
+        fs::create_directories(parentPath, ec);
+    }
+
+    // Stage a copy next to dst, so the rename replaces dst in one step.  This
+    // copies like insert, since a hardlink would let an in-place edit of the
+    // output change the entry.  The entry may be evicted at any point, and
+    // then this is just a miss.
+    string tmpFilename = dstFilename;
+    tmpFilename += uniqueTmpSuffix();
+
+    fs::copy_file(entry, tmpFilename, fs::copy_options::overwrite_existing, ec);
+
+    if (!ec) {
+        fs::rename(tmpFilename, dstFilename, ec);
+    }
+
+    // the tmp file is left if the copy or rename failed
+    std::error_code removeEc;
+    fs::remove(tmpFilename, removeEc);
+
+    return !ec;
+}
+
+bool EncodeCache::insert(const string& key, const char* ext, const char* srcFilename)
+{
+    if (!isOpen())
+        return false;
+
+    string entry = entryFilename(key, ext);
+    string tmpFilename = entry;
+    tmpFilename += uniqueTmpSuffix();
+
+    // Copy rather than link the output, so later writes to it can't change
+    // the entry.  Rename is atomic, so a reader sees no entry or all of it.
+    // Racing inserts of a key have the same content, and the last one wins.
+    std::error_code ec;
+    fs::copy_file(srcFilename, tmpFilename, fs::copy_options::overwrite_existing, ec);
+    if (!ec) {
+        fs::rename(tmpFilename, entry, ec);
+    }
+
+    if (ec) {
+        std::error_code removeEc;
+        fs::remove(tmpFilename, removeEc);
+        KLOGW("EncodeCache", "couldn't insert %s", entry.c_str());
+        return false;
+    }
+
+    // a replaced entry is counted twice, but that only rescans sooner
+    uint64_t entrySize = fs::file_size(entry, ec);
+    if (ec) {
+        entrySize = 0;
+    }
+
+    bool isEvicting = false;
+    {
+        lock_guard<std::mutex> lock(gCacheDirUsageLock);
+        CacheDirUsage& usage = gCacheDirUsage[_cacheDir];
+        usage.size += entrySize;
+        usage.numInserts++;
+
+        isEvicting = !usage.isScanned || usage.size > _maxSize ||
+                     (usage.numInserts % kRescanInterval) == 0;
+    }
+
+    if (isEvicting) {
+        evict();
+    }
+    return true;
+}
+
+void EncodeCache::evict()
+{
+    if (!isOpen())
+        return;
+
+    std::error_code ec;
+    auto now = fs::file_time_type::clock::now();
+
+    // "x" fails if the lock exists, so only one process evicts at a time.
+    // Others skip eviction, since the lock holder trims the dir anyways.
+    string lockFilename = _cacheDir + "/.evict.lock";
+    FILE* lockFile = fopen(lockFilename.c_str(), "wx");
+    if (!lockFile) {
+        auto lockTime = fs::last_write_time(lockFilename, ec);
+        if (!ec && (now - lockTime) > kStaleLockAge) {
+            fs::remove(lockFilename, ec);
+        }
+        return;
+    }
+    fclose(lockFile);
+
+    struct CacheEntry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type time;
+    };
+
+    vector<CacheEntry> entries;
+    uint64_t totalSize = 0;
+
+    for (fs::directory_iterator it(_cacheDir, ec), itEnd; !ec && it != itEnd; it.increment(ec)) {
+        const fs::directory_entry& dirEntry = *it;
+
+        std::error_code entryEc;
+        if (!dirEntry.is_regular_file(entryEc))
+            continue;
+
+        string filename = dirEntry.path().filename().string();
+        if (filename.empty() || filename[0] == '.')
+            continue;
+
+        CacheEntry entry;
+        entry.path = dirEntry.path();
+        entry.size = dirEntry.file_size(entryEc);
+        if (entryEc)
+            continue;
+        entry.time = dirEntry.last_write_time(entryEc);
+        if (entryEc)
+            continue;
+
+        // in-flight inserts are skipped, crashed ones are cleaned up
+        if (endsWith(filename, ".tmp")) {
+            if ((now - entry.time) > kStaleTmpAge) {
+                fs::remove(entry.path, entryEc);
+            }
+            continue;
+        }
+
+        entries.push_back(entry);
+        totalSize += entry.size;
+    }
+
+    if (totalSize > _maxSize) {
+        uint64_t targetSize = _maxSize - _maxSize / 10;
+
+        std::sort(entries.begin(), entries.end(), [](const CacheEntry& lhs, const CacheEntry& rhs) {
+            return lhs.time < rhs.time;
+        });
+
+        // A reader that already opened or linked an entry keeps its copy.
+        for (const CacheEntry& entry : entries) {
+            if (totalSize <= targetSize)
+                break;
+
+            std::error_code removeEc;
+            if (fs::remove(entry.path, removeEc)) {
+                totalSize -= entry.size;
+            }
+        }
+    }
+
+    {
+        lock_guard<std::mutex> lock(gCacheDirUsageLock);
+        CacheDirUsage& usage = gCacheDirUsage[_cacheDir];
+        usage.size = totalSize;
+        usage.isScanned = true;
+    }
+
+    fs::remove(lockFilename, ec);
+}
+
+} // namespace kram
@@ -0,0 +1,56 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+#include <stdint.h>
+
+//#include <string>
+
+//#include "KramConfig.h"
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+// 64-bit xxHash (XXH64) of data.  Chain calls by passing the last hash as the seed.
+// Cache keys hash with two seeds, for 128 bits.
+uint64_t xxhash64(const uint8_t* data, size_t dataSize, uint64_t seed);
+
+// Content-addressed cache of encoded files in a local directory.  The key is
+// a hash of the src bytes, encode args and kram version, so identical encodes
+// across builds, branches and scripts are a file copy instead of an encode.
+//
+// Entries are only ever added by renaming a completed tmp file into the
+// cache, and a hit touches the entry mod stamp.  Eviction removes the
+// least recently used entries once the dir exceeds maxSize.  Any number of
+// kram processes can share one dir, a lost race just looks like a miss.
+class EncodeCache {
+public:
+    // creates the dir if needed
+    bool open(const char* cacheDir, uint64_t maxSize);
+
+    bool isOpen() const { return !_cacheDir.empty(); }
+
+    // Copies the entry for key to dstFilename, and returns false on a miss.
+    // The ext (.ktx, .ktx2, .dds) is part of the key, since args don't include it.
+    bool fetch(const string& key, const char* ext, const char* dstFilename);
+
+    // Copies a completed encode into the cache, and then evicts if over maxSize.
+    // The dir size is estimated from inserts, so the dir isn't scanned each time.
+    bool insert(const string& key, const char* ext, const char* srcFilename);
+
+    // Once the dir exceeds maxSize, removes lru entries until it's 90% of that,
+    // so the next inserts have room.  Skipped if another process is evicting.
+    void evict();
+
+    uint64_t maxSize() const { return _maxSize; }
+
+private:
+    string entryFilename(const string& key, const char* ext) const;
+
+    string _cacheDir;
+    uint64_t _maxSize = 0;
+};
+
+} // namespace kram
@@ -15,12 +15,17 @@
 
 #include "tmpfileplus.h"
 
+// stdio rename won't replace dst on Win, but this does
+#include <filesystem>
+
 #if KRAM_APPLE || KRAM_LINUX
-#include <unistd.h> // for getpagesize()
+#include <fcntl.h> // for open() of dir
+#include <unistd.h> // for getpagesize(), fsync()
 #endif
 
 #if KRAM_WIN
 #include <direct.h> // direct-ory for _mkdir, _rmdir
+#include <io.h> // for _commit()
 #include <windows.h> // for GetNativeSystemInfo()
 
 // Windows mkdir doesn't take permission
@@ -33,14 +38,37 @@ using namespace STL_NAMESPACE;
 
 #define nl "\n"
 
+// Win paths can also use a backslash
+static const char* findLastSeparator(const char* path)
+{
+    const char* sep = strrchr(path, '/');
+#if KRAM_WIN
+    const char* sepWin = strrchr(path, '\\');
+    if (sepWin && (!sep || sepWin > sep)) {
+        sep = sepWin;
+    }
+#endif
+    return sep;
+}
+
+#if KRAM_APPLE || KRAM_LINUX
+// Read once before any threads start, since reading it means setting it.
+static const mode_t gUmask = []() {
+    mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}();
+#endif
+
 // https://stackoverflow.com/questions/7430248/creating-a-new-directory-in-c
 static void mkdirRecursive(char* path)
 {
-    char* sep = strrchr(path, '/');
+    char* sep = (char*)findLastSeparator(path);
     if (sep != NULL) {
+        char sepChar = *sep;
         *sep = 0;
         mkdirRecursive(path);
-        *sep = '/';
+        *sep = sepChar;
     }
 
     if (*path != '\0' && mkdir(path, 0755) && errno != EEXIST) {
@@ -51,7 +79,7 @@ static void mkdirRecursive(char* path)
 
 static FILE* fopen_mkdir(const char* path, const char* mode)
 {
-    const char* sep = strrchr(path, '/');
+    const char* sep = findLastSeparator(path);
     if (sep) {
         char* path0 = strdup(path);
         path0[sep - path] = 0;
@@ -94,6 +122,128 @@ bool FileHelper::openTemporaryFile(const char* prefix, const char* suffix, const
     return true;
 }
 
+bool FileHelper::openTemporaryFileFor(const char* dstFilename, const char* prefix, const char* suffix)
+{
+    close();
+
+    // tmpfileplus expects the dir to end in a separator, except on Win where it adds one
+    string dir = dstFilename;
+    const char* sep = findLastSeparator(dstFilename);
+    if (sep) {
+        dir.resize(sep - dstFilename);
+        if (!dir.empty()) {
+            mkdirRecursive((char*)dir.c_str());
+        }
+        dir += '/';
+    }
+    else {
+        dir = "./";
+    }
+#if KRAM_WIN
+    dir.pop_back();
+#endif
+
+    char* pathname = nullptr;
+
+    // keep the file on close, so it can be renamed.  close() deletes it
+    // otherwise.  If the dir isn't writable, this uses the tmp dir instead,
+    // and then the move has to copy.
+    int keep = 1;
+
+    _fp = tmpfileplus(dir.c_str(), prefix, suffix, &pathname, keep);
+    if (!_fp) {
+        return false;
+    }
+
+    _isTmpFile = true;
+    _isTmpFileKept = true;
+    _filename = pathname;
+    free(pathname);
+
+    return true;
+}
+
+bool FileHelper::moveTemporaryFileTo(const char* dstFilename, bool isSynced, size_t& bytesSaved)
+{
+    bytesSaved = 0;
+
+    if (!_fp)
+        return false;
+    if (!_isTmpFileKept)
+        return copyTemporaryFileTo(dstFilename);
+
+    size_t size_ = size();
+    if (size_ == (size_t)-1) {
+        return false;
+    }
+
+    int fd = fileno(_fp);
+
+#if KRAM_APPLE || KRAM_LINUX
+    // tmp files are created 0600, so keep the mode of the dst that's replaced,
+    // or use what fopen would have created it with
+    struct stat dstStat;
+    mode_t mode = 0666 & ~gUmask;
+    if (stat(dstFilename, &dstStat) == 0) {
+        mode = dstStat.st_mode & 0777;
+    }
+    fchmod(fd, mode);
+#endif
+
+    if (isSynced) {
+#if KRAM_WIN
+        _commit(fd);
+#else
+        fsync(fd);
+#endif
+    }
+
+    // Win can't rename an open file
+    fclose(_fp);
+    _fp = nullptr;
+
+    // This replaces any hardlink at dst instead of writing through it.
+    std::error_code ec;
+    std::filesystem::rename(_filename.c_str(), dstFilename, ec);
+
+    if (!ec) {
+        _isTmpFile = false;
+        _isTmpFileKept = false;
+
+#if KRAM_APPLE || KRAM_LINUX
+        // the rename isn't durable until the dir entry is synced
+        if (isSynced) {
+            string dir = dstFilename;
+            const char* sep = strrchr(dstFilename, '/');
+            dir = sep ? dir.substr(0, sep - dstFilename + 1) : string(".");
+
+            int dirFd = ::open(dir.c_str(), O_RDONLY);
+            if (dirFd >= 0) {
+                fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+#endif
+
+        bytesSaved = size_;
+        return true;
+    }
+
+    // the tmp file ended up on another volume, so copy it over
+    _fp = fopen(_filename.c_str(), "rb");
+    if (!_fp) {
+        close();
+        return false;
+    }
+
+    bool success = copyTemporaryFileTo(dstFilename);
+
+    // deletes the tmp file
+    close();
+
+    return success;
+}
+
 bool FileHelper::read(uint8_t* data, size_t dataSize)
 {
     return FileHelper::readBytes(_fp, data, dataSize);
@@ -173,6 +323,10 @@ bool FileHelper::copyTemporaryFileTo(const char* dstFilename)
     // temp file will automatically be destroyed with in close() call
     // but can copy it as many times as needed.
 
+    // dst may be a hardlink into an encode cache, so unlink it instead of
+    // writing through the link and changing the cached file.
+    remove(dstFilename);
+
     FileHelper dstHelper;
     if (!dstHelper.open(dstFilename, "w+b")) {
         return false;
@@ -218,6 +372,19 @@ bool FileHelper::open(const char* filename, const char* access)
 
 void FileHelper::close()
 {
+    // a kept tmp file that wasn't moved is deleted, even if already closed
+    if (_isTmpFileKept) {
+        if (_fp) {
+            fclose(_fp);
+            _fp = nullptr;
+        }
+        remove(_filename.c_str());
+
+        _isTmpFileKept = false;
+        _isTmpFile = false;
+        return;
+    }
+
     if (!_fp) {
         return;
     }
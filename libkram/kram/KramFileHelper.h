@@ -35,6 +35,16 @@ public:
     // may fail if tmp file and dst are different volumes.
     bool copyTemporaryFileTo(const char* dstFilename);
 
+    // Opens a tmp file in the dir of dstFilename, so that moveTemporaryFileTo
+    // can rename it into place.  Falls back to the tmp dir if that fails.
+    // The tmp file is deleted by close() unless it's moved.  It's always opened "w+b".
+    bool openTemporaryFileFor(const char* dstFilename, const char* prefix, const char* suffix);
+
+    // Renames the tmp file over dstFilename, and closes it.  That replaces dst in one step
+    // and avoids rewriting the data.  Falls back to copyTemporaryFileTo across volumes.
+    // isSynced flushes the data to disk before the rename.  bytesSaved is 0 if copied.
+    bool moveTemporaryFileTo(const char* dstFilename, bool isSynced, size_t& bytesSaved);
+
     void close();
 
     // returns (size_t)-1 if stat call fails
@@ -62,6 +72,7 @@ private:
     FILE* _fp = nullptr;
     string _filename;
     bool _isTmpFile = false;
+    bool _isTmpFileKept = false; // tmp file is on disk until moved or closed
 };
 
 } // namespace kram
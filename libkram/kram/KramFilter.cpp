@@ -0,0 +1,456 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramFilter.h"
+
+#include <math.h>
+
+#include "KramMipper.h"
+
+namespace kram {
+using namespace STL_NAMESPACE;
+using namespace SIMD_NAMESPACE;
+
+// Dst tile size.  The horizontal pass writes (tileHeight * scale + taps) rows
+// of tileWidth float4 into the intermediate, and that's ~300KB for a 2x
+// lanczos3 downsample.  This keeps the vertical pass reading from L2 even
+// when a 16K row is 256KB.
+static const int32_t kFilterTileWidth = 128;
+static const int32_t kFilterTileHeight = 64;
+
+// Weights are rebuilt after this many sizes, a mip chain only uses ~15 each axis
+static const int32_t kMaxCachedFilterWeights = 64;
+
+struct FilterInfo {
+    const char* name;
+    double radius; // support at a scale of 1
+};
+
+static const FilterInfo kFilterInfos[] = {
+    {"point", 0.0},
+    {"box", 0.5},
+    {"linear", 1.0},
+    {"mitchell", 2.0},
+    {"lanczos3", 3.0},
+    {"kaiser", 3.0},
+};
+
+const char* imageResizeFilterName(ImageResizeFilter filter)
+{
+    return kFilterInfos[filter].name;
+}
+
+bool parseImageResizeFilter(const char* name, ImageResizeFilter& filter)
+{
+    for (int32_t i = 0; i < (int32_t)(sizeof(kFilterInfos) / sizeof(kFilterInfos[0])); ++i) {
+        if (strcmp(name, kFilterInfos[i].name) == 0) {
+            filter = (ImageResizeFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double sinc(double x)
+{
+    // M_PI needs _USE_MATH_DEFINES on Win
+    const double kPi = 3.14159265358979323846;
+
+    if (fabs(x) < 1e-6)
+        return 1.0;
+    x *= kPi;
+    return sin(x) / x;
+}
+
+// modified bessel function of the first kind, order 0
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double halfX = 0.5 * x;
+    for (int32_t k = 1; k < 32; ++k) {
+        term *= halfX / k;
+        double termSq = term * term;
+        sum += termSq;
+        if (termSq < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+static double filterKernel(ImageResizeFilter filter, double x)
+{
+    x = fabs(x);
+
+    switch (filter) {
+        case kImageResizeFilterPoint:
+        case kImageResizeFilterBox:
+            return (x < 0.5) ? 1.0 : 0.0;
+
+        case kImageResizeFilterLinear:
+            return (x < 1.0) ? 1.0 - x : 0.0;
+
+        case kImageResizeFilterMitchell: {
+            const double B = 1.0 / 3.0;
+            const double C = 1.0 / 3.0;
+            double x2 = x * x;
+            double x3 = x2 * x;
+            if (x < 1.0) {
+                return ((12.0 - 9.0 * B - 6.0 * C) * x3 +
+                        (-18.0 + 12.0 * B + 6.0 * C) * x2 +
+                        (6.0 - 2.0 * B)) /
+                       6.0;
+            }
+            if (x < 2.0) {
+                return ((-B - 6.0 * C) * x3 +
+                        (6.0 * B + 30.0 * C) * x2 +
+                        (-12.0 * B - 48.0 * C) * x +
+                        (8.0 * B + 24.0 * C)) /
+                       6.0;
+            }
+            return 0.0;
+        }
+
+        case kImageResizeFilterLanczos3:
+            return (x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+
+        case kImageResizeFilterKaiser: {
+            // same alpha and width as nvtt
+            const double alpha = 4.0;
+            const double width = 3.0;
+            if (x >= width)
+                return 0.0;
+            double t = x / width;
+            return sinc(x) * besselI0(alpha * sqrt(1.0 - t * t)) / besselI0(alpha);
+        }
+    }
+    return 0.0;
+}
+
+void FilterWeights::init(ImageResizeFilter filter_, int32_t srcSize_, int32_t dstSize_)
+{
+    filter = filter_;
+    srcSize = srcSize_;
+    dstSize = dstSize_;
+
+    double scale = (double)srcSize / (double)dstSize;
+
+    // stretch the kernel when downsampling, so it's a lowpass at the dst rate
+    double filterScale = std::max(1.0, scale);
+    double support = kFilterInfos[filter].radius * filterScale;
+
+    // dense weights per dst pixel, before padding to the widest
+    vector<int32_t> lows(dstSize);
+    vector<int32_t> counts(dstSize);
+    vector<double> denseWeights;
+    vector<size_t> offsets(dstSize);
+
+    numTaps = 1;
+
+    for (int32_t i = 0; i < dstSize; ++i) {
+        // dst pixel center in src pixel coordinates
+        double center = (i + 0.5) * scale - 0.5;
+
+        int32_t first = (int32_t)floor(center - support);
+        int32_t last = (int32_t)ceil(center + support);
+
+        int32_t lo = std::max(0, std::min(first, srcSize - 1));
+        int32_t hi = std::min(srcSize - 1, std::max(last, 0));
+        int32_t count = hi - lo + 1;
+
+        size_t offset = denseWeights.size();
+        denseWeights.resize(offset + count, 0.0);
+        double* w = denseWeights.data() + offset;
+
+        double sum = 0.0;
+        if (filter == kImageResizeFilterPoint) {
+            int32_t nearest = std::min(srcSize - 1, (int32_t)floor((i + 0.5) * scale));
+            w[nearest - lo] = 1.0;
+            sum = 1.0;
+        }
+        else {
+            for (int32_t j = first; j <= last; ++j) {
+                double weight = filterKernel(filter, (j - center) / filterScale);
+                if (weight == 0.0)
+                    continue;
+
+                // clamp to edge, by folding the weight into the edge pixel
+                int32_t jClamped = std::max(0, std::min(j, srcSize - 1));
+                w[jClamped - lo] += weight;
+                sum += weight;
+            }
+        }
+
+        if (sum == 0.0) {
+            int32_t nearest = std::max(0, std::min((int32_t)floor(center + 0.5), srcSize - 1));
+            w[nearest - lo] = 1.0;
+            sum = 1.0;
+        }
+
+        // normalize, so flat areas stay flat
+        for (int32_t j = 0; j < count; ++j) {
+            w[j] /= sum;
+        }
+
+        // drop zero taps at the ends, box and tent have one on each side
+        int32_t trimLo = 0;
+        while (trimLo < count - 1 && w[trimLo] == 0.0) {
+            ++trimLo;
+        }
+        while (count > trimLo + 1 && w[count - 1] == 0.0) {
+            --count;
+        }
+        count -= trimLo;
+        lo += trimLo;
+        offset += trimLo;
+
+        lows[i] = lo;
+        counts[i] = count;
+        offsets[i] = offset;
+        numTaps = std::max(numTaps, count);
+    }
+
+    // Pad each dst to numTaps, shifting the start back at the right edge so
+    // the reads stay in bounds.  numTaps <= srcSize, so start stays >= 0.
+    starts.resize(dstSize);
+    weights.clear();
+    weights.resize(dstSize * numTaps, 0.0f);
+
+    for (int32_t i = 0; i < dstSize; ++i) {
+        int32_t start = std::min(lows[i], srcSize - numTaps);
+        starts[i] = start;
+
+        float* w = weights.data() + i * numTaps;
+        const double* dense = denseWeights.data() + offsets[i];
+        for (int32_t j = 0; j < counts[i]; ++j) {
+            w[lows[i] - start + j] = (float)dense[j];
+        }
+    }
+}
+
+shared_ptr<const FilterWeights> findFilterWeights(ImageResizeFilter filter, int32_t srcSize, int32_t dstSize)
+{
+    static std::mutex cacheMutex;
+    static unordered_map<uint64_t, shared_ptr<const FilterWeights>> cache;
+
+    uint64_t key = ((uint64_t)filter << 56) | ((uint64_t)srcSize << 28) | (uint64_t)dstSize;
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            return it->second;
+        }
+    }
+
+    // build outside the lock, a racing build of the same key is identical
+    auto weights = make_shared<FilterWeights>();
+    weights->init(filter, srcSize, dstSize);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    // callers hold a ref, so clearing doesn't free tables in use
+    if ((int32_t)cache.size() >= kMaxCachedFilterWeights) {
+        cache.clear();
+    }
+    cache[key] = weights;
+
+    return weights;
+}
+
+// Horizontal pass.  src starts at srcX0, and each dst pixel is a dot of
+// numTaps float4 with the weights.
+static void filterRow(const float4* src, int32_t srcX0,
+                      const FilterWeights& weights, int32_t x0, int32_t count,
+                      float4* dst)
+{
+    int32_t numTaps = weights.numTaps;
+
+    for (int32_t i = 0; i < count; ++i) {
+        const float* w = weights.weightsFor(x0 + i);
+        const float4* s = src + (weights.starts[x0 + i] - srcX0);
+
+        float4 sum = s[0] * w[0];
+        for (int32_t t = 1; t < numTaps; ++t) {
+            sum += s[t] * w[t];
+        }
+        dst[i] = sum;
+    }
+}
+
+// Vertical pass.  Accumulates whole rows per tap, so the inner loop is a
+// multiply-add over contiguous float4 and can use the full simd width.
+static void filterColumn(const float4* src, int32_t srcStride,
+                         const float* w, int32_t numTaps, int32_t count,
+                         float4* dst)
+{
+    float w0 = w[0];
+    for (int32_t i = 0; i < count; ++i) {
+        dst[i] = src[i] * w0;
+    }
+
+    for (int32_t t = 1; t < numTaps; ++t) {
+        float wt = w[t];
+        if (wt == 0.0f)
+            continue;
+
+        const float4* s = src + t * srcStride;
+        for (int32_t i = 0; i < count; ++i) {
+            dst[i] += s[i] * wt;
+        }
+    }
+}
+
+// returns a ptr to count float4 pixels of row y starting at x
+static const float4* loadRow(const ImageData& srcImage, int32_t x, int32_t y, int32_t count,
+                             float4* scratch)
+{
+    int32_t index = y * srcImage.width + x;
+
+    if (srcImage.pixelsFloat) {
+        return srcImage.pixelsFloat + index;
+    }
+
+    if (srcImage.pixelsHalf) {
+        const half4* src = srcImage.pixelsHalf + index;
+        for (int32_t i = 0; i < count; ++i) {
+            scratch[i] = float4m(src[i]);
+        }
+    }
+    else {
+        const Color* src = srcImage.pixels + index;
+        for (int32_t i = 0; i < count; ++i) {
+            scratch[i] = ColorToUnormFloat4(src[i]);
+        }
+    }
+    return scratch;
+}
+
+static void storeRow(const ImageData& srcImage, ImageData& dstImage,
+                     int32_t x, int32_t y, int32_t count, float4* row)
+{
+    int32_t index = y * dstImage.width + x;
+
+    bool isFloatSrc = srcImage.pixelsFloat || srcImage.pixelsHalf;
+
+    // Negative lobes ring past the input range.  Keep hdr as is, but
+    // don't let ldr premul data exceed alpha or go negative.
+    if (!srcImage.isHDR) {
+        for (int32_t i = 0; i < count; ++i) {
+            row[i] = saturate(row[i]);
+        }
+    }
+
+    if (srcImage.pixelsFloat) {
+        memcpy(dstImage.pixelsFloat + index, row, count * sizeof(float4));
+    }
+    else if (srcImage.pixelsHalf) {
+        half4* dst = dstImage.pixelsHalf + index;
+        for (int32_t i = 0; i < count; ++i) {
+            dst[i] = half4m(row[i]);
+        }
+    }
+
+    // assume hdr pulls from half/float data
+    if (!dstImage.pixels || (isFloatSrc && srcImage.isHDR))
+        return;
+
+    Color* dst = dstImage.pixels + index;
+
+    // convert back to srgb for encode
+    if (isFloatSrc && dstImage.isSRGB) {
+        for (int32_t i = 0; i < count; ++i) {
+            dst[i] = linearToSRGBColor(row[i]);
+        }
+        return;
+    }
+
+    for (int32_t i = 0; i < count; ++i) {
+        dst[i] = ColorFromUnormFloat4(row[i]);
+    }
+}
+
+void resampleImage(const ImageData& srcImage_, ImageData& dstImage, ImageResizeFilter filter)
+{
+    int32_t srcWidth = srcImage_.width;
+    int32_t srcHeight = srcImage_.height;
+    int32_t dstWidth = dstImage.width;
+    int32_t dstHeight = dstImage.height;
+
+    // Tiles read src rows that earlier tiles overwrote when in-place,
+    // so copy the src data that is read.
+    ImageData srcImage = srcImage_;
+    vector<float4> srcFloatCopy;
+    vector<half4> srcHalfCopy;
+    vector<Color> srcColorCopy;
+
+    size_t numSrcPixels = (size_t)srcWidth * srcHeight;
+
+    if (srcImage.pixelsFloat) {
+        if (srcImage.pixelsFloat == dstImage.pixelsFloat) {
+            srcFloatCopy.assign(srcImage.pixelsFloat, srcImage.pixelsFloat + numSrcPixels);
+            srcImage.pixelsFloat = srcFloatCopy.data();
+        }
+    }
+    else if (srcImage.pixelsHalf) {
+        if (srcImage.pixelsHalf == dstImage.pixelsHalf) {
+            srcHalfCopy.assign(srcImage.pixelsHalf, srcImage.pixelsHalf + numSrcPixels);
+            srcImage.pixelsHalf = srcHalfCopy.data();
+        }
+    }
+    else if (srcImage.pixels == dstImage.pixels) {
+        srcColorCopy.assign(srcImage.pixels, srcImage.pixels + numSrcPixels);
+        srcImage.pixels = srcColorCopy.data();
+    }
+
+    shared_ptr<const FilterWeights> weightsXRef = findFilterWeights(filter, srcWidth, dstWidth);
+    shared_ptr<const FilterWeights> weightsYRef = findFilterWeights(filter, srcHeight, dstHeight);
+    const FilterWeights& weightsX = *weightsXRef;
+    const FilterWeights& weightsY = *weightsYRef;
+
+    // horizontally filtered src rows for a tile, then the dst row
+    vector<float4> tileRows;
+    vector<float4> scratchRow;
+    float4 dstRow[kFilterTileWidth];
+
+    for (int32_t tileY = 0; tileY < dstHeight; tileY += kFilterTileHeight) {
+        int32_t tileHeight = std::min(kFilterTileHeight, dstHeight - tileY);
+
+        // src rows read by the tile
+        int32_t srcY0 = weightsY.starts[tileY];
+        int32_t srcY1 = weightsY.starts[tileY + tileHeight - 1] + weightsY.numTaps;
+
+        tileRows.resize((srcY1 - srcY0) * kFilterTileWidth);
+
+        for (int32_t tileX = 0; tileX < dstWidth; tileX += kFilterTileWidth) {
+            int32_t tileWidth = std::min(kFilterTileWidth, dstWidth - tileX);
+
+            // src columns read by the tile
+            int32_t srcX0 = weightsX.starts[tileX];
+            int32_t srcX1 = weightsX.starts[tileX + tileWidth - 1] + weightsX.numTaps;
+            int32_t srcCount = srcX1 - srcX0;
+
+            if ((int32_t)scratchRow.size() < srcCount) {
+                scratchRow.resize(srcCount);
+            }
+
+            for (int32_t y = srcY0; y < srcY1; ++y) {
+                const float4* srcRow = loadRow(srcImage, srcX0, y, srcCount, scratchRow.data());
+                filterRow(srcRow, srcX0, weightsX, tileX, tileWidth,
+                          tileRows.data() + (y - srcY0) * kFilterTileWidth);
+            }
+
+            for (int32_t y = tileY; y < tileY + tileHeight; ++y) {
+                filterColumn(tileRows.data() + (weightsY.starts[y] - srcY0) * kFilterTileWidth,
+                             kFilterTileWidth,
+                             weightsY.weightsFor(y), weightsY.numTaps, tileWidth,
+                             dstRow);
+
+                storeRow(srcImage, dstImage, tileX, y, tileWidth, dstRow);
+            }
+        }
+    }
+}
+
+} // namespace kram
@@ -0,0 +1,64 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+#include <cstdint>
+//#include <vector>
+
+//#include "KramConfig.h"
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+class ImageData;
+
+enum ImageResizeFilter {
+    kImageResizeFilterPoint,
+    kImageResizeFilterBox,
+    kImageResizeFilterLinear, // tent
+    kImageResizeFilterMitchell, // bicubic with B = C = 1/3
+    kImageResizeFilterLanczos3,
+    kImageResizeFilterKaiser, // kaiser windowed sinc
+};
+
+const char* imageResizeFilterName(ImageResizeFilter filter);
+
+// parses the names above, returns false if unknown
+bool parseImageResizeFilter(const char* name, ImageResizeFilter& filter);
+
+// Weights to resample one axis from srcSize to dstSize.  Each dst pixel
+// has its own phase of the kernel.  Taps off the edge are folded into the
+// edge pixel (clamp), so every dst pixel reads numTaps in-bounds src
+// pixels starting at starts[i], and no clamping is needed in the passes.
+class FilterWeights {
+public:
+    void init(ImageResizeFilter filter, int32_t srcSize, int32_t dstSize);
+
+    const float* weightsFor(int32_t dstIndex) const { return weights.data() + dstIndex * numTaps; }
+
+    ImageResizeFilter filter = kImageResizeFilterBox;
+    int32_t srcSize = 0;
+    int32_t dstSize = 0;
+
+    // all dst pixels are padded to the same tap count with zero weights
+    int32_t numTaps = 0;
+
+    vector<int32_t> starts; // dstSize
+    vector<float> weights; // dstSize * numTaps, each sums to 1
+};
+
+// Weights are shared across images, chunks and threads, since every mip level
+// of a given size reuses the same tables.  The cache is bounded.
+shared_ptr<const FilterWeights> findFilterWeights(ImageResizeFilter filter, int32_t srcSize, int32_t dstSize);
+
+// Separable resample of srcImage to the dstImage width/height.  This reads
+// pixelsFloat, pixelsHalf, or pixels in that order, and writes to the same
+// representation in dstImage.  Like the mipper, pixels is also written from
+// float data when not hdr, and is converted back to srgb if dstImage.isSRGB.
+// Processes dst in tiles, so the intermediate stays in L2 on large images.
+// srcImage and dstImage can alias for in-place mips.
+void resampleImage(const ImageData& srcImage, ImageData& dstImage, ImageResizeFilter filter);
+
+} // namespace kram
@@ -46,11 +46,15 @@
 #include <errno.h>
 
 #include "KTXImage.h"
+#include "KramBlockCache.h"
+#include "KramBlockDecoder.h"
 #include "KramFileHelper.h"
 #include "KramMipper.h"
 #include "KramSDFMipper.h"
+#include "KramSolidBlock.h"
 #include "KramTimer.h"
 #include "KramZipHelper.h"
+#include "TaskSystem.h"
 
 // for zlib compress
 #include "miniz.h"
@@ -208,10 +212,10 @@ bool Image::convertToFourChannel(const KTXImage& image, uint32_t mipNumber)
         case MyMTLPixelFormatRGBA16Float: {
             int32_t numSrcChannels = numChannelsOfFormat(image.pixelFormat);
 
-            _pixelsFloat.resize(_width * _height);
+            // keep as half, this is half the memory of float4
+            _pixelsHalf.resize(_width * _height);
 
-            // treat as float for per channel copies
-            float4* dstPixels = _pixelsFloat.data();
+            half4* dstPixels = _pixelsHalf.data();
 
             const half* srcPixels = (const half*)(srcLevelData + mipBaseOffset);
 
@@ -229,8 +233,7 @@ bool Image::convertToFourChannel(const KTXImage& image, uint32_t mipNumber)
                         dstTemp[i] = srcPixels[srcX + i];
                     }
 
-                    // use AVX to convert
-                    dstPixels[dstX] = float4m(dstTemp);
+                    dstPixels[dstX] = dstTemp;
                 }
             }
             break;
@@ -468,6 +471,51 @@ void Image::setSrgbState(bool isSrgb, bool hasSrgbBlock, bool hasNonSrgbBlocks)
     _hasNonSrgbBlocks = hasNonSrgbBlocks;
 }
 
+void Image::convertPixelsToHalf()
+{
+    if (_pixelsFloat.empty()) {
+        return;
+    }
+
+    _pixelsHalf.resize(_pixelsFloat.size());
+
+    // Values past the half max would go to inf, so clamp them to it.
+    // The hdr encoders are limited to half range anyways.
+    const float kHalfMax = 65504.0f;
+    size_t numClamped = 0;
+
+    for (size_t i = 0, iEnd = _pixelsFloat.size(); i < iEnd; ++i) {
+        float4 c = _pixelsFloat[i];
+        if (reduce_max(abs(c)) > kHalfMax) {
+            c = clamp(c, float4m(-kHalfMax), float4m(kHalfMax));
+            numClamped++;
+        }
+        _pixelsHalf[i] = half4m(c);
+    }
+
+    if (numClamped > 0) {
+        KLOGW("Image", "clamped %zu pixels to the half range +/-%.0f", numClamped, kHalfMax);
+    }
+
+    // release the memory, clear() would hold onto it
+    vector<float4>().swap(_pixelsFloat);
+}
+
+void Image::convertPixelsToFloat()
+{
+    if (_pixelsHalf.empty()) {
+        return;
+    }
+
+    _pixelsFloat.resize(_pixelsHalf.size());
+
+    for (size_t i = 0, iEnd = _pixelsHalf.size(); i < iEnd; ++i) {
+        _pixelsFloat[i] = float4m(_pixelsHalf[i]);
+    }
+
+    vector<half4>().swap(_pixelsHalf);
+}
+
 // Can average any channels per block, this means they are constant across the
 // block and use endpoint storage but do not affect the endpoint fitting.
 // Results in a low-res, blocky version of those channels, but better
@@ -562,6 +610,154 @@ static bool writeDataAtOffset(const uint8_t* data, size_t dataSize, size_t dataO
     return true;
 }
 
+// Split numBlockRows into bands, and encode or decode each band on the task
+// system.  Blocks only depend on their own pixels, so the output is the same
+// as processing all the rows at once.  Without a system, this runs all rows inline.
+template <typename F>
+static void processBlockRows(task_system* system, int32_t numBlockRows, const F& processRows)
+{
+    // a few bands per thread evens out bands with slower blocks
+    int32_t numBands = system ? system->num_threads() * 4 : 1;
+    int32_t rowsPerBand = (numBlockRows + numBands - 1) / numBands;
+
+    parallel_for(system, 0, numBlockRows, rowsPerBand, processRows);
+}
+
+// Allocating an astcenc context rebuilds the partition and block mode tables,
+// and that dominates the time to encode small mips.  So hold onto contexts
+// across all the mips and chunks, and all the encodes that a kram serve runs.
+// A context can only compress one image at a time, so parallel encodes each
+// acquire their own.  Decodes use decompress only contexts from here too.
+class AstcencContextCache {
+public:
+    ~AstcencContextCache();
+
+    // idle contexts past this are freed, oldest first
+    static constexpr uint32_t kMaxIdleContexts = 8;
+
+#if COMPILE_ASTCENC
+    // quality isn't stored in the config, so it's passed in for the key
+    astcenc_context* acquire(const astcenc_config& config, float quality, uint32_t numThreads);
+    void release(astcenc_context* context);
+
+private:
+    struct Entry {
+        astcenc_profile profile;
+        uint32_t blockX;
+        uint32_t blockY;
+        float quality;
+        uint32_t flags;
+        float weights[4];
+        uint32_t numThreads;
+
+        astcenc_context* context;
+        bool isInUse;
+    };
+
+    std::mutex _mutex;
+    vector<Entry> _entries;
+#endif
+};
+
+#if COMPILE_ASTCENC
+
+AstcencContextCache::~AstcencContextCache()
+{
+    for (auto& entry : _entries) {
+        astcenc_context_free(entry.context);
+    }
+}
+
+astcenc_context* AstcencContextCache::acquire(const astcenc_config& config, float quality, uint32_t numThreads)
+{
+    Entry key = {
+        config.profile,
+        config.block_x,
+        config.block_y,
+        quality,
+        config.flags,
+        {config.cw_r_weight, config.cw_g_weight, config.cw_b_weight, config.cw_a_weight},
+        numThreads,
+        nullptr,
+        true,
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& entry : _entries) {
+            if (!entry.isInUse &&
+                entry.profile == key.profile &&
+                entry.blockX == key.blockX &&
+                entry.blockY == key.blockY &&
+                entry.quality == key.quality &&
+                entry.flags == key.flags &&
+                memcmp(entry.weights, key.weights, sizeof(key.weights)) == 0 &&
+                entry.numThreads == key.numThreads) {
+                entry.isInUse = true;
+                return entry.context;
+            }
+        }
+    }
+
+    // alloc outside the lock, since this is the slow part
+    if (astcenc_context_alloc(&config, numThreads, &key.context) != ASTCENC_SUCCESS) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.push_back(key);
+    return key.context;
+}
+
+void AstcencContextCache::release(astcenc_context* context)
+{
+    // ready the context for the next image, only one of these applies
+    // depending on whether it's a decompress only context
+    astcenc_compress_reset(context);
+    astcenc_decompress_reset(context);
+
+    astcenc_context* freeContext = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        uint32_t numIdle = 0;
+        for (auto& entry : _entries) {
+            if (entry.context == context) {
+                entry.isInUse = false;
+            }
+            if (!entry.isInUse) {
+                numIdle++;
+            }
+        }
+
+        // entries are in order of alloc, so this drops the oldest idle one
+        if (numIdle > kMaxIdleContexts) {
+            for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+                if (!it->isInUse) {
+                    freeContext = it->context;
+                    _entries.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (freeContext) {
+        astcenc_context_free(freeContext);
+    }
+}
+
+#else
+
+AstcencContextCache::~AstcencContextCache()
+{
+}
+
+#endif
+
+// shared by all encodes and decodes in the process
+static AstcencContextCache gAstcencContexts;
+
 bool KramDecoder::decode(const KTXImage& srcImage, FILE* dstFile, const KramDecoderParams& params) const
 {
     KTXImage dstImage; // thrown out, data written to file
@@ -573,11 +769,35 @@ bool KramDecoder::decode(const KTXImage& srcImage, KTXImage& dstImage, const Kra
     return decodeImpl(srcImage, nullptr, dstImage, params);
 }
 
+// Threads aren't worth starting up for smaller mips
+static const int32_t kMinParallelDecodePixels = 256 * 256;
+
 bool KramDecoder::decodeBlocks(
     int32_t w, int32_t h,
     const uint8_t* blockData, uint32_t blockDataSize, MyMTLPixelFormat blockFormat,
     vector<uint8_t>& outputTexture, // currently Color
     const KramDecoderParams& params) const
+{
+    if (w * h < kMinParallelDecodePixels) {
+        return decodeBlocksImpl(w, h, blockData, blockDataSize, blockFormat, outputTexture, params, nullptr);
+    }
+    if (params.system) {
+        return decodeBlocksImpl(w, h, blockData, blockDataSize, blockFormat, outputTexture, params, params.system);
+    }
+    if (params.numJobs > 1) {
+        task_system system(params.numJobs);
+        return decodeBlocksImpl(w, h, blockData, blockDataSize, blockFormat, outputTexture, params, &system);
+    }
+
+    return decodeBlocksImpl(w, h, blockData, blockDataSize, blockFormat, outputTexture, params, nullptr);
+}
+
+bool KramDecoder::decodeBlocksImpl(
+    int32_t w, int32_t h,
+    const uint8_t* blockData, uint32_t blockDataSize, MyMTLPixelFormat blockFormat,
+    vector<uint8_t>& outputTexture, // currently Color
+    const KramDecoderParams& params,
+    task_system* system) const
 {
     bool success = false;
 
@@ -636,132 +856,155 @@ bool KramDecoder::decodeBlocks(
             // just to chain if/else
         }
 #if COMPILE_BCENC
-        else if (useBcenc) {
+        else if (useBcenc && params.useBlockRowDecoder && isBlockRowDecoderFormat(blockFormat)) {
+            // bc1-5 palettes for several blocks at once, and rows go straight to the output
             Color* dstPixels = (Color*)outputTexture.data();
 
             const int32_t blockDim = 4;
-            int32_t blocks_x = (w + blockDim - 1) / blockDim;
-            //int32_t blocks_y = (h + blockDim - 1) / blockDim;
-            int32_t blockSize = blockSizeOfFormat(blockFormat);
+            int32_t blocks_y = (h + blockDim - 1) / blockDim;
 
-            for (int32_t y = 0; y < h; y += blockDim) {
-                for (int32_t x = 0; x < w; x += blockDim) {
-                    int32_t bbx = x / blockDim;
-                    int32_t bby = y / blockDim;
-                    int32_t bb0 = bby * blocks_x + bbx;
-                    const uint8_t* srcBlock = &srcData[bb0 * blockSize];
-
-                    // Clear to 0001
-                    // TODO: could only do for bc4/5
-                    Color pixels[blockDim * blockDim] = {};
-                    for (uint32_t i = 0, iEnd = blockDim * blockDim; i < iEnd; ++i) {
-                        pixels[i].a = 255;
-                    }
+            processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                decodeBlockRows(blockFormat, srcData, w, h, blockRowStart, blockRowEnd, dstPixels);
+            });
 
-                    // TODO: need this for bc4/5/6sn on other decoders (ate + squish)
-                    // but have to run through all blocks before passing.  Here doing one block
-                    // at a time.  EAC_R11/RG11sn already do this conversion on decode.
+            success = true;
+        }
+        else if (useBcenc) {
+            Color* dstPixels = (Color*)outputTexture.data();
 
-                    // Switch from unorm to snorm if needed
-                    uint16_t* e0;
-                    uint16_t* e1;
+            const int32_t blockDim = 4;
+            int32_t blocks_x = (w + blockDim - 1) / blockDim;
+            int32_t blocks_y = (h + blockDim - 1) / blockDim;
+            int32_t blockSize = blockSizeOfFormat(blockFormat);
 
-                    e0 = (uint16_t*)&srcBlock[0];
+            // bands of block rows decode in parallel, blocks are independent
+            std::atomic<bool> isFailed(false);
+
+            processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                for (int32_t y = blockRowStart * blockDim, yEnd = std::min(h, blockRowEnd * blockDim); y < yEnd; y += blockDim) {
+                    for (int32_t x = 0; x < w; x += blockDim) {
+                        int32_t bbx = x / blockDim;
+                        int32_t bby = y / blockDim;
+                        int32_t bb0 = bby * blocks_x + bbx;
+                        const uint8_t* srcBlock = &srcData[bb0 * blockSize];
+
+                        // Clear to 0001
+                        // TODO: could only do for bc4/5
+                        Color pixels[blockDim * blockDim] = {};
+                        for (uint32_t i = 0, iEnd = blockDim * blockDim; i < iEnd; ++i) {
+                            pixels[i].a = 255;
+                        }
 
-                    if (blockFormat == MyMTLPixelFormatBC4_RSnorm) {
-                        // 2 8-bit endpoints
-                        remapFromSignedBCEndpoint88(*e0);
-                    }
-                    else if (blockFormat == MyMTLPixelFormatBC5_RGSnorm) {
-                        // 4 8-bit endpoints
-                        remapFromSignedBCEndpoint88(*e0);
+                        // TODO: need this for bc4/5/6sn on other decoders (ate + squish)
+                        // but have to run through all blocks before passing.  Here doing one block
+                        // at a time.  EAC_R11/RG11sn already do this conversion on decode.
 
-                        e1 = (uint16_t*)&srcBlock[4 * 2];
-                        remapFromSignedBCEndpoint88(*e1);
-                    }
+                        // Switch from unorm to snorm if needed
+                        uint16_t* e0;
+                        uint16_t* e1;
 
-                    // decode into temp 4x4 pixels
-                    success = true;
+                        e0 = (uint16_t*)&srcBlock[0];
 
-                    switch (blockFormat) {
-                        case MyMTLPixelFormatBC1_RGBA:
-                        case MyMTLPixelFormatBC1_RGBA_sRGB:
-                            // Returns true if the block uses 3 color punchthrough alpha mode.
-                            rgbcx::unpack_bc1(srcBlock, pixels);
-                            break;
-                        case MyMTLPixelFormatBC3_RGBA_sRGB:
-                        case MyMTLPixelFormatBC3_RGBA:
-                            // Returns false if the block uses 3 color punchthrough alpha mode.
-                            rgbcx::unpack_bc3(srcBlock, pixels);
-                            break;
+                        if (blockFormat == MyMTLPixelFormatBC4_RSnorm) {
+                            // 2 8-bit endpoints
+                            remapFromSignedBCEndpoint88(*e0);
+                        }
+                        else if (blockFormat == MyMTLPixelFormatBC5_RGSnorm) {
+                            // 4 8-bit endpoints
+                            remapFromSignedBCEndpoint88(*e0);
 
-                        // writes r packed
-                        case MyMTLPixelFormatBC4_RSnorm:
-                        case MyMTLPixelFormatBC4_RUnorm:
-                            rgbcx::unpack_bc4(srcBlock, (uint8_t*)pixels);
-                            break;
+                            e1 = (uint16_t*)&srcBlock[4 * 2];
+                            remapFromSignedBCEndpoint88(*e1);
+                        }
 
-                        // writes rg packed
-                        case MyMTLPixelFormatBC5_RGSnorm:
-                        case MyMTLPixelFormatBC5_RGUnorm:
-                            rgbcx::unpack_bc5(srcBlock, pixels);
-                            break;
+                        // decode into temp 4x4 pixels
+                        bool isBlockDecoded = true;
+
+                        switch (blockFormat) {
+                            case MyMTLPixelFormatBC1_RGBA:
+                            case MyMTLPixelFormatBC1_RGBA_sRGB:
+                                // Returns true if the block uses 3 color punchthrough alpha mode.
+                                rgbcx::unpack_bc1(srcBlock, pixels);
+                                break;
+                            case MyMTLPixelFormatBC3_RGBA_sRGB:
+                            case MyMTLPixelFormatBC3_RGBA:
+                                // Returns false if the block uses 3 color punchthrough alpha mode.
+                                rgbcx::unpack_bc3(srcBlock, pixels);
+                                break;
+
+                            // writes r packed
+                            case MyMTLPixelFormatBC4_RSnorm:
+                            case MyMTLPixelFormatBC4_RUnorm:
+                                rgbcx::unpack_bc4(srcBlock, (uint8_t*)pixels);
+                                break;
+
+                            // writes rg packed
+                            case MyMTLPixelFormatBC5_RGSnorm:
+                            case MyMTLPixelFormatBC5_RGUnorm:
+                                rgbcx::unpack_bc5(srcBlock, pixels);
+                                break;
 
 #if COMPILE_COMP
-                        // writes rg packed
-                        case MyMTLPixelFormatBC6H_RGBUfloat:
-                        case MyMTLPixelFormatBC6H_RGBFloat: {
-                            // go to compressenator calls here
-                            float pixelsFloat[16][4]; // really rgb x fp16, a=1.0
-                            uint8_t srcBlockForDecompress[16];
-                            for (uint32_t i = 0; i < 16; ++i) {
-                                srcBlockForDecompress[i] = srcBlock[i];
+                            // writes rg packed
+                            case MyMTLPixelFormatBC6H_RGBUfloat:
+                            case MyMTLPixelFormatBC6H_RGBFloat: {
+                                // go to compressenator calls here
+                                float pixelsFloat[16][4]; // really rgb x fp16, a=1.0
+                                uint8_t srcBlockForDecompress[16];
+                                for (uint32_t i = 0; i < 16; ++i) {
+                                    srcBlockForDecompress[i] = srcBlock[i];
+                                }
+
+                                BC6HBlockDecoder decoderCompressenator;
+                                decoderCompressenator.DecompressBlock(pixelsFloat, srcBlockForDecompress);
+
+                                // losing snorm and chopping to 8-bit
+                                for (uint32_t i = 0; i < 16; ++i) {
+                                    pixels[i] = ColorFromUnormFloat4(*(const float4*)&pixelsFloat[i]);
+                                }
+                                break;
                             }
-
-                            BC6HBlockDecoder decoderCompressenator;
-                            decoderCompressenator.DecompressBlock(pixelsFloat, srcBlockForDecompress);
-
-                            // losing snorm and chopping to 8-bit
-                            for (uint32_t i = 0; i < 16; ++i) {
-                                pixels[i] = ColorFromUnormFloat4(*(const float4*)&pixelsFloat[i]);
-                            }
-                            break;
-                        }
 #endif
 
-                        case MyMTLPixelFormatBC7_RGBAUnorm:
-                        case MyMTLPixelFormatBC7_RGBAUnorm_sRGB:
-                            bc7decomp::unpack_bc7(srcBlock, (bc7decomp::color_rgba*)pixels);
-                            break;
-
-                        default:
-                            KLOGE("Image", "decode unsupported format");
-                            success = false;
-                            break;
-                    }
+                            case MyMTLPixelFormatBC7_RGBAUnorm:
+                            case MyMTLPixelFormatBC7_RGBAUnorm_sRGB:
+                                bc7decomp::unpack_bc7(srcBlock, (bc7decomp::color_rgba*)pixels);
+                                break;
 
-                    if (!success) {
-                        return false;
-                    }
+                            default:
+                                isBlockDecoded = false;
+                                break;
+                        }
 
-                    // copy temp pixels to outputTexture
-                    for (int32_t by = 0; by < blockDim; ++by) {
-                        int32_t yy = y + by;
-                        if (yy >= h) {
-                            break;
+                        if (!isBlockDecoded) {
+                            isFailed = true;
+                            return;
                         }
 
-                        for (int32_t bx = 0; bx < blockDim; ++bx) {
-                            int32_t xx = x + bx;
-                            if (xx >= w) {
-                                break; // go to next y above
+                        // copy temp pixels to outputTexture
+                        for (int32_t by = 0; by < blockDim; ++by) {
+                            int32_t yy = y + by;
+                            if (yy >= h) {
+                                break;
                             }
 
-                            const Color& c = pixels[by * blockDim + bx];
-                            dstPixels[yy * w + xx] = c;
+                            for (int32_t bx = 0; bx < blockDim; ++bx) {
+                                int32_t xx = x + bx;
+                                if (xx >= w) {
+                                    break; // go to next y above
+                                }
+
+                                const Color& c = pixels[by * blockDim + bx];
+                                dstPixels[yy * w + xx] = c;
+                            }
                         }
                     }
                 }
+            });
+
+            success = !isFailed;
+            if (!success) {
+                KLOGE("Image", "decode unsupported format");
             }
         }
 #endif
@@ -795,9 +1038,21 @@ bool KramDecoder::decodeBlocks(
             }
 
             if (success) {
+                const int32_t blockDim = 4;
+                int32_t blocks_x = (w + blockDim - 1) / blockDim;
+                int32_t blocks_y = (h + blockDim - 1) / blockDim;
+                int32_t blockSize = blockSizeOfFormat(blockFormat);
+
                 // only handles bc1,3,4,5
                 // TODO: colors still don't look correct on rs, rgs.  Above it always requests unorm.
-                squish::DecompressImage(outputTexture.data(), w, h, srcData, format);
+                // Each band is decoded as a shorter image.
+                processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                    int32_t y0 = blockRowStart * blockDim;
+                    int32_t bandHeight = std::min(h, blockRowEnd * blockDim) - y0;
+
+                    squish::DecompressImage(outputTexture.data() + y0 * w * sizeof(Color), w, bandHeight,
+                                            srcData + blockRowStart * blocks_x * blockSize, format);
+                });
 
                 success = true;
             }
@@ -816,50 +1071,83 @@ bool KramDecoder::decodeBlocks(
 #endif
     }
     else if (isETCFormat(blockFormat)) {
-        // etc via etc2comp
+        if (params.useBlockRowDecoder && isBlockRowDecoderFormat(blockFormat)) {
+            // etc2/eac palettes and modes are parsed per block, rows go straight to the output
+            Color* dstPixels = (Color*)outputTexture.data();
+
+            const int32_t blockDim = 4;
+            int32_t blocks_y = (h + blockDim - 1) / blockDim;
+
+            processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                decodeBlockRows(blockFormat, srcData, w, h, blockRowStart, blockRowEnd, dstPixels);
+            });
+
+            success = true;
+        }
 #if COMPILE_ETCENC
-        Etc::Image::Format format = Etc::Image::Format::R11;
+        else {
+            // etc via etc2comp
+            Etc::Image::Format format = Etc::Image::Format::R11;
 
-        success = true;
+            success = true;
 
-        switch (blockFormat) {
-            case MyMTLPixelFormatEAC_R11Unorm:
-                format = Etc::Image::Format::R11;
-                break;
-            case MyMTLPixelFormatEAC_R11Snorm:
-                format = Etc::Image::Format::SIGNED_R11;
-                break;
-            case MyMTLPixelFormatEAC_RG11Unorm:
-                format = Etc::Image::Format::RG11;
-                break;
-            case MyMTLPixelFormatEAC_RG11Snorm:
-                format = Etc::Image::Format::SIGNED_RG11;
-                break;
+            switch (blockFormat) {
+                case MyMTLPixelFormatEAC_R11Unorm:
+                    format = Etc::Image::Format::R11;
+                    break;
+                case MyMTLPixelFormatEAC_R11Snorm:
+                    format = Etc::Image::Format::SIGNED_R11;
+                    break;
+                case MyMTLPixelFormatEAC_RG11Unorm:
+                    format = Etc::Image::Format::RG11;
+                    break;
+                case MyMTLPixelFormatEAC_RG11Snorm:
+                    format = Etc::Image::Format::SIGNED_RG11;
+                    break;
 
-            case MyMTLPixelFormatETC2_RGB8:
-                format = Etc::Image::Format::RGB8;
-                break;
-            case MyMTLPixelFormatETC2_RGB8_sRGB:
-                format = Etc::Image::Format::SRGB8;
-                break;
-            case MyMTLPixelFormatEAC_RGBA8:
-                format = Etc::Image::Format::RGBA8;
-                break;
-            case MyMTLPixelFormatEAC_RGBA8_sRGB:
-                format = Etc::Image::Format::SRGBA8;
-                break;
+                case MyMTLPixelFormatETC2_RGB8:
+                    format = Etc::Image::Format::RGB8;
+                    break;
+                case MyMTLPixelFormatETC2_RGB8_sRGB:
+                    format = Etc::Image::Format::SRGB8;
+                    break;
+                case MyMTLPixelFormatEAC_RGBA8:
+                    format = Etc::Image::Format::RGBA8;
+                    break;
+                case MyMTLPixelFormatEAC_RGBA8_sRGB:
+                    format = Etc::Image::Format::SRGBA8;
+                    break;
 
-            default:
-                KLOGE("Image", "decode unsupported format");
-                success = false;
-                break;
-        }
+                default:
+                    KLOGE("Image", "decode unsupported format");
+                    success = false;
+                    break;
+            }
+
+            if (success) {
+                const int32_t blockDim = 4;
+                int32_t blocks_x = (w + blockDim - 1) / blockDim;
+                int32_t blocks_y = (h + blockDim - 1) / blockDim;
+                int32_t blockSize = blockSizeOfFormat(blockFormat);
+
+                std::atomic<bool> isFailed(false);
+
+                // Each band is decoded as a shorter image.
+                processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                    int32_t y0 = blockRowStart * blockDim;
+                    int32_t bandHeight = std::min(h, blockRowEnd * blockDim) - y0;
 
-        if (success) {
-            Etc::Image etcImage(format, nullptr,
-                                w, h, Etc::ErrorMetric::NUMERIC);
+                    Etc::Image etcImage(format, nullptr,
+                                        w, bandHeight, Etc::ErrorMetric::NUMERIC);
 
-            success = etcImage.Decode(srcData, outputTexture.data()) == Etc::Image::SUCCESS;
+                    if (etcImage.Decode(srcData + blockRowStart * blocks_x * blockSize,
+                                        outputTexture.data() + y0 * w * sizeof(Color)) != Etc::Image::SUCCESS) {
+                        isFailed = true;
+                    }
+                });
+
+                success = !isFailed;
+            }
         }
 #endif
     }
@@ -876,6 +1164,7 @@ bool KramDecoder::decodeBlocks(
             dstImageASTC.dim_y = h;
             dstImageASTC.dim_z = 1; // Not using 3D blocks, not supported on iOS
             //dstImageASTC.dim_pad = 0;
+            dstImageASTC.skip_blocks = nullptr;
             dstImageASTC.data_type = ASTCENC_TYPE_U8;
 
             // encode/encode still setup on array of 2d slices, so need address of data
@@ -897,17 +1186,39 @@ bool KramDecoder::decodeBlocks(
                 return false;
             }
 
-            astcenc_context* codec_context = nullptr;
-            error = astcenc_context_alloc(&config, 1, &codec_context);
-            if (error != ASTCENC_SUCCESS) {
+            // astcenc pulls blocks across however many thread indices call
+            // decompress, so each thread of the system gets one index
+            uint32_t numThreads = system ? system->num_threads() : 1;
+
+            // contexts are reused across mips and decodes
+            astcenc_context* codec_context = gAstcencContexts.acquire(config, ASTCENC_PRE_FAST, numThreads);
+            if (!codec_context) {
                 return false;
             }
+
             // no swizzle
             astcenc_swizzle swizzleDecode = {ASTCENC_SWZ_R, ASTCENC_SWZ_G, ASTCENC_SWZ_B, ASTCENC_SWZ_A};
 
-            error = astcenc_decompress_image(codec_context, srcData, srcDataLength, &dstImageASTC, &swizzleDecode, 0);
+            if (numThreads > 1) {
+                std::atomic<uint32_t> threadError(ASTCENC_SUCCESS);
+
+                system->run_and_wait(numThreads, [&](int32_t threadIndex) {
+                    astcenc_error threadResult = astcenc_decompress_image(
+                        codec_context, srcData, srcDataLength, &dstImageASTC, &swizzleDecode,
+                        threadIndex);
+
+                    if (threadResult != ASTCENC_SUCCESS) {
+                        threadError = threadResult;
+                    }
+                });
+
+                error = (astcenc_error)threadError.load();
+            }
+            else {
+                error = astcenc_decompress_image(codec_context, srcData, srcDataLength, &dstImageASTC, &swizzleDecode, 0);
+            }
 
-            astcenc_context_free(codec_context);
+            gAstcencContexts.release(codec_context);
 
             success = (error == ASTCENC_SUCCESS);
         }
@@ -1029,6 +1340,14 @@ bool KramDecoder::decodeImpl(const KTXImage& srcImage, FILE* dstFile, KTXImage&
     vector<uint8_t> mipStorage;
     mipStorage.resize(srcImage.mipLengthLargest() * numChunks); // enough to hold biggest mip
 
+    // one pool is shared by all the mips, small mips decode inline
+    unique_ptr<task_system> localSystem;
+    task_system* system = params.system;
+    if (!system && params.numJobs > 1) {
+        localSystem = make_unique<task_system>(params.numJobs);
+        system = localSystem.get();
+    }
+
     for (uint32_t i = 0; i < srcImage.mipLevels.size(); ++i) {
         // DONE: to decode compressed KTX2 want to walk all chunks of a single level
         // after decompressing the level.   This isn't doing unpackLevel and needs to here.
@@ -1063,7 +1382,8 @@ bool KramDecoder::decodeImpl(const KTXImage& srcImage, FILE* dstFile, KTXImage&
                 // just copy the data as is
                 memcpy(outputTexture.data(), srcData, srcMipLevel.length);
             }
-            else if (!decodeBlocks(w, h, srcData, srcMipLevel.length, srcImage.pixelFormat, outputTexture, params)) {
+            else if (!decodeBlocksImpl(w, h, srcData, srcMipLevel.length, srcImage.pixelFormat, outputTexture, params,
+                                       (int32_t)(w * h) >= kMinParallelDecodePixels ? system : nullptr)) {
                 return false;
             }
 
@@ -1094,7 +1414,7 @@ bool KramDecoder::decodeImpl(const KTXImage& srcImage, FILE* dstFile, KTXImage&
     return success;
 }
 
-bool Image::resizeImage(int32_t wResize, int32_t hResize, bool resizePow2, ImageResizeFilter /* filter */)
+bool Image::resizeImage(int32_t wResize, int32_t hResize, bool resizePow2, ImageResizeFilter filter)
 {
     if (resizePow2) {
         if (isPow2(_width) && isPow2(_height)) {
@@ -1109,11 +1429,57 @@ bool Image::resizeImage(int32_t wResize, int32_t hResize, bool resizePow2, Image
     if (_width == wResize && _height == hResize) {
         return true;
     }
-    if (_pixels.empty()) {
+    if (_pixels.empty() && !isHDR()) {
         return false;
     }
 
-    if (!_pixels.empty()) {
+    if (filter != kImageResizeFilterPoint) {
+        ImageData srcImage;
+        srcImage.width = _width;
+        srcImage.height = _height;
+
+        ImageData dstImage;
+        dstImage.width = wResize;
+        dstImage.height = hResize;
+
+        // filters the stored values, so 8-bit srgb isn't linearized first
+        if (!_pixelsFloat.empty()) {
+            vector<float4> pixelsResize;
+            pixelsResize.resize(wResize * hResize);
+
+            srcImage.isHDR = true;
+            srcImage.pixelsFloat = _pixelsFloat.data();
+            dstImage.pixelsFloat = pixelsResize.data();
+
+            resampleImage(srcImage, dstImage, filter);
+
+            _pixelsFloat = pixelsResize;
+        }
+        else if (!_pixelsHalf.empty()) {
+            vector<half4> pixelsResize;
+            pixelsResize.resize(wResize * hResize);
+
+            srcImage.isHDR = true;
+            srcImage.pixelsHalf = _pixelsHalf.data();
+            dstImage.pixelsHalf = pixelsResize.data();
+
+            resampleImage(srcImage, dstImage, filter);
+
+            _pixelsHalf = pixelsResize;
+        }
+        else {
+            vector<Color> pixelsResize;
+            pixelsResize.resize(wResize * hResize);
+
+            srcImage.pixels = _pixels.data();
+            dstImage.pixels = pixelsResize.data();
+
+            resampleImage(srcImage, dstImage, filter);
+
+            _pixels = pixelsResize;
+        }
+    }
+    else if (!_pixels.empty()) {
         vector<Color> pixelsResize;
         pixelsResize.resize(wResize * hResize);
 
@@ -1129,6 +1495,14 @@ bool Image::resizeImage(int32_t wResize, int32_t hResize, bool resizePow2, Image
 
         _pixelsFloat = pixelsResize;
     }
+    else if (!_pixelsHalf.empty()) {
+        vector<half4> pixelsResize;
+        pixelsResize.resize(wResize * hResize);
+
+        pointFilterImage(_width, _height, _pixelsHalf.data(), wResize, hResize, pixelsResize.data());
+
+        _pixelsHalf = pixelsResize;
+    }
 
     _width = wResize;
     _height = hResize;
@@ -1151,28 +1525,42 @@ bool KramEncoder::encode(ImageInfo& info, Image& singleImage, FILE* dstFile) con
 
 // Use this for in-place construction of mips
 struct MipConstructData {
+    // Subdividing strips of larger images into cube/atlas/etc.
+    // These offsets are where to find each chunk in that larger image
+    vector<Int2> chunkOffsets;
+
+    // Can skip the larger and smaller mips.  This is the larger mips skipped.
+    uint32_t numSkippedMips = 0;
+
+    // 2d image src after accounting for chunks for a strip of array/cube data
+    uint32_t chunkWidth = 0;
+    uint32_t chunkHeight = 0;
+};
+
+// Scratch memory for the mips of a single chunk.  Each chunk gets its own
+// when building in parallel, so nothing is shared between jobs.
+struct ChunkMipData {
     // use this for complex texture types, copy data from vertical/horizotnal
     // strip image into here to then gen mips
     vector<Color> copyImage;
 
     // So can use simd ops to do conversions, use float4.
-    // using half4 for mips of ldr data to cut memory in half
+    // using half4 for mips of ldr and 16f hdr data to cut memory in half
     // processing large textures nees lots of memory for src image
     // 8k x 8k x 8b = 500 mb
     // 8k x 8k x 16b = 1 gb
     vector<half4> halfImage;
     vector<float4> floatImage;
 
-    // Subdividing strips of larger images into cube/atlas/etc.
-    // These offsets are where to find each chunk in that larger image
-    vector<Int2> chunkOffsets;
+    // mip1...n are held here
+    vector<Color> mipPixels;
+    vector<half4> mipPixelsHalf;
+    vector<float4> mipPixelsFloat;
 
-    // Can skip the larger and smaller mips.  This is the larger mips skipped.
-    uint32_t numSkippedMips = 0;
+    // points into the buffers above, or the source image
+    vector<ImageData> dstMipImages;
 
-    // 2d image src after accounting for chunks for a strip of array/cube data
-    uint32_t chunkWidth = 0;
-    uint32_t chunkHeight = 0;
+    SDFMipper sdfMipper;
 };
 
 // See here:
@@ -1489,10 +1877,10 @@ void KramEncoder::addBaseProps(const ImageInfo& info, KTXImage& dstImage) const
         dstImage.addFilterProps("Lin,Lin,X"); // min,mag,mip
     }
 
-    // This is hash of source png/ktx file (use xxhash32 or crc32)
-    // can quickly check header if multiple copies of same source w/diff names.
-    // May also need to store command line args in a prop to reject duplicate processing
-    // TODO: ktxImage.addSourceHashProps(0);
+    // This is crc32 of source png/ktx file and the encode args that affect
+    // the output, so an incremental encode can skip an output that's current.
+    // Only set when encoding with -incremental.
+    dstImage.addSourceHashProps(info.sourceHash);
 }
 
 // wish C++ had a defer
@@ -1554,7 +1942,7 @@ bool KramEncoder::encodeImpl(ImageInfo& info, Image& singleImage, FILE* dstFile,
         }
 
         // now write that as ktx2 with potentially supercompressed mips
-        if (!saveKTX2(dstImage, info.compressor, dstFile)) {
+        if (!saveKTX2(dstImage, info.compressor, dstFile, info.numJobs, info.system)) {
             return false;
         }
     }
@@ -1568,7 +1956,7 @@ bool KramEncoder::encodeImpl(ImageInfo& info, Image& singleImage, FILE* dstFile,
     return true;
 }
 
-bool KramEncoder::saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compressor, FILE* dstFile) const
+bool KramEncoder::saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compressor, FILE* dstFile, int32_t numJobs, task_system* system) const
 {
     // TODO: move this propsData into KTXImage
     vector<uint8_t> propsData;
@@ -1677,35 +2065,15 @@ bool KramEncoder::saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compr
         }
     }
     else {
-        // start compression with the smallest mips first, then can write out data as we go through it all
-
-        // update the offsets and compressed sizes
-        lastImageByteOffset = imageByteOffset;
-
-        // allocate big enough to hold entire uncompressed level
-        vector<uint8_t> compressedData;
-        compressedData.resize(mz_compressBound(ktx2Levels[0].length)); // largest mip
-        size_t compressedDataSize = 0;
-
-        // reuse a context here
-        ZSTD_CCtx* cctx = nullptr;
+        int zstdLevel = 0;
         int zlibLevel = MZ_DEFAULT_COMPRESSION;
 
         if (compressor.compressorType == KTX2SupercompressionZstd) {
-            cctx = ZSTD_createCCtx();
-            if (!cctx) {
-                return false;
-            }
-
             if (compressor.compressorLevel > 0.0f) {
-                int zstdLevel = (int)round(compressor.compressorLevel);
+                zstdLevel = (int)round(compressor.compressorLevel);
                 if (zstdLevel > 100) {
                     zstdLevel = 100;
                 }
-
-                ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, zstdLevel);
-
-                // may need to reset the compressor context, but says call starts a new frame
             }
         }
         else if (compressor.compressorType == KTX2SupercompressionZlib) {
@@ -1723,40 +2091,105 @@ bool KramEncoder::saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compr
             }
         }
 
-        ZSTDScope scope(cctx);
+        // Levels are independent, so they're each compressed to their own
+        // buffer, and then the offsets are laid out once all sizes are known.
+        int32_t numLevels = (int32_t)ktx2Levels.size();
+        vector<vector<uint8_t>> compressedLevels;
+        compressedLevels.resize(numLevels);
+
+        // each worker reuses one context across the levels that it compresses,
+        // and takes the next level starting from the largest.
+        std::atomic<int32_t> nextLevel(0);
+        std::atomic<bool> success(true);
+
+        auto compressLevels = [&]() {
+            ZSTD_CCtx* cctx = nullptr;
+            if (compressor.compressorType == KTX2SupercompressionZstd) {
+                cctx = ZSTD_createCCtx();
+                if (!cctx) {
+                    success = false;
+                    return;
+                }
 
-        for (int32_t i = (int32_t)ktx2Levels.size() - 1; i >= 0; --i) {
-            auto& level2 = ktx2Levels[i];
-            const auto& level1 = srcImage.mipLevels[i];
+                if (zstdLevel > 0) {
+                    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, zstdLevel);
 
-            const uint8_t* levelData = srcImage.fileData + level1.offset;
+                    // may need to reset the compressor context, but says call starts a new frame
+                }
+            }
 
-            // compress each mip
-            switch (compressor.compressorType) {
-                case KTX2SupercompressionZstd: {
-                    // this resets the frame on each call
-                    compressedDataSize = ZSTD_compress2(cctx, compressedData.data(), compressedData.size(), levelData, level2.length);
+            ZSTDScope scope(cctx);
 
-                    if (ZSTD_isError(compressedDataSize)) {
-                        KLOGE("kram", "encode mip zstd failed");
-                        return false;
-                    }
-                    break;
-                }
-                case KTX2SupercompressionZlib: {
-                    mz_ulong dstSize = compressedData.size();
-                    if (mz_compress2(compressedData.data(), &dstSize, levelData, level2.length, zlibLevel) != MZ_OK) {
-                        KLOGE("kram", "encode mip zlib failed");
-                        return false;
+            for (int32_t i = nextLevel++; i < numLevels && success; i = nextLevel++) {
+                const auto& level2 = ktx2Levels[i];
+                const auto& level1 = srcImage.mipLevels[i];
+
+                const uint8_t* levelData = srcImage.fileData + level1.offset;
+                vector<uint8_t>& compressedData = compressedLevels[i];
+
+                // compress each mip
+                switch (compressor.compressorType) {
+                    case KTX2SupercompressionZstd: {
+                        compressedData.resize(ZSTD_compressBound(level2.length));
+
+                        // this resets the frame on each call
+                        size_t compressedDataSize = ZSTD_compress2(cctx, compressedData.data(), compressedData.size(), levelData, level2.length);
+
+                        if (ZSTD_isError(compressedDataSize)) {
+                            KLOGE("kram", "encode mip zstd failed");
+                            success = false;
+                            return;
+                        }
+                        compressedData.resize(compressedDataSize);
+                        break;
                     }
-                    compressedDataSize = dstSize;
+                    case KTX2SupercompressionZlib: {
+                        compressedData.resize(mz_compressBound(level2.length));
 
-                    break;
+                        mz_ulong dstSize = compressedData.size();
+                        if (mz_compress2(compressedData.data(), &dstSize, levelData, level2.length, zlibLevel) != MZ_OK) {
+                            KLOGE("kram", "encode mip zlib failed");
+                            success = false;
+                            return;
+                        }
+                        compressedData.resize(dstSize);
+                        break;
+                    }
+                    default:
+                        // should never get here
+                        success = false;
+                        return;
                 }
-                default:
-                    // should never get here
-                    return false;
             }
+        };
+
+        int32_t numWorkers = std::min(numJobs, numLevels);
+        if (numWorkers > 1 && system) {
+            // each level is pulled by one of the workers
+            system->run_and_wait(std::min(numWorkers, system->num_threads()), [&](int32_t /* worker */) {
+                compressLevels();
+            });
+        }
+        else if (numWorkers > 1) {
+            task_system localSystem(numWorkers);
+            localSystem.run_and_wait(localSystem.num_threads(), [&](int32_t /* worker */) {
+                compressLevels();
+            });
+        }
+        else {
+            compressLevels();
+        }
+
+        if (!success) {
+            return false;
+        }
+
+        // update the offsets and compressed sizes, smallest mips come first
+        lastImageByteOffset = imageByteOffset;
+
+        for (int32_t i = numLevels - 1; i >= 0; --i) {
+            auto& level2 = ktx2Levels[i];
+            const vector<uint8_t>& compressedData = compressedLevels[i];
 
             // also need for compressed levels?
             // align the offset to leastCommonMultiple(4, texel_block_size);
@@ -1764,13 +2197,13 @@ bool KramEncoder::saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compr
                 lastImageByteOffset += 4 - (lastImageByteOffset & 0x3);
             }
 
-            level2.lengthCompressed = compressedDataSize;
+            level2.lengthCompressed = compressedData.size();
             level2.offset = lastImageByteOffset;
 
             lastImageByteOffset = level2.offset + level2.lengthCompressed;
 
             // write the mip
-            if (!writeDataAtOffset(compressedData.data(), compressedDataSize, level2.offset, dstFile, dummyImage)) {
+            if (!writeDataAtOffset(compressedData.data(), compressedData.size(), level2.offset, dstFile, dummyImage)) {
                 return false;
             }
         }
@@ -1983,24 +2416,32 @@ void printBCBlock(const uint8_t* bcBlock, MyMTLPixelFormat format)
     }
 }
 
-bool KramEncoder::createMipsFromChunks(
-    ImageInfo& info,
-    Image& singleImage,
-    MipConstructData& data,
-    FILE* dstFile,
-    KTXImage& dstImage) const
+// These encoders can split up a mip across threads.  astcenc doesn't
+// use bands, but pulls blocks across all the thread indices.  These
+// are also the encoders that can skip blocks that are already encoded.
+static bool canEncodeInBands(const ImageInfo& info)
 {
-    Timer totalTimer;
-
-    // ----------------------------------------------------
+    if (info.isBC) {
+        return info.useBcenc || info.useSquish;
+    }
+    if (info.isETC) {
+        return info.useEtcenc;
+    }
+    if (info.isASTC) {
+        return info.useAstcenc;
+    }
+    return false;
+}
 
-    // set the structure fields and allocate it, only need enough to hold single
-    // mip (reuses mem) also because mips are written out to file after
-    // generated.
-    TextureData outputTexture;
-    outputTexture.width = dstImage.width;
-    outputTexture.height = dstImage.height;
-    outputTexture.data.resize(dstImage.mipLengthLargest());
+void KramEncoder::buildChunkMips(
+    const ImageInfo& info,
+    Image& singleImage,
+    const MipConstructData& data,
+    const KTXImage& dstImage,
+    int32_t chunk,
+    ChunkMipData& chunkData) const
+{
+    Timer timerBuildMips;
 
     // This is for 8-bit data (pixelsFloat used for in-place mipgen)
     ImageData srcImage;
@@ -2014,66 +2455,79 @@ bool KramEncoder::createMipsFromChunks(
     int32_t w = srcImage.width;
     int32_t h = srcImage.height;
 
-    // ----------------------------------------------------
-
-    // use this for complex texture types, copy data from vertical/horizotnal
-    // strip image into here to then gen mips
-    vector<Color>& copyImage = data.copyImage;
-
-    // So can use simd ops to do conversions, use float4.
-    // using half4 for mips of ldr data to cut memory in half
-    // processing large textures nees lots of memory for src image
-    // 8k x 8k x 8b = 500 mb
-    // 8k x 8k x 16b = 1 gb
-    vector<half4>& halfImage = data.halfImage;
-    vector<float4>& floatImage = data.floatImage;
-
     int32_t numChunks = (int32_t)data.chunkOffsets.size();
     bool doPremultiply = info.hasAlpha && (info.isPremultiplied || info.isPrezero);
     bool isMultichunk = numChunks > 1;
 
-    if (info.isHDR) {
-        // here the source is float
+    // copy a chunk at a time, mip that if needed, and then move to next chunk
+    Int2 chunkOffset = data.chunkOffsets[chunk];
 
-        // used to store chunks of the strip data
+    Mipper mipper;
+    mipper.setFilter(info.mipFilter);
+
+    if (info.isHDR && !singleImage.pixelsHalf().empty()) {
+        // mips are built and stored in half, only the encoders convert
         if (isMultichunk) {
-            floatImage.resize(w * h);
-            srcImage.pixelsFloat = floatImage.data();
+            chunkData.halfImage.resize(w * h);
+            srcImage.pixelsHalf = chunkData.halfImage.data();
+
+            const half4* srcPixels = singleImage.pixelsHalf().data();
+            for (int32_t y = 0; y < h; ++y) {
+                int32_t y0 = y * w;
+
+                // offset into original strip/atlas
+                int32_t yOffset = (y + chunkOffset.y) * singleImage.width() + chunkOffset.x;
+
+                memcpy(&chunkData.halfImage[y0], &srcPixels[yOffset], w * sizeof(half4));
+            }
         }
         else {
-            srcImage.pixelsFloat = (float4*)singleImage.pixelsFloat().data();
+            srcImage.pixelsHalf = (half4*)singleImage.pixelsHalf().data();
         }
+    }
+    else if (info.isHDR) {
+        // used to store chunks of the strip data
+        if (isMultichunk) {
+            chunkData.floatImage.resize(w * h);
+            srcImage.pixelsFloat = chunkData.floatImage.data();
 
-        // run this across all the source data
-        // do this in-place before mips are generated
-        if (doPremultiply) {
-            if (info.isPrezero) {
-                for (const auto& pixel : singleImage.pixelsFloat()) {
-                    float alpha = pixel.w;
-                    float4& pixelChange = const_cast<float4&>(pixel);
+            const float4* srcPixels = (const float4*)singleImage.pixelsFloat().data();
+            for (int32_t y = 0; y < h; ++y) {
+                int32_t y0 = y * w;
 
-                    // only premul at 0 alpha regions
-                    if (alpha == 0.0f) {
-                        pixelChange *= alpha;
-                        pixelChange.w = alpha;
-                    }
-                }
-            }
-            else {
-                for (const auto& pixel : singleImage.pixelsFloat()) {
-                    float alpha = pixel.w;
-                    float4& pixelChange = const_cast<float4&>(pixel);
-                    pixelChange *= alpha;
-                    pixelChange.w = alpha;
+                // offset into original strip/atlas
+                int32_t yOffset = (y + chunkOffset.y) * singleImage.width() + chunkOffset.x;
+
+                for (int32_t x = 0; x < w; ++x) {
+                    float4 c0 = srcPixels[yOffset + x];
+                    float4& d0 = chunkData.floatImage[y0 + x];
+                    d0 = c0;
                 }
             }
         }
+        else {
+            srcImage.pixelsFloat = (float4*)singleImage.pixelsFloat().data();
+        }
     }
     else {
         // used to store chunks of the strip data
         if (isMultichunk) {
-            copyImage.resize(w * h);
-            srcImage.pixels = copyImage.data();
+            chunkData.copyImage.resize(w * h);
+            srcImage.pixels = chunkData.copyImage.data();
+
+            const Color* srcPixels = (const Color*)singleImage.pixels().data();
+            for (int32_t y = 0; y < h; ++y) {
+                int32_t y0 = y * w;
+
+                // offset into original strip/atlas
+                int32_t yOffset = (y + chunkOffset.y) * singleImage.width() + chunkOffset.x;
+
+                for (int32_t x = 0; x < w; ++x) {
+                    Color c0 = srcPixels[yOffset + x];
+                    Color& d0 = chunkData.copyImage[y0 + x];
+                    d0 = c0;
+                }
+            }
         }
         else {
             srcImage.pixels = (Color*)singleImage.pixels().data();
@@ -2081,292 +2535,437 @@ bool KramEncoder::createMipsFromChunks(
 
         // used to store premul and linear color
         if (info.isSRGBSrc || doPremultiply) {
-            halfImage.resize(w * h);
+            chunkData.halfImage.resize(w * h);
 
             // so large mips even if clamped with -mipmax allocate to largest mip size (2k x 2k @16 = 64MB)
             // have to build the mips off that.  srgb and premul is why fp32 is
             // needed, and need to downsample in linear space.
 
-            srcImage.pixelsHalf = halfImage.data();
+            srcImage.pixelsHalf = chunkData.halfImage.data();
+        }
+
+        if (info.doSDF) {
+            chunkData.sdfMipper.init(srcImage, info.sdfThreshold, info.isVerbose);
+        }
+        else {
+            // copy and convert to half4 or float4 image
+            // srcImage already points to float data, so could modify that
+            // only need doPremultiply at the top mip
+            mipper.initPixelsHalfIfNeeded(srcImage,
+                                          doPremultiply && info.isPremultiplied,
+                                          doPremultiply && info.isPrezero,
+                                          chunkData.halfImage);
         }
     }
 
-    Mipper mipper;
-    SDFMipper sdfMipper;
+    // Build mips for the chunk, dropping mips as needed, but downsampling
+    // from available srcImage.   This is no longer done in-place so that
+    // mipgen and encoding are separated.  This simplifies mipFlood and
+    // channel averaging.
+    const int32_t numMipLevels = (int32_t)dstImage.mipLevels.size();
+
+    vector<ImageData>& dstMipImages = chunkData.dstMipImages;
+    dstMipImages.clear();
+    dstMipImages.resize(numMipLevels);
+
+    // mip1...n are held here
+    vector<Color>& mipPixels = chunkData.mipPixels;
+    vector<half4>& mipPixelsHalf = chunkData.mipPixelsHalf;
+    vector<float4>& mipPixelsFloat = chunkData.mipPixelsFloat;
+
+    {
+        ImageData dstImageData = srcImage;
+        dstImageData.isSRGB = isSrgbFormat(info.pixelFormat);
+
+        int32_t numSkippedMips = data.numSkippedMips;
+
+        if (info.doSDF) {
+            // count up pixels needed for all mips of this chunk
+            uint32_t numPixels = 0;
+            for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+                w = srcImage.width;
+                h = srcImage.height;
+                int32_t d = 1;
+                mipDown(w, h, d, mipLevel + numSkippedMips);
+                numPixels += w * h;
+            }
 
-    vector<KTXImageLevel>& dstMipLevels = dstImage.mipLevels;
-
-    int32_t srcTopMipWidth = srcImage.width;
-    int32_t srcTopMipHeight = srcImage.height;
-
-    // Need this to restore the pointers after mip gen
-    const ImageData srcImageSaved = srcImage;
-    
-    for (int32_t chunk = 0; chunk < numChunks; ++chunk) {
-        Timer timerBuildMips;
-
-        // this needs to append before chunkOffset copy below
-        w = srcTopMipWidth;
-        h = srcTopMipHeight;
-
-        // copy a chunk at a time, mip that if needed, and then move to next chunk
-        Int2 chunkOffset = data.chunkOffsets[chunk];
-
-        // reset these dimensions, or the mip mapping drops them to 1x1
-        srcImage.width = w;
-        srcImage.height = h;
-        
-        // restore the pointers
-        srcImage.pixels = srcImageSaved.pixels;
-        srcImage.pixelsHalf = srcImageSaved.pixelsHalf;
-        srcImage.pixelsFloat = srcImageSaved.pixelsFloat;
-        
-        if (info.isHDR) {
-            // TODO: should this support halfImage too?
-
-            if (isMultichunk) {
-                const float4* srcPixels = (const float4*)singleImage.pixelsFloat().data();
-                for (int32_t y = 0; y < h; ++y) {
-                    int32_t y0 = y * w;
-
-                    // offset into original strip/atlas
-                    int32_t yOffset = (y + chunkOffset.y) * singleImage.width() + chunkOffset.x;
-
-                    for (int32_t x = 0; x < w; ++x) {
-                        float4 c0 = srcPixels[yOffset + x];
-                        float4& d0 = data.floatImage[y0 + x];
-                        d0 = c0;
-                    }
-                }
+            // now allocate enough memory to hold all the mips
+            mipPixels.resize(numPixels);
+
+            size_t pixelOffset = 0;
+            for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+                ImageData& dstMipImage = dstMipImages[mipLevel];
+
+                dstMipImage = dstImageData; // settings replaced in mipmap call
+                dstMipImage.pixels = mipPixels.data() + pixelOffset;
+
+                // sdf mipper has to build from largest sourceImage
+                // but it can in-place write to the same dstImage
+                // But not doing in-place mips anymore.
+                chunkData.sdfMipper.mipmap(dstMipImage, mipLevel + numSkippedMips);
+
+                // assumes depth = 1
+                pixelOffset += dstMipImage.width * dstMipImage.height;
             }
         }
         else {
-            if (isMultichunk) {
-                const Color* srcPixels = (const Color*)singleImage.pixels().data();
-                for (int32_t y = 0; y < h; ++y) {
-                    int32_t y0 = y * w;
-
-                    // offset into original strip/atlas
-                    int32_t yOffset = (y + chunkOffset.y) * singleImage.width() + chunkOffset.x;
-
-                    for (int32_t x = 0; x < w; ++x) {
-                        Color c0 = srcPixels[yOffset + x];
-                        Color& d0 = data.copyImage[y0 + x];
-                        d0 = c0;
-                    }
+            if (numSkippedMips > 0) {
+                // this does in-place mipmap to dstImage (also updates floatPixels if used)
+                for (int32_t i = 0; i < numSkippedMips; ++i) {
+                    // have to build the submips even with skipMip
+                    mipper.mipmap(srcImage, dstImageData);
+
+                    // dst becomes src for next in-place mipmap
+                    srcImage = dstImageData;
                 }
             }
 
-            if (info.doSDF) {
-                sdfMipper.init(srcImage, info.sdfThreshold, info.isVerbose);
-            }
-            else {
-                // copy and convert to half4 or float4 image
-                // srcImage already points to float data, so could modify that
-                // only need doPremultiply at the top mip
-                mipper.initPixelsHalfIfNeeded(srcImage,
-                                              doPremultiply && info.isPremultiplied,
-                                              doPremultiply && info.isPrezero,
-                                              data.halfImage);
+            // allocate memory for mips
+            dstMipImages[0] = dstImageData;
+
+            // count up pixels needed for all sub mips of this chunk
+            // srcImage is already the first kept mip here
+            uint32_t numPixels = 0;
+            for (int32_t mipLevel = 1; mipLevel < numMipLevels; ++mipLevel) {
+                w = srcImage.width;
+                h = srcImage.height;
+                int32_t d = 1;
+                mipDown(w, h, d, mipLevel);
+                numPixels += w * h;
             }
-        }
 
-        // Build mips for the chunk, dropping mips as needed, but downsampling
-        // from available srcImage.   This is no longer done in-place so that
-        // mipgen and encoding are separated.  This simplifies mipFlood and
-        // channel averaging.
-        const int32_t numMipLevels = (int32_t)dstMipLevels.size();
+            // This is more memory than in-place, but the submips
+            // are only 1/3rd the memory of the main mip.  Hdr mips
+            // only write the half/float pixels.
+            if (!info.isHDR)
+                mipPixels.resize(numPixels);
+            if (srcImage.pixelsFloat)
+                mipPixelsFloat.resize(numPixels);
+            else if (srcImage.pixelsHalf)
+                mipPixelsHalf.resize(numPixels);
+
+            size_t pixelOffset = 0;
+            for (int32_t mipLevel = 1; mipLevel < numMipLevels; ++mipLevel) {
+                ImageData& dstMipImage = dstMipImages[mipLevel];
+                dstMipImage.isSRGB = dstImageData.isSRGB;
 
-        vector<ImageData> dstMipImages;
-        dstMipImages.resize(numMipLevels);
+                if (!info.isHDR)
+                    dstMipImage.pixels = mipPixels.data() + pixelOffset;
+                if (srcImage.pixelsFloat)
+                    dstMipImage.pixelsFloat = mipPixelsFloat.data() + pixelOffset;
+                else if (srcImage.pixelsHalf)
+                    dstMipImage.pixelsHalf = mipPixelsHalf.data() + pixelOffset;
 
-        // mip1...n are held here
-        vector<Color> mipPixels;
-        vector<half4> mipPixelsHalf;
-        vector<float4> mipPixelsFloat;
+                w = srcImage.width;
+                h = srcImage.height;
+                int32_t d = 1;
+                mipDown(w, h, d, mipLevel);
+                pixelOffset += w * h;
+            }
 
-        {
-            ImageData dstImageData = srcImage;
-            dstImageData.isSRGB = isSrgbFormat(info.pixelFormat);
+            // builds all the levels from tiles of srcImage, instead of
+            // reading each level back from memory to build the next
+            if (numMipLevels > 1) {
+                mipper.mipmapLevels(srcImage, &dstMipImages[1], numMipLevels - 1);
+            }
 
-            int32_t numSkippedMips = data.numSkippedMips;
+            // Now can run mip flooding on image, this only floods 8-bit pixels
+            if (info.doMipflood && !info.isHDR) {
+                mipper.mipflood(dstMipImages);
+            }
 
-            if (info.doSDF) {
-                // count up pixels needed for all mips of this chunk
-                uint32_t numPixels = 0;
+            // apply average channels, now that unique mips
+            bool isFloat = srcImage.pixelsHalf || srcImage.pixelsFloat;
+            if (!info.averageChannels.empty() && !isFloat) {
                 for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
-                    w = srcImage.width;
-                    h = srcImage.height;
-                    int32_t d = 1;
-                    mipDown(w, h, d, mipLevel + numSkippedMips);
-                    numPixels += w * h;
+                    ImageData& dstMipImage = dstMipImages[mipLevel];
+
+                    // this isn't applied to srgb data (what about premul?)
+                    averageChannelsInBlock(info.averageChannels.c_str(), dstImage,
+                                           dstMipImage);
                 }
+            }
+        }
+    }
 
-                // now allocate enough memory to hold all the mips
-                mipPixels.resize(numPixels);
+    timerBuildMips.stop();
 
-                size_t pixelOffset = 0;
-                for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
-                    //const auto& dstMipLevel = dstMipLevels[mipLevel];
-                    ImageData& dstMipImage = dstMipImages[mipLevel];
+    if (info.isVerbose) {
+        KLOGI("Image", "Chunk %d source %d miplevels in %0.3fms\n",
+              chunk, numMipLevels,
+              timerBuildMips.timeElapsedMillis());
+    }
+}
 
-                    dstMipImage = dstImageData; // settings replaced in mipmap call
-                    dstMipImage.pixels = mipPixels.data() + pixelOffset;
+bool KramEncoder::writeChunkMip(
+    const ImageInfo& info,
+    int32_t numChunks,
+    int32_t chunk,
+    int32_t mipLevel,
+    const TextureData& outputTexture,
+    FILE* dstFile,
+    KTXImage& dstImage) const
+{
+    const auto& dstMipLevel = dstImage.mipLevels[mipLevel];
 
-                    // sdf mipper has to build from largest sourceImage
-                    // but it can in-place write to the same dstImage
-                    // But not doing in-place mips anymore.
-                    sdfMipper.mipmap(dstMipImage, mipLevel + numSkippedMips);
+    // size of one mip, not levelSize = numChunks * mipStorageSize
+    size_t mipStorageSize = dstMipLevel.length;
 
-                    // assumes depth = 1
-                    pixelOffset += dstMipImage.width * dstMipImage.height;
-                }
-            }
-            else {
-                if (numSkippedMips > 0) {
-                    // this does in-place mipmap to dstImage (also updates floatPixels if used)
-                    for (int32_t i = 0; i < numSkippedMips; ++i) {
-                        // have to build the submips even with skipMip
-                        mipper.mipmap(srcImage, dstImageData);
-
-                        // dst becomes src for next in-place mipmap
-                        srcImage = dstImageData;
-                    }
-                }
+    // offset only valid for KTX and KTX2 w/o isCompressed
+    size_t mipChunkOffset = dstMipLevel.offset + chunk * mipStorageSize;
 
-                // allocate memory for mips
-                dstMipImages[0] = dstImageData;
-
-                // count up pixels needed for all sub mips of this chunk
-                uint32_t numPixels = 0;
-                for (int32_t mipLevel = 1; mipLevel < numMipLevels; ++mipLevel) {
-                    w = srcImage.width;
-                    h = srcImage.height;
-                    int32_t d = 1;
-                    mipDown(w, h, d, mipLevel + numSkippedMips);
-                    numPixels += w * h;
-                }
+    // Write out the mip size on chunk 0, all other mips are this size since not supercompressed.
+    // This throws off block alignment and gpu loading of ktx files from mmap.  I guess 3d textures
+    // and arrays can then load entire level in a single call.
+    bool isDstKTX1 = !info.isKTX2;
+    if (isDstKTX1 && chunk == 0) {
+        // some clarification on what imageSize means, but best to look at ktx codebase itself
+        // https://github.com/BinomialLLC/basis_universal/issues/40
 
-                // This is more memory than in-place, but the submips
-                // are only 1/3rd the memory of the main mip
-                mipPixels.resize(numPixels);
-                if (srcImage.pixelsFloat)
-                    mipPixelsFloat.resize(numPixels);
-                else if (srcImage.pixelsHalf)
-                    mipPixelsHalf.resize(numPixels);
+        // this contains all bytes at a mipLOD but not any padding
+        uint32_t levelSize = (uint32_t)mipStorageSize;
 
-                size_t pixelOffset = 0;
-                for (int32_t mipLevel = 1; mipLevel < numMipLevels; ++mipLevel) {
-                    ImageData& dstMipImage = dstMipImages[mipLevel];
-                    dstMipImage.isSRGB = dstImageData.isSRGB;
+        // this is size of one face for non-array cubes
+        // but for everything else, it's the numChunks * mipStorageSize
+        if (info.textureType != MyMTLTextureTypeCube) {
+            levelSize *= numChunks;
+        }
 
-                    dstMipImage.pixels = mipPixels.data() + pixelOffset;
-                    if (srcImage.pixelsFloat)
-                        dstMipImage.pixelsFloat = mipPixelsFloat.data() + pixelOffset;
-                    else if (srcImage.pixelsHalf)
-                        dstMipImage.pixelsHalf = mipPixelsHalf.data() + pixelOffset;
+        int32_t levelSizeOf = sizeof(levelSize);
+        assert(levelSizeOf == 4);
 
-                    mipper.mipmap(srcImage, dstMipImage);
+        if (!writeDataAtOffset((const uint8_t*)&levelSize, levelSizeOf, dstMipLevel.offset - levelSizeOf, dstFile, dstImage)) {
+            return false;
+        }
+    }
 
-                    // dst becomes src for next mipmap
-                    // preserve the isSRGB state
-                    bool isSRGBSrc = srcImage.isSRGB;
-                    srcImage = dstMipImage; // this is changing srcImage.pixels
-                    srcImage.isSRGB = isSRGBSrc;
+    // Note that default ktx alignment is 4, so r8u, r16f mips need to be padded out to 4 bytes
+    // may need to write these out row by row, and let fseek pad the rows to 4.
 
-                    pixelOffset += dstMipImage.width * dstMipImage.height;
-                }
+    if (!writeDataAtOffset(outputTexture.data.data(), mipStorageSize, mipChunkOffset, dstFile, dstImage)) {
+        return false;
+    }
 
-                // Now can run mip flooding on image
-                if (info.doMipflood) {
-                    mipper.mipflood(dstMipImages);
-                }
+    return true;
+}
 
-                // apply average channels, now that unique mips
-                bool isFloat = srcImage.pixelsHalf || srcImage.pixelsFloat;
-                if (!info.averageChannels.empty() && !isFloat) {
-                    for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
-                        ImageData& dstMipImage = dstMipImages[mipLevel];
+// Bounds the memory of the footprints and encoded bits kept for repeated blocks
+static const size_t kMaxBlockCacheBytes = 64 * 1024 * 1024;
 
-                        // this isn't applied to srgb data (what about premul?)
-                        averageChannelsInBlock(info.averageChannels.c_str(), dstImage,
-                                               dstMipImage);
-                    }
+bool KramEncoder::createMipsFromChunks(
+    ImageInfo& info,
+    Image& singleImage,
+    MipConstructData& data,
+    FILE* dstFile,
+    KTXImage& dstImage) const
+{
+    Timer totalTimer;
+
+    int32_t numChunks = (int32_t)data.chunkOffsets.size();
+    bool doPremultiply = info.hasAlpha && (info.isPremultiplied || info.isPrezero);
+
+    // run this across all the source data
+    // do this in-place before mips are generated
+    if (info.isHDR && doPremultiply) {
+        // here the source is float or half
+        if (info.isPrezero) {
+            for (const auto& pixel : singleImage.pixelsFloat()) {
+                float alpha = pixel.w;
+                float4& pixelChange = const_cast<float4&>(pixel);
+
+                // only premul at 0 alpha regions
+                if (alpha == 0.0f) {
+                    pixelChange *= alpha;
+                    pixelChange.w = alpha;
                 }
             }
         }
+        else {
+            for (const auto& pixel : singleImage.pixelsFloat()) {
+                float alpha = pixel.w;
+                float4& pixelChange = const_cast<float4&>(pixel);
+                pixelChange *= alpha;
+                pixelChange.w = alpha;
+            }
+        }
 
-        timerBuildMips.stop();
+        // or the source is half, so premul in float and store back
+        for (const auto& pixel : singleImage.pixelsHalf()) {
+            float4 pixelFloat = float4m(pixel);
+            float alpha = pixelFloat.w;
 
-        if (info.isVerbose) {
-            KLOGI("Image", "Chunk %d source %d miplevels in %0.3fms\n",
-                  chunk, numMipLevels,
-                  timerBuildMips.timeElapsedMillis());
+            // only premul at 0 alpha regions
+            if (info.isPrezero && alpha != 0.0f) {
+                continue;
+            }
+
+            pixelFloat *= alpha;
+            pixelFloat.w = alpha;
+
+            half4& pixelChange = const_cast<half4&>(pixel);
+            pixelChange = half4m(pixelFloat);
         }
+    }
+
+    const int32_t numMipLevels = (int32_t)dstImage.mipLevels.size();
 
-        //----------------------------------------------
+    // lives for the whole process, so contexts are only built once
+    AstcencContextCache& astcencContexts = gAstcencContexts;
 
-        for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
-            const auto& dstMipLevel = dstMipLevels[mipLevel];
-            ImageData& dstImageData = dstMipImages[mipLevel]; // TODO: fix const
+    // encoded blocks are only reused within this encode, since they depend on the settings
+    size_t numBlocks = 0;
+    int32_t blockSize = blockSizeOfFormat(info.pixelFormat);
+    for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+        numBlocks += dstImage.levelLength(mipLevel) / blockSize;
+    }
+    BlockCache blockCache(info.pixelFormat, info.quality, kMaxBlockCacheBytes, numBlocks);
+
+    // Each (chunk, mip) pair is encoded into its own output, and then written
+    // in the same order as the serial path, so the output is identical.
+    if (info.numJobs > 1) {
+        // kram serve passes in its pool, so commands don't each start threads
+        unique_ptr<task_system> localSystem;
+        if (!info.system) {
+            localSystem = make_unique<task_system>(info.numJobs);
+        }
+        task_system& system = info.system ? *info.system : *localSystem;
 
-            w = dstImageData.width;
-            h = dstImageData.height;
+        // limit memory by only building mips for a batch of chunks at a time
+        int32_t chunksPerBatch = std::min(numChunks, system.num_threads());
 
-            // size of one mip, not levelSize = numChunks * mipStorageSize
-            size_t mipStorageSize = dstMipLevel.length;
+        vector<ChunkMipData> chunkDatas;
+        chunkDatas.resize(chunksPerBatch);
 
-            // offset only valid for KTX and KTX2 w/o isCompressed
-            size_t mipChunkOffset = dstMipLevel.offset + chunk * mipStorageSize;
+        vector<TextureData> outputTextures;
+        outputTextures.resize(chunksPerBatch * numMipLevels);
 
-            Timer timerEncodeMips;
-            bool success =
-                compressMipLevel(info, dstImage,
-                                 dstImageData, outputTexture, mipStorageSize);
-            assert(success);
+        for (int32_t chunkStart = 0; chunkStart < numChunks; chunkStart += chunksPerBatch) {
+            int32_t numBatchChunks = std::min(chunksPerBatch, numChunks - chunkStart);
+
+            system.run_and_wait(numBatchChunks, [&](int32_t i) {
+                buildChunkMips(info, singleImage, data, dstImage, chunkStart + i, chunkDatas[i]);
+            });
+
+            std::atomic<bool> success(true);
+
+            auto encodeChunkMip = [&](int32_t i, int32_t mipLevel, task_system* bandSystem) {
+                ImageData& dstImageData = chunkDatas[i].dstMipImages[mipLevel];
+                size_t mipStorageSize = dstImage.mipLevels[mipLevel].length;
+
+                TextureData& outputTexture = outputTextures[i * numMipLevels + mipLevel];
+                outputTexture.width = dstImageData.width;
+                outputTexture.height = dstImageData.height;
+                outputTexture.data.resize(mipStorageSize);
+
+                Timer timerEncodeMips;
+                if (!compressMipLevel(info, dstImage,
+                                      dstImageData, outputTexture, mipStorageSize,
+                                      bandSystem, &astcencContexts, &blockCache)) {
+                    success = false;
+                    return;
+                }
 
-            if (success) {
                 if (info.isVerbose) {
-                    KLOGI("Image", "Compressed mipLevel %dx%d in %0.3fms\n", w, h,
+                    KLOGI("Image", "Compressed mipLevel %dx%d in %0.3fms\n",
+                          dstImageData.width, dstImageData.height,
                           timerEncodeMips.timeElapsedMillis());
                 }
+            };
+
+            // When there are fewer chunks than threads, the large mips are split
+            // into bands of block rows that are spread across all the threads.
+            // That's driven from this thread, since a task can't wait on other tasks.
+            int32_t numBandedMips = 0;
+            if (numBatchChunks < system.num_threads() && canEncodeInBands(info)) {
+                int32_t blockHeight = dstImage.blockDims().y;
+                for (; numBandedMips < numMipLevels; ++numBandedMips) {
+                    int32_t mipHeight = chunkDatas[0].dstMipImages[numBandedMips].height;
+                    int32_t numBlockRows = (mipHeight + blockHeight - 1) / blockHeight;
+                    if (numBlockRows < 2 * system.num_threads()) {
+                        break;
+                    }
+                }
             }
 
-            // Write out the mip size on chunk 0, all other mips are this size since not supercompressed.
-            // This throws off block alignment and gpu loading of ktx files from mmap.  I guess 3d textures
-            // and arrays can then load entire level in a single call.
-            bool isDstKTX1 = !info.isKTX2;
-            if (isDstKTX1 && chunk == 0) {
-                // some clarification on what imageSize means, but best to look at ktx codebase itself
-                // https://github.com/BinomialLLC/basis_universal/issues/40
+            for (int32_t mipLevel = 0; mipLevel < numBandedMips; ++mipLevel) {
+                for (int32_t i = 0; i < numBatchChunks; ++i) {
+                    encodeChunkMip(i, mipLevel, &system);
+                }
+            }
 
-                // this contains all bytes at a mipLOD but not any padding
-                uint32_t levelSize = (uint32_t)mipStorageSize;
+            // Encode the largest remaining mips first, so the small ones fill in at the end.
+            int32_t numItems = numBatchChunks * (numMipLevels - numBandedMips);
 
-                // this is size of one face for non-array cubes
-                // but for everything else, it's the numChunks * mipStorageSize
-                if (info.textureType != MyMTLTextureTypeCube) {
-                    levelSize *= numChunks;
+            system.run_and_wait(numItems, [&](int32_t item) {
+                int32_t mipLevel = numBandedMips + item / numBatchChunks;
+                int32_t i = item % numBatchChunks;
+
+                encodeChunkMip(i, mipLevel, nullptr);
+            });
+
+            // don't write out levels that failed to encode
+            if (!success) {
+                return false;
+            }
+
+            // writes stay on this thread, since they seek within a single file
+            for (int32_t i = 0; i < numBatchChunks; ++i) {
+                for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+                    if (!writeChunkMip(info, numChunks, chunkStart + i, mipLevel,
+                                       outputTextures[i * numMipLevels + mipLevel],
+                                       dstFile, dstImage)) {
+                        return false;
+                    }
                 }
+            }
+        }
+    }
+    else {
+        // set the structure fields and allocate it, only need enough to hold single
+        // mip (reuses mem) also because mips are written out to file after
+        // generated.
+        TextureData outputTexture;
+        outputTexture.width = dstImage.width;
+        outputTexture.height = dstImage.height;
+        outputTexture.data.resize(dstImage.mipLengthLargest());
+
+        ChunkMipData chunkData;
+
+        for (int32_t chunk = 0; chunk < numChunks; ++chunk) {
+            buildChunkMips(info, singleImage, data, dstImage, chunk, chunkData);
 
-                int32_t levelSizeOf = sizeof(levelSize);
-                assert(levelSizeOf == 4);
+            for (int32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+                ImageData& dstImageData = chunkData.dstMipImages[mipLevel]; // TODO: fix const
 
-                if (!writeDataAtOffset((const uint8_t*)&levelSize, levelSizeOf, dstMipLevel.offset - levelSizeOf, dstFile, dstImage)) {
+                // size of one mip, not levelSize = numChunks * mipStorageSize
+                size_t mipStorageSize = dstImage.mipLevels[mipLevel].length;
+
+                Timer timerEncodeMips;
+                bool success =
+                    compressMipLevel(info, dstImage,
+                                     dstImageData, outputTexture, mipStorageSize,
+                                     nullptr, &astcencContexts, &blockCache);
+                if (!success) {
                     return false;
                 }
-            }
 
-            // Note that default ktx alignment is 4, so r8u, r16f mips need to be padded out to 4 bytes
-            // may need to write these out row by row, and let fseek pad the rows to 4.
+                if (info.isVerbose) {
+                    KLOGI("Image", "Compressed mipLevel %dx%d in %0.3fms\n",
+                          dstImageData.width, dstImageData.height,
+                          timerEncodeMips.timeElapsedMillis());
+                }
 
-            if (!writeDataAtOffset(outputTexture.data.data(), mipStorageSize, mipChunkOffset, dstFile, dstImage)) {
-                return false;
+                if (!writeChunkMip(info, numChunks, chunk, mipLevel, outputTexture, dstFile, dstImage)) {
+                    return false;
+                }
             }
         }
     }
 
     if (info.isVerbose) {
+        blockCache.logStats();
+
         KLOGI("Image", "Total time in %0.3fms\n",
               totalTimer.timeElapsedMillis());
     }
@@ -2380,15 +2979,326 @@ bool KramEncoder::createMipsFromChunks(
     return true;
 }
 
+#if COMPILE_BCENC
+// these must be called once before any compress call, and they fill
+// global tables, so can't be called while other threads are encoding
+static void initBcenc()
+{
+    static std::once_flag initFlag;
+    std::call_once(initFlag, []() {
+        rgbcx::init();
+        bc7enc_compress_block_init();
+    });
+}
+
+// Maps quality 0-100 to the bc7enc settings, and to the rgbcx level for bc1/3.
+// The bc7enc weights are set for every format, since refine measures error with them.
+static void initBcencParams(const ImageInfo& info, int32_t quality,
+                            bc7enc_compress_block_params& bc7params,
+                            uint32_t& bc1QualityLevel)
+{
+    bc1QualityLevel = 0;
+
+    bc7enc_compress_block_params_init(&bc7params);
+    if (!info.isColorWeighted) {
+        bc7enc_compress_block_params_init_linear_weights(&bc7params);
+    }
+
+    if (info.pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm ||
+        info.pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm_sRGB) {
+        uint32_t uberLevel = 0;
+        uint32_t maxPartitions = 0;
+
+        // Can see timings on the home page here.  bc7enc isn't vectorized.
+        // https://github.com/richgel999/bc7enc16
+
+        if (quality <= 10) {
+            uberLevel = 0;
+            maxPartitions = 0;
+            bc7params.m_try_least_squares = false;
+            bc7params.m_mode17_partition_estimation_filterbank = true;
+        }
+        else if (quality <= 40) {
+            uberLevel = 0;
+            maxPartitions = 16;
+            bc7params.m_try_least_squares = false;
+            bc7params.m_mode17_partition_estimation_filterbank = true;
+        }
+        else if (quality <= 90) {
+            uberLevel = 1;
+            maxPartitions = 64;
+            bc7params.m_try_least_squares = true; // true = 0.7s on test case
+            bc7params.m_mode17_partition_estimation_filterbank = true;
+        }
+        else {
+            uberLevel = 4;
+            maxPartitions = 64;
+            bc7params.m_try_least_squares = true;
+            bc7params.m_mode17_partition_estimation_filterbank = true;
+        }
+
+        bc7params.m_uber_level = std::min(uberLevel, (uint32_t)BC7ENC_MAX_UBER_LEVEL);
+        bc7params.m_max_partitions = std::min(maxPartitions, (uint32_t)BC7ENC_MAX_PARTITIONS);
+    }
+    else if (info.pixelFormat == MyMTLPixelFormatBC1_RGBA ||
+             info.pixelFormat == MyMTLPixelFormatBC1_RGBA_sRGB ||
+             info.pixelFormat == MyMTLPixelFormatBC3_RGBA ||
+             info.pixelFormat == MyMTLPixelFormatBC3_RGBA_sRGB) {
+        if (quality <= 10) {
+            bc1QualityLevel = (rgbcx::MAX_LEVEL * 1) / 4;
+        }
+        else if (quality <= 50) {
+            bc1QualityLevel = (rgbcx::MAX_LEVEL * 2) / 4;
+        }
+        else if (quality <= 90) {
+            bc1QualityLevel = (rgbcx::MAX_LEVEL * 3) / 4;
+        }
+        else {
+            bc1QualityLevel = rgbcx::MAX_LEVEL;
+        }
+    }
+}
+
+// bc1/3/7 blocks can be refined, since those encoders have levels
+static bool isBcencRefineFormat(MyMTLPixelFormat format)
+{
+    switch (format) {
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+        case MyMTLPixelFormatBC3_RGBA:
+        case MyMTLPixelFormatBC3_RGBA_sRGB:
+        case MyMTLPixelFormatBC7_RGBAUnorm:
+        case MyMTLPixelFormatBC7_RGBAUnorm_sRGB:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Weighted squared error of a decoded bc1/3/7 block against its source pixels.
+// This uses the bc7enc metric, so color weighted content is measured in YCbCr
+// with its perceptual weights.  bc1 is encoded opaque, so its alpha isn't counted.
+static uint64_t bcencBlockError(MyMTLPixelFormat format, const uint8_t* block, const Color* srcPixels,
+                                const bc7enc_compress_block_params& params)
+{
+    Color pixels[16];
+    bool hasAlpha = true;
+
+    switch (format) {
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+            rgbcx::unpack_bc1(block, pixels);
+            hasAlpha = false;
+            break;
+        case MyMTLPixelFormatBC3_RGBA:
+        case MyMTLPixelFormatBC3_RGBA_sRGB:
+            rgbcx::unpack_bc3(block, pixels);
+            break;
+        default:
+            bc7decomp::unpack_bc7(block, (bc7decomp::color_rgba*)pixels);
+            break;
+    }
+
+    const uint32_t* weights = params.m_weights;
+
+    uint64_t error = 0;
+    for (int32_t i = 0; i < 16; ++i) {
+        const Color& c1 = pixels[i];
+        const Color& c2 = srcPixels[i];
+
+        int32_t dr, dg, db;
+        if (params.m_perceptual) {
+            int32_t l1 = c1.r * 109 + c1.g * 366 + c1.b * 37;
+            int32_t cr1 = ((int32_t)c1.r << 9) - l1;
+            int32_t cb1 = ((int32_t)c1.b << 9) - l1;
+            int32_t l2 = c2.r * 109 + c2.g * 366 + c2.b * 37;
+            int32_t cr2 = ((int32_t)c2.r << 9) - l2;
+            int32_t cb2 = ((int32_t)c2.b << 9) - l2;
+            dr = (l1 - l2) >> 8;
+            dg = (cr1 - cr2) >> 8;
+            db = (cb1 - cb2) >> 8;
+        }
+        else {
+            dr = (int32_t)c1.r - (int32_t)c2.r;
+            dg = (int32_t)c1.g - (int32_t)c2.g;
+            db = (int32_t)c1.b - (int32_t)c2.b;
+        }
+        error += weights[0] * (uint64_t)(dr * dr) + weights[1] * (uint64_t)(dg * dg) + weights[2] * (uint64_t)(db * db);
+
+        if (hasAlpha) {
+            int32_t da = (int32_t)c1.a - (int32_t)c2.a;
+            error += weights[3] * (uint64_t)(da * da);
+        }
+    }
+    return error;
+}
+#endif
+
+// Copies the block at x,y into footprint, clamping the edge pixels like the encoders.
+static void copyBlockFootprint(const Color* srcPixels, int32_t w, int32_t h,
+                               int32_t x, int32_t y, Int2 blockDims, Color* footprint)
+{
+    for (int32_t by = 0; by < blockDims.y; ++by) {
+        int32_t yy = std::min(y + by, h - 1);
+        for (int32_t bx = 0; bx < blockDims.x; ++bx) {
+            int32_t xx = std::min(x + bx, w - 1);
+            footprint[by * blockDims.x + bx] = srcPixels[yy * w + xx];
+        }
+    }
+}
+
 bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
                                    ImageData& mipImage, TextureData& outputTexture,
-                                   int32_t mipStorageSize) const
+                                   int32_t mipStorageSize,
+                                   task_system* system,
+                                   AstcencContextCache* astcencContexts,
+                                   BlockCache* blockCache) const
+{
+    int32_t w = mipImage.width;
+    int32_t h = mipImage.height;
+
+    const Color* srcPixelData = mipImage.pixels;
+
+    int32_t numBlocks = image.blockCount(w, h);
+    int32_t blockSize = image.blockSize();
+    Int2 blockDims = image.blockDims();
+
+    int32_t blocks_x = (w + blockDims.x - 1) / blockDims.x;
+    int32_t blocks_y = (h + blockDims.y - 1) / blockDims.y;
+
+    // whole blocks that are inside the mip
+    int32_t fullBlocks_x = w / blockDims.x;
+    int32_t fullBlocks_y = h / blockDims.y;
+
+    uint8_t* dstData = outputTexture.data.data();
+
+    // Solid blocks are encoded up front from tables, and the encoders skip them.
+    // ATE encodes whole images, and astcenc already finds constant blocks.
+    bool useSolidBlocks = isSolidBlockFormat(info.pixelFormat) &&
+                          ((info.isETC && info.useEtcenc) ||
+                           (info.isBC && (info.useBcenc || info.useSquish)));
+
+    // Repeated blocks are copied from earlier mips and chunks, or from their first
+    // copy in this mip.  The encoders that work in bands are the ones that can skip
+    // blocks.  Snorm BC endpoints are remapped in place after the encode, so
+    // cached bits would get remapped twice.  Partial blocks on the right and bottom
+    // edges aren't cached, since some encoders ignore the pixels past the edge.
+    bool useBlockCache = blockCache && canEncodeInBands(info) &&
+                         !info.isHDR && !info.isSigned;
+
+    // a byte per block, nonzero blocks are already encoded
+    vector<uint8_t> skipBlocks;
+    if (useSolidBlocks || useBlockCache) {
+        skipBlocks.resize(numBlocks);
+    }
+
+    if (useSolidBlocks) {
+#if COMPILE_BCENC
+        // bc1/3 use the rgbcx single color tables
+        initBcenc();
+#endif
+        // squish bc1 has transparent pixels, bcenc bc1 is opaque
+        bool hasBC1Alpha = info.useSquish && !info.useBcenc;
+
+        std::atomic<int32_t> numSolidBlocks(0);
+        processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+            numSolidBlocks += encodeSolidBlocks(info.pixelFormat, srcPixelData, w, h,
+                                                blockRowStart, blockRowEnd, hasBC1Alpha,
+                                                dstData, skipBlocks.data());
+        });
+
+        if (info.isVerbose) {
+            KLOGI("Image", "Skipped %d of %d solid blocks in mipLevel %dx%d\n",
+                  numSolidBlocks.load(), numBlocks, w, h);
+        }
+    }
+
+    // per block, the cache entry it claimed, or the block in this mip it repeats
+    const uint32_t kNoEntry = 0xFFFFFFFF;
+    vector<uint32_t> claimedEntries;
+    vector<int32_t> repeatedBlocks;
+
+    if (useBlockCache) {
+        assert(blockCache->format() == info.pixelFormat);
+        assert(blockCache->quality() == info.quality);
+
+        claimedEntries.resize(numBlocks, kNoEntry);
+        repeatedBlocks.resize(numBlocks, -1);
+
+        uint32_t mipId = blockCache->beginMip();
+
+        processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+            // largest astc block is 12x12
+            Color footprint[12 * 12];
+            assert(blockDims.x * blockDims.y <= 12 * 12);
+
+            int32_t byEnd = std::min(blockRowEnd, fullBlocks_y);
+            for (int32_t by = blockRowStart; by < byEnd; ++by) {
+                for (int32_t bx = 0; bx < fullBlocks_x; ++bx) {
+                    int32_t b0 = by * blocks_x + bx;
+                    if (skipBlocks[b0]) {
+                        continue;
+                    }
+
+                    copyBlockFootprint(srcPixelData, w, h, bx * blockDims.x, by * blockDims.y,
+                                       blockDims, footprint);
+
+                    uint32_t entryIndex = kNoEntry;
+                    int32_t srcBlockIndex = -1;
+                    switch (blockCache->lookup(mipId, b0, footprint, dstData + b0 * blockSize,
+                                               entryIndex, srcBlockIndex)) {
+                        case BlockCache::kHit:
+                            skipBlocks[b0] = 1;
+                            break;
+                        case BlockCache::kDuplicate:
+                            skipBlocks[b0] = 1;
+                            repeatedBlocks[b0] = srcBlockIndex;
+                            break;
+                        case BlockCache::kClaimed:
+                            claimedEntries[b0] = entryIndex;
+                            break;
+                        case BlockCache::kMiss:
+                            break;
+                    }
+                }
+            }
+        });
+    }
+
+    if (!encodeMipLevel(info, image, mipImage, outputTexture, mipStorageSize,
+                        system, astcencContexts,
+                        skipBlocks.empty() ? nullptr : skipBlocks.data())) {
+        return false;
+    }
+
+    if (useBlockCache) {
+        // the first copy of each repeated block is encoded now
+        for (int32_t b0 = 0; b0 < numBlocks; ++b0) {
+            if (repeatedBlocks[b0] >= 0) {
+                memcpy(dstData + b0 * blockSize, dstData + repeatedBlocks[b0] * blockSize, blockSize);
+            }
+            else if (claimedEntries[b0] != kNoEntry) {
+                blockCache->complete(claimedEntries[b0], dstData + b0 * blockSize);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool KramEncoder::encodeMipLevel(const ImageInfo& info, KTXImage& image,
+                                 ImageData& mipImage, TextureData& outputTexture,
+                                 int32_t mipStorageSize,
+                                 task_system* system,
+                                 AstcencContextCache* astcencContexts,
+                                 const uint8_t* skipBlocks) const
 {
     int32_t w = mipImage.width;
     int32_t h = mipImage.height;
 
     const Color* srcPixelData = mipImage.pixels;
     const float4* srcPixelDataFloat4 = mipImage.pixelsFloat;
+    const half4* srcPixelDataHalf4 = mipImage.pixelsHalf;
 
     // TODO: try to elim KTXImage passed into this
     // only use of image (can determine this from format)
@@ -2439,11 +3349,13 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
 
                 half* dst = (half*)outputTexture.data.data();
 
+                // mips are usually already half, else convert each pixel
+                const half4* srcHalf = mipImage.pixelsHalf;
                 const float4* src = mipImage.pixelsFloat;
 
                 // assumes we don't need to align r16f rows to 4 bytes
                 for (int32_t i = 0, iEnd = w * h; i < iEnd; ++i) {
-                    half4 src16 = half4m(src[0]);
+                    half4 src16 = srcHalf ? srcHalf[i] : half4m(src[i]);
 
                     switch (count) {
                         case 4:
@@ -2469,21 +3381,24 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
 
                 float* dst = (float*)outputTexture.data.data();
 
+                const half4* srcHalf = mipImage.pixelsHalf;
                 const float4* src = mipImage.pixelsFloat;
 
                 for (int32_t i = 0, iEnd = w * h; i < iEnd; ++i) {
+                    float4 src32 = srcHalf ? float4m(srcHalf[i]) : src[i];
+
                     switch (count) {
                         case 4:
-                            dst[count * i + 3] = src[i].w;
+                            dst[count * i + 3] = src32.w;
                             [[fallthrough]];
                         case 3:
-                            dst[count * i + 2] = src[i].z;
+                            dst[count * i + 2] = src32.z;
                             [[fallthrough]];
                         case 2:
-                            dst[count * i + 1] = src[i].y;
+                            dst[count * i + 1] = src32.y;
                             [[fallthrough]];
                         case 1:
-                            dst[count * i + 0] = src[i].x;
+                            dst[count * i + 0] = src32.x;
                     }
                 }
 
@@ -2564,18 +3479,38 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
                     break;
             }
 
-            Etc::Image imageEtc(format, (const Etc::ColorR8G8B8A8*)srcPixelData, w, h, errMetric);
-
-            imageEtc.SetVerboseOutput(info.isVerbose);
             Etc::Image::EncodingStatus status;
 
             // TODO: have encoder setting to enable multipass
             bool doSinglepass = true; // || (effort == 100.0f); // problem is 100% quality also runs all passes
             if (doSinglepass) {
-                // single pass iterates each block until done
-                status = imageEtc.EncodeSinglepass(effort, outputTexture.data.data());
+                // single pass iterates each block until done, so each band of rows
+                // can be its own image that writes to its part of the output
+                const int32_t blockDim = 4;
+                int32_t blocks_x = (w + blockDim - 1) / blockDim;
+                int32_t blocks_y = (h + blockDim - 1) / blockDim;
+
+                // status bits are or'd together like AddToEncodingStatus
+                std::atomic<uint32_t> bandStatus(Etc::Image::SUCCESS);
+
+                processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                    int32_t y0 = blockRowStart * blockDim;
+                    int32_t bandHeight = std::min(h, blockRowEnd * blockDim) - y0;
+
+                    Etc::Image imageEtc(format, (const Etc::ColorR8G8B8A8*)(srcPixelData + y0 * w), w, bandHeight, errMetric);
+                    imageEtc.SetVerboseOutput(info.isVerbose);
+
+                    uint8_t* dstData = outputTexture.data.data() + blockRowStart * blocks_x * blockSize;
+                    const uint8_t* bandSkipBlocks = skipBlocks ? skipBlocks + blockRowStart * blocks_x : nullptr;
+                    bandStatus |= (uint32_t)imageEtc.EncodeSinglepass(effort, dstData, bandSkipBlocks);
+                });
+
+                status = (Etc::Image::EncodingStatus)bandStatus.load();
             }
             else {
+                Etc::Image imageEtc(format, (const Etc::ColorR8G8B8A8*)srcPixelData, w, h, errMetric);
+                imageEtc.SetVerboseOutput(info.isVerbose);
+
                 // multipass iterates all blocks once, then a percentage of the blocks with highest errors
                 // if that percentage isn't already reached in the first pass.  Below a certain block count
                 // all blocks are processed until done.  So only the largest mips have less quality.
@@ -2602,188 +3537,236 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
         }
 #if COMPILE_BCENC
         else if (info.useBcenc) {
-            // these must be called once before any compress call, might be able to move out to ctor
-            rgbcx::init();
-            bc7enc_compress_block_init();
+            initBcenc();
+
+            // With refinement, all blocks are encoded at the fastest level first,
+            // and then the worst blocks are encoded again at the highest level.
+            bool useRefine = info.refinePercent > 0 && isBcencRefineFormat(info.pixelFormat);
 
             bc7enc_compress_block_params bc7params;
             uint32_t bc1QualityLevel = 0;
-            uint32_t bc3QualityLevel = 0;
-
-            if (info.pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm ||
-                info.pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm_sRGB) {
-                bc7enc_compress_block_params_init(&bc7params);
-                if (!info.isColorWeighted) {
-                    bc7enc_compress_block_params_init_linear_weights(&bc7params);
-                }
-
-                uint32_t uberLevel = 0;
-                uint32_t maxPartitions = 0;
-
-                // Can see timings on the home page here.  bc7enc isn't vectorized.
-                // https://github.com/richgel999/bc7enc16
-
-                if (info.quality <= 10) {
-                    uberLevel = 0;
-                    maxPartitions = 0;
-                    bc7params.m_try_least_squares = false;
-                    bc7params.m_mode17_partition_estimation_filterbank = true;
-                }
-                else if (info.quality <= 40) {
-                    uberLevel = 0;
-                    maxPartitions = 16;
-                    bc7params.m_try_least_squares = false;
-                    bc7params.m_mode17_partition_estimation_filterbank = true;
-                }
-                else if (info.quality <= 90) {
-                    uberLevel = 1;
-                    maxPartitions = 64;
-                    bc7params.m_try_least_squares = true; // true = 0.7s on test case
-                    bc7params.m_mode17_partition_estimation_filterbank = true;
-                }
-                else {
-                    uberLevel = 4;
-                    maxPartitions = 64;
-                    bc7params.m_try_least_squares = true;
-                    bc7params.m_mode17_partition_estimation_filterbank = true;
-                }
-
-                bc7params.m_uber_level = std::min(uberLevel, (uint32_t)BC7ENC_MAX_UBER_LEVEL);
-                bc7params.m_max_partitions = std::min(maxPartitions, (uint32_t)BC7ENC_MAX_PARTITIONS);
-            }
-            else if (info.pixelFormat == MyMTLPixelFormatBC1_RGBA ||
-                     info.pixelFormat == MyMTLPixelFormatBC1_RGBA_sRGB ||
-                     info.pixelFormat == MyMTLPixelFormatBC3_RGBA ||
-                     info.pixelFormat == MyMTLPixelFormatBC3_RGBA_sRGB) {
-                if (info.quality <= 10) {
-                    bc1QualityLevel = (rgbcx::MAX_LEVEL * 1) / 4;
-                }
-                else if (info.quality <= 50) {
-                    bc1QualityLevel = (rgbcx::MAX_LEVEL * 2) / 4;
-                }
-                else if (info.quality <= 90) {
-                    bc1QualityLevel = (rgbcx::MAX_LEVEL * 3) / 4;
-                }
-                else {
-                    bc1QualityLevel = rgbcx::MAX_LEVEL;
-                }
-                bc3QualityLevel = bc1QualityLevel;
-            }
+            initBcencParams(info, useRefine ? 0 : info.quality, bc7params, bc1QualityLevel);
+            uint32_t bc3QualityLevel = bc1QualityLevel;
 
             uint8_t* dstData = (uint8_t*)outputTexture.data.data();
 
             const int32_t blockDim = 4;
             int32_t blocks_x = (w + blockDim - 1) / blockDim;
-            //int32_t blocks_y = (h + blockDim - 1) / blockDim;
-            for (int32_t y = 0; y < h; y += blockDim) {
-                for (int32_t x = 0; x < w; x += blockDim) {
-                    // Have to copy to temp block, since encode doesn't test w/h edges
-                    // copy src to 4x4 clamping the edge pixels
-                    // TODO: do clamped edge pixels get weighted more then on non-multiple of 4 images ?
-                    Color srcPixelCopyAsBlock[blockDim * blockDim];
-                    for (int32_t by = 0; by < blockDim; ++by) {
-                        int32_t yy = y + by;
-                        if (yy >= h) {
-                            yy = h - 1;
+            int32_t blocks_y = (h + blockDim - 1) / blockDim;
+
+            // error of each block from the first pass, skipped blocks stay at 0
+            vector<uint64_t> blockErrors;
+            if (useRefine) {
+                blockErrors.resize(numBlocks);
+            }
+
+            // bands of block rows write to disjoint parts of dstData
+            processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                int32_t yEnd = std::min(h, blockRowEnd * blockDim);
+                for (int32_t y = blockRowStart * blockDim; y < yEnd; y += blockDim) {
+                    for (int32_t x = 0; x < w; x += blockDim) {
+                        int32_t bx = x / blockDim;
+                        int32_t by = y / blockDim;
+                        int32_t b0 = by * blocks_x + bx;
+                        uint8_t* dstBlock = &dstData[b0 * blockSize];
+
+                        if (skipBlocks && skipBlocks[b0]) {
+                            continue;
                         }
-                        for (int32_t bx = 0; bx < blockDim; ++bx) {
-                            int32_t xx = x + bx;
-                            if (xx >= w) {
-                                xx = w - 1;
+
+                        // Have to copy to temp block, since encode doesn't test w/h edges
+                        // copy src to 4x4 clamping the edge pixels
+                        // TODO: do clamped edge pixels get weighted more then on non-multiple of 4 images ?
+                        Color srcPixelCopyAsBlock[blockDim * blockDim];
+                        copyBlockFootprint(srcPixelData, w, h, x, y, blockDims, srcPixelCopyAsBlock);
+
+                        const uint8_t* srcPixelCopy = (const uint8_t*)(srcPixelCopyAsBlock);
+
+                        // bc7enc is not setting pbit on bc7 mode6 and doesn's support opaque mode3 yet
+                        // , so opaque textures repro as 254 alpha on Toof-a.png.
+                        // ate sets pbits on mode 6 for same block.  Also fixed mip weights in non-pow2 mipper.
+
+                        // bool doPrintBlock = false;
+                        // if (bx == 8 && by == 1) {
+                        //     int32_t bp = 0;
+                        //     bp = bp;
+                        //     doPrintBlock = true;
+                        // }
+
+                        // could tie to quality parameter, high quality uses the two
+                        // modes of bc3/4/5.
+                        bool useHighQuality = true;
+
+                        switch (info.pixelFormat) {
+                            case MyMTLPixelFormatBC1_RGBA:
+                            case MyMTLPixelFormatBC1_RGBA_sRGB: {
+                                rgbcx::encode_bc1(bc1QualityLevel, dstBlock,
+                                                  srcPixelCopy, false, false);
+                                break;
+                            }
+                            case MyMTLPixelFormatBC3_RGBA:
+                            case MyMTLPixelFormatBC3_RGBA_sRGB: {
+                                if (useHighQuality)
+                                    rgbcx::encode_bc3_hq(bc3QualityLevel, dstBlock, srcPixelCopy);
+                                else
+                                    rgbcx::encode_bc3(bc3QualityLevel, dstBlock, srcPixelCopy);
+                                break;
                             }
 
-                            srcPixelCopyAsBlock[by * blockDim + bx] = srcPixelData[yy * w + xx];
-                        }
-                    }
+                            case MyMTLPixelFormatBC4_RUnorm:
+                            case MyMTLPixelFormatBC4_RSnorm: {
+                                if (useHighQuality)
+                                    rgbcx::encode_bc4_hq(dstBlock, srcPixelCopy);
+                                else
+                                    rgbcx::encode_bc4(dstBlock, srcPixelCopy);
+                                break;
+                            }
 
-                    const uint8_t* srcPixelCopy = (const uint8_t*)(srcPixelCopyAsBlock);
+                            case MyMTLPixelFormatBC5_RGUnorm:
+                            case MyMTLPixelFormatBC5_RGSnorm: {
+                                if (useHighQuality)
+                                    rgbcx::encode_bc5_hq(dstBlock, srcPixelCopy);
+                                else
+                                    rgbcx::encode_bc5(dstBlock, srcPixelCopy);
+                                break;
+                            }
 
-                    int32_t bx = x / blockDim;
-                    int32_t by = y / blockDim;
-                    int32_t b0 = by * blocks_x + bx;
-                    uint8_t* dstBlock = &dstData[b0 * blockSize];
-
-                    // bc7enc is not setting pbit on bc7 mode6 and doesn's support opaque mode3 yet
-                    // , so opaque textures repro as 254 alpha on Toof-a.png.
-                    // ate sets pbits on mode 6 for same block.  Also fixed mip weights in non-pow2 mipper.
-
-                    // bool doPrintBlock = false;
-                    // if (bx == 8 && by == 1) {
-                    //     int32_t bp = 0;
-                    //     bp = bp;
-                    //     doPrintBlock = true;
-                    // }
-
-                    // could tie to quality parameter, high quality uses the two
-                    // modes of bc3/4/5.
-                    bool useHighQuality = true;
-
-                    switch (info.pixelFormat) {
-                        case MyMTLPixelFormatBC1_RGBA:
-                        case MyMTLPixelFormatBC1_RGBA_sRGB: {
-                            rgbcx::encode_bc1(bc1QualityLevel, dstBlock,
-                                              srcPixelCopy, false, false);
-                            break;
-                        }
-                        case MyMTLPixelFormatBC3_RGBA:
-                        case MyMTLPixelFormatBC3_RGBA_sRGB: {
-                            if (useHighQuality)
-                                rgbcx::encode_bc3_hq(bc3QualityLevel, dstBlock, srcPixelCopy);
-                            else
-                                rgbcx::encode_bc3(bc3QualityLevel, dstBlock, srcPixelCopy);
-                            break;
+#if COMPILE_COMP
+                            case MyMTLPixelFormatBC6H_RGBUfloat:
+                            case MyMTLPixelFormatBC6H_RGBFloat: {
+                                CMP_BC6H_BLOCK_PARAMETERS options;
+                                options.isSigned = info.isSigned;
+
+                                BC6HBlockEncoder encoderCompressenator(options);
+
+                                // TODO: this needs HDR data
+                                float srcPixelCopyFloat[16][4];
+                                for (int i = 0; i < 16; ++i) {
+                                    srcPixelCopyFloat[i][0] = srcPixelCopy[i * 4 + 0];
+                                    srcPixelCopyFloat[i][1] = srcPixelCopy[i * 4 + 1];
+                                    srcPixelCopyFloat[i][2] = srcPixelCopy[i * 4 + 2];
+                                    srcPixelCopyFloat[i][3] = 1.0f;
+                                }
+                                encoderCompressenator.CompressBlock(srcPixelCopyFloat, dstBlock);
+                                break;
+                            }
+#endif
+                            case MyMTLPixelFormatBC7_RGBAUnorm:
+                            case MyMTLPixelFormatBC7_RGBAUnorm_sRGB: {
+                                bc7enc_compress_block(dstBlock, srcPixelCopy, &bc7params);
+
+                                // if (doPrintBlock) {
+                                //     printBCBlock(dstBlock, info.pixelFormat);
+                                // }
+                                break;
+                            }
+                            default: {
+                                assert(false);
+                            }
                         }
 
-                        case MyMTLPixelFormatBC4_RUnorm:
-                        case MyMTLPixelFormatBC4_RSnorm: {
-                            if (useHighQuality)
-                                rgbcx::encode_bc4_hq(dstBlock, srcPixelCopy);
-                            else
-                                rgbcx::encode_bc4(dstBlock, srcPixelCopy);
-                            break;
+                        if (useRefine) {
+                            blockErrors[b0] = bcencBlockError(info.pixelFormat, dstBlock, srcPixelCopyAsBlock, bc7params);
                         }
+                    }
+                }
+            });
+
+            if (useRefine) {
+                // find the error of the worst refinePercent of the blocks with any error
+                vector<uint64_t> sortedErrors;
+                sortedErrors.reserve(numBlocks);
+                for (uint64_t error : blockErrors) {
+                    if (error > 0) {
+                        sortedErrors.push_back(error);
+                    }
+                }
 
-                        case MyMTLPixelFormatBC5_RGUnorm:
-                        case MyMTLPixelFormatBC5_RGSnorm: {
-                            if (useHighQuality)
-                                rgbcx::encode_bc5_hq(dstBlock, srcPixelCopy);
-                            else
-                                rgbcx::encode_bc5(dstBlock, srcPixelCopy);
-                            break;
+                int32_t numErrorBlocks = (int32_t)sortedErrors.size();
+                int32_t numRefineBlocks = (numErrorBlocks * info.refinePercent + 99) / 100;
+
+                if (numRefineBlocks > 0) {
+                    auto thresholdIt = sortedErrors.begin() + (numErrorBlocks - numRefineBlocks);
+                    std::nth_element(sortedErrors.begin(), thresholdIt, sortedErrors.end());
+                    uint64_t errorThreshold = *thresholdIt;
+
+                    // Blocks tied at the threshold could go over the count, so only the
+                    // first of those in block order are kept.  Blocks that aren't refined
+                    // have their error zeroed.  This is serial, so the output is the same
+                    // for any number of jobs.
+                    int32_t numAboveThreshold = 0;
+                    for (uint64_t error : blockErrors) {
+                        if (error > errorThreshold) {
+                            numAboveThreshold++;
                         }
+                    }
 
-#if COMPILE_COMP
-                        case MyMTLPixelFormatBC6H_RGBUfloat:
-                        case MyMTLPixelFormatBC6H_RGBFloat: {
-                            CMP_BC6H_BLOCK_PARAMETERS options;
-                            options.isSigned = info.isSigned;
-
-                            BC6HBlockEncoder encoderCompressenator(options);
-
-                            // TODO: this needs HDR data
-                            float srcPixelCopyFloat[16][4];
-                            for (int i = 0; i < 16; ++i) {
-                                srcPixelCopyFloat[i][0] = srcPixelCopy[i * 4 + 0];
-                                srcPixelCopyFloat[i][1] = srcPixelCopy[i * 4 + 1];
-                                srcPixelCopyFloat[i][2] = srcPixelCopy[i * 4 + 2];
-                                srcPixelCopyFloat[i][3] = 1.0f;
+                    int32_t numTiesLeft = numRefineBlocks - numAboveThreshold;
+                    for (uint64_t& error : blockErrors) {
+                        if (error < errorThreshold) {
+                            error = 0;
+                        }
+                        else if (error == errorThreshold) {
+                            if (numTiesLeft > 0) {
+                                numTiesLeft--;
+                            }
+                            else {
+                                error = 0;
                             }
-                            encoderCompressenator.CompressBlock(srcPixelCopyFloat, dstBlock);
-                            break;
                         }
-#endif
-                        case MyMTLPixelFormatBC7_RGBAUnorm:
-                        case MyMTLPixelFormatBC7_RGBAUnorm_sRGB: {
-                            bc7enc_compress_block(dstBlock, srcPixelCopy, &bc7params);
+                    }
 
-                            // if (doPrintBlock) {
-                            //     printBCBlock(dstBlock, info.pixelFormat);
-                            // }
-                            break;
-                        }
-                        default: {
-                            assert(false);
+                    bc7enc_compress_block_params bc7paramsRefine;
+                    uint32_t bc1QualityLevelRefine = 0;
+                    initBcencParams(info, 100, bc7paramsRefine, bc1QualityLevelRefine);
+
+                    std::atomic<int32_t> numRefined(0);
+                    std::atomic<int32_t> numImproved(0);
+
+                    processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                        for (int32_t by = blockRowStart; by < blockRowEnd; ++by) {
+                            for (int32_t bx = 0; bx < blocks_x; ++bx) {
+                                int32_t b0 = by * blocks_x + bx;
+                                uint64_t error = blockErrors[b0];
+                                if (error == 0) {
+                                    continue;
+                                }
+
+                                Color srcPixelCopyAsBlock[blockDim * blockDim];
+                                copyBlockFootprint(srcPixelData, w, h, bx * blockDim, by * blockDim,
+                                                   blockDims, srcPixelCopyAsBlock);
+                                const uint8_t* srcPixelCopy = (const uint8_t*)(srcPixelCopyAsBlock);
+
+                                uint8_t refinedBlock[16];
+                                switch (info.pixelFormat) {
+                                    case MyMTLPixelFormatBC1_RGBA:
+                                    case MyMTLPixelFormatBC1_RGBA_sRGB:
+                                        rgbcx::encode_bc1(bc1QualityLevelRefine, refinedBlock,
+                                                          srcPixelCopy, false, false);
+                                        break;
+                                    case MyMTLPixelFormatBC3_RGBA:
+                                    case MyMTLPixelFormatBC3_RGBA_sRGB:
+                                        rgbcx::encode_bc3_hq(bc1QualityLevelRefine, refinedBlock, srcPixelCopy);
+                                        break;
+                                    default:
+                                        bc7enc_compress_block(refinedBlock, srcPixelCopy, &bc7paramsRefine);
+                                        break;
+                                }
+
+                                numRefined++;
+
+                                // the highest level isn't always better on every block
+                                if (bcencBlockError(info.pixelFormat, refinedBlock, srcPixelCopyAsBlock, bc7paramsRefine) < error) {
+                                    memcpy(&dstData[b0 * blockSize], refinedBlock, blockSize);
+                                    numImproved++;
+                                }
+                            }
                         }
+                    });
+
+                    if (info.isVerbose) {
+                        KLOGI("Image", "Refined %d of %d blocks, %d improved in mipLevel %dx%d\n",
+                              numRefined.load(), numBlocks, numImproved.load(), w, h);
                     }
                 }
             }
@@ -2876,9 +3859,20 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
             }
 
             if (success) {
-                squish::CompressImage((const squish::u8*)srcPixelData, w, h,
-                                      outputTexture.data.data(), format, flags,
-                                      weights);
+                const int32_t blockDim = 4;
+                int32_t blocks_x = (w + blockDim - 1) / blockDim;
+                int32_t blocks_y = (h + blockDim - 1) / blockDim;
+
+                // each band is compressed as its own shorter image
+                processBlockRows(system, blocks_y, [&](int32_t blockRowStart, int32_t blockRowEnd) {
+                    int32_t y0 = blockRowStart * blockDim;
+                    int32_t bandHeight = std::min(h, blockRowEnd * blockDim) - y0;
+
+                    squish::CompressImage((const squish::u8*)(srcPixelData + y0 * w), w, bandHeight,
+                                          outputTexture.data.data() + blockRowStart * blocks_x * blockSize,
+                                          format, flags, weights,
+                                          skipBlocks ? skipBlocks + blockRowStart * blocks_x : nullptr);
+                });
 
                 if (info.isSigned) {
                     doRemapSnormEndpoints = true;
@@ -3069,18 +4063,22 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
             //            config.tune_block_mode_limit =
             //            config.a_scale_radius =
 
-            // Note: this can accept fp16 src, but have already converted to
-            // float4
+            // Note: this accepts fp16 src, so half mips aren't converted to float4
             astcenc_image srcImage;
             srcImage.dim_x = w;
             srcImage.dim_y = h;
             srcImage.dim_z = 1; // Not using 3D blocks, not supported on iOS
             //srcImage.dim_pad = 0;
+            srcImage.skip_blocks = skipBlocks;
 
             // data is triple-pointer so it can work with 3d textures, but only
             // have 2d image
             // hacked the src pixel handling to only do slices, not a 3D texture
-            if (info.isHDR) {
+            if (info.isHDR && srcPixelDataHalf4) {
+                srcImage.data = (void**)&srcPixelDataHalf4;
+                srcImage.data_type = ASTCENC_TYPE_F16;
+            }
+            else if (info.isHDR) {
                 srcImage.data = (void**)&srcPixelDataFloat4;
                 srcImage.data_type = ASTCENC_TYPE_F32;
             }
@@ -3093,10 +4091,16 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
             astcenc_swizzle swizzleEncode = {ASTCENC_SWZ_R, ASTCENC_SWZ_G,
                                              ASTCENC_SWZ_B, ASTCENC_SWZ_A};
 
-            // could this be built once, and reused across all mips
-            astcenc_context* codec_context = nullptr;
-            error = astcenc_context_alloc(&config, 1, &codec_context);
-            if (error != ASTCENC_SUCCESS) {
+            // contexts are reused across all mips and chunks of the encode
+            AstcencContextCache localContexts;
+            AstcencContextCache& contexts = astcencContexts ? *astcencContexts : localContexts;
+
+            // astcenc pulls blocks across however many thread indices call
+            // compress, so each thread of the system gets one index
+            uint32_t numThreads = system ? system->num_threads() : 1;
+
+            astcenc_context* codec_context = contexts.acquire(config, quality, numThreads);
+            if (!codec_context) {
                 return false;
             }
 
@@ -3134,14 +4138,31 @@ bool KramEncoder::compressMipLevel(const ImageInfo& info, KTXImage& image,
                 gAstcenc_UniqueChannelsInPartitioning = 4;
             }
 #else
-            error = astcenc_compress_image(
-                codec_context, &srcImage, &swizzleEncode,
-                outputTexture.data.data(), mipStorageSize,
-                0); // threadIndex
+            if (numThreads > 1) {
+                std::atomic<uint32_t> threadError(ASTCENC_SUCCESS);
+
+                system->run_and_wait(numThreads, [&](int32_t threadIndex) {
+                    astcenc_error threadResult = astcenc_compress_image(
+                        codec_context, &srcImage, &swizzleEncode,
+                        outputTexture.data.data(), mipStorageSize,
+                        threadIndex);
+
+                    if (threadResult != ASTCENC_SUCCESS) {
+                        threadError = threadResult;
+                    }
+                });
+
+                error = (astcenc_error)threadError.load();
+            }
+            else {
+                error = astcenc_compress_image(
+                    codec_context, &srcImage, &swizzleEncode,
+                    outputTexture.data.data(), mipStorageSize,
+                    0); // threadIndex
+            }
 #endif
 
-            // Or should this context only be freed after all mips?
-            astcenc_context_free(codec_context);
+            contexts.release(codec_context);
 
             if (error != ASTCENC_SUCCESS) {
                 return false;
@@ -20,16 +20,14 @@ using namespace SIMD_NAMESPACE;
 class Mipper;
 class KTXHeader;
 class TextureData;
-
-enum ImageResizeFilter {
-    kImageResizeFilterPoint,
-    //kImageResizeFilterLinear,
-    //kImageResizeFilterLanczos3, Mitchell, Kaiser, etc,
-};
+class task_system;
+class AstcencContextCache;
+class BlockCache;
 
 //---------------------------
 
 struct MipConstructData;
+struct ChunkMipData;
 
 // TODO: this can only hold one level of mips, so custom mips aren't possible.
 // Mipmap generation is all in-place to this storage.
@@ -61,8 +59,18 @@ public:
     int32_t height() const { return _height; }
 
     const vector<Color>& pixels() const { return _pixels; }
+    const vector<half4>& pixelsHalf() const { return _pixelsHalf; }
     const vector<float4>& pixelsFloat() const { return _pixelsFloat; }
 
+    // hdr sources are stored in only one of pixelsHalf or pixelsFloat
+    bool isHDR() const { return !_pixelsHalf.empty() || !_pixelsFloat.empty(); }
+
+    // 16f sources load as half, and 32f as float.  Encodes that don't write
+    // 32f convert to half to halve the source and mip memory.  Values past
+    // the half max are clamped to it with a warning, instead of going to inf.
+    void convertPixelsToHalf();
+    void convertPixelsToFloat();
+
     // content analysis
     bool hasColor() const { return _hasColor; }
     bool hasAlpha() const { return _hasAlpha; }
@@ -80,7 +88,7 @@ public:
     void setChunksY(uint32_t chunksY) { _chunksY = chunksY; }
 
 private:
-    // convert r/rg/rgb to rgba, 16f -> 32f
+    // convert r/rg/rgb to rgba, 16f stays half
     bool convertToFourChannel(const KTXImage& image, uint32_t mipNumber);
 
     // converts all to rgba8unorm
@@ -104,10 +112,10 @@ private:
     // track to fix Apple Finder previews that are always white background
     bool _hasBlackBackground = false;
 
-    // this is the entire strip data, float version can be passed for HDR
-    // sources always 4 channels RGBA for 8 and 32f data.  16f promoted to 32f.
+    // this is the entire strip data, half/float version is used for HDR
+    // sources always 4 channels RGBA for 8, 16f and 32f data.
     vector<Color> _pixels;
-    //vector<half4> _pixelsHalf; // TODO: add support to import fp16
+    vector<half4> _pixelsHalf;
     vector<float4> _pixelsFloat;
 
     uint32_t _chunksY = 0;
@@ -118,6 +126,16 @@ public:
     TexEncoder decoder = kTexEncoderUnknown; // will pick best available from format
     bool isVerbose = false;
     string swizzleText;
+
+    // > 1 decodes bands of block rows in parallel on larger mips
+    int32_t numJobs = 1;
+
+    // optional pool to decode on, else one is made when numJobs > 1
+    task_system* system = nullptr;
+
+    // bc1-5 and etc2/eac decode straight to rows with simd palettes, the output
+    // is the same.  false uses the rgbcx and etc2comp per block decoders.
+    bool useBlockRowDecoder = true;
 };
 
 // The decoder can decode an entire KTX/KTX2 into RGBA8u/16F/32F data.
@@ -137,6 +155,14 @@ public:
 
 private:
     bool decodeImpl(const KTXImage& srcImage, FILE* dstFile, KTXImage& dstImage, const KramDecoderParams& params) const;
+
+    // system is null to decode on the calling thread
+    bool decodeBlocksImpl(
+        int32_t w, int32_t h,
+        const uint8_t* blockData, uint32_t numBlocks, MyMTLPixelFormat blockFormat,
+        vector<uint8_t>& dstPixels, // currently Color
+        const KramDecoderParams& params,
+        task_system* system) const;
 };
 
 // The encoder takes a single-mip image, and in-place encodes mips and applies other
@@ -154,7 +180,9 @@ public:
     bool saveKTX1(const KTXImage& image, FILE* dstFile) const;
 
     // can save out to ktx2 directly, this can supercompress mips
-    bool saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compressor, FILE* dstFile) const;
+    // numJobs > 1 supercompresses the levels in parallel, on system if it's passed
+    bool saveKTX2(const KTXImage& srcImage, const KTX2Compressor& compressor, FILE* dstFile, int32_t numJobs = 1,
+                  task_system* system = nullptr) const;
 
 private:
     bool encodeImpl(ImageInfo& info, Image& singleImage, FILE* dstFile, KTXImage& dstImage) const;
@@ -165,14 +193,42 @@ private:
                            vector<KTXImageLevel>& dstMipLevels) const;
 
     // ugh, reduce the params into this
+    // system is optional, and splits the mip into bands of block rows.
+    // astcencContexts is optional, and reuses contexts across calls.
+    // blockCache is optional, and reuses the encodes of repeated blocks.
     bool compressMipLevel(const ImageInfo& info, KTXImage& image,
                           ImageData& mipImage, TextureData& outputTexture,
-                          int32_t mipStorageSize) const;
+                          int32_t mipStorageSize,
+                          task_system* system = nullptr,
+                          AstcencContextCache* astcencContexts = nullptr,
+                          BlockCache* blockCache = nullptr) const;
+
+    // encodes the mip, skipBlocks has a byte per block and nonzero blocks
+    // are already in outputTexture
+    bool encodeMipLevel(const ImageInfo& info, KTXImage& image,
+                        ImageData& mipImage, TextureData& outputTexture,
+                        int32_t mipStorageSize,
+                        task_system* system,
+                        AstcencContextCache* astcencContexts,
+                        const uint8_t* skipBlocks) const;
 
     // can pass in which channels to average
     void averageChannelsInBlock(const char* averageChannels,
                                 const KTXImage& image, ImageData& srcImage) const;
 
+    // build all mips of one chunk into chunkData, this can run in parallel
+    void buildChunkMips(const ImageInfo& info,
+                        Image& singleImage,
+                        const MipConstructData& data,
+                        const KTXImage& dstImage,
+                        int32_t chunk,
+                        ChunkMipData& chunkData) const;
+
+    bool writeChunkMip(const ImageInfo& info,
+                       int32_t numChunks, int32_t chunk, int32_t mipLevel,
+                       const TextureData& outputTexture,
+                       FILE* dstFile, KTXImage& dstImage) const;
+
     bool createMipsFromChunks(ImageInfo& info,
                               Image& singleImage,
                               MipConstructData& data,
@@ -867,6 +867,47 @@ void ImageInfo::swizzleTextureHDR(int32_t w, int32_t h, float4* srcPixelsFloat_,
     }
 }
 
+void ImageInfo::swizzleTextureHDR(int32_t w, int32_t h, half4* srcPixelsHalf_,
+                                  const char* swizzleText)
+{
+    // set any channels that are constant
+    SwizzleIndex swizzle = toSwizzleIndex(swizzleText);
+
+    // this is a noop
+    if (swizzle.index[0] == 0 && swizzle.index[1] == 1 && swizzle.index[2] == 2 && swizzle.index[3] == 3) {
+        return;
+    }
+
+    // only moves channels, so no conversion to float except for the constant
+    half4 c = half4m(float4m(0.0f));
+    half4 cOne = half4m(float4m(1.0f));
+    for (int32_t i = 0; i < 4; ++i) {
+        if (swizzle.index[i] == -1) {
+            c[i] = cOne[i];
+        }
+    }
+
+    half4* srcPixelsHalf = (half4*)srcPixelsHalf_;
+    for (int32_t y = 0; y < h; ++y) {
+        int32_t y0 = y * w;
+
+        for (int32_t x = 0; x < w; ++x) {
+            half4& c0 = srcPixelsHalf[y0 + x];
+            const half4 ci = c0;
+
+            // reorder, then writeback
+            // this doesn't copy over constants set outside loop
+            for (int32_t i = 0; i < 4; ++i) {
+                if (swizzle.index[i] >= 0) {
+                    c[i] = ci[swizzle.index[i]];
+                }
+            }
+
+            c0 = c;
+        }
+    }
+}
+
 void ImageInfo::swizzleTextureLDR(int32_t w, int32_t h, Color* srcPixels_,
                                   const char* swizzleText_)
 {
@@ -960,6 +1001,50 @@ void ImageInfo::updateImageTraitsHDR(int32_t w, int32_t h, const float4* srcPixe
     }
 }
 
+void ImageInfo::updateImageTraitsHDR(int32_t w, int32_t h, const half4* srcPixels)
+{
+    if (srcPixels == nullptr) {
+        return;
+    }
+
+    // validate that image hasColor and isn't grayscale data
+    if (hasColor) {
+        hasColor = false;
+
+        // stop on first color pixel
+        for (int32_t y = 0; y < h && !hasColor; ++y) {
+            int32_t y0 = y * w;
+
+            for (int32_t x = 0; x < w; ++x) {
+                float4 c0 = float4m(srcPixels[y0 + x]);
+
+                if (c0.x != c0.y || c0.x != c0.z) {
+                    hasColor = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // validate that image truly has alpha
+    if (hasAlpha) {
+        hasAlpha = false;
+
+        // stop on first non 1.0 alpha
+        for (int32_t y = 0; y < h && !hasAlpha; ++y) {
+            int32_t y0 = y * w;
+
+            for (int32_t x = 0; x < w; ++x) {
+                float4 c0 = float4m(srcPixels[y0 + x]);
+                if (c0.w != 1.0f) {
+                    hasAlpha = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
 void ImageInfo::updateImageTraitsLDR(int32_t w, int32_t h, const Color* srcPixels)
 {
     if (srcPixels == nullptr) {
@@ -1036,13 +1121,18 @@ void ImageInfo::initWithArgs(const ImageInfoArgs& args)
     mipMinSize = args.mipMinSize;
     mipMaxSize = args.mipMaxSize;
     mipSkip = args.mipSkip;
+    mipFilter = args.mipFilter;
 
     swizzleText = args.swizzleText;
     averageChannels = args.averageChannels;
 
     isVerbose = args.isVerbose;
+    numJobs = args.numJobs;
+    system = args.system;
+    sourceHash = args.sourceHash;
 
     quality = args.quality;
+    refinePercent = std::max(0, std::min(args.refinePercent, 100));
 
     // this is for height to normal, will convert .r to normal xy
     isHeight = args.isHeight;
@@ -1074,6 +1164,22 @@ void ImageInfo::initWithArgs(const ImageInfoArgs& args)
 
     isSigned = isSignedFormat(pixelFormat);
 
+    // only the bcenc bc1/3/7 encoders have levels to refine with
+    if (refinePercent > 0) {
+        bool isRefineFormat =
+            pixelFormat == MyMTLPixelFormatBC1_RGBA ||
+            pixelFormat == MyMTLPixelFormatBC1_RGBA_sRGB ||
+            pixelFormat == MyMTLPixelFormatBC3_RGBA ||
+            pixelFormat == MyMTLPixelFormatBC3_RGBA_sRGB ||
+            pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm ||
+            pixelFormat == MyMTLPixelFormatBC7_RGBAUnorm_sRGB;
+
+        if (!useBcenc || !isRefineFormat) {
+            KLOGW("ImageInfo", "-refine only applies to bcenc bc1/3/7, ignoring it\n");
+            refinePercent = 0;
+        }
+    }
+
     // formats that aren't srgb
     // image will undergo srgb to linear conversion and then get written out
     isSRGBSrc = args.isSRGBSrc;
@@ -1126,8 +1232,9 @@ void ImageInfo::initWithSourceImage(Image& sourceImage)
     int32_t h = sourceImage.height();
     Color* srcPixels = (Color*)sourceImage.pixels().data();
     float4* srcPixelsFloat = (float4*)sourceImage.pixelsFloat().data();
+    half4* srcPixelsHalf = (half4*)sourceImage.pixelsHalf().data();
 
-    isHDR = srcPixelsFloat != nullptr;
+    isHDR = sourceImage.isHDR();
 
     // transfer the chunk count, this was a ktx/2 import
     if (sourceImage.chunksY() > 0) {
@@ -1148,7 +1255,7 @@ void ImageInfo::initWithSourceImage(Image& sourceImage)
 
     // this will only work on 2d textures, since this is all pre-chunk
     if (isHeight) {
-        heightToNormals(w, h, srcPixelsFloat, srcPixels, heightScale, isWrap);
+        heightToNormals(w, h, srcPixelsFloat, srcPixelsHalf, srcPixels, heightScale, isWrap);
     }
 
     // this updates hasColor/hasAlpha
@@ -1165,7 +1272,10 @@ void ImageInfo::initWithSourceImage(Image& sourceImage)
             hasAlpha = false;
         }
 
-        if (isHDR) {
+        if (srcPixelsHalf) {
+            swizzleTextureHDR(w, h, srcPixelsHalf, swizzleText.c_str());
+        }
+        else if (isHDR) {
             swizzleTextureHDR(w, h, srcPixelsFloat, swizzleText.c_str());
         }
         else {
@@ -1174,7 +1284,10 @@ void ImageInfo::initWithSourceImage(Image& sourceImage)
     }
 
     // this updates hasColor/hasAlpha by walking pixels
-    if (isHDR) {
+    if (srcPixelsHalf) {
+        updateImageTraitsHDR(w, h, srcPixelsHalf);
+    }
+    else if (isHDR) {
         updateImageTraitsHDR(w, h, srcPixelsFloat);
     }
     else {
@@ -1245,6 +1358,7 @@ void ImageInfo::initWithSourceImage(Image& sourceImage)
 
 void ImageInfo::heightToNormals(int32_t w, int32_t h,
                                 float4* srcPixels,
+                                half4* srcPixelsHalf,
                                 Color* srcPixels8,
                                 float scale, bool isWrap)
 {
@@ -1254,14 +1368,23 @@ void ImageInfo::heightToNormals(int32_t w, int32_t h,
     // src/dst the same here
     // may need to copy a row/column of pixels for wrap
     float4* dstPixels = srcPixels;
+    half4* dstPixelsHalf = srcPixelsHalf;
     Color* dstPixels8 = srcPixels8;
 
-    bool isFloat = srcPixels;
+    bool isFloat = srcPixels || srcPixelsHalf;
 
     // copy the texture, or there are too many edge cases in the code below
+    // half is copied to float, so the math is the same
     vector<Color> srcDataCopy8;
     vector<float4> srcDataCopy;
-    if (isFloat) {
+    if (srcPixelsHalf) {
+        srcDataCopy.resize(w * h);
+        for (int32_t i = 0, iEnd = w * h; i < iEnd; ++i) {
+            srcDataCopy[i] = float4m(srcPixelsHalf[i]);
+        }
+        srcPixels = srcDataCopy.data();
+    }
+    else if (isFloat) {
         srcDataCopy.resize(w * h);
         memcpy(srcDataCopy.data(), srcPixels, vsizeof(srcDataCopy));
         srcPixels = srcDataCopy.data();
@@ -1354,7 +1477,7 @@ void ImageInfo::heightToNormals(int32_t w, int32_t h,
                 normal = normal * 0.5 + 0.5f;
 
                 // write out the result
-                float4& dstPixel = dstPixels[y0 + x];
+                float4 dstPixel;
 
                 dstPixel.x = normal.x;
                 dstPixel.y = normal.y;
@@ -1366,6 +1489,13 @@ void ImageInfo::heightToNormals(int32_t w, int32_t h,
 
                 dstPixel.z = srcPixels[y0 + x].z;
                 dstPixel.w = srcPixels[y0 + x].w;
+
+                if (dstPixelsHalf) {
+                    dstPixelsHalf[y0 + x] = half4m(dstPixel);
+                }
+                else {
+                    dstPixels[y0 + x] = dstPixel;
+                }
             }
             else {
                 // cross pattern
@@ -13,6 +13,7 @@
 
 namespace kram {
 class Image;
+class task_system;
 
 using namespace SIMD_NAMESPACE;
 using namespace STL_NAMESPACE;
@@ -47,8 +48,15 @@ public:
     int32_t mipMaxSize = 32 * 1024;
     int32_t mipSkip = 0;
 
+    // box is fastest, but mitchell/lanczos3/kaiser give sharper mips
+    ImageResizeFilter mipFilter = kImageResizeFilterBox;
+
     int32_t quality = 49; // may want float
 
+    // bc1/3/7 with bcenc encode at the fastest level, then re-encode this
+    // percent of the worst blocks at the highest level, 0 to disable
+    int32_t refinePercent = 0;
+
     // ktx2 has a compression type and level
     KTX2Compressor compressor;
     bool isKTX2 = false;
@@ -94,6 +102,15 @@ public:
     int32_t chunksCount = 0;
 
     int32_t sdfThreshold = 120;
+
+    // threads used to build and encode chunks and mips of a single texture
+    int32_t numJobs = 1;
+
+    // optional pool for those threads, else one is made when numJobs > 1
+    task_system* system = nullptr;
+
+    // hash of src bytes and encode args, written to the output props when non-zero
+    uint32_t sourceHash = 0;
 };
 
 // preset data that contains all inputs about the encoding
@@ -108,12 +125,15 @@ public:
     // this makea input pixels non-const.
     static void swizzleTextureHDR(int32_t w, int32_t h, float4* srcPixelsFloat_,
                                   const char* swizzleText);
+    static void swizzleTextureHDR(int32_t w, int32_t h, half4* srcPixelsHalf_,
+                                  const char* swizzleText);
     static void swizzleTextureLDR(int32_t w, int32_t h, Color* srcPixels_,
                                   const char* swizzleText);
 
-    // convert x field to normals
+    // convert x field to normals, only one of the pixel ptrs is set
     static void heightToNormals(int32_t w, int32_t h,
                                 float4* srcPixelsFloat_,
+                                half4* srcPixelsHalf_,
                                 Color* srcPixels_,
                                 float scale, bool isWrap = false);
 
@@ -121,6 +141,8 @@ private:
     // this walks pixels for hasColor and hasAlpha if not already set to false
     void updateImageTraitsHDR(int32_t w, int32_t h,
                               const float4* srcPixelsFloat_);
+    void updateImageTraitsHDR(int32_t w, int32_t h,
+                              const half4* srcPixelsHalf_);
     void updateImageTraitsLDR(int32_t w, int32_t h, const Color* srcPixels_);
 
     void optimizeFormat();
@@ -180,10 +202,12 @@ public:
     float heightScale = 1.0f;
 
     int32_t quality = 49;
+    int32_t refinePercent = 0;
 
     int32_t mipMinSize = 1;
     int32_t mipMaxSize = 32 * 1024;
     int32_t mipSkip = 0; // count of large mips to skip
+    ImageResizeFilter mipFilter = kImageResizeFilterBox;
 
     int32_t chunksX = 0;
     int32_t chunksY = 0;
@@ -191,6 +215,12 @@ public:
 
     // This converts incoming image channel to bitmap
     int32_t sdfThreshold = 120;
+
+    // threads used to build and encode chunks and mips
+    int32_t numJobs = 1;
+    task_system* system = nullptr;
+
+    uint32_t sourceHash = 0;
 };
 
 bool isSwizzleValid(const char* swizzle);
@@ -14,6 +14,7 @@
 #include "Kram.h"
 #include "KramFileHelper.h"
 #include "KramFileIO.h"
+#include "KramFilter.h"
 #include "KramImage.h"
 #include "KramImageInfo.h"
 #include "KramLog.h"
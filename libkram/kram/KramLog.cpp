@@ -565,6 +565,7 @@ struct LogState {
     string errorLogCaptureText;
     string buffer;
     bool isErrorLogCapture = false;
+    bool isLogToStderr = false;
     uint32_t counter = 0;
 
 #if KRAM_WIN
@@ -585,6 +586,8 @@ void setErrorLogCapture(bool enable)
 
 bool isErrorLogCapture() { return gLogState.isErrorLogCapture; }
 
+void setLogToStderr(bool enable) { gLogState.isLogToStderr = enable; }
+
 // return the text
 void getErrorLogCaptureText(string& text)
 {
@@ -893,7 +896,7 @@ static int32_t logMessageImpl(const LogMessage& msg)
         formatMessage(buffer, msg, tokens);
 
         // avoid double print to debugger
-        FILE* fp = stdout;
+        FILE* fp = gLogState.isLogToStderr ? stderr : stdout;
         fwrite(buffer.c_str(), 1, buffer.size(), fp);
         // if heavy logging, then could delay fflush
         fflush(fp);
@@ -979,7 +982,7 @@ static int32_t logMessageImpl(const LogMessage& msg)
         getFormatTokens(tokens, msg, Debugger);
         formatMessage(buffer, msg, tokens);
 
-        FILE* fp = stdout;
+        FILE* fp = gLogState.isLogToStderr ? stderr : stdout;
         fwrite(buffer.c_str(), 1, buffer.size(), fp);
         // if heavy logging, then could delay fflush
         fflush(fp);
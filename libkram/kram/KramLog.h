@@ -67,6 +67,10 @@ bool isErrorLogCapture();
 // return the text
 void getErrorLogCaptureText(string& text);
 
+// when set true, logs go to stderr instead of stdout, so stdout can carry
+// a protocol like the kram serve status lines
+void setLogToStderr(bool enable);
+
 //-----------------------
 // String Ops
 
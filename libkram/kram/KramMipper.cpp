@@ -87,6 +87,106 @@ float4 linearToSRGB(float4 lin)
         lin.w);
 }
 
+//-----------------------------
+// Linear to srgb8 without powf.  The linear range is split into buckets that
+// are each narrower than one srgb8 step (the steepest slope is 12.92 * 255
+// steps, so a bucket spans at most 0.8 of a step).  So a bucket starts at one
+// code and crosses at most one threshold to the next code.  The thresholds
+// are the smallest linear value where the reference rounds to each code,
+// found by bisecting the float bits, so the result matches
+// Unormfloat4ToColor(linearToSRGB(lin)) exactly instead of approximately.
+
+static const int32_t kSRGBBuckets = 4096;
+
+// same rounding as Unormfloat4ToColor
+static uint32_t linearToSRGB8Reference(float lin)
+{
+    return (uint32_t)rintf(linearToSRGBFunc(lin) * 255.0f);
+}
+
+class SRGBEncodeTable {
+public:
+    SRGBEncodeTable()
+    {
+        uint32_t oneBits = floatToBits(1.0f);
+
+        thresholds[0] = 0.0f;
+        for (uint32_t code = 1; code < 256; ++code) {
+            // smallest float in [0,1] that encodes to >= code
+            uint32_t lo = 0;
+            uint32_t hi = oneBits;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (linearToSRGB8Reference(bitsToFloat(mid)) >= code)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            thresholds[code] = bitsToFloat(lo);
+        }
+
+        // never crossed
+        thresholds[256] = 2.0f;
+
+        // lin * kSRGBBuckets is exact, so bucket b starts at b / kSRGBBuckets
+        for (int32_t i = 0; i < kSRGBBuckets; ++i) {
+            uint32_t code = linearToSRGB8Reference((float)i / kSRGBBuckets);
+            bucketCodes[i] = (uint8_t)code;
+            bucketThresholds[i] = thresholds[code + 1];
+        }
+    }
+
+    // lin must be saturated
+    uint8_t encode(float lin) const
+    {
+        // NaN converts to an invalid int, so clamp both ends
+        int32_t bucket = std::min(std::max((int32_t)(lin * (float)kSRGBBuckets), 0), kSRGBBuckets - 1);
+
+        // both loads only depend on the bucket
+        uint32_t code = bucketCodes[bucket];
+        code += (lin >= bucketThresholds[bucket]) ? 1 : 0;
+        return (uint8_t)code;
+    }
+
+private:
+    static uint32_t floatToBits(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    static float bitsToFloat(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    float thresholds[257];
+
+    // code at the start of each bucket, and the threshold to the next code
+    float bucketThresholds[kSRGBBuckets];
+    uint8_t bucketCodes[kSRGBBuckets];
+};
+
+// built at startup, this is ~10K powf calls
+static const SRGBEncodeTable gSRGBEncodeTable;
+
+Color linearToSRGBColor(float4 lin)
+{
+    // saturate and scale all 4 lanes at once, then look up rgb.  Alpha
+    // is saturated too, since hdr and premul sources go outside [0,1].
+    float4 s = saturate(lin);
+    float4 a = round(s * 255.0f);
+
+    Color c;
+    c.r = gSRGBEncodeTable.encode(s.x);
+    c.g = gSRGBEncodeTable.encode(s.y);
+    c.b = gSRGBEncodeTable.encode(s.z);
+    c.a = (uint8_t)a.w;
+    return c;
+}
+
 //
 // inline void color565To888(uint16_t endpoint, Color &c) {
 //    uint16_t red = (endpoint >> 11)  & 31;
@@ -227,8 +327,7 @@ void Mipper::initPixelsHalfIfNeeded(ImageData& srcImage, bool doPremultiply, boo
                 if (doPremultiply && c0.a != 255) {
                     // need to overwrite the color 8-bit color too
                     // but this writes back to srgb for encoding
-                    cFloat = linearToSRGB(cFloat);
-                    c0 = Unormfloat4ToColor(cFloat);
+                    c0 = linearToSRGBColor(cFloat);
                 }
             }
         }
@@ -415,10 +514,112 @@ void Mipper::mipmap(const ImageData& srcImage, ImageData& dstImage) const
 
     mipDown(dstImage.width, dstImage.height, dstImage.depth);
 
+    // wider kernels also handle odd sizes, since each dst has its own phase
+    if (_filter != kImageResizeFilterBox) {
+        resampleImage(srcImage, dstImage, _filter);
+        return;
+    }
+
     // this assumes that we can read mip-1 from srcImage
     mipmapLevel(srcImage, dstImage);
 }
 
+// Src tile for a fused run of levels.  Tiles are wide, so each row is a
+// long contiguous read that the prefetcher can follow, and the tile and the
+// levels built from it (1/3rd more) stay in L2.
+static const int32_t kMipTileWidth = 2048;
+static const int32_t kMipTileBytes = 512 * 1024;
+
+void Mipper::mipmapLevels(const ImageData& srcImage, ImageData* dstImages, int32_t numLevels) const
+{
+    // size all the levels up front, the pixel storage is already set on each
+    const ImageData* levelSrcImage = &srcImage;
+    for (int32_t i = 0; i < numLevels; ++i) {
+        ImageData& dstImage = dstImages[i];
+        dstImage.width = levelSrcImage->width;
+        dstImage.height = levelSrcImage->height;
+        dstImage.depth = levelSrcImage->depth;
+        mipDown(dstImage.width, dstImage.height, dstImage.depth);
+
+        // each level is the src of the next
+        dstImage.isHDR = srcImage.isHDR;
+
+        levelSrcImage = &dstImage;
+    }
+
+    int32_t pixelSize = srcImage.pixelsFloat ? sizeof(float4) : srcImage.pixelsHalf ? sizeof(half4)
+                                                                                    : sizeof(Color);
+
+    int32_t level = 0;
+    while (level < numLevels) {
+        const ImageData& levelSrc = (level == 0) ? srcImage : dstImages[level - 1];
+
+        // tile height is a pow2, and sets how many levels a tile can build
+        int32_t tileWidth = std::min(kMipTileWidth, levelSrc.width);
+        int32_t tileHeight = 2;
+        while (tileWidth * (tileHeight * 2) * pixelSize <= kMipTileBytes) {
+            tileHeight *= 2;
+        }
+
+        // Even sizes are a 2x2 box per dst pixel, so a tile of the src
+        // builds the same tile of each level below it with no neighbors.
+        int32_t numFused = 0;
+        if (_filter == kImageResizeFilterBox) {
+            int32_t w = levelSrc.width;
+            int32_t h = levelSrc.height;
+            while (level + numFused < numLevels && (2 << numFused) <= tileHeight &&
+                   w >= 2 && h >= 2 && !(w & 1) && !(h & 1)) {
+                w /= 2;
+                h /= 2;
+                numFused++;
+            }
+        }
+
+        // odd sizes and other filters read across tiles, so those go a level at a time
+        if (numFused < 2) {
+            mipmap(levelSrc, dstImages[level]);
+            level++;
+            continue;
+        }
+
+        // tile sizes are a multiple of 2^numFused, and so is the src size
+        int32_t tileMask = (1 << numFused) - 1;
+        tileWidth &= ~tileMask;
+        tileHeight = std::min(tileHeight, levelSrc.height);
+
+        for (int32_t tileY = 0; tileY < levelSrc.height; tileY += tileHeight) {
+            int32_t rectHeight = std::min(tileHeight, levelSrc.height - tileY);
+
+            for (int32_t tileX = 0; tileX < levelSrc.width; tileX += tileWidth) {
+                int32_t rectWidth = std::min(tileWidth, levelSrc.width - tileX);
+
+                // the tile of the previous level was just written, so it's still in cache
+                const ImageData* tileSrc = &levelSrc;
+                for (int32_t i = 0; i < numFused; ++i) {
+                    ImageData& dstImage = dstImages[level + i];
+                    mipmapLevelRect(*tileSrc, dstImage,
+                                    tileX >> i, tileY >> i,
+                                    rectWidth >> i, rectHeight >> i);
+                    tileSrc = &dstImage;
+                }
+            }
+        }
+
+        level += numFused;
+    }
+}
+
+void Mipper::mipmapScalar(const ImageData& srcImage, ImageData& dstImage) const
+{
+    dstImage.width = srcImage.width;
+    dstImage.height = srcImage.height;
+    dstImage.depth = srcImage.depth;
+
+    mipDown(dstImage.width, dstImage.height, dstImage.depth);
+
+    mipmapLevelScalar(srcImage, dstImage);
+}
+
 void Mipper::mipmapLevelOdd(const ImageData& srcImage, ImageData& dstImage) const
 {
     int32_t width = srcImage.width;
@@ -604,13 +805,9 @@ void Mipper::mipmapLevelOdd(const ImageData& srcImage, ImageData& dstImage) cons
                 // assume hdr pulls from half/float data
                 if (!srcImage.isHDR) {
                     // convert back to srgb for encode
-                    if (isSRGBDst) {
-                        // getting some values > 1m, but this saturates
-                        cFloat = linearToSRGB(cFloat);
-                    }
-
+                    // getting some values > 1m, but this saturates
                     // overwrite rgba8u version, since this is what is encoded
-                    Color color = Unormfloat4ToColor(cFloat);
+                    Color color = isSRGBDst ? linearToSRGBColor(cFloat) : Unormfloat4ToColor(cFloat);
 
                     // can only skip this if cSrc = cDst
                     cDstColor[dstIndex] = color;
@@ -623,15 +820,11 @@ void Mipper::mipmapLevelOdd(const ImageData& srcImage, ImageData& dstImage) cons
                 // assume hdr pulls from half/float data
                 if (!srcImage.isHDR) {
                     // convert back to srgb for encode
-                    if (isSRGBDst) {
-                        // getting some values > 1, but this saturates
-                        cFloat = linearToSRGB(cFloat);
-                    }
-
+                    // getting some values > 1, but this saturates
                     // Overwrite the RGBA8u image too (this will go out to
                     // encoder) that means BC/ASTC are linearly fit to
                     // non-linear srgb colors - ick
-                    Color color = Unormfloat4ToColor(cFloat);
+                    Color color = isSRGBDst ? linearToSRGBColor(cFloat) : Unormfloat4ToColor(cFloat);
                     cDstColor[dstIndex] = color;
                 }
             }
@@ -646,6 +839,251 @@ void Mipper::mipmapLevelOdd(const ImageData& srcImage, ImageData& dstImage) cons
     }
 }
 
+//-----------------------------
+// Row kernels for the 2x2 box filter of even sized levels.  Each one averages
+// two src rows into count dst pixels.  The SIMD paths do the same float ops
+// in the same order as mipmapLevelScalar, so the output is bit-exact.  They
+// only load a batch before storing it, so dst can overwrite the src rows.
+
+// outputs per batch, so the float row stays in L1
+static const int32_t kMipBatchSize = 64;
+
+// (c0 + c1 + c2 + c3) * 0.25, where c0,c1 are from src0 and c2,c3 from src1
+static void boxFilterRowFloat(const float4* src0, const float4* src1, float4* dst, int32_t count)
+{
+    int32_t i = 0;
+
+#if SIMD_AVX2
+    // 2 outputs per op, pairs [p0|p1] [p2|p3] are permuted to [p0|p2] [p1|p3]
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    for (; i + 2 <= count; i += 2) {
+        const float* s0 = (const float*)(src0 + 2 * i);
+        const float* s1 = (const float*)(src1 + 2 * i);
+
+        __m256 a01 = _mm256_loadu_ps(s0);
+        __m256 a23 = _mm256_loadu_ps(s0 + 8);
+        __m256 b01 = _mm256_loadu_ps(s1);
+        __m256 b23 = _mm256_loadu_ps(s1 + 8);
+
+        __m256 c0 = _mm256_permute2f128_ps(a01, a23, 0x20);
+        __m256 c1 = _mm256_permute2f128_ps(a01, a23, 0x31);
+        __m256 c2 = _mm256_permute2f128_ps(b01, b23, 0x20);
+        __m256 c3 = _mm256_permute2f128_ps(b01, b23, 0x31);
+
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(c0, c1), c2), c3);
+        _mm256_storeu_ps((float*)(dst + i), _mm256_mul_ps(sum, quarter));
+    }
+#elif SIMD_NEON
+    for (; i < count; ++i) {
+        const float* s0 = (const float*)(src0 + 2 * i);
+        const float* s1 = (const float*)(src1 + 2 * i);
+
+        float32x4_t sum = vaddq_f32(vld1q_f32(s0), vld1q_f32(s0 + 4));
+        sum = vaddq_f32(sum, vld1q_f32(s1));
+        sum = vaddq_f32(sum, vld1q_f32(s1 + 4));
+        vst1q_f32((float*)(dst + i), vmulq_n_f32(sum, 0.25f));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = (src0[2 * i] + src0[2 * i + 1] + src1[2 * i] + src1[2 * i + 1]) * 0.25;
+    }
+}
+
+// same as above, but from half4 src, the float dst is then stored to half4
+static void boxFilterRowHalf(const half4* src0, const half4* src1, float4* dst, int32_t count)
+{
+    int32_t i = 0;
+
+#if SIMD_AVX2
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    for (; i + 2 <= count; i += 2) {
+        const __m128i* s0 = (const __m128i*)(src0 + 2 * i);
+        const __m128i* s1 = (const __m128i*)(src1 + 2 * i);
+
+        __m256 a01 = _mm256_cvtph_ps(_mm_loadu_si128(s0));
+        __m256 a23 = _mm256_cvtph_ps(_mm_loadu_si128(s0 + 1));
+        __m256 b01 = _mm256_cvtph_ps(_mm_loadu_si128(s1));
+        __m256 b23 = _mm256_cvtph_ps(_mm_loadu_si128(s1 + 1));
+
+        __m256 c0 = _mm256_permute2f128_ps(a01, a23, 0x20);
+        __m256 c1 = _mm256_permute2f128_ps(a01, a23, 0x31);
+        __m256 c2 = _mm256_permute2f128_ps(b01, b23, 0x20);
+        __m256 c3 = _mm256_permute2f128_ps(b01, b23, 0x31);
+
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(c0, c1), c2), c3);
+        _mm256_storeu_ps((float*)(dst + i), _mm256_mul_ps(sum, quarter));
+    }
+#elif SIMD_NEON
+    for (; i < count; ++i) {
+        const float16_t* s0 = (const float16_t*)(src0 + 2 * i);
+        const float16_t* s1 = (const float16_t*)(src1 + 2 * i);
+
+        float16x8_t a01 = vld1q_f16(s0);
+        float16x8_t b01 = vld1q_f16(s1);
+
+        float32x4_t sum = vaddq_f32(vcvt_f32_f16(vget_low_f16(a01)), vcvt_high_f32_f16(a01));
+        sum = vaddq_f32(sum, vcvt_f32_f16(vget_low_f16(b01)));
+        sum = vaddq_f32(sum, vcvt_high_f32_f16(b01));
+        vst1q_f32((float*)(dst + i), vmulq_n_f32(sum, 0.25f));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        float4 c0 = float4m(src0[2 * i]);
+        float4 c1 = float4m(src0[2 * i + 1]);
+        float4 c2 = float4m(src1[2 * i]);
+        float4 c3 = float4m(src1[2 * i + 1]);
+        dst[i] = (c0 + c1 + c2 + c3) * 0.25;
+    }
+}
+
+// round to nearest even like half4m
+static void storeRowHalf(const float4* src, half4* dst, int32_t count)
+{
+    int32_t i = 0;
+
+#if SIMD_AVX2
+    for (; i + 2 <= count; i += 2) {
+        __m128i h01 = _mm256_cvtps_ph(_mm256_loadu_ps((const float*)(src + i)), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h01);
+    }
+#elif SIMD_NEON
+    for (; i + 2 <= count; i += 2) {
+        const float* s = (const float*)(src + i);
+        float16x8_t h01 = vcvt_high_f16_f32(vcvt_f16_f32(vld1q_f32(s)), vld1q_f32(s + 4));
+        vst1q_f16((float16_t*)(dst + i), h01);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = half4m(src[i]);
+    }
+}
+
+// same as Unormfloat4ToColor, which rounds to nearest even and truncates to 8 bits
+static void storeRowColor(const float4* src, Color* dst, int32_t count)
+{
+    int32_t i = 0;
+
+#if SIMD_AVX2
+    const __m256 scale = _mm256_set1_ps(255.0f);
+
+    // low byte of each int32, per 128-bit lane
+    const __m256i lowBytes = _mm256_setr_epi8(
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    for (; i + 4 <= count; i += 4) {
+        const float* s = (const float*)(src + i);
+
+        __m256 v01 = _mm256_round_ps(_mm256_mul_ps(_mm256_loadu_ps(s), scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 v23 = _mm256_round_ps(_mm256_mul_ps(_mm256_loadu_ps(s + 8), scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+        __m256i c01 = _mm256_shuffle_epi8(_mm256_cvttps_epi32(v01), lowBytes);
+        __m256i c23 = _mm256_shuffle_epi8(_mm256_cvttps_epi32(v23), lowBytes);
+
+        __m128i c0 = _mm_unpacklo_epi32(_mm256_castsi256_si128(c01), _mm256_extracti128_si256(c01, 1));
+        __m128i c2 = _mm_unpacklo_epi32(_mm256_castsi256_si128(c23), _mm256_extracti128_si256(c23, 1));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi64(c0, c2));
+    }
+#elif SIMD_NEON
+    for (; i + 4 <= count; i += 4) {
+        const float* s = (const float*)(src + i);
+
+        uint32x4_t c0 = vcvtq_u32_f32(vrndnq_f32(vmulq_n_f32(vld1q_f32(s), 255.0f)));
+        uint32x4_t c1 = vcvtq_u32_f32(vrndnq_f32(vmulq_n_f32(vld1q_f32(s + 4), 255.0f)));
+        uint32x4_t c2 = vcvtq_u32_f32(vrndnq_f32(vmulq_n_f32(vld1q_f32(s + 8), 255.0f)));
+        uint32x4_t c3 = vcvtq_u32_f32(vrndnq_f32(vmulq_n_f32(vld1q_f32(s + 12), 255.0f)));
+
+        uint16x8_t c01 = vcombine_u16(vmovn_u32(c0), vmovn_u32(c1));
+        uint16x8_t c23 = vcombine_u16(vmovn_u32(c2), vmovn_u32(c3));
+        vst1q_u8((uint8_t*)(dst + i), vcombine_u8(vmovn_u16(c01), vmovn_u16(c23)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = Unormfloat4ToColor(src[i]);
+    }
+}
+
+// same as linearToSRGB and then storeRowColor, but uses the srgb8 table
+static void storeRowColorSRGB(const float4* src, Color* dst, int32_t count)
+{
+    for (int32_t i = 0; i < count; ++i) {
+        dst[i] = linearToSRGBColor(src[i]);
+    }
+}
+
+// 8-bit box filter, with +2/4 for rounding
+static void boxFilterRowColor(const Color* src0, const Color* src1, Color* dst, int32_t count)
+{
+    int32_t i = 0;
+
+#if SIMD_SSE
+    // 4 outputs from 8 src pixels per row, summed in 16-bit channels
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128i* s0 = (const __m128i*)(src0 + 2 * i);
+        const __m128i* s1 = (const __m128i*)(src1 + 2 * i);
+
+        __m128i a0 = _mm_loadu_si128(s0);
+        __m128i a1 = _mm_loadu_si128(s0 + 1);
+        __m128i b0 = _mm_loadu_si128(s1);
+        __m128i b1 = _mm_loadu_si128(s1 + 1);
+
+        // vertical sums of pixel pairs (p0,p1) (p2,p3) (p4,p5) (p6,p7)
+        __m128i v01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i v23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i v45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i v67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // horizontal sums of even and odd pixels
+        __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi64(v01, v23), _mm_unpackhi_epi64(v01, v23));
+        __m128i s23 = _mm_add_epi16(_mm_unpacklo_epi64(v45, v67), _mm_unpackhi_epi64(v45, v67));
+
+        s01 = _mm_srli_epi16(_mm_add_epi16(s01, two), 2);
+        s23 = _mm_srli_epi16(_mm_add_epi16(s23, two), 2);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(s01, s23));
+    }
+#elif SIMD_NEON
+    // deinterleave even and odd pixels, and then widen the sums
+    for (; i + 4 <= count; i += 4) {
+        uint32x4x2_t a = vld2q_u32((const uint32_t*)(src0 + 2 * i));
+        uint32x4x2_t b = vld2q_u32((const uint32_t*)(src1 + 2 * i));
+
+        uint8x16_t a0 = vreinterpretq_u8_u32(a.val[0]);
+        uint8x16_t a1 = vreinterpretq_u8_u32(a.val[1]);
+        uint8x16_t b0 = vreinterpretq_u8_u32(b.val[0]);
+        uint8x16_t b1 = vreinterpretq_u8_u32(b.val[1]);
+
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a0), vget_low_u8(a1)),
+                                  vaddl_u8(vget_low_u8(b0), vget_low_u8(b1)));
+        uint16x8_t hi = vaddq_u16(vaddl_high_u8(a0, a1), vaddl_high_u8(b0, b1));
+
+        // rounding shift is (sum + 2) >> 2
+        vst1q_u8((uint8_t*)(dst + i), vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const Color& c0 = src0[2 * i];
+        const Color& c1 = src0[2 * i + 1];
+        const Color& c2 = src1[2 * i];
+        const Color& c3 = src1[2 * i + 1];
+
+        int32_t r = ((int32_t)c0.r + (int32_t)c1.r + (int32_t)c2.r + (int32_t)c3.r + 2) / 4;
+        int32_t g = ((int32_t)c0.g + (int32_t)c1.g + (int32_t)c2.g + (int32_t)c3.g + 2) / 4;
+        int32_t b = ((int32_t)c0.b + (int32_t)c1.b + (int32_t)c2.b + (int32_t)c3.b + 2) / 4;
+        int32_t a = ((int32_t)c0.a + (int32_t)c1.a + (int32_t)c2.a + (int32_t)c3.a + 2) / 4;
+
+        Color c = {(uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a};
+        dst[i] = c;
+    }
+}
+
 void Mipper::mipmapLevel(const ImageData& srcImage, ImageData& dstImage) const
 {
     int32_t width = srcImage.width;
@@ -659,6 +1097,98 @@ void Mipper::mipmapLevel(const ImageData& srcImage, ImageData& dstImage) const
         return;
     }
 
+    mipmapLevelRect(srcImage, dstImage, 0, 0, width, height);
+}
+
+void Mipper::mipmapLevelRect(const ImageData& srcImage, ImageData& dstImage,
+                             int32_t x0, int32_t y0, int32_t rectWidth, int32_t rectHeight) const
+{
+    int32_t width = srcImage.width;
+
+    // this can receive premul, srgb data
+    // the mip chain is linear data only
+    Color* cDstColor = dstImage.pixels;
+    const Color* srcColor = srcImage.pixels;
+
+    float4* cDstFloat = dstImage.pixelsFloat;
+    const float4* srcFloat = srcImage.pixelsFloat;
+
+    half4* cDstHalf = dstImage.pixelsHalf;
+    const half4* srcHalf = srcImage.pixelsHalf;
+
+    // Note the ptrs above may point to same memory
+
+    // After linear combine, convert back to srgb
+    // mip source is always linear to build all levels.
+    bool isSRGBDst = dstImage.isSRGB;
+
+    // assume hdr pulls from half/float data
+    bool isColorDst = !srcImage.isHDR;
+
+    int32_t dstWidth = width / 2;
+    int32_t dstRectWidth = rectWidth / 2;
+
+    // averages for a batch of a row, before they're stored
+    float4 rowFloat[kMipBatchSize];
+
+    for (int32_t y = y0; y < y0 + rectHeight; y += 2) {
+        int32_t srcY0 = y * width + x0;
+        int32_t srcY1 = srcY0 + width;
+        int32_t dstY = (y / 2) * dstWidth + x0 / 2;
+
+        if (!srcHalf && !srcFloat) {
+            // faster 8-bit only path for LDR, linear, and not premul
+            // can overwrite memory on linear image, some precision loss, but fast
+            boxFilterRowColor(srcColor + srcY0, srcColor + srcY1, cDstColor + dstY, dstRectWidth);
+            continue;
+        }
+
+        for (int32_t x = 0; x < dstRectWidth; x += kMipBatchSize) {
+            int32_t count = std::min(kMipBatchSize, dstRectWidth - x);
+            int32_t dstIndex = dstY + x;
+
+            // mip filter is simple box filter
+            // assumes alpha premultiplied already
+            if (srcHalf) {
+                boxFilterRowHalf(srcHalf + srcY0 + 2 * x, srcHalf + srcY1 + 2 * x, rowFloat, count);
+
+                // overwrite half4 image
+                storeRowHalf(rowFloat, cDstHalf + dstIndex, count);
+            }
+            else {
+                boxFilterRowFloat(srcFloat + srcY0 + 2 * x, srcFloat + srcY1 + 2 * x, rowFloat, count);
+
+                // overwrite float4 image
+                memcpy(cDstFloat + dstIndex, rowFloat, count * sizeof(float4));
+            }
+
+            if (isColorDst) {
+                // Overwrite rgba8u version, since this is what is encoded
+                if (isSRGBDst) {
+                    // convert back to srgb for encode
+                    storeRowColorSRGB(rowFloat, cDstColor + dstIndex, count);
+                }
+                else {
+                    storeRowColor(rowFloat, cDstColor + dstIndex, count);
+                }
+            }
+        }
+    }
+}
+
+void Mipper::mipmapLevelScalar(const ImageData& srcImage, ImageData& dstImage) const
+{
+    int32_t width = srcImage.width;
+    int32_t height = srcImage.height;
+
+    bool isOddX = width & 1;
+    bool isOddY = height & 1;
+
+    if (isOddX || isOddY) {
+        mipmapLevelOdd(srcImage, dstImage);
+        return;
+    }
+
     // fast path for 2x2 downsample below, can do in 4 taps
 
     // this can receive premul, srgb data
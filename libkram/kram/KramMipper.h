@@ -8,6 +8,7 @@
 //#include <vector>
 
 //#include "KramConfig.h"
+#include "KramFilter.h"
 
 namespace kram {
 using namespace STL_NAMESPACE;
@@ -66,6 +67,10 @@ float4 linearToSRGB(float4 lin);
 // return srgb from a linear intesnity
 float linearToSRGBFunc(float lin);
 
+// Same as Unormfloat4ToColor(linearToSRGB(lin)), but uses a table instead of
+// powf.  Alpha stays linear, and all 4 channels are saturated.
+Color linearToSRGBColor(float4 lin);
+
 class ImageData {
 public:
     // data can be mipped as 8u, 16f, or 32f.  Prefer smallest size.
@@ -79,7 +84,7 @@ public:
     int32_t depth = 0;
 
     bool isSRGB = false;
-    bool isHDR = false; // only updates pixelsFloat
+    bool isHDR = false; // only updates pixelsHalf or pixelsFloat
 };
 
 class Mipper {
@@ -87,6 +92,8 @@ private:
     float srgbToLinear[256];
     float alphaToFloat[256];
 
+    ImageResizeFilter _filter = kImageResizeFilterBox;
+
 public:
     Mipper();
 
@@ -94,9 +101,22 @@ public:
     void initPixelsHalfIfNeeded(ImageData& srcImage, bool doPremultiply, bool doPrezero,
                                 vector<half4>& halfImage) const;
 
-    // drop by 1 mip level by box filter
+    // box is the default, and is the fast path.  Others go through resampleImage.
+    void setFilter(ImageResizeFilter filter) { _filter = filter; }
+    ImageResizeFilter filter() const { return _filter; }
+
+    // drop by 1 mip level by the filter
     void mipmap(const ImageData& srcImage, ImageData& dstImage) const;
 
+    // Builds numLevels mips below srcImage into dstImages, which have their
+    // pixel storage set like mipmap.  Even levels are built together from
+    // L2-sized tiles of srcImage, instead of reading each level back from
+    // memory.  The output is the same as calling mipmap on each level.
+    void mipmapLevels(const ImageData& srcImage, ImageData* dstImages, int32_t numLevels) const;
+
+    // same output as mipmap, but one pixel at a time.  For benchmarks and testing.
+    void mipmapScalar(const ImageData& srcImage, ImageData& dstImage) const;
+
     // Build all the mips, and then copy from small to big
     // wherever the alpha is 0.  This is a form of cheap
     // dilation, but will result in invalid premul colors r > a.
@@ -115,6 +135,11 @@ private:
 
     void mipmapLevel(const ImageData& srcImage, ImageData& dstImage) const;
 
+    // box filters an even rect of srcImage into the same rect at half size of dstImage
+    void mipmapLevelRect(const ImageData& srcImage, ImageData& dstImage,
+                         int32_t x0, int32_t y0, int32_t rectWidth, int32_t rectHeight) const;
+    void mipmapLevelScalar(const ImageData& srcImage, ImageData& dstImage) const;
+
     void mipmapLevelOdd(const ImageData& srcImage, ImageData& dstImage) const;
 };
 
@@ -0,0 +1,595 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#include "KramSolidBlock.h"
+
+#include <cassert>
+#include <mutex>
+
+#include "KramMipper.h" // for Color
+
+#if COMPILE_BCENC
+#include "rgbcx.h"
+#endif
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+// Same tables as the etc2comp encoder and the block decoder.
+static const int32_t kEACModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static const int32_t kETC1Modifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+static const int32_t kETC2Distances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+inline int32_t expand4(int32_t v) { return (v << 4) | v; }
+inline int32_t expand5(int32_t v) { return (v << 3) | (v >> 2); }
+inline int32_t expand6(int32_t v) { return (v << 2) | (v >> 4); }
+inline int32_t expand7(int32_t v) { return (v << 1) | (v >> 6); }
+
+inline int32_t clamp255(int32_t v) { return std::min(std::max(v, 0), 255); }
+
+// etc1 selector order is +small, +large, -small, -large
+inline int32_t etcModifier(int32_t table, int32_t selector)
+{
+    int32_t modifier = kETC1Modifiers[table][selector & 1];
+    return (selector & 2) ? -modifier : modifier;
+}
+
+// T mode selector order is color1, color2 + d, color2, color2 - d
+inline int32_t etcTModifier(int32_t distance, int32_t selector)
+{
+    int32_t modifier = (selector & 1) ? kETC2Distances[distance] : 0;
+    return (selector == 3) ? -modifier : modifier;
+}
+
+// Closest quantized value to each 8-bit channel value, and its error.
+struct SolidEndpoint {
+    uint8_t value;
+    uint8_t error;
+};
+
+// Planar corners for one channel, and the squared error over the 16 pixels.
+struct SolidPlanar {
+    uint8_t o, h, v;
+    uint16_t error;
+};
+
+// Constant encodings that need a search are done for every 8-bit value once.
+struct SolidBlockTables {
+    // bc7 mode 5 7-bit endpoints that hit each value at index 1
+    uint8_t bc7Mode5[256][2];
+
+    // etc individual (4-bit) and differential (5-bit) base per table and selector
+    SolidEndpoint etc4[8][4][256];
+    SolidEndpoint etc5[8][4][256];
+
+    // etc2 T mode 4-bit color2 per distance and selector
+    SolidEndpoint etcT[8][4][256];
+
+    // etc planar, 676 bits.  Corners a step off the origin interpolate to
+    // values between the steps, so the block isn't quite constant.
+    SolidPlanar etc6[256];
+    SolidPlanar etc7[256];
+
+    // eac r11 base, multiplier/table byte and selector
+    uint8_t eac11[256][3];
+};
+
+static SolidBlockTables gSolidBlockTables;
+static std::once_flag gSolidBlockTablesInit;
+
+template <typename F>
+static SolidEndpoint closestEndpoint(int32_t c, int32_t numValues, int32_t modifier, const F& expand)
+{
+    SolidEndpoint best = {0, 255};
+    for (int32_t v = 0; v < numValues; ++v) {
+        int32_t error = abs(clamp255(expand(v) + modifier) - c);
+        if (error < best.error) {
+            best = {(uint8_t)v, (uint8_t)error};
+        }
+    }
+    return best;
+}
+
+template <typename F>
+static SolidPlanar closestPlanar(int32_t c, int32_t numValues, const F& expand)
+{
+    SolidPlanar best = {0, 0, 0, 0xFFFF};
+
+    int32_t closest = closestEndpoint(c, numValues, 0, expand).value;
+    for (int32_t o = std::max(closest - 1, 0); o <= std::min(closest + 1, numValues - 1); ++o) {
+        for (int32_t h = std::max(o - 3, 0); h <= std::min(o + 3, numValues - 1); ++h) {
+            for (int32_t v = std::max(o - 3, 0); v <= std::min(o + 3, numValues - 1); ++v) {
+                int32_t dh = expand(h) - expand(o);
+                int32_t dv = expand(v) - expand(o);
+
+                int32_t error = 0;
+                for (int32_t y = 0; y < 4; ++y) {
+                    for (int32_t x = 0; x < 4; ++x) {
+                        int32_t d = clamp255((x * dh + y * dv + 4 * expand(o) + 2) >> 2) - c;
+                        error += d * d;
+                    }
+                }
+
+                if (error < best.error) {
+                    best = {(uint8_t)o, (uint8_t)h, (uint8_t)v, (uint16_t)error};
+                }
+            }
+        }
+    }
+    return best;
+}
+
+static void initSolidBlockTables()
+{
+    SolidBlockTables& t = gSolidBlockTables;
+
+    for (int32_t c = 0; c < 256; ++c) {
+        // bc7 interpolates 43:21 at index 1, and some pair hits every value
+        int32_t bestError = 256;
+        for (int32_t lo = 0; lo < 128 && bestError != 0; ++lo) {
+            for (int32_t hi = 0; hi < 128; ++hi) {
+                int32_t value = (43 * expand7(lo) + 21 * expand7(hi) + 32) >> 6;
+                int32_t error = abs(value - c);
+                if (error < bestError) {
+                    bestError = error;
+                    t.bc7Mode5[c][0] = (uint8_t)lo;
+                    t.bc7Mode5[c][1] = (uint8_t)hi;
+                    if (error == 0)
+                        break;
+                }
+            }
+        }
+
+        for (int32_t table = 0; table < 8; ++table) {
+            for (int32_t selector = 0; selector < 4; ++selector) {
+                int32_t modifier = etcModifier(table, selector);
+                t.etc4[table][selector][c] = closestEndpoint(c, 16, modifier, expand4);
+                t.etc5[table][selector][c] = closestEndpoint(c, 32, modifier, expand5);
+                t.etcT[table][selector][c] = closestEndpoint(c, 16, etcTModifier(table, selector), expand4);
+            }
+        }
+
+        t.etc6[c] = closestPlanar(c, 64, expand6);
+        t.etc7[c] = closestPlanar(c, 128, expand7);
+
+        // r11 is 11-bit, so find the closest value to c widened to 11 bits.
+        // Multiplier 0 steps by 1/8.
+        int32_t target = (c * 2047 + 127) / 255;
+        bestError = 2048;
+        for (int32_t multiplier = 0; multiplier < 16 && bestError != 0; ++multiplier) {
+            int32_t multiplier11 = (multiplier == 0) ? 1 : (multiplier * 8);
+
+            for (int32_t table = 0; table < 16 && bestError != 0; ++table) {
+                for (int32_t selector = 0; selector < 8; ++selector) {
+                    int32_t offset = 4 + kEACModifiers[table][selector] * multiplier11;
+                    int32_t base = std::min(std::max((target - offset + 4) >> 3, 0), 255);
+
+                    int32_t value = std::min(std::max(base * 8 + offset, 0), 2047);
+                    int32_t error = abs(value - target);
+                    if (error < bestError) {
+                        bestError = error;
+                        t.eac11[c][0] = (uint8_t)base;
+                        t.eac11[c][1] = (uint8_t)((multiplier << 4) | table);
+                        t.eac11[c][2] = (uint8_t)selector;
+                        if (error == 0)
+                            break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------
+
+// Which bytes of the color the format stores.  Color is rgba in memory.
+static uint32_t solidChannelMask(MyMTLPixelFormat format)
+{
+    switch (format) {
+        case MyMTLPixelFormatBC4_RUnorm:
+        case MyMTLPixelFormatBC4_RSnorm:
+        case MyMTLPixelFormatEAC_R11Unorm:
+            return 0x000000FF;
+
+        case MyMTLPixelFormatBC5_RGUnorm:
+        case MyMTLPixelFormatBC5_RGSnorm:
+        case MyMTLPixelFormatEAC_RG11Unorm:
+            return 0x0000FFFF;
+
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+        case MyMTLPixelFormatETC2_RGB8:
+        case MyMTLPixelFormatETC2_RGB8_sRGB:
+            return 0x00FFFFFF;
+
+        default:
+            return 0xFFFFFFFF;
+    }
+}
+
+bool isSolidBlockFormat(MyMTLPixelFormat format)
+{
+    switch (format) {
+#if COMPILE_BCENC
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+        case MyMTLPixelFormatBC3_RGBA:
+        case MyMTLPixelFormatBC3_RGBA_sRGB:
+#endif
+        // snorm endpoints are remapped after the encode
+        case MyMTLPixelFormatBC4_RUnorm:
+        case MyMTLPixelFormatBC4_RSnorm:
+        case MyMTLPixelFormatBC5_RGUnorm:
+        case MyMTLPixelFormatBC5_RGSnorm:
+        case MyMTLPixelFormatBC7_RGBAUnorm:
+        case MyMTLPixelFormatBC7_RGBAUnorm_sRGB:
+
+        case MyMTLPixelFormatETC2_RGB8:
+        case MyMTLPixelFormatETC2_RGB8_sRGB:
+        case MyMTLPixelFormatEAC_RGBA8:
+        case MyMTLPixelFormatEAC_RGBA8_sRGB:
+        case MyMTLPixelFormatEAC_R11Unorm:
+        case MyMTLPixelFormatEAC_RG11Unorm:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+//-----------------------------
+
+// Same as rgbcx::encode_bc4_hq, both endpoints at the value in 6 value mode.
+static void encodeSolidBC4(uint8_t value, uint8_t* dst)
+{
+    dst[0] = value;
+    dst[1] = value;
+    memset(dst + 2, 0, 6);
+}
+
+inline void setBits(uint64_t bits[2], int32_t offset, int32_t count, uint32_t value)
+{
+    for (int32_t i = 0; i < count; ++i, ++offset) {
+        if (value & (1u << i)) {
+            bits[offset >> 6] |= 1ull << (offset & 63);
+        }
+    }
+}
+
+// Mode 5 with 7-bit color endpoints that interpolate to the color at index 1,
+// and 8-bit alpha endpoints at alpha with index 0.  This is exact.
+static void encodeSolidBC7(Color color, uint8_t* dst)
+{
+    const SolidBlockTables& t = gSolidBlockTables;
+
+    uint64_t bits[2] = {1ull << 5, 0};
+
+    // rotation 0 at 6
+    int32_t offset = 8;
+    uint8_t channels[3] = {color.r, color.g, color.b};
+    for (uint8_t channel : channels) {
+        setBits(bits, offset, 7, t.bc7Mode5[channel][0]);
+        setBits(bits, offset + 7, 7, t.bc7Mode5[channel][1]);
+        offset += 14;
+    }
+
+    setBits(bits, offset, 8, color.a);
+    setBits(bits, offset + 8, 8, color.a);
+    offset += 16;
+
+    // color indices are all 1, the anchor drops its high bit
+    setBits(bits, offset, 1, 1);
+    offset += 1;
+    for (int32_t i = 1; i < 16; ++i, offset += 2) {
+        setBits(bits, offset, 2, 1);
+    }
+
+    // alpha indices are all 0
+    memcpy(dst, bits, 16);
+}
+
+// 16 3-bit selectors, big endian after the 2 byte header.
+static void encodeSolidEAC(uint8_t base, uint8_t multiplierAndTable, uint32_t selector, uint8_t* dst)
+{
+    uint64_t selectors = 0;
+    for (int32_t i = 0; i < 16; ++i) {
+        selectors = (selectors << 3) | selector;
+    }
+
+    dst[0] = base;
+    dst[1] = multiplierAndTable;
+    for (int32_t i = 0; i < 6; ++i) {
+        dst[2 + i] = (uint8_t)(selectors >> (40 - 8 * i));
+    }
+}
+
+static void encodeSolidEACAlpha(uint8_t alpha, uint8_t* dst)
+{
+    // table 0 with multiplier 1 has +2 and -3, which reach every value
+    if (alpha >= 2)
+        encodeSolidEAC(alpha - 2, 0x10, 4, dst);
+    else
+        encodeSolidEAC(alpha + 3, 0x10, 0, dst);
+}
+
+static void encodeSolidR11(uint8_t value, uint8_t* dst)
+{
+    const uint8_t* eac = gSolidBlockTables.eac11[value];
+    encodeSolidEAC(eac[0], eac[1], eac[2], dst);
+}
+
+// Picks the closest of differential, individual, T and planar.  Both subblocks
+// get the same base and table, and every pixel the same selector.  H mode has
+// the same offsets from a 4-bit color as T mode, so it's not searched.  Errors
+// are summed over the block, since planar can vary across it.
+static void encodeSolidETC2(Color color, uint8_t* dst)
+{
+    const SolidBlockTables& t = gSolidBlockTables;
+
+    auto sq = [](int32_t x) { return x * x; };
+
+    enum { kDifferential,
+           kIndividual,
+           kT,
+           kPlanar };
+
+    int32_t bestMode = kPlanar;
+    int32_t bestTable = 0;
+    int32_t bestSelector = 0;
+    int32_t bestError = t.etc6[color.r].error + t.etc7[color.g].error + t.etc6[color.b].error;
+
+    for (int32_t table = 0; table < 8 && bestError != 0; ++table) {
+        for (int32_t selector = 0; selector < 4; ++selector) {
+            const SolidEndpoint* e5 = t.etc5[table][selector];
+            const SolidEndpoint* e4 = t.etc4[table][selector];
+
+            int32_t error5 = 16 * (sq(e5[color.r].error) + sq(e5[color.g].error) + sq(e5[color.b].error));
+            int32_t error4 = 16 * (sq(e4[color.r].error) + sq(e4[color.g].error) + sq(e4[color.b].error));
+
+            if (error5 < bestError) {
+                bestError = error5;
+                bestMode = kDifferential;
+                bestTable = table;
+                bestSelector = selector;
+            }
+            if (error4 < bestError) {
+                bestError = error4;
+                bestMode = kIndividual;
+                bestTable = table;
+                bestSelector = selector;
+            }
+
+            // selector 0 is color1, which has the same offset as selector 2
+            if (selector != 0) {
+                const SolidEndpoint* eT = t.etcT[table][selector];
+                int32_t errorT = 16 * (sq(eT[color.r].error) + sq(eT[color.g].error) + sq(eT[color.b].error));
+
+                if (errorT < bestError) {
+                    bestError = errorT;
+                    bestMode = kT;
+                    bestTable = table;
+                    bestSelector = selector;
+                }
+            }
+        }
+    }
+
+    if (bestMode == kPlanar) {
+        const SolidPlanar& r = t.etc6[color.r];
+        const SolidPlanar& g = t.etc7[color.g];
+        const SolidPlanar& b = t.etc6[color.b];
+
+        // Planar is flagged by red and green not overflowing their 5-bit base
+        // plus 3-bit delta, and blue overflowing.  The spare bits force that.
+        uint32_t b0 = ((~r.o & 0x20) << 2) | (r.o << 1) | (g.o >> 6);
+        uint32_t b1 = ((~g.o & 0x20) << 2) | ((g.o & 63) << 1) | (b.o >> 5);
+
+        uint32_t b2 = (b.o & 0x18) | ((b.o >> 1) & 3);
+        if (((b.o >> 3) & 3) + ((b.o >> 1) & 3) >= 4)
+            b2 |= 0xE0;
+        else
+            b2 |= 0x04;
+
+        dst[0] = (uint8_t)b0;
+        dst[1] = (uint8_t)b1;
+        dst[2] = (uint8_t)b2;
+        dst[3] = (uint8_t)(((b.o & 1) << 7) | ((r.h >> 1) << 2) | 2 | (r.h & 1));
+        dst[4] = (uint8_t)((g.h << 1) | (b.h >> 5));
+        dst[5] = (uint8_t)(((b.h & 31) << 3) | (r.v >> 3));
+        dst[6] = (uint8_t)(((r.v & 7) << 5) | (g.v >> 2));
+        dst[7] = (uint8_t)(((g.v & 3) << 6) | b.v);
+        return;
+    }
+
+    if (bestMode == kT) {
+        const SolidEndpoint* eT = t.etcT[bestTable][bestSelector];
+        uint32_t r = eT[color.r].value;
+        uint32_t g = eT[color.g].value;
+        uint32_t b = eT[color.b].value;
+
+        // T mode is flagged by red overflowing, which the spare bits force.
+        // color1 is unused, so it's the same as color2.
+        uint32_t b0 = ((r >> 2) << 3) | (r & 3);
+        if ((r >> 2) + (r & 3) >= 4)
+            b0 |= 0xE0;
+        else
+            b0 |= 0x04;
+
+        dst[0] = (uint8_t)b0;
+        dst[1] = (uint8_t)((g << 4) | b);
+        dst[2] = (uint8_t)((r << 4) | g);
+        dst[3] = (uint8_t)((b << 4) | ((bestTable >> 1) << 2) | 2 | (bestTable & 1));
+    }
+    else if (bestMode == kDifferential) {
+        // zero deltas, so the second subblock matches
+        const SolidEndpoint* e5 = t.etc5[bestTable][bestSelector];
+        dst[0] = (uint8_t)(e5[color.r].value << 3);
+        dst[1] = (uint8_t)(e5[color.g].value << 3);
+        dst[2] = (uint8_t)(e5[color.b].value << 3);
+        dst[3] = (uint8_t)((bestTable << 5) | (bestTable << 2) | 2);
+    }
+    else {
+        const SolidEndpoint* e4 = t.etc4[bestTable][bestSelector];
+        dst[0] = (uint8_t)(e4[color.r].value * 0x11);
+        dst[1] = (uint8_t)(e4[color.g].value * 0x11);
+        dst[2] = (uint8_t)(e4[color.b].value * 0x11);
+        dst[3] = (uint8_t)((bestTable << 5) | (bestTable << 2));
+    }
+
+    // selector msb plane, then lsb plane
+    uint8_t msb = (bestSelector & 2) ? 0xFF : 0;
+    uint8_t lsb = (bestSelector & 1) ? 0xFF : 0;
+    dst[4] = msb;
+    dst[5] = msb;
+    dst[6] = lsb;
+    dst[7] = lsb;
+}
+
+static void encodeSolidBlock(MyMTLPixelFormat format, Color color, bool hasBC1Alpha, uint8_t* dst)
+{
+    switch (format) {
+#if COMPILE_BCENC
+        case MyMTLPixelFormatBC1_RGBA:
+        case MyMTLPixelFormatBC1_RGBA_sRGB:
+            if (hasBC1Alpha && color.a < 128) {
+                // 3 color block with equal endpoints, and every index is transparent black
+                memset(dst, 0, 4);
+                memset(dst + 4, 0xFF, 4);
+                break;
+            }
+
+            // same as rgbcx::encode_bc1 without 3 color blocks
+            rgbcx::encode_bc1_solid_block(dst, color.r, color.g, color.b, false);
+            break;
+
+        case MyMTLPixelFormatBC3_RGBA:
+        case MyMTLPixelFormatBC3_RGBA_sRGB:
+            encodeSolidBC4(color.a, dst);
+            rgbcx::encode_bc1_solid_block(dst + 8, color.r, color.g, color.b, false);
+            break;
+#endif
+        case MyMTLPixelFormatBC4_RUnorm:
+        case MyMTLPixelFormatBC4_RSnorm:
+            encodeSolidBC4(color.r, dst);
+            break;
+
+        case MyMTLPixelFormatBC5_RGUnorm:
+        case MyMTLPixelFormatBC5_RGSnorm:
+            encodeSolidBC4(color.r, dst);
+            encodeSolidBC4(color.g, dst + 8);
+            break;
+
+        case MyMTLPixelFormatBC7_RGBAUnorm:
+        case MyMTLPixelFormatBC7_RGBAUnorm_sRGB:
+            encodeSolidBC7(color, dst);
+            break;
+
+        case MyMTLPixelFormatETC2_RGB8:
+        case MyMTLPixelFormatETC2_RGB8_sRGB:
+            encodeSolidETC2(color, dst);
+            break;
+
+        case MyMTLPixelFormatEAC_RGBA8:
+        case MyMTLPixelFormatEAC_RGBA8_sRGB:
+            encodeSolidEACAlpha(color.a, dst);
+            encodeSolidETC2(color, dst + 8);
+            break;
+
+        case MyMTLPixelFormatEAC_R11Unorm:
+            encodeSolidR11(color.r, dst);
+            break;
+
+        case MyMTLPixelFormatEAC_RG11Unorm:
+            encodeSolidR11(color.r, dst);
+            encodeSolidR11(color.g, dst + 8);
+            break;
+
+        default:
+            assert(false);
+            break;
+    }
+}
+
+int32_t encodeSolidBlocks(MyMTLPixelFormat format, const Color* srcPixels,
+                          int32_t w, int32_t h, int32_t blockRowStart, int32_t blockRowEnd,
+                          bool hasBC1Alpha, uint8_t* dstBlocks, uint8_t* isSolid)
+{
+    if (!isSolidBlockFormat(format)) {
+        return 0;
+    }
+
+    std::call_once(gSolidBlockTablesInit, initSolidBlockTables);
+
+    const int32_t blockDim = 4;
+    int32_t blocks_x = (w + blockDim - 1) / blockDim;
+    int32_t blockSize = blockSizeOfFormat(format);
+    uint32_t mask = solidChannelMask(format);
+
+    // squish turns bc1 alpha < 128 into transparent pixels, so the solid
+    // blocks must all be on the same side of that
+    bool isBC1 = format == MyMTLPixelFormatBC1_RGBA || format == MyMTLPixelFormatBC1_RGBA_sRGB;
+    hasBC1Alpha = hasBC1Alpha && isBC1;
+    if (hasBC1Alpha) {
+        mask |= 0x80000000;
+    }
+
+    int32_t numSolidBlocks = 0;
+
+    for (int32_t by = blockRowStart; by < blockRowEnd; ++by) {
+        int32_t y = by * blockDim;
+        int32_t yEnd = std::min(y + blockDim, h);
+
+        for (int32_t bx = 0; bx < blocks_x; ++bx) {
+            int32_t x = bx * blockDim;
+            int32_t xEnd = std::min(x + blockDim, w);
+
+            uint32_t first;
+            memcpy(&first, &srcPixels[y * w + x], sizeof(uint32_t));
+
+            bool isBlockSolid = true;
+            for (int32_t yy = y; yy < yEnd && isBlockSolid; ++yy) {
+                for (int32_t xx = x; xx < xEnd; ++xx) {
+                    uint32_t pixel;
+                    memcpy(&pixel, &srcPixels[yy * w + xx], sizeof(uint32_t));
+                    if ((pixel ^ first) & mask) {
+                        isBlockSolid = false;
+                        break;
+                    }
+                }
+            }
+
+            int32_t blockIndex = by * blocks_x + bx;
+            isSolid[blockIndex] = isBlockSolid;
+
+            if (isBlockSolid) {
+                encodeSolidBlock(format, srcPixels[y * w + x], hasBC1Alpha, dstBlocks + blockIndex * blockSize);
+                numSolidBlocks++;
+            }
+        }
+    }
+
+    return numSolidBlocks;
+}
+
+} // namespace kram
@@ -0,0 +1,33 @@
+// kram - Copyright 2020-2025 by Alec Miller. - MIT License
+// The license and copyright notice shall be included
+// in all copies or substantial portions of the Software.
+
+#pragma once
+
+#include <cstdint>
+
+//#include "KramConfig.h"
+#include "KTXImage.h" // for MyMTLPixelFormat
+
+namespace kram {
+using namespace STL_NAMESPACE;
+
+struct Color;
+
+// Whether encodeSolidBlocks has a constant encoding for the format.  These are
+// BC1/3/4/5/7 and ETC2 rgb/rgba and EAC r11/rg11 unorm.  BC1/3 need bcenc.
+bool isSolidBlockFormat(MyMTLPixelFormat format);
+
+// Finds the 4x4 blocks in block rows [blockRowStart, blockRowEnd) of a w x h mip
+// that are one color in the channels the format stores, and writes the closest
+// encoding of that color into dstBlocks, which is the whole mip.  isSolid has a
+// byte per block of the mip, and is set to 1 for those blocks so the encoder can
+// skip them.  Pixels past the edge of the mip don't count, since encoders clamp.
+// Returns the number of solid blocks.  BC1/3 use the rgbcx single color tables,
+// so rgbcx::init must have been called.  hasBC1Alpha matches squish, which
+// encodes bc1 alpha < 128 as transparent, otherwise bc1 is always opaque.
+int32_t encodeSolidBlocks(MyMTLPixelFormat format, const Color* srcPixels,
+                          int32_t w, int32_t h, int32_t blockRowStart, int32_t blockRowEnd,
+                          bool hasBC1Alpha, uint8_t* dstBlocks, uint8_t* isSolid);
+
+} // namespace kram
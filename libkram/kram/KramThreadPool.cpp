@@ -11,31 +11,30 @@
 //#include <synchapi.h>
 #endif
 
-#if KRAM_LINUX
+#if KRAM_LINUX || KRAM_ANDROID
 #include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
-// Remove this, and move out all the threading prims
-#include "TaskSystem.h"
-
 // Android is missing defines
 #if KRAM_ANDROID
 #ifndef SYS_futex
 # define SYS_futex __NR_futex
 #endif
-#ifndef FUTEX_WAIT_BITSET
-# define FUTEX_WAIT_BITSET 9
+#ifndef FUTEX_WAIT
+# define FUTEX_WAIT 0
 #endif
-#ifndef FUTEX_WAKE_BITSET
-# define FUTEX_WAKE_BITSET 10
+#ifndef FUTEX_WAKE
+# define FUTEX_WAKE 1
 #endif
 #ifndef FUTEX_PRIVATE_FLAG
 # define FUTEX_PRIVATE_FLAG 128
 #endif
 #endif
 
-// TODO: don't understand how jobs get distributed to the various queues
-// Especially if all jobs are coming in from the main/scheduler thread.
+// Jobs from outside the workers go to the worker with the fewest queued jobs.
+// Jobs from a worker go to its own queue, and idle workers steal them.
 //
 // TODO: add ability to grow/shrink workers
 //
@@ -55,7 +54,9 @@ namespace kram {
 using namespace STL_NAMESPACE;
 
 
-// futex is 0 when waiting, and 1+ when active.
+// futex holds a wake generation.  Workers read it before looking for jobs,
+// and only sleep if it hasn't changed since, so a wake can't be missed.
+// The generation can rollover, it's only compared for equality.
 // futex wait and timout support with newer macOS API, but requires iOS17.4/macOS14.4.
 // #include "os/os_sync_wait_on_address.h"
 // int os_sync_wait_on_address(void *addr, uint64_t value, size_t size, os_sync_wait_on_address_flags_t flags);
@@ -110,18 +111,19 @@ void futex::notify_all() {
 // Only has uint32_t support
 
 void futex::wait(uint32_t expectedValue) {
-    syscall(SYS_futex, &_value, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
-            NULL, NULL, expectedValue);
+    // returns immediately if value doesn't match, or spuriously, callers recheck
+    syscall(SYS_futex, &_value, FUTEX_WAIT | FUTEX_PRIVATE_FLAG,
+            expectedValue, NULL, NULL, 0);
 }
 
 void futex::notify_one() {
-    syscall(SYS_futex, &_value, FUTEX_WAKE_BITSET | FUTEX_PRIVATE_FLAG,
-            NULL, NULL, 1);
+    syscall(SYS_futex, &_value, FUTEX_WAKE | FUTEX_PRIVATE_FLAG,
+            1, NULL, NULL, 0);
 }
 
 void futex::notify_all() {
-    syscall(SYS_futex, &_value, FUTEX_WAKE_BITSET | FUTEX_PRIVATE_FLAG,
-            NULL, NULL, INT32_MAX); // TODO: UINT32_MAX?
+    syscall(SYS_futex, &_value, FUTEX_WAKE | FUTEX_PRIVATE_FLAG,
+            INT32_MAX, NULL, NULL, 0);
 }
 
 #endif
@@ -138,10 +140,6 @@ Scheduler::Scheduler(uint32_t numWorkers) {
     
     _schedulerThread = getCurrentThread();
     
-    // TODO: should move the scheduler settings out
-    ThreadInfo infoMain = {"Sheduler", ThreadPriority::Interactive, 0};
-    setThreadInfo(infoMain);
-    
     string name;
     
     for (uint32_t threadIndex = 0; threadIndex < numWorkers; ++threadIndex) {
@@ -176,66 +174,105 @@ Scheduler::Scheduler(uint32_t numWorkers) {
 }
 
 
-// TODO: this is one way to pass pririty with priority
-//    template<typename F>
-//    void scheduleJob(int priority, F f) {
-//        sheduleJob(Job2(priority, f));
-//    }
+// Identifies the worker that a job is running on, so jobs spawned by it
+// go to its own queue.
+struct SchedulerWorker {
+    Scheduler* scheduler = nullptr;
+    Worker* worker = nullptr;
+};
+
+static thread_local SchedulerWorker gSchedulerWorker;
+
+bool Scheduler::scheduleJob(Job2& job) {
+    return scheduleJob(job.priority, std::move(job.job));
+}
 
-void Scheduler::scheduleJob(Job2& job) {
-    auto currentThread = getCurrentThread();
+bool Scheduler::scheduleNode(JobPriority priority, task_node* node) {
+    Worker* currentWorker = nullptr;
+    if (gSchedulerWorker.scheduler == this) {
+        currentWorker = gSchedulerWorker.worker;
+    }
+
+    // Workers can still spawn jobs while the queues drain on stop,
+    // but other threads can't add more work.
+    if (!currentWorker && _isStop) {
+        free_task_node(node);
+        return false;
+    }
+
+    uint32_t numWorkers = (uint32_t)_workers.size();
 
     // job subtasks always first pushed to their own queue.
     // if this is null, then it's either the scheduler thread or a random thread
-    //  trying to submit a job (which goes to scheduler).
-    Worker* worker = findWorker(currentThread);
-    
-    // Already on same thread.  That thread is awake.
-    // But another thread could be stealing a job,
-    // So for now project queue with mutex.
-    
-    if (currentThread == _schedulerThread || !worker) {
-        // Need to pick a best queue to put work on?
-        // otherwise everything gets stuck on scheduler queue
-        // and then is stolen off it.
-        
-        // Scheduler thread needs to ensure a worker is awake
-        // since it doesn't run it's own work?
-        
+    // trying to submit a job.
+    uint32_t firstQueue = 0;
+    if (currentWorker) {
+        firstQueue = currentWorker->_workerId;
+    }
+    else {
         // Atomic count per Worker helps here.  Can read outside
         // of lock, and can then spread work more evenly.
-        
-        uint32_t minQueue = 0;
         uint32_t minQueueCount = _workers[0]->queueSize();
-        
-        for (uint32_t i = 1; i < _workers.size(); ++i) {
+
+        for (uint32_t i = 1; i < numWorkers; ++i) {
             uint32_t queueCount = _workers[i]->queueSize();
             if (queueCount < minQueueCount) {
                 minQueueCount = queueCount;
-                minQueue = i;
+                firstQueue = i;
             }
         }
-        
-        worker = _workers[minQueue];
-        
-        {
-            lock_guard<mutex> lock(worker->_mutex);
-            worker->_queue.push(std::move(job));
-            worker->incQueueSize();
-            _stats.jobsTotal++;
+    }
+
+    _stats.jobsTotal++;
+    _stats.jobsScheduled++;
+    _stats.jobsPerPriority[(uint32_t)priority]++;
+
+    while (true) {
+        // queues are bounded, so try the others if the first is full
+        for (uint32_t i = 0; i < numWorkers; ++i) {
+            Worker* worker = _workers[(firstQueue + i) % numWorkers];
+            if (!worker->push(priority, node)) {
+                continue;
+            }
+
+            if (worker == currentWorker) {
+                // the worker is already awake, but get others to steal
+                currentWorker->wakeWorkers();
+            }
+            else {
+                // here the scheduler or random thread needs to wake a worker,
+                // and others to steal if that one is busy or jobs are backing up
+                worker->wake();
+                if (worker->_isExecuting || _stats.jobsRemaining() > 1) {
+                    worker->wakeWorkers();
+                }
+            }
+            return true;
         }
-        
-        // here the scheduler or random thread needs to wake a worker
-        worker->_futex.notify_one();
+
+        // All queues full.  A worker runs the job inline, which also throttles
+        // whatever is spawning jobs.  Other threads wait for a slot.
+        if (currentWorker) {
+            _stats.jobsRunInline++;
+            _stats.jobsExecuting++;
+
+            node->func();
+            free_task_node(node);
+
+            _stats.jobsExecuting--;
+            _stats.jobsTotal--;
+            _stats.jobsCompleted++;
+            return true;
+        }
+
+        this_thread::yield();
     }
-    else {
-        lock_guard<mutex> lock(worker->_mutex);
-        worker->_queue.push(std::move(job));
-        worker->incQueueSize();
-        _stats.jobsTotal++;
-        
-        // the job is already awake and scheduling to its own queue
-        // so don't need to notify.
+}
+
+void Scheduler::waitIdle()
+{
+    while (_stats.jobsTotal > 0) {
+        this_thread::yield();
     }
 }
 
@@ -244,158 +281,180 @@ void Scheduler::stop()
     // has to be called on scheduler thread
     // just don't call from a worker
     //KASSERT(getCurrentThread() == _schedulerThread);
-    
+
     if (_isStop)
         return;
-    
+
     _isStop = true;
-    
+
     for (uint32_t i = 0; i < _workers.size(); ++i) {
-        // wake it
-        _workers[i]->_futex.notify_one();
-        
-        // wait on thread to end
+        // A worker about to sleep sees the new generation, and doesn't
+        // miss the wake.  It then drains the queues and exits.
+        _workers[i]->wake();
+    }
+
+    // wait on threads to end, must join all before deleting any
+    // since workers steal from each other's queues.
+    for (uint32_t i = 0; i < _threads.size(); ++i) {
         _threads[i].join();
-        
-        // since had to use ptrs, delete them
+    }
+
+    // since had to use ptrs, delete them
+    for (uint32_t i = 0; i < _workers.size(); ++i) {
         delete _workers[i];
         _workers[i] = nullptr;
     }
 }
-   
 
-bool Worker::stealFromOtherQueues(Job2& job)
+void SchedulerStats::log() const
 {
-    // Is this safe to test?
-    if (_scheduler->stats().jobsRemaining() == 0)
+    KLOGI("Scheduler", "jobs:%llu completed:%llu stolen:%llu inline:%llu sleeps:%llu (high:%llu default:%llu low:%llu)",
+          (unsigned long long)jobsScheduled, (unsigned long long)jobsCompleted,
+          (unsigned long long)jobsStolen, (unsigned long long)jobsRunInline,
+          (unsigned long long)sleeps,
+          (unsigned long long)jobsPerPriority[(uint32_t)JobPriority::High],
+          (unsigned long long)jobsPerPriority[(uint32_t)JobPriority::Default],
+          (unsigned long long)jobsPerPriority[(uint32_t)JobPriority::Low]);
+}
+
+bool Worker::push(JobPriority priority, task_node* node)
+{
+    // count goes up first, so a thief can't take it below zero
+    incQueueSize();
+    if (!_queues[(uint32_t)priority].try_push(node)) {
+        decQueueSize();
         return false;
-    
-    bool found = false;
-    
+    }
+    return true;
+}
+
+task_node* Worker::pop(JobPriority priority)
+{
+    task_node* node = _queues[(uint32_t)priority].try_pop();
+    if (node) {
+        decQueueSize();
+    }
+    return node;
+}
+
+task_node* Worker::stealFromOtherQueues(JobPriority priority)
+{
     auto& workers = _scheduler->workers();
 
     // This will visit buddy and then the rest
-    for (uint32_t i = 0; i < workers.size()-1; ++i) {
-        Worker* worker = workers[(_workerId+1+i) % workers.size()];
-        
+    for (uint32_t i = 0; i < workers.size() - 1; ++i) {
+        Worker* worker = workers[(_workerId + 1 + i) % workers.size()];
+
         // This should never visit caller Worker.
         KASSERT(worker != this);
-        
-        // loop of expensive queue mutex locks below searching for jobs
-        // use atomic queueSize per worker.  A little racy.
-//        if (worker->queueSize() == 0) {
-//            continue;
-//        }
-        
-        lock_guard<mutex> lock(worker->_mutex);
-        if (!worker->_queue.empty()) {
-            job = std::move(worker->_queue.top());
-            worker->_queue.pop();
-            worker->decQueueSize();
-            
-            SchedulerStats& stats = _scheduler->stats();
-            stats.jobsExecuting++;
-            
-            // stop search, since returning a job
-            found = true;
-            break;
+
+        // skip empty queues without touching the queue memory.  A little racy.
+        if (worker->queueSize() == 0) {
+            continue;
+        }
+
+        task_node* node = worker->pop(priority);
+        if (node) {
+            _scheduler->stats().jobsStolen++;
+            return node;
         }
-        
     }
 
-    return found;
+    return nullptr;
+}
+
+task_node* Worker::findJob()
+{
+    // Higher priority jobs anywhere go before lower priority jobs
+    // in our own queue.  That's what lets priority preempt queue order.
+    for (uint32_t p = 0; p < kNumPriorities; ++p) {
+        JobPriority priority = (JobPriority)p;
+
+        task_node* node = pop(priority);
+        if (!node && _scheduler->stats().jobsRemaining() > 0) {
+            node = stealFromOtherQueues(priority);
+        }
+
+        if (node) {
+            _scheduler->stats().jobsExecuting++;
+            return node;
+        }
+    }
+    return nullptr;
 }
 
 void Worker::wakeWorkers()
 {
-    // Is this safe to test?
-    if (_scheduler->stats().jobsRemaining() == 0)
+    // A little racy, but a worker that's missed finds the job
+    // when it finishes what it's running.
+    uint32_t numJobs = _scheduler->stats().jobsRemaining();
+    if (numJobs == 0)
         return;
-    
+
     // This takes responsibility off the main thread
     // to keep waking threads to run tasks.
     auto& workers = _scheduler->workers();
-    
-    Worker* buddy = workers[(_workerId+1) % workers.size()];
-    
-    if (!buddy->_isExecuting) {
-        buddy->_futex.notify_one();
-        return;
-    }
-    
-    // TODO: should we only wake as many workers as jobs
-    // what if they are already awake and working?
-    // uint32_t numJobs = _scheduler->stats().jobsRemaining();
-    
-    // Wrap around visit from just past buddy
-    for (uint32_t i = 0; i < workers.size()-2; ++i) {
-        Worker* worker = workers[(_workerId+2+i) % workers.size()];
+
+    // Wrap around visit from buddy, and wake as many idle workers as
+    // there are jobs waiting, so a burst of jobs fans out quickly.
+    for (uint32_t i = 0; i + 1 < workers.size() && numJobs > 0; ++i) {
+        Worker* worker = workers[(_workerId + 1 + i) % workers.size()];
         if (!worker->_isExecuting) {
-            worker->_futex.notify_one();
-            break;
+            worker->wake();
+            numJobs--;
         }
     }
 }
 
-bool Worker::shouldSleep()
-{
-    // TODO: needs to be more complex
-    // for parallel task exectution.
-    
-    return true;
-}
-
 void Worker::run()
 {
+    gSchedulerWorker.scheduler = _scheduler;
+    gSchedulerWorker.worker = this;
+
     SchedulerStats& stats = _scheduler->stats();
-    
-    while(!_scheduler->isStop()) {
+
+    while (true) {
+        // read before looking for jobs, any wake after this keeps us from sleeping
+        uint32_t generation = _futex._value;
+
         // Take a job from our worker thread’s local queue
-        Job2 job;
-        bool found = false;
-        {
-            lock_guard<mutex> lock(_mutex);
-            if (!_queue.empty()) {
-                job = std::move(_queue.top());
-                _queue.pop();
-                decQueueSize();
-                stats.jobsExecuting++;
-                found = true;
-            }
-        }
-        
         // If our queue is empty try to steal work from someone
         // else's queue to help them out.
-        if(!found) {
-            found = stealFromOtherQueues(job);
-        }
-        
-        if(found) {
+        task_node* node = findJob();
+
+        if (node) {
             // If we found work, there may be more conditionally
             // wake up other workers as necessary
             wakeWorkers();
-            
+
             // Any job spawned by job goes to same queue.
             // But may get stolen by another thread.
             // Try not to have tasks wait on sub-tasks
             // or their thread is locked down.
             _isExecuting = true;
-            job.execute();
+            node->func();
+            free_task_node(node);
             _isExecuting = false;
-            
+
             // these can change a little out of order
             stats.jobsExecuting--;
             stats.jobsTotal--;
+            stats.jobsCompleted++;
+            continue;
         }
-        
-        // Conditionally go to sleep (perhaps we were told there is a
-        // parallel job we can help with)
-        else if(shouldSleep()) {
-            // Put the thread to sleep until more jobs are scheduled.
-            // Wakes when value is non-zero and notify called.
-            _futex.wait(0);
+
+        // queues were all empty, so exit once stopped
+        if (_scheduler->isStop()) {
+            break;
         }
+
+        // Put the thread to sleep until more jobs are scheduled.
+        // Returns right away if woken since the generation was read.
+        stats.sleeps++;
+        _futex.wait(generation);
     }
+
+    gSchedulerWorker = SchedulerWorker();
 }
 
 } // namespace kram
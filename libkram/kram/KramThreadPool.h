@@ -1,4 +1,6 @@
-#include <queue>
+#pragma once
+
+#include "TaskSystem.h"
 
 namespace kram {
 using namespace STL_NAMESPACE;
@@ -6,82 +8,116 @@ using namespace STL_NAMESPACE;
 // this must not rollover
 using AtomicValue = atomic<uint32_t>;
 
+// counters that can rollover a uint32_t over a long run
+using AtomicCounter = atomic<uint64_t>;
+
 // fast locking
 class futex {
 public: // for now leave this public
-    AtomicValue _value;
+    AtomicValue _value{0};
     futex() = default;
-    
+
 public:
     // wait.  wake when atomic does not match expectedValue and notify called
     void wait(uint32_t expectedValue = 0);
-    
+
     // wake first thread waiting
     void notify_one();
-    
+
     // wake all threads wiating
     void notify_all();
 };
-    
+
 // No affinity needed.  OS can shedule threads from p to e core.
 // What about skipping HT though.
 class Scheduler;
 
+// Workers drain all queued High jobs across all workers, before Default,
+// and then Low.  A running job is never interrupted.
+enum class JobPriority : uint8_t {
+    High,
+    Default,
+    Low,
+
+    Count,
+};
+
 // This wraps priority and function together.
-// A priority queue can then return higher priority jobs.
 class Job2 {
 public:
-    int priority = 0; // smaller type?
+    JobPriority priority = JobPriority::Default;
     function<void()> job;
-    
+
     Job2() {}
-    Job2(int p, function<void()> f) : priority(p), job(f) {}
-    
-    bool operator<(const Job2& other) const {
-        return priority > other.priority; // Higher priority comes first
-    }
-    
+    Job2(JobPriority p, function<void()> f) : priority(p), job(std::move(f)) {}
+
     void execute() { job(); }
 };
 
 class Worker {
 public:
+    // jobs per priority class in each worker queue
+    static constexpr uint32_t kQueueCapacity = 1024;
+    static constexpr uint32_t kNumPriorities = (uint32_t)JobPriority::Count;
+
     string _name;
-    priority_queue<Job2> _queue;
-    mutex _mutex; // for queue
-    futex _futex; // to wait/notify threads, holds count of jobs in queue
+    inject_queue _queues[kNumPriorities] = {kQueueCapacity, kQueueCapacity, kQueueCapacity};
+    futex _futex; // to wait/notify threads, holds a wake generation
+    AtomicValue _queueSize{0}; // count of jobs in queues
     Scheduler* _scheduler = nullptr;
     uint32_t _workerId = 0;
-    bool _isExecuting = false;
-    
+    atomic<bool> _isExecuting{false};
+
     void Init(const string& name, uint32_t workerId, Scheduler* scheduler) {
         _name = name;
         _workerId = workerId;
         _scheduler = scheduler;
     }
-    
+
     // could be const, but it's atomic so volatile
-    uint32_t queueSize() { return _futex._value; }
-    void incQueueSize() { _futex._value++; }
-    void decQueueSize() { _futex._value--; }
-    
+    uint32_t queueSize() { return _queueSize; }
+    void incQueueSize() { _queueSize++; }
+    void decQueueSize() { _queueSize--; }
+
+    // bump the generation, so a worker about to sleep doesn't miss the wake
+    void wake() {
+        _futex._value++;
+        _futex.notify_one();
+    }
+
+    // fails if the queue for that priority is full
+    bool push(JobPriority priority, task_node* node);
+    task_node* pop(JobPriority priority);
+
     void run();
-    
-private:
-    bool stealFromOtherQueues(Job2& job);
+
+    // wake idle workers to steal, one for each job that's not running
     void wakeWorkers();
-    bool shouldSleep();
+
+private:
+    task_node* findJob();
+    task_node* stealFromOtherQueues(JobPriority priority);
 };
 
 class SchedulerStats {
 public:
-    AtomicValue jobsTotal;
-    AtomicValue jobsExecuting;
+    AtomicValue jobsTotal{0};     // queued + executing
+    AtomicValue jobsExecuting{0};
     uint32_t jobsRemaining() const { return jobsTotal - jobsExecuting; }
+
+    AtomicCounter jobsScheduled{0};
+    AtomicCounter jobsCompleted{0};
+    AtomicCounter jobsStolen{0};
+    AtomicCounter jobsRunInline{0}; // all queues full, so the submitting worker ran the job
+    AtomicCounter jobsPerPriority[(uint32_t)JobPriority::Count] = {};
+    AtomicCounter sleeps{0};        // times a worker waited on its futex
+
+    void log() const;
 };
 
 class Scheduler {
 public:
+    // This doesn't rename or reprioritize the calling thread, callers do that.
     Scheduler(uint32_t numWorkers);
     ~Scheduler() {
         if (!_isStop) {
@@ -89,27 +125,37 @@ public:
         }
     }
 
-    void scheduleJob(Job2& job);
-    
+    // returns false if the scheduler is stopping, and the job wasn't queued
+    bool scheduleJob(Job2& job);
+
+    template <typename F>
+    bool scheduleJob(JobPriority priority, F&& f)
+    {
+        task_node* node = alloc_task_node();
+        node->func = task_function(std::forward<F>(f));
+        return scheduleNode(priority, node);
+    }
+
+    // Block until all scheduled jobs have completed.
+    void waitIdle();
+
     bool isStop() const { return _isStop; }
+
+    // Stops accepting jobs, runs all that are queued, and then joins the workers.
+    // Has to be called from outside the workers.
     void stop();
-    
+
+    uint32_t numWorkers() const { return (uint32_t)_workers.size(); }
+
     // Not really public API
     vector<Worker*>& workers() { return _workers; }
-    
+
     SchedulerStats& stats() { return _stats; }
-    
+
 private:
-    Worker* findWorker(thread::native_handle_type currentThread) {
-        for (uint32_t i = 0; i < (uint32_t)_workers.size(); ++i) {
-            if (_threads[i].native_handle() == currentThread) {
-                return _workers[i];
-            }
-        }
-        return nullptr;
-    }
-    
-    bool _isStop = false;
+    bool scheduleNode(JobPriority priority, task_node* node);
+
+    atomic<bool> _isStop{false};
     vector<Worker*> _workers;
     vector<thread> _threads;
     SchedulerStats _stats;
@@ -554,51 +554,393 @@ void task_system::set_current_affinity(uint32_t threadIndex)
 
 #endif
 
-void task_system::run(int32_t threadIndex)
+//-----------------------------
+
+// Each thread keeps a few nodes around, so async_ doesn't hit the allocator.
+// A node freed on another thread just lands in that thread's cache.
+struct TaskNodeCache {
+    static constexpr int32_t kMaxNodes = 256;
+
+    task_node* head = nullptr;
+    int32_t count = 0;
+
+    ~TaskNodeCache()
+    {
+        while (head) {
+            task_node* next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+};
+
+static thread_local TaskNodeCache gTaskNodeCache;
+
+task_node* alloc_task_node()
 {
-    while (true) {
-        // pop() wait avoids a spinloop.
+    TaskNodeCache& cache = gTaskNodeCache;
+    task_node* node = cache.head;
+    if (!node)
+        return new task_node;
+
+    cache.head = node->next;
+    cache.count--;
+    node->next = nullptr;
+    return node;
+}
+
+void free_task_node(task_node* node)
+{
+    // release the closure captures now, not when the node is reused
+    node->func.reset();
 
-        myfunction<void()> f;
+    TaskNodeCache& cache = gTaskNodeCache;
+    if (cache.count >= TaskNodeCache::kMaxNodes) {
+        delete node;
+        return;
+    }
 
-        // start with ours, but steal from other queues if nothing found
-        // Note that if threadIndex queue is empty and stays empty
-        // then pop() below will stop using that thread.  But async_ is round-robining
-        // all work across the available queues.
-        int32_t multiple = 4; // 32;
-        int32_t numTries = 0;
-        for (int32_t n = 0, nEnd = _count * multiple; n < nEnd; ++n) {
-            numTries++;
+    node->next = cache.head;
+    cache.head = node;
+    cache.count++;
+}
 
-            // break for loop if work found
-            if (_q[(threadIndex + n) % _count].try_pop(f)) {
-                break;
+//-----------------------------
+
+work_deque::work_deque() : _top(0), _bottom(0)
+{
+    ring* r = new ring;
+    r->capacity = 256;
+    r->slots = new std::atomic<task_node*>[r->capacity];
+    _rings.push_back(r);
+    _ring.store(r, std::memory_order_relaxed);
+}
+
+work_deque::~work_deque()
+{
+    // system only destroys the deques once all tasks are run
+    for (ring* r : _rings) {
+        delete[] r->slots;
+        delete r;
+    }
+}
+
+work_deque::ring* work_deque::grow(ring* r, int64_t bottom, int64_t top)
+{
+    ring* bigger = new ring;
+    bigger->capacity = r->capacity * 2;
+    bigger->slots = new std::atomic<task_node*>[bigger->capacity];
+    for (int64_t i = top; i < bottom; ++i) {
+        bigger->put(i, r->get(i));
+    }
+
+    // old ring stays alive, since a thief may still be reading it
+    _rings.push_back(bigger);
+    _ring.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+void work_deque::push(task_node* node)
+{
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    ring* r = _ring.load(std::memory_order_relaxed);
+
+    if (b - t > r->capacity - 1) {
+        r = grow(r, b, t);
+    }
+
+    // release publishes the slot to thieves
+    r->put(b, node);
+    _bottom.store(b + 1, std::memory_order_release);
+}
+
+task_node* work_deque::pop()
+{
+    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    ring* r = _ring.load(std::memory_order_relaxed);
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+
+    task_node* node = nullptr;
+    if (t <= b) {
+        node = r->get(b);
+        if (t == b) {
+            // last item, so race thieves for it
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                node = nullptr;
             }
+            _bottom.store(b + 1, std::memory_order_relaxed);
         }
+    }
+    else {
+        // was empty
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return node;
+}
 
-        // numTries is 64 when queues are empty, and typically 1 when queues are full
-        //KLOGD("task_system", "thread %d searched %d tries", threadIndex, numTries);
+task_node* work_deque::steal()
+{
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
 
-        // if no task, and nothing to steal, pop own queue if possible
-        // pop blocks until it's queue receives tasks
-        if (!f && !_q[threadIndex].pop(f)) {
-            // shutdown if tasks have all been submitted and queue marked as done.
-            if (_q[threadIndex].is_done()) {
-                KLOGD("task_system", "thread %d shutting down", threadIndex);
+    if (t >= b)
+        return nullptr;
+
+    ring* r = _ring.load(std::memory_order_acquire);
+    task_node* node = r->get(t);
+    if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return node;
+}
+
+bool work_deque::empty() const
+{
+    int64_t b = _bottom.load(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_seq_cst);
+    return b <= t;
+}
+
+//-----------------------------
+
+inject_queue::inject_queue(uint32_t capacity)
+{
+    // capacity must be pow2 for the mask
+    size_t count = 1;
+    while (count < capacity)
+        count *= 2;
+
+    _cells = new cell[count];
+    _mask = count - 1;
+    for (size_t i = 0; i < count; ++i) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+        _cells[i].node = nullptr;
+    }
+
+    _enqueuePos.store(0, std::memory_order_relaxed);
+    _dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+inject_queue::~inject_queue()
+{
+    delete[] _cells;
+}
 
+bool inject_queue::try_push(task_node* node)
+{
+    cell* c;
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        c = &_cells[pos & _mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
                 break;
+        }
+        else if (diff < 0) {
+            // full
+            return false;
+        }
+        else {
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->node = node;
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+task_node* inject_queue::try_pop()
+{
+    cell* c;
+    size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+        c = &_cells[pos & _mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            // empty
+            return nullptr;
+        }
+        else {
+            pos = _dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    task_node* node = c->node;
+    c->sequence.store(pos + _mask + 1, std::memory_order_release);
+    return node;
+}
+
+bool inject_queue::empty() const
+{
+    return _enqueuePos.load(std::memory_order_seq_cst) ==
+           _dequeuePos.load(std::memory_order_seq_cst);
+}
+
+//-----------------------------
+
+// Identifies the system and deque of a worker thread, so async_ from inside
+// a task can push to its own deque without locks.
+struct TaskWorker {
+    task_system* system = nullptr;
+    int32_t index = 0;
+    uint32_t stealSeed = 0;
+};
+
+static thread_local TaskWorker gTaskWorker;
+
+void task_system::submit(task_node* node)
+{
+    if (gTaskWorker.system == this) {
+        _deques[gTaskWorker.index].push(node);
+    }
+    else {
+        // only blocks if thousands of tasks are queued up from outside
+        while (!_injected.try_push(node)) {
+            std::this_thread::yield();
+        }
+    }
+
+    wake_one();
+}
+
+void task_system::wake_one()
+{
+    // pairs with the fence in run() after incrementing _numParked,
+    // either the parker sees the new task, or this sees the parker.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_numParked.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(_parkMutex);
+        _parkCondition.notify_one();
+    }
+}
+
+bool task_system::has_work() const
+{
+    if (!_injected.empty())
+        return true;
+
+    for (int32_t i = 0; i < _count; ++i) {
+        if (!_deques[i].empty())
+            return true;
+    }
+    return false;
+}
+
+task_node* task_system::find_work(int32_t threadIndex, uint32_t& stealSeed)
+{
+    // newest work in our own deque is hottest in cache
+    task_node* node = _deques[threadIndex].pop();
+    if (node)
+        return node;
+
+    node = _injected.try_pop();
+    if (node)
+        return node;
+
+    // steal oldest work from others, starting at a random victim
+    if (_count > 1) {
+        for (int32_t round = 0; round < 2; ++round) {
+            // xorshift
+            stealSeed ^= stealSeed << 13;
+            stealSeed ^= stealSeed >> 17;
+            stealSeed ^= stealSeed << 5;
+
+            int32_t start = (int32_t)(stealSeed % (uint32_t)_count);
+            for (int32_t n = 0; n < _count; ++n) {
+                int32_t victim = (start + n) % _count;
+                if (victim == threadIndex)
+                    continue;
+
+                node = _deques[victim].steal();
+                if (node)
+                    return node;
             }
-            else {
-                KLOGD("task_system", "no work found for %d in %d tries", threadIndex, numTries);
+        }
+    }
+
+    return nullptr;
+}
+
+bool task_system::run_pending_task()
+{
+    task_node* node = nullptr;
+    if (gTaskWorker.system == this) {
+        node = find_work(gTaskWorker.index, gTaskWorker.stealSeed);
+    }
+    else {
+        // outside threads can still steal, they just don't have a deque
+        node = _injected.try_pop();
+        for (int32_t i = 0; !node && i < _count; ++i) {
+            node = _deques[i].steal();
+        }
+    }
+
+    if (!node)
+        return false;
+
+    node->func();
+    free_task_node(node);
+    return true;
+}
+
+void task_system::run(int32_t threadIndex)
+{
+    gTaskWorker.system = this;
+    gTaskWorker.index = threadIndex;
+    gTaskWorker.stealSeed = 0x9E3779B9u * (uint32_t)(threadIndex + 1);
+
+    uint32_t& stealSeed = gTaskWorker.stealSeed;
 
-                // keep searching
-                continue;
+    // spin a little before parking, since tasks often arrive in bursts
+    const int32_t kNumSpins = 64;
+
+    while (true) {
+        task_node* node = find_work(threadIndex, stealSeed);
+        for (int32_t i = 0; !node && i < kNumSpins; ++i) {
+            std::this_thread::yield();
+            node = find_work(threadIndex, stealSeed);
+        }
+
+        if (node) {
+            // do the work
+            node->func();
+            free_task_node(node);
+            continue;
+        }
+
+        // park until a submit, or shutdown
+        std::unique_lock<std::mutex> lock(_parkMutex);
+        _numParked.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool isWorkQueued = has_work();
+        if (!isWorkQueued) {
+            // shutdown once all submitted tasks have run
+            if (_done.load(std::memory_order_relaxed)) {
+                _numParked.fetch_sub(1, std::memory_order_relaxed);
+                KLOGD("task_system", "thread %d shutting down", threadIndex);
+                break;
             }
+
+            _parkCondition.wait(lock);
         }
 
-        // do the work
-        f();
+        _numParked.fetch_sub(1, std::memory_order_relaxed);
     }
+
+    gTaskWorker = TaskWorker();
 }
 
 // This only works for current thread, but simplifies setting several thread params.
@@ -613,15 +955,15 @@ void setThreadInfo(ThreadInfo& info)
 #endif
 }
 
-task_system::task_system(int32_t count) : _count(std::min(count, (int32_t)GetCoreInfo().physicalCoreCount)),
-                                          _q{(size_t)_count},
-                                          _index(0)
+task_system::task_system(int32_t count) : _count(std::max(1, std::min(count, (int32_t)GetCoreInfo().physicalCoreCount))),
+                                          _deques(new work_deque[_count]),
+                                          _injected(4096),
+                                          _numParked(0),
+                                          _done(false)
 {
-    // see WWDC 2021 presentation here
-    // Tune CPU job scheduling for Apple silicon games
-    // https://developer.apple.com/videos/play/tech-talks/110147/
-    ThreadInfo infoMain = {"Sheduler", ThreadPriority::Interactive, 0};
-    setThreadInfo(infoMain);
+    if (count < 1) {
+        KLOGE("task_system", "thread count %d must be > 0, using 1", count);
+    }
 
     // Note that running work on core0 when core0 may starve it
     // from assigning work to threads.
@@ -641,9 +983,15 @@ task_system::task_system(int32_t count) : _count(std::min(count, (int32_t)GetCor
             run(threadIndex);
         });
     }
+}
 
-    // dump out thread data
-    log_threads();
+void task_system::setup_scheduler_thread()
+{
+    // see WWDC 2021 presentation here
+    // Tune CPU job scheduling for Apple silicon games
+    // https://developer.apple.com/videos/play/tech-talks/110147/
+    ThreadInfo infoMain = {"Sheduler", ThreadPriority::Interactive, 0};
+    setThreadInfo(infoMain);
 }
 
 static ThreadPriority getThreadPriority(std::thread::native_handle_type handle)
@@ -744,13 +1092,18 @@ void task_system::log_threads()
 
 task_system::~task_system()
 {
-    // indicate that all tasks are submitted
-    for (auto& e : _q)
-        e.set_done();
+    // indicate that all tasks are submitted, threads exit once queues drain
+    {
+        std::lock_guard<std::mutex> lock(_parkMutex);
+        _done.store(true, std::memory_order_relaxed);
+    }
+    _parkCondition.notify_all();
 
     // wait until threads are all done by joining each thread
     for (auto& e : _threads)
         e.join();
+
+    delete[] _deques;
 }
 
 } //namespace kram
@@ -5,6 +5,8 @@
     This file is intended as example code and is not production quality.
 */
 
+#pragma once
+
 /**************************************************************************************************/
 
 //#include <algorithm>
@@ -28,99 +30,181 @@ using namespace STL_NAMESPACE;
 
 /**************************************************************************************************/
 
-using mymutex = std::recursive_mutex;
-using mylock = std::unique_lock<mymutex>;
-using mycondition = std::condition_variable_any;
-
-// TODO: can also have a priority_queue
-#define mydeque deque
-#define myfunction function
+// Move-only callable that holds small closures inline, so submitting a task
+// doesn't heap allocate like std::function can.  Larger closures go to the heap.
+class task_function {
+public:
+    static constexpr size_t kInlineSize = 48;
 
-class task_queue {
-    mydeque<myfunction<void()>> _q;
-    bool _done = false;
-    mymutex _mutex;
-    mycondition _ready;
+    task_function() = default;
 
-public:
-    bool try_pop(myfunction<void()>& x)
+    template <typename F>
+    task_function(F&& f)
     {
-        mylock lock{_mutex, std::try_to_lock};
-        if (!lock || _q.empty()) {
-            return false;
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= kInlineSize && alignof(T) <= alignof(max_align_t)) {
+            new (_storage) T(std::forward<F>(f));
+            _invoke = &invoke_inline<T>;
+            _manage = &manage_inline<T>;
+        }
+        else {
+            *(T**)_storage = new T(std::forward<F>(f));
+            _invoke = &invoke_heap<T>;
+            _manage = &manage_heap<T>;
         }
-        x = std::move(_q.front());
-        _q.pop_front();
-        return true;
     }
 
-    bool pop(myfunction<void()>& x)
+    task_function(task_function&& rhs) { move_from(rhs); }
+
+    task_function& operator=(task_function&& rhs)
     {
-        mylock lock{_mutex};
-        while (_q.empty() && !_done) {
-            _ready.wait(lock); // this is what blocks a given thread to avoid spin loop
+        if (this != &rhs) {
+            reset();
+            move_from(rhs);
         }
+        return *this;
+    }
 
-        // handle done state
-        if (_q.empty()) {
-            return false;
-        }
+    task_function(const task_function&) = delete;
+    task_function& operator=(const task_function&) = delete;
 
-        // return the work while lock is held
-        x = std::move(_q.front());
-        _q.pop_front();
-        return true;
-    }
+    ~task_function() { reset(); }
 
-    template <typename F>
-    bool try_push(F&& f)
+    explicit operator bool() const { return _invoke != nullptr; }
+
+    void operator()() { _invoke(_storage); }
+
+    void reset()
     {
-        {
-            mylock lock{_mutex, std::try_to_lock};
-            if (!lock) {
-                return false;
-            }
-            _q.emplace_back(forward<F>(f));
+        if (_manage) {
+            _manage(nullptr, _storage);
+            _invoke = nullptr;
+            _manage = nullptr;
         }
-        _ready.notify_one();
-        return true;
     }
 
-    template <typename F>
-    void push(F&& f)
+private:
+    // dst == nullptr destroys src, otherwise moves src to dst and destroys src
+    using invoke_fn = void (*)(void* storage);
+    using manage_fn = void (*)(void* dst, void* src);
+
+    void move_from(task_function& rhs)
     {
-        {
-            mylock lock{_mutex};
-            // TODO: fix this construct, eastl is saying no matching sctor for
-            // mydeque<eastl::function<void ()>>>::value_type
-#if USE_EASTL
-            KLOGE("TaskSystem", "Fix eastl deque or function");
-            //_q.emplace_back(forward<F>(f));
-#else
-            _q.emplace_back(std::forward<F>(f));
-#endif
+        if (rhs._manage) {
+            rhs._manage(_storage, rhs._storage);
+            _invoke = rhs._invoke;
+            _manage = rhs._manage;
+            rhs._invoke = nullptr;
+            rhs._manage = nullptr;
         }
-        // allow a waiting pop() to awaken
-        _ready.notify_one();
     }
 
-    // has queue been marked done or not
-    bool is_done() const
+    template <typename T>
+    static void invoke_inline(void* storage) { (*(T*)storage)(); }
+
+    template <typename T>
+    static void manage_inline(void* dst, void* src)
     {
-        mylock lock{const_cast<mymutex&>(_mutex)}; // ugh
-        bool done_ = _done;
-        return done_;
+        if (dst) {
+            new (dst) T(std::move(*(T*)src));
+        }
+        ((T*)src)->~T();
     }
 
-    // mark all tasks submitted to queue, and can start to shutdown
-    void set_done()
+    template <typename T>
+    static void invoke_heap(void* storage) { (**(T**)storage)(); }
+
+    template <typename T>
+    static void manage_heap(void* dst, void* src)
     {
-        {
-            mylock lock{_mutex};
-            _done = true;
+        if (dst) {
+            *(T**)dst = *(T**)src;
+        }
+        else {
+            delete *(T**)src;
         }
-        _ready.notify_all();
     }
+
+    alignas(max_align_t) uint8_t _storage[kInlineSize];
+    invoke_fn _invoke = nullptr;
+    manage_fn _manage = nullptr;
+};
+
+// Tasks are passed around as pointers, so the deques only hold atomic pointers.
+// Nodes are recycled through a small cache on each thread, so steady-state
+// submits don't hit the allocator.
+struct task_node {
+    task_function func;
+    task_node* next = nullptr;
+};
+
+task_node* alloc_task_node();
+void free_task_node(task_node* node);
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Nardelli 2013).  The owner
+// pushes and pops at the bottom without locks, and thieves steal from the top.
+// Grows as needed, and old rings are held until destruction since a thief may
+// still be reading one.
+class work_deque {
+public:
+    work_deque();
+    ~work_deque();
+
+    work_deque(const work_deque&) = delete;
+    void operator=(const work_deque&) = delete;
+
+    // owner thread only
+    void push(task_node* node);
+    task_node* pop();
+
+    // any thread, can return nullptr if it loses a race
+    task_node* steal();
+
+    bool empty() const;
+
+private:
+    struct ring {
+        int64_t capacity;
+        std::atomic<task_node*>* slots;
+
+        task_node* get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, task_node* node) { slots[i & (capacity - 1)].store(node, std::memory_order_relaxed); }
+    };
+
+    ring* grow(ring* r, int64_t bottom, int64_t top);
+
+    alignas(64) std::atomic<int64_t> _top;
+    alignas(64) std::atomic<int64_t> _bottom;
+    std::atomic<ring*> _ring;
+    vector<ring*> _rings; // all rings, freed in dtor
+};
+
+// Bounded multi-producer multi-consumer queue (Vyukov) for tasks submitted
+// from threads that aren't part of the system, since those can't push to a deque.
+class inject_queue {
+public:
+    inject_queue(uint32_t capacity);
+    ~inject_queue();
+
+    inject_queue(const inject_queue&) = delete;
+    void operator=(const inject_queue&) = delete;
+
+    // fail when full or empty
+    bool try_push(task_node* node);
+    task_node* try_pop();
+
+    bool empty() const;
+
+private:
+    struct cell {
+        std::atomic<size_t> sequence;
+        task_node* node;
+    };
+
+    cell* _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueuePos;
+    alignas(64) std::atomic<size_t> _dequeuePos;
 };
 
 /**************************************************************************************************/
@@ -175,45 +259,251 @@ class task_system {
     // want to store with thread itself, but no field.  Also have affinity, priority data.
     vector<string> _threadNames;
 
-    // currently one queue to each thread, but can steal from other queues
-    vector<task_queue> _q;
-    std::atomic<int32_t> _index;
+    // one deque for each thread, threads steal from other deques when theirs is empty
+    work_deque* _deques;
+
+    // tasks submitted from outside the system
+    inject_queue _injected;
+
+    // threads park here when no work is found after spinning
+    std::mutex _parkMutex;
+    std::condition_variable _parkCondition;
+    std::atomic<int32_t> _numParked;
+    std::atomic<bool> _done;
 
     void run(int32_t threadIndex);
 
+    task_node* find_work(int32_t threadIndex, uint32_t& stealSeed);
+    bool has_work() const;
+
+    void submit(task_node* node);
+    void wake_one();
+
 #if SUPPORT_AFFINITY
     static void set_current_affinity(uint32_t threadIndex);
 #endif
 
     static void set_current_priority(ThreadPriority priority);
 
-    void log_threads();
-
 public:
+    // count is clamped to the physical cores.  A count < 1 is an error, and makes 1 thread.
+    // This doesn't touch the calling thread or log, since short-lived pools are made
+    // on whatever thread calls into the library.
     task_system(int32_t count = 1);
     ~task_system();
 
+    // For a long-lived pool, names the thread that drives it and raises its priority.
+    static void setup_scheduler_thread();
+
+    // logs the name, priority and affinity of the calling thread and each worker
+    void log_threads();
+
     int32_t num_threads() const { return _count; }
 
     template <typename F>
     void async_(F&& f)
     {
-        auto i = _index++;
+        // From a task of this system, this pushes to the calling thread's deque and
+        // other threads steal it.  Otherwise it goes to the shared inject queue.
+        task_node* node = alloc_task_node();
+        node->func = task_function(std::forward<F>(f));
+        submit(node);
+    }
+
+    // Run func(i) for i in [0, count) across the threads, and block until all complete.
+    // The calling thread helps run tasks, so this can be called from a task too.
+    template <typename F>
+    void run_and_wait(int32_t count, const F& func);
+
+    // Pull one queued task and run it on the calling thread.  Returns false if
+    // nothing was found.  This is how waits help instead of blocking a thread.
+    bool run_pending_task();
+
+    // Help run tasks until isDone() returns true.  When nothing is queued, this blocks
+    // on the condition, which the finishing task must notify while holding doneMutex.
+    template <typename P>
+    void help_until(const P& isDone, std::mutex& doneMutex, std::condition_variable& doneCondition)
+    {
+        while (!isDone()) {
+            if (run_pending_task())
+                continue;
+
+            // wake periodically, since tasks may be queued that this thread could help with
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait_for(lock, std::chrono::microseconds(500), isDone);
+        }
+
+        // the finisher signals under the lock, so this waits for it to release the lock
+        // before the caller can destroy the mutex and condition.
+        std::lock_guard<std::mutex> lock(doneMutex);
+    }
+};
+
+/**************************************************************************************************/
+
+// Tracks a set of tasks, so a caller can wait on just those instead of
+// joining the whole system.  Can be reused after wait().
+class task_group {
+    NOT_COPYABLE(task_group);
+
+    task_system& _system;
+    std::atomic<int32_t> _numPending;
+    std::mutex _doneMutex;
+    std::condition_variable _doneCondition;
+
+    void finish_task()
+    {
+        // The last task decrements under the lock, so that once wait sees
+        // zero and takes the lock, this task no longer touches the group.
+        int32_t numPending = _numPending.load(std::memory_order_relaxed);
+        while (numPending > 1) {
+            if (_numPending.compare_exchange_weak(numPending, numPending - 1, std::memory_order_acq_rel))
+                return;
+        }
+
+        std::lock_guard<std::mutex> lock(_doneMutex);
+        if (_numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _doneCondition.notify_all();
+        }
+    }
+
+public:
+    task_group(task_system& system) : _system(system), _numPending(0) {}
+    ~task_group() { wait(); }
+
+    task_system& system() { return _system; }
+
+    template <typename F>
+    void run(F&& f)
+    {
+        _numPending.fetch_add(1, std::memory_order_relaxed);
+        _system.async_([this, func = std::forward<F>(f)]() mutable {
+            func();
+            finish_task();
+        });
+    }
+
+    bool is_done() const { return _numPending.load(std::memory_order_acquire) == 0; }
+
+    // Block until all tasks run on the group complete.  The calling thread runs
+    // queued tasks while it waits.
+    void wait()
+    {
+        _system.help_until([this]() { return is_done(); }, _doneMutex, _doneCondition);
+    }
+};
+
+template <typename F>
+void task_system::run_and_wait(int32_t count, const F& func)
+{
+    task_group group(*this);
+    for (int32_t i = 0; i < count; ++i) {
+        group.run([&func, i]() { func(i); });
+    }
+    group.wait();
+}
+
+/**************************************************************************************************/
+
+// Shared state between a task and its future.
+template <typename T>
+struct future_state {
+    task_system* system = nullptr;
+    std::atomic<bool> isReady{false};
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    T value{};
+};
 
-        // Note: this isn't a balanced distribution of work
-        // but work stealing from other queues in the run() call.
-        // Doesn't seem like we need to distribute work here.  Work stealing will pull.
+template <>
+struct future_state<void> {
+    task_system* system = nullptr;
+    std::atomic<bool> isReady{false};
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+};
+
+// Result of a task queued with async_future.  No exceptions are propagated,
+// since kram builds without them.
+template <typename T>
+class future {
+    shared_ptr<future_state<T>> _state;
+
+public:
+    future() = default;
+    future(shared_ptr<future_state<T>> state) : _state(std::move(state)) {}
 
-        // push to the next queue that is available
-        // this was meant to avoid mutex stalls using a try_lock
-        //        for (int32_t n = 0; n != _count; ++n)
-        //        {
-        //            if (_q[(i + n) % _count].try_push(forward<F>(f))) return;
-        //        }
+    bool valid() const { return _state != nullptr; }
+    bool is_ready() const { return _state && _state->isReady.load(std::memory_order_acquire); }
+
+    // Block until the task completes, running other queued tasks meanwhile.
+    void wait() const
+    {
+        future_state<T>& state = *_state;
+        state.system->help_until([&state]() { return state.isReady.load(std::memory_order_acquire); },
+                                 state.doneMutex, state.doneCondition);
+    }
 
-        // otherwise just push to the next indexed queue
-        _q[i % _count].push(std::forward<F>(f));
+    // Wait, and then return the result.  For void, this only waits.
+    decltype(auto) get()
+    {
+        wait();
+        if constexpr (!std::is_void_v<T>) {
+            return (_state->value);
+        }
     }
 };
 
+// Queue f on the system, and return a future to wait on its result.
+template <typename F>
+auto async_future(task_system& system, F&& f) -> future<std::invoke_result_t<std::decay_t<F>&>>
+{
+    using T = std::invoke_result_t<std::decay_t<F>&>;
+
+    auto state = std::make_shared<future_state<T>>();
+    state->system = &system;
+
+    system.async_([state, func = std::forward<F>(f)]() mutable {
+        if constexpr (std::is_void_v<T>) {
+            func();
+        }
+        else {
+            state->value = func();
+        }
+
+        std::lock_guard<std::mutex> lock(state->doneMutex);
+        state->isReady.store(true, std::memory_order_release);
+        state->doneCondition.notify_all();
+    });
+
+    return future<T>(std::move(state));
+}
+
+/**************************************************************************************************/
+
+// Split [begin, end) into ranges of about grain items, and run func(rangeStart, rangeEnd)
+// on each across the system.  Blocks until all complete, and the caller helps run them.
+// A null system, or a single range, runs inline.
+template <typename F>
+void parallel_for(task_system* system, int32_t begin, int32_t end, int32_t grain, const F& func)
+{
+    int32_t count = end - begin;
+    if (count <= 0)
+        return;
+
+    grain = std::max(grain, 1);
+    int32_t numRanges = (count + grain - 1) / grain;
+
+    if (!system || numRanges <= 1) {
+        func(begin, end);
+        return;
+    }
+
+    system->run_and_wait(numRanges, [&](int32_t range) {
+        int32_t rangeStart = begin + range * grain;
+        int32_t rangeEnd = std::min(end, rangeStart + grain);
+        func(rangeStart, rangeEnd);
+    });
+}
+
 } // namespace kram
@@ -131,7 +131,7 @@ static int GetBlockSize( int format ) {
     return 16;
 }
 
-void CompressImage( u8 const* rgba, int width, int height, void* blocks, int format, int flags, float const *metric )
+void CompressImage( u8 const* rgba, int width, int height, void* blocks, int format, int flags, float const *metric, u8 const* skipBlocks )
 {
 	// fix any bad flags
 	flags = FixFlags( flags );
@@ -145,6 +145,13 @@ void CompressImage( u8 const* rgba, int width, int height, void* blocks, int for
 	{
 		for( int x = 0; x < width; x += 4 )
 		{
+			// leave blocks that are already encoded
+			if( skipBlocks && *skipBlocks++ )
+			{
+				targetBlock += bytesPerBlock;
+				continue;
+			}
+			
 			// build the 4x4 block of pixels
 			u8 sourceRgba[16*4];
 			u8* targetPixel = sourceRgba;
@@ -213,8 +213,11 @@ void Decompress( u8* rgba, void const* block, int format );
 	allows for pixels outside the image to take arbitrary values. The function 
 	squish::GetStorageRequirements can be called to compute the amount of memory
 	to allocate for the compressed output.
+
+	The optional skipBlocks has a byte per block, and blocks that are nonzero
+	are left as is in the output.  This is for blocks already encoded elsewhere.
 */
-void CompressImage( u8 const* rgba, int width, int height, void* blocks, int format, int flags, float const* metric = 0 );
+void CompressImage( u8 const* rgba, int width, int height, void* blocks, int format, int flags, float const* metric = 0, u8 const* skipBlocks = 0 );
 
 // -----------------------------------------------------------------------------
 